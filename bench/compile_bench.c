@@ -0,0 +1,320 @@
+/* Compile throughput benchmark: generates VSL programs of several shapes,
+ * each meant to stress a part of the compiler, and times vslc on them at
+ * growing sizes. The per-phase breakdown comes from vslc --stats, and the
+ * growth exponent between sizes shows where the work is superlinear.
+ *
+ *   compile_bench [path/to/vslc]            run the benchmark
+ *   compile_bench generate <shape> <size>   write a program to stdout
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define N_SIZES 3
+#define GROWTH 4            /* Between consecutive sizes */
+#define SUPERLINEAR 1.3     /* Growth exponents above this are flagged */
+
+static const char *phases[] = {
+    "load", "parse", "simplify", "bind", "inline", "optimize", "generate", "teardown"
+};
+#define N_PHASES (sizeof(phases) / sizeof(phases[0]))
+
+
+/**********
+ * Shapes *
+ **********/
+
+
+/* Many small functions, each calling the next */
+static void
+gen_functions ( FILE *out, size_t n )
+{
+    for ( size_t f=0; f<n; f++ )
+    {
+        fprintf ( out, "def f%zu ( a, b )\nbegin\n    var x\n", f );
+        fprintf ( out, "    x := a * %zu + b\n", f );
+        if ( f + 1 < n )
+            fprintf ( out, "    x := f%zu ( x, a )\n", f+1 );
+        fprintf ( out, "    return x\nend\n\n" );
+    }
+}
+
+
+/* One function with a long statement list */
+static void
+gen_statements ( FILE *out, size_t n )
+{
+    fprintf ( out, "def main ()\nbegin\n    var x, y, z\n" );
+    fprintf ( out, "    x := 1\n    y := 2\n    z := 3\n" );
+    for ( size_t s=0; s<n; s++ )
+        switch ( s % 4 )
+        {
+            case 0: fprintf ( out, "    x := y + %zu\n", s ); break;
+            case 1: fprintf ( out, "    y := z - x\n" ); break;
+            case 2: fprintf ( out, "    z := x * 2 + y / 3\n" ); break;
+            case 3: fprintf ( out, "    print x, y, z\n" ); break;
+        }
+    fprintf ( out, "    return x\nend\n" );
+}
+
+
+/* Blocks nested n deep, each declaring a variable and reading the one of
+ * the outermost block, so name lookups pass through every scope
+ */
+static void
+gen_nesting ( FILE *out, size_t n )
+{
+    fprintf ( out, "def main ()\nbegin\n    var v0\n    v0 := 1\n" );
+    for ( size_t d=1; d<=n; d++ )
+        fprintf ( out, "begin\nvar v%zu\nv%zu := v0 + v%zu\n", d, d, d-1 );
+    fprintf ( out, "print v%zu\n", n );
+    for ( size_t d=1; d<=n; d++ )
+        fprintf ( out, "end\n" );
+    fprintf ( out, "    return v0\nend\n" );
+}
+
+
+/* An if/else chain n long, with a while loop at every other link */
+static void
+gen_chains ( FILE *out, size_t n )
+{
+    fprintf ( out, "def main ( x )\nbegin\n    var y\n    y := 0\n" );
+    for ( size_t c=0; c<n; c++ )
+    {
+        fprintf ( out, "if x = %zu then ", c );
+        if ( c % 2 == 0 )
+            fprintf ( out, "while y < %zu do y := y + 1\nelse\n", c );
+        else
+            fprintf ( out, "y := %zu\nelse\n", c );
+    }
+    fprintf ( out, "y := 0 - 1\n    return y\nend\n" );
+}
+
+
+/* One expression with n operands, eight to a line */
+static void
+gen_expression ( FILE *out, size_t n )
+{
+    static const char operators[] = "+-*|&^";
+    fprintf ( out, "def main ( a, b )\nbegin\n    var x\n    x := a" );
+    for ( size_t t=1; t<n; t++ )
+        fprintf ( out, "%s%c %s%s", (t % 8 == 0) ? "\n        " : " ",
+            operators[t % (sizeof(operators)-1)],
+            (t % 3 == 0) ? "(b - " : "", (t % 3 == 0) ? "1)" : "b"
+        );
+    fprintf ( out, "\n    return x\nend\n" );
+}
+
+
+/* Many globals, all read and written by one function */
+static void
+gen_globals ( FILE *out, size_t n )
+{
+    for ( size_t g=0; g<n; g++ )
+        fprintf ( out, "var g%zu\n", g );
+    fprintf ( out, "\ndef main ()\nbegin\n" );
+    for ( size_t g=0; g<n; g++ )
+        fprintf ( out, "    g%zu := g%zu + %zu\n", g, (g > 0) ? g-1 : 0, g );
+    fprintf ( out, "    return g0\nend\n" );
+}
+
+
+/* Many string literals */
+static void
+gen_strings ( FILE *out, size_t n )
+{
+    fprintf ( out, "def main ()\nbegin\n" );
+    for ( size_t s=0; s<n; s++ )
+        fprintf ( out, "    print \"String literal number %zu\", %zu\n", s, s );
+    fprintf ( out, "    return 0\nend\n" );
+}
+
+
+static const struct {
+    const char *name;
+    void (*generate) ( FILE *out, size_t n );
+    size_t base;    /* Smallest size benchmarked */
+} shapes[] = {
+    { "functions", gen_functions, 1000 },
+    { "statements", gen_statements, 10000 },
+    { "nesting", gen_nesting, 100 },
+    { "chains", gen_chains, 100 },
+    { "expression", gen_expression, 1000 },
+    { "globals", gen_globals, 1000 },
+    { "strings", gen_strings, 2000 },
+};
+#define N_SHAPES (sizeof(shapes) / sizeof(shapes[0]))
+
+
+/*************
+ * Benchmark *
+ *************/
+
+
+static double
+now ( void )
+{
+    struct timespec t;
+    clock_gettime ( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+static size_t
+count_lines ( const char *path )
+{
+    FILE *file = fopen ( path, "r" );
+    size_t lines = 0;
+    int c;
+    while ( file != NULL && (c = getc ( file )) != EOF )
+        lines += (c == '\n');
+    if ( file != NULL )
+        fclose ( file );
+    return lines;
+}
+
+
+/* Run vslc on a program with statistics, return the wall time of the whole
+ * run, or a negative number if it failed
+ */
+static double
+run_vslc ( const char *vslc, const char *input, const char *stats )
+{
+    char stats_option[256];
+    snprintf ( stats_option, sizeof(stats_option), "--stats=%s", stats );
+    double start = now();
+    pid_t pid = fork();
+    if ( pid == 0 )
+    {
+        execl ( vslc, vslc, stats_option, "-o", "/dev/null", input,
+            (char *) NULL
+        );
+        perror ( vslc );
+        _exit ( 127 );
+    }
+    int status;
+    if ( pid < 0 || waitpid ( pid, &status, 0 ) < 0 ||
+         !WIFEXITED ( status ) || WEXITSTATUS ( status ) != 0
+    )
+        return -1.0;
+    return now() - start;
+}
+
+
+/* Wall time of a phase, from the JSON line vslc --stats wrote */
+static double
+phase_time ( const char *json, const char *phase )
+{
+    char key[64];
+    snprintf ( key, sizeof(key), "\"%s\": {\"wall\": ", phase );
+    const char *found = strstr ( json, key );
+    return (found != NULL) ? strtod ( found + strlen(key), NULL ) : 0.0;
+}
+
+
+static int
+benchmark ( const char *vslc )
+{
+    char input[] = "/tmp/compile_bench_XXXXXX";
+    int fd = mkstemp ( input );
+    if ( fd < 0 )
+    {
+        perror ( "mkstemp" );
+        return EXIT_FAILURE;
+    }
+    close ( fd );
+    char stats[sizeof(input) + 8];
+    snprintf ( stats, sizeof(stats), "%s.json", input );
+
+    printf ( "%-10s %7s %8s %9s %10s", "shape", "size", "lines", "seconds",
+        "lines/s"
+    );
+    for ( size_t p=0; p<N_PHASES; p++ )
+        printf ( " %9s", phases[p] );
+    printf ( " %8s\n", "exponent" );
+
+    int status = EXIT_SUCCESS;
+    for ( size_t s=0; s<N_SHAPES; s++ )
+    {
+        double previous_time = 0.0;
+        size_t size = shapes[s].base;
+        for ( int i=0; i<N_SIZES; i++, size *= GROWTH )
+        {
+            FILE *program = fopen ( input, "w" );
+            shapes[s].generate ( program, size );
+            fclose ( program );
+            size_t lines = count_lines ( input );
+
+            double seconds = run_vslc ( vslc, input, stats );
+            printf ( "%-10s %7zu %8zu", shapes[s].name, size, lines );
+            if ( seconds < 0.0 )
+            {
+                printf ( " vslc failed\n" );
+                status = EXIT_FAILURE;
+                break;
+            }
+            printf ( " %9.4f %10.0f", seconds, lines / seconds );
+
+            char json[4096] = "";
+            FILE *file = fopen ( stats, "r" );
+            if ( file != NULL )
+            {
+                if ( fgets ( json, sizeof(json), file ) == NULL )
+                    json[0] = '\0';
+                fclose ( file );
+            }
+            for ( size_t p=0; p<N_PHASES; p++ )
+                printf ( " %9.4f", phase_time ( json, phases[p] ) );
+
+            /* How the time grows with the size: 1 is linear */
+            if ( previous_time > 0.0 )
+            {
+                double exponent =
+                    log ( seconds / previous_time ) / log ( GROWTH );
+                printf ( " %8.2f%s", exponent,
+                    (exponent > SUPERLINEAR) ? " superlinear" : ""
+                );
+            }
+            putchar ( '\n' );
+            fflush ( stdout );
+            previous_time = seconds;
+        }
+    }
+    unlink ( input );
+    unlink ( stats );
+    return status;
+}
+
+
+int
+main ( int argc, char **argv )
+{
+    if ( argc == 4 && strcmp ( argv[1], "generate" ) == 0 )
+    {
+        for ( size_t s=0; s<N_SHAPES; s++ )
+            if ( strcmp ( argv[2], shapes[s].name ) == 0 )
+            {
+                shapes[s].generate ( stdout, strtoul ( argv[3], NULL, 10 ) );
+                return EXIT_SUCCESS;
+            }
+        fprintf ( stderr, "Unknown shape '%s', shapes are:", argv[2] );
+        for ( size_t s=0; s<N_SHAPES; s++ )
+            fprintf ( stderr, " %s", shapes[s].name );
+        fputc ( '\n', stderr );
+        return EXIT_FAILURE;
+    }
+    if ( argc > 2 )
+    {
+        fprintf ( stderr,
+            "Usage: %s [vslc]\n       %s generate <shape> <size>\n",
+            argv[0], argv[0]
+        );
+        return EXIT_FAILURE;
+    }
+    return benchmark ( (argc == 2) ? argv[1] : "../src/vslc" );
+}
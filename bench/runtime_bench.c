@@ -0,0 +1,404 @@
+/* Runtime benchmark for generated code: compiles VSL programs with vslc,
+ * runs each with fixed arguments a number of times, and reports cycles,
+ * instructions, branch misses and L1 data cache misses from perf_event_open
+ * along with the deepest stack each run reached. Medians of the runs are
+ * reported, and can be saved as a baseline that later runs compare to, so
+ * changes to the code generator show up as deltas.
+ *
+ *   runtime_bench [-v vslc] [-n runs] [-b baseline] [-s save]
+ *
+ * Counters the machine cannot provide are reported as '-'.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#define MAX_RUNS 64
+#define MAX_ARGS 8
+
+static const struct {
+    const char *name, *path;
+    const char *args[MAX_ARGS];
+} programs[] = {
+    { "fibonacci_recursive", "../vsl_programs/fibonacci_recursive.vsl",
+        { "32" } },
+    { "fibonacci_iterative", "../vsl_programs/fibonacci_iterative.vsl",
+        { "90" } },
+    { "prime", "../vsl_programs/prime.vsl", { NULL } },
+    { "newton", "../vsl_programs/newton.vsl", { "1000000000" } },
+    { "euclid", "../vsl_programs/euclid.vsl",
+        { "1836311903", "1134903170" } },
+    { "ackermann", "programs/ackermann.vsl", { "3", "9" } },
+    { "collatz", "programs/collatz.vsl", { "200000" } },
+    { "tak", "programs/tak.vsl", { "24", "16", "8" } },
+    { "arithmetic", "programs/arithmetic.vsl", { "2000" } },
+};
+#define N_PROGRAMS (sizeof(programs) / sizeof(programs[0]))
+
+/* What is measured of a run, -1 where it could not be */
+typedef enum {
+    CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, STACK_KB, NANOSECONDS,
+    N_MEASURES
+} measure_t;
+
+static const char *measure_names[N_MEASURES] = {
+    "cycles", "instructions", "branch-misses", "L1d-misses", "stack-kB",
+    "ns"
+};
+
+static const struct perf_event_attr counter_attrs[] = {
+    [CYCLES] = {
+        .type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_CPU_CYCLES
+    },
+    [INSTRUCTIONS] = {
+        .type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_INSTRUCTIONS
+    },
+    [BRANCH_MISSES] = {
+        .type = PERF_TYPE_HARDWARE, .config = PERF_COUNT_HW_BRANCH_MISSES
+    },
+    [L1D_MISSES] = {
+        .type = PERF_TYPE_HW_CACHE,
+        .config = PERF_COUNT_HW_CACHE_L1D |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+    },
+};
+#define N_COUNTERS (sizeof(counter_attrs) / sizeof(counter_attrs[0]))
+
+typedef int64_t result_t[N_MEASURES];
+
+
+static double
+now ( void )
+{
+    struct timespec t;
+    clock_gettime ( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+/* Run a command to completion, and tell if it succeeded */
+static int
+run_command ( char *const argv[] )
+{
+    pid_t pid = fork();
+    if ( pid == 0 )
+    {
+        execvp ( argv[0], argv );
+        perror ( argv[0] );
+        _exit ( 127 );
+    }
+    int status;
+    return pid > 0 && waitpid ( pid, &status, 0 ) == pid &&
+        WIFEXITED ( status ) && WEXITSTATUS ( status ) == 0;
+}
+
+
+/* Counters for the user space part of a process, disabled until it runs */
+static void
+open_counters ( pid_t pid, int *fds )
+{
+    for ( size_t c=0; c<N_COUNTERS; c++ )
+    {
+        struct perf_event_attr attr = counter_attrs[c];
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fds[c] = syscall ( SYS_perf_event_open, &attr, pid, -1, -1, 0 );
+    }
+}
+
+
+/* The stack mapping grows to the deepest page touched and never shrinks,
+ * so its size at exit is the deepest the stack went
+ */
+static int64_t
+stack_kb ( pid_t pid )
+{
+    char path[64], line[256];
+    snprintf ( path, sizeof(path), "/proc/%d/status", (int) pid );
+    FILE *status = fopen ( path, "r" );
+    int64_t kb = -1;
+    while ( status != NULL && fgets ( line, sizeof(line), status ) != NULL )
+        if ( strncmp ( line, "VmStk:", 6 ) == 0 )
+            kb = strtoll ( line + 6, NULL, 10 );
+    if ( status != NULL )
+        fclose ( status );
+    return kb;
+}
+
+
+/* Run a program once under ptrace, which stops it right after exec to
+ * start the counters and right before exit, while its memory is still
+ * there, to read them. Returns 0 if the program did not exit normally.
+ */
+static int
+measure_run ( const char *binary, char *const argv[], result_t result )
+{
+    pid_t pid = fork();
+    if ( pid == 0 )
+    {
+        int null = open ( "/dev/null", O_WRONLY );
+        dup2 ( null, STDOUT_FILENO );
+        ptrace ( PTRACE_TRACEME, 0, NULL, NULL );
+        execv ( binary, argv );
+        _exit ( 127 );
+    }
+    int status, fds[N_COUNTERS];
+    if ( pid < 0 || waitpid ( pid, &status, 0 ) != pid ||
+         !WIFSTOPPED ( status )
+    )
+        return 0;
+    ptrace ( PTRACE_SETOPTIONS, pid, NULL,
+        (void *) (PTRACE_O_TRACEEXIT | PTRACE_O_EXITKILL)
+    );
+    open_counters ( pid, fds );
+    for ( size_t c=0; c<N_COUNTERS; c++ )
+        if ( fds[c] >= 0 )
+            ioctl ( fds[c], PERF_EVENT_IOC_ENABLE, 0 );
+    for ( int m=0; m<N_MEASURES; m++ )
+        result[m] = -1;
+
+    double start = now();
+    ptrace ( PTRACE_CONT, pid, NULL, NULL );
+    while ( waitpid ( pid, &status, 0 ) == pid && WIFSTOPPED ( status ) )
+    {
+        int pending = WSTOPSIG ( status );
+        if ( status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8)) )
+        {
+            result[NANOSECONDS] = (now() - start) * 1e9;
+            for ( size_t c=0; c<N_COUNTERS; c++ )
+                if ( fds[c] >= 0 &&
+                     read ( fds[c], &result[c], sizeof(int64_t) ) !=
+                        sizeof(int64_t)
+                )
+                    result[c] = -1;
+            result[STACK_KB] = stack_kb ( pid );
+            pending = 0;
+        }
+        ptrace ( PTRACE_CONT, pid, NULL, (void *) (intptr_t) pending );
+    }
+    for ( size_t c=0; c<N_COUNTERS; c++ )
+        if ( fds[c] >= 0 )
+            close ( fds[c] );
+    return WIFEXITED ( status );
+}
+
+
+static int
+compare_int64 ( const void *a, const void *b )
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+
+/* Median of each measure over the runs */
+static void
+median ( result_t *runs, int n_runs, result_t result )
+{
+    int64_t values[MAX_RUNS];
+    for ( int m=0; m<N_MEASURES; m++ )
+    {
+        for ( int r=0; r<n_runs; r++ )
+            values[r] = runs[r][m];
+        qsort ( values, n_runs, sizeof(int64_t), compare_int64 );
+        result[m] = values[n_runs / 2];
+    }
+}
+
+
+/* Compile, assemble and run one program; returns 0 if any step failed */
+static int
+benchmark ( const char *vslc, int p, int n_runs, result_t result )
+{
+    char assembly[256], binary[256];
+    snprintf ( assembly, sizeof(assembly), "/tmp/runtime_bench_%d_%s.s",
+        (int) getpid(), programs[p].name
+    );
+    snprintf ( binary, sizeof(binary), "/tmp/runtime_bench_%d_%s",
+        (int) getpid(), programs[p].name
+    );
+    char *compile[] = {
+        (char *) vslc, "-o", assembly, (char *) programs[p].path, NULL
+    };
+    char *assemble[] = {
+        "cc", "-no-pie", "-Wl,-z,noexecstack", "-o", binary, assembly, NULL
+    };
+    int success = run_command ( compile ) && run_command ( assemble );
+
+    char *argv[MAX_ARGS + 2] = { binary };
+    for ( int a=0; a<MAX_ARGS && programs[p].args[a] != NULL; a++ )
+        argv[a+1] = (char *) programs[p].args[a];
+    result_t runs[MAX_RUNS];
+    for ( int r=0; success && r<n_runs; r++ )
+        success = measure_run ( binary, argv, runs[r] );
+    if ( success )
+        median ( runs, n_runs, result );
+    unlink ( assembly );
+    unlink ( binary );
+    return success;
+}
+
+
+/* Baselines are lines of a program name followed by its measures */
+static int
+load_baseline ( const char *path, result_t *baseline, int *found )
+{
+    FILE *file = fopen ( path, "r" );
+    if ( file == NULL )
+        return 0;
+    char line[512], name[128];
+    while ( fgets ( line, sizeof(line), file ) != NULL )
+    {
+        int offset;
+        if ( line[0] == '#' || sscanf ( line, "%127s%n", name, &offset ) != 1 )
+            continue;
+        for ( size_t p=0; p<N_PROGRAMS; p++ )
+            if ( strcmp ( name, programs[p].name ) == 0 )
+            {
+                char *cursor = line + offset;
+                for ( int m=0; m<N_MEASURES; m++ )
+                    baseline[p][m] = strtoll ( cursor, &cursor, 10 );
+                found[p] = 1;
+            }
+    }
+    fclose ( file );
+    return 1;
+}
+
+
+static void
+save_results ( const char *path, result_t *results, int *measured )
+{
+    FILE *file = fopen ( path, "w" );
+    if ( file == NULL )
+    {
+        perror ( path );
+        return;
+    }
+    fprintf ( file, "# program" );
+    for ( int m=0; m<N_MEASURES; m++ )
+        fprintf ( file, " %s", measure_names[m] );
+    fputc ( '\n', file );
+    for ( size_t p=0; p<N_PROGRAMS; p++ )
+    {
+        if ( !measured[p] )
+            continue;
+        fprintf ( file, "%s", programs[p].name );
+        for ( int m=0; m<N_MEASURES; m++ )
+            fprintf ( file, " %lld", (long long) results[p][m] );
+        fputc ( '\n', file );
+    }
+    fclose ( file );
+}
+
+
+static void
+print_value ( int64_t value, int width )
+{
+    if ( value < 0 )
+        printf ( " %*s", width, "-" );
+    else
+        printf ( " %*lld", width, (long long) value );
+}
+
+
+/* Change from the baseline in percent, if both have the measure */
+static void
+print_delta ( int64_t value, int64_t base )
+{
+    if ( value < 0 || base <= 0 )
+        printf ( " %8s", "-" );
+    else
+        printf ( " %+7.1f%%", 100.0 * (value - base) / base );
+}
+
+
+int
+main ( int argc, char **argv )
+{
+    const char *vslc = "../src/vslc", *baseline_path = NULL, *save = NULL;
+    int n_runs = 5, option;
+    while ( (option = getopt ( argc, argv, "v:n:b:s:" )) != -1 )
+        switch ( option )
+        {
+            case 'v': vslc = optarg; break;
+            case 'n': n_runs = atoi ( optarg ); break;
+            case 'b': baseline_path = optarg; break;
+            case 's': save = optarg; break;
+            default:
+                fprintf ( stderr,
+                    "Usage: %s [-v vslc] [-n runs] [-b baseline] [-s save]\n",
+                    argv[0]
+                );
+                return EXIT_FAILURE;
+        }
+    if ( n_runs < 1 || n_runs > MAX_RUNS )
+    {
+        fprintf ( stderr, "Runs must be between 1 and %d\n", MAX_RUNS );
+        return EXIT_FAILURE;
+    }
+
+    result_t results[N_PROGRAMS], baseline[N_PROGRAMS];
+    int measured[N_PROGRAMS] = { 0 }, in_baseline[N_PROGRAMS] = { 0 };
+    int compare = baseline_path != NULL &&
+        load_baseline ( baseline_path, baseline, in_baseline );
+    if ( baseline_path != NULL && !compare )
+        fprintf ( stderr, "No baseline in %s, nothing to compare\n",
+            baseline_path
+        );
+
+    printf ( "%-20s", "program" );
+    for ( int m=0; m<N_MEASURES; m++ )
+        printf ( " %13s", measure_names[m] );
+    printf ( " %5s", "IPC" );
+    if ( compare )
+        printf ( " %8s %8s %8s %8s", "cycles", "instrs", "stack", "time" );
+    putchar ( '\n' );
+
+    int status = EXIT_SUCCESS;
+    for ( size_t p=0; p<N_PROGRAMS; p++ )
+    {
+        printf ( "%-20s", programs[p].name );
+        fflush ( stdout );
+        measured[p] = benchmark ( vslc, p, n_runs, results[p] );
+        if ( !measured[p] )
+        {
+            printf ( " failed\n" );
+            status = EXIT_FAILURE;
+            continue;
+        }
+        for ( int m=0; m<N_MEASURES; m++ )
+            print_value ( results[p][m], 13 );
+        if ( results[p][CYCLES] > 0 && results[p][INSTRUCTIONS] >= 0 )
+            printf ( " %5.2f",
+                (double) results[p][INSTRUCTIONS] / results[p][CYCLES]
+            );
+        else
+            printf ( " %5s", "-" );
+        if ( compare && in_baseline[p] )
+        {
+            print_delta ( results[p][CYCLES], baseline[p][CYCLES] );
+            print_delta ( results[p][INSTRUCTIONS], baseline[p][INSTRUCTIONS] );
+            print_delta ( results[p][STACK_KB], baseline[p][STACK_KB] );
+            print_delta ( results[p][NANOSECONDS], baseline[p][NANOSECONDS] );
+        }
+        putchar ( '\n' );
+    }
+    if ( save != NULL )
+        save_results ( save, results, measured );
+    return status;
+}
@@ -0,0 +1,116 @@
+/* Microbenchmark: the open addressing tlhash against the chained table it
+ * replaced, both started at 32 buckets as the compiler does. Keys look
+ * like identifiers; every table size runs inserts, hits and misses.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <tlhash.h>
+#include "tlhash_chained.h"
+
+#define INITIAL_BUCKETS 32
+#define KEY_LENGTH 24
+
+
+static double
+now ( void )
+{
+    struct timespec t;
+    clock_gettime ( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+/* Run 'body' enough times over n keys to take a measurable while,
+ * report nanoseconds per operation
+ */
+#define TIMED(ns,n,body) do { \
+    size_t rounds = 1 + 200000 / (n), r; \
+    double start = now(); \
+    for ( r=0; r<rounds; r++ ) { body; } \
+    ns = (now() - start) * 1e9 / ((double)rounds * (n)); \
+} while ( 0 )
+
+
+static void
+run ( size_t n, char (*keys)[KEY_LENGTH], char (*misses)[KEY_LENGTH] )
+{
+    double ns[2][3];
+    void *value;
+    size_t i;
+
+    TIMED ( ns[0][0], n, {
+        chained_t tab;
+        chained_init ( &tab, INITIAL_BUCKETS );
+        for ( i=0; i<n; i++ )
+            chained_insert ( &tab, keys[i], strlen(keys[i]), keys[i] );
+        chained_finalize ( &tab );
+    } );
+    chained_t chained;
+    chained_init ( &chained, INITIAL_BUCKETS );
+    for ( i=0; i<n; i++ )
+        chained_insert ( &chained, keys[i], strlen(keys[i]), keys[i] );
+    TIMED ( ns[0][1], n, {
+        for ( i=0; i<n; i++ )
+            chained_lookup ( &chained, keys[i], strlen(keys[i]), &value );
+    } );
+    TIMED ( ns[0][2], n, {
+        for ( i=0; i<n; i++ )
+            chained_lookup ( &chained, misses[i], strlen(misses[i]), &value );
+    } );
+    chained_finalize ( &chained );
+
+    TIMED ( ns[1][0], n, {
+        tlhash_t tab;
+        tlhash_init ( &tab, INITIAL_BUCKETS );
+        for ( i=0; i<n; i++ )
+            tlhash_insert ( &tab, keys[i], strlen(keys[i]), keys[i] );
+        tlhash_finalize ( &tab );
+    } );
+    tlhash_t open;
+    tlhash_init ( &open, INITIAL_BUCKETS );
+    for ( i=0; i<n; i++ )
+        tlhash_insert ( &open, keys[i], strlen(keys[i]), keys[i] );
+    TIMED ( ns[1][1], n, {
+        for ( i=0; i<n; i++ )
+            tlhash_lookup ( &open, keys[i], strlen(keys[i]), &value );
+    } );
+    TIMED ( ns[1][2], n, {
+        for ( i=0; i<n; i++ )
+            tlhash_lookup ( &open, misses[i], strlen(misses[i]), &value );
+    } );
+    tlhash_finalize ( &open );
+
+    const char *phase[3] = { "insert", "hit", "miss" };
+    for ( int p=0; p<3; p++ )
+        printf ( "%8zu  %-6s  %10.1f  %10.1f  %7.2fx\n",
+            n, phase[p], ns[0][p], ns[1][p], ns[0][p] / ns[1][p]
+        );
+}
+
+
+int
+main ( int argc, char **argv )
+{
+    size_t sizes[] = { 16, 256, 4096, 16384 };
+    size_t max = sizes[sizeof(sizes)/sizeof(size_t)-1];
+    char (*keys)[KEY_LENGTH] = malloc ( max * KEY_LENGTH );
+    char (*misses)[KEY_LENGTH] = malloc ( max * KEY_LENGTH );
+    for ( size_t i=0; i<max; i++ )
+    {
+        snprintf ( keys[i], KEY_LENGTH, "name_%zu", i * 2654435761u % max );
+        snprintf ( misses[i], KEY_LENGTH, "other_%zu", i );
+    }
+
+    printf ( "%8s  %-6s  %10s  %10s  %8s\n",
+        "entries", "op", "chained ns", "open ns", "speedup"
+    );
+    for ( size_t s=0; s<sizeof(sizes)/sizeof(size_t); s++ )
+        run ( sizes[s], keys, misses );
+    free ( keys );
+    free ( misses );
+    return EXIT_SUCCESS;
+}
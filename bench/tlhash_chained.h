@@ -0,0 +1,28 @@
+#ifndef CHAINED_H
+#define CHAINED_H
+#include <stddef.h>
+typedef struct el {
+    void *key, *value;
+    size_t key_length;
+    struct el *next;
+} chained_element_t;
+
+typedef struct {
+    size_t n_buckets, size;
+    chained_element_t **buckets;
+} chained_t;
+
+int chained_init ( chained_t *tab, size_t n_buckets );
+int chained_finalize ( chained_t *tab );
+int chained_insert ( chained_t *tab, void *key, size_t keylen, void *val );
+int chained_lookup ( chained_t *tab, void *key, size_t keylen, void **val );
+int chained_remove ( chained_t *tab, void *key, size_t key_length );
+size_t chained_size ( chained_t *tab );
+void chained_keys ( chained_t *tab, void **keys );
+void chained_values ( chained_t *tab, void **values );
+
+#define CHAINED_SUCCESS 0    /* Success */
+#define CHAINED_ENOMEM 1     /* No memory available */
+#define CHAINED_ENOENT 2     /* No such table entry */
+#define CHAINED_EEXIST 3     /* Table entry already exists */
+#endif
@@ -0,0 +1,26 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+/* Bump allocator: requests are carved out of large chunks, and nothing is
+ * given back until the whole arena is released.
+ */
+typedef struct chunk {
+    struct chunk *next;
+    size_t size, used;
+    char data[];
+} arena_chunk_t;
+
+typedef struct {
+    size_t chunk_size;
+    arena_chunk_t *chunks;
+} arena_t;
+
+void arena_init ( arena_t *arena, size_t chunk_size );
+void *arena_alloc ( arena_t *arena, size_t size );
+char *arena_strdup ( arena_t *arena, const char *string );
+void arena_release ( arena_t *arena );
+
+#define ARENA_CHUNK_SIZE (64*1024)  /* Default size of a chunk */
+#define ARENA_ALIGN 8               /* Every allocation is aligned to this */
+#endif
@@ -0,0 +1,32 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "memprof.h"
+#include "emitter.h"
+
+/* On-disk cache of generated code, in a directory of entries. The key of
+ * an entry holds everything its code was generated from. Entries are
+ * found by a hash of the key, and only used if the whole key matches, so
+ * a collision is just a miss.
+ */
+typedef struct {
+    uint8_t *bytes;
+    size_t size, capacity;
+} cache_key_t;
+
+void cache_key_init ( cache_key_t *key );
+void cache_key_finalize ( cache_key_t *key );
+void cache_key_int ( cache_key_t *key, int64_t value );
+void cache_key_string ( cache_key_t *key, const char *string );
+void cache_key_bytes ( cache_key_t *key, const void *bytes, size_t size );
+
+int cache_load ( const char *directory, cache_key_t *key, emitter_t *out );
+int cache_store (
+    const char *directory, cache_key_t *key, const char *text, size_t size
+);
+
+#define CACHE_SUCCESS 0     /* Success */
+#define CACHE_ENOENT 1      /* No entry for the key */
+#define CACHE_EIO 2         /* The entry could not be written */
+#endif
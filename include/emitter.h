@@ -0,0 +1,58 @@
+#ifndef EMITTER_H
+#define EMITTER_H
+#include <stddef.h>
+#include <stdint.h>
+#include "memprof.h"
+
+/* Append-only text buffer that the generated assembly is collected in,
+ * and written out with a single call when the program is complete.
+ */
+typedef struct {
+    char *text;
+    size_t size, capacity;
+} emitter_t;
+
+int emitter_init ( emitter_t *out, size_t capacity );
+void emitter_finalize ( emitter_t *out );
+int emitter_flush ( emitter_t *out, int fd );
+
+/* Plain text */
+void emit_text ( emitter_t *out, const char *text, size_t length );
+void emit_string ( emitter_t *out, const char *string );
+void emit_line ( emitter_t *out, const char *line );
+void emit_int ( emitter_t *out, int64_t value );
+void emit_uint ( emitter_t *out, uint64_t value );
+void emitf ( emitter_t *out, const char *format, ... );
+
+/* Common instruction shapes, all of them written as "\t<op> <operands>\n" */
+void emit_instr ( emitter_t *out, const char *op, const char *operands );
+void emit_instr_rr (
+    emitter_t *out, const char *op, const char *src, const char *dst
+);
+void emit_instr_ir (
+    emitter_t *out, const char *op, int64_t imm, const char *dst
+);
+void emit_instr_mr (
+    emitter_t *out, const char *op,
+    int64_t offset, const char *base, const char *dst
+);
+void emit_instr_rm (
+    emitter_t *out, const char *op,
+    const char *src, int64_t offset, const char *base
+);
+void emit_instr_label (
+    emitter_t *out, const char *op,
+    const char *prefix, int64_t id, const char *suffix
+);
+
+/* Labels, written as "<prefix><id><suffix>:\n" */
+void emit_label (
+    emitter_t *out, const char *prefix, int64_t id, const char *suffix
+);
+
+#define EMITTER_CAPACITY (64*1024)  /* Default initial buffer size */
+
+#define EMITTER_SUCCESS 0   /* Success */
+#define EMITTER_ENOMEM 1    /* No memory available */
+#define EMITTER_EIO 2       /* Output could not be written */
+#endif
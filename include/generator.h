@@ -1,10 +1,25 @@
 #pragma once
 
+// Code generation state of one function. Functions only read the syntax
+// tree and symbol tables, so each can be generated into an output of its
+// own, in parallel with the others. Their labels are numbered from 1 in
+// each function, and made unique by prefixes holding the function number
 typedef struct
 {
-    int if_id;
+    compiler_t *compiler;
+    emitter_t *out;
+    int if_id;          // The last label numbers taken in this function
     int while_id;
-} scope;
+    char if_prefix[32]; // "__vslif_<seq>_", "__vslwhile_<seq>_"
+    char while_prefix[32];
+    walk_t walk;        // Nodes being generated, from the function body down
+    int live;           // Values of expressions held in scratch registers
+    const char **homes; // Registers of parameters, then locals, or NULL on the stack
+    int n_saved;        // Callee-saved registers taken, saved at save_offset(%rbp)
+    int save_offset;
+    bool tail_loop;     // A return statement calls the function itself, see tail_callee
+    size_t peephole_hits[PEEPHOLE_N_RULES]; // Rewrites by each peephole rule
+} generator_t;
 
 #define DEBUG_GENERATOR 0
 
@@ -12,23 +27,66 @@ typedef struct
 #define N_PARAM_REGISTERS 6
 static const char *record[6] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
 
+// Registers holding the values of expressions while they are evaluated. The
+// value computed while v others are held goes in scratch[v], so the value of
+// a whole expression ends up in %rax. Division and shifts take %rdx and %rcx
+#define N_SCRATCH 6
+static const char *scratch[N_SCRATCH] = {"%rax", "%r10", "%r11", "%r8", "%r9", "%rsi"};
+// The second operand of a node whose first is spilled, with no scratch register left
+static const char *spill = "%rdi";
+
+// Registers that parameters and locals are allocated to. Calls preserve them,
+// so only the function that takes them saves them
+#define N_VARIABLE_REGISTERS 5
+static const char *variable_registers[N_VARIABLE_REGISTERS] = {"%rbx", "%r12", "%r13", "%r14", "%r15"};
+
+// What evaluating an expression may do besides computing its value, which
+// decides whether its operands can be evaluated in either order
+#define EFFECT_CALL 1   // Calls a function, which may assign globals
+#define EFFECT_GLOBAL 2 // Reads a global
+
 #define ALIGN_BYTES(amount) ((amount + 15) & (~15))
 #define ALIGNED_VARIABLES(amount) (ALIGN_BYTES(amount*8))
 
-static void generate_global_access(symbol_t *symbol);
-static void generate_parameter_access(symbol_t *symbol);
-static void generate_local_access(symbol_t *symbol, symbol_t* function);
-static void generate_access(symbol_t *symbol, symbol_t* function);
+// The positions in a function body where a variable is live
+typedef struct
+{
+    int start, end; // Positions of nodes in pre-order, start is -1 if unused
+    int loop;       // The last outermost loop it is used in, or -1
+} interval_t;
+
+static int find_live_intervals(generator_t *gen, symbol_t *function, interval_t *intervals, int *order);
+static void allocate_registers(generator_t *gen, symbol_t *function);
+static void generate_leave(generator_t *gen);
+static void generate_epilogue(generator_t *gen);
+
+static void generate_global_access(generator_t *gen, symbol_t *symbol, const char *reg);
+static void generate_variable_access(generator_t *gen, symbol_t *symbol, symbol_t *function, const char *reg);
+static void generate_access(generator_t *gen, symbol_t *symbol, symbol_t* function, const char *reg);
 
-static void generate_global_assignment(symbol_t *symbol);
-static void generate_parameter_assignment(symbol_t *symbol);
-static void generate_local_assignment(symbol_t *symbol, symbol_t* function);
-static void generate_assignment(node_t *node, symbol_t* function, scope s);
+static void generate_global_assignment(generator_t *gen, symbol_t *symbol);
+static void generate_variable_assignment(generator_t *gen, symbol_t *symbol, symbol_t *function);
 
-static void generate_expression(node_t *node, symbol_t* function, scope s);
-static void generate_comparison(node_t *node, symbol_t* function, scope s);
+static int divisor_shift(generator_t *gen, node_t *node);
+static void label_expression(generator_t *gen, node_t *node);
+static void label_expressions(generator_t *gen, node_t **root, symbol_t *function);
+static symbol_t *tail_callee(generator_t *gen, node_t *node, symbol_t *function);
+static bool operands_swapped(node_t *node);
+static node_t **generate_operands(generator_t *gen, walk_frame_t *frame, const char **left, const char **right);
+static void generate_parallel_move(generator_t *gen, const char **sources, const char **destinations, int n);
 
-static void generate_statements(node_t *node, symbol_t* function, scope s);
+static node_t **generate_comparison(generator_t *gen, walk_frame_t *frame);
+static node_t **generate_expression(generator_t *gen, walk_frame_t *frame, symbol_t *function);
+static node_t **generate_function_call(generator_t *gen, walk_frame_t *frame, symbol_t *function);
+static void generate_tail_call(generator_t *gen, symbol_t *callee, int n_args, symbol_t *function);
+static node_t **generate_assignment(generator_t *gen, walk_frame_t *frame, symbol_t *function);
+static node_t **generate_if_statement(generator_t *gen, walk_frame_t *frame);
+static node_t **generate_while_statement(generator_t *gen, walk_frame_t *frame);
+static node_t **generate_print_statement(generator_t *gen, walk_frame_t *frame);
+static node_t **generate_node(generator_t *gen, walk_frame_t *frame, symbol_t *function);
 
-static void generate_function(symbol_t *symbol);
-static void generate_function_call(node_t *call_node, symbol_t *caller, scope s);
\ No newline at end of file
+static void generate_statements(generator_t *gen, node_t **root, symbol_t *function);
+static void generate_function_ssa(generator_t *gen, symbol_t *symbol);
+static void generate_function(generator_t *gen, symbol_t *symbol);
+static void function_key(generator_t *gen, symbol_t *symbol, cache_key_t *key);
+static bool generate_cached_function(generator_t *gen, symbol_t *symbol);
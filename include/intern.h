@@ -0,0 +1,33 @@
+#ifndef INTERN_H
+#define INTERN_H
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "tlhash.h"
+
+/* Every distinct identifier is stored once, so names can be compared by
+ * pointer. The characters are preceded by a header holding the length and
+ * the tlhash hash, which symbol tables use instead of hashing again, and
+ * the symbol the name is bound to while names are bound (see ir.c).
+ */
+typedef struct {
+    uint32_t hash;
+    uint32_t length;
+    uint32_t scope;     /* Depth of the scope declaring 'binding' */
+    void *binding;      /* Innermost declaration of the name, or NULL */
+} intern_header_t;
+
+/* Table from the characters of a name to its interned copy */
+typedef struct {
+    tlhash_t names;
+    arena_t *storage;
+} intern_t;
+
+int intern_init ( intern_t *table, arena_t *arena );
+char *intern ( intern_t *table, const char *text, size_t length );
+void intern_finalize ( intern_t *table );
+
+#define INTERN_HEADER(name) (((intern_header_t *)(name)) - 1)
+#define INTERN_HASH(name) (INTERN_HEADER(name)->hash)
+#define INTERN_LENGTH(name) (INTERN_HEADER(name)->length)
+#endif
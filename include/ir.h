@@ -1,18 +1,32 @@
 #ifndef IR_H
 #define IR_H
 
-/* This is the tree node structure */
+/* This is the tree node structure. Constants and operators are held in
+ * the node itself, and the children of a node are allocated right after
+ * it, unless a list has grown out of them.
+ */
 typedef struct n {
-    node_index_t type;
-    void *data;
+    uint8_t type;               // node_index_t
+    uint8_t op;                 // operator_t
+    uint8_t registers;          // Needed to evaluate an expression, and
+    uint8_t effects;            // what it does, see generator.h
+    uint32_t n_children;
+    union {
+        int64_t number;         // NUMBER_DATA
+        char *name;             // IDENTIFIER_DATA, interned
+        char *string;           // STRING_DATA, until it is bound
+        size_t string_index;    // STRING_DATA, once it is bound
+    } data;
     struct s *entry;
-    uint64_t n_children;
     struct n **children;
 } node_t;
 
+// Compilation context, defined in vslc.h
+typedef struct compiler compiler_t;
+
 // Export the initializer function, it is needed by the parser
 void node_init (
-    node_t *nd, node_index_t type, void *data, uint64_t n_children, ...
+    node_t *nd, node_index_t type, operator_t op, uint64_t n_children, ...
 );
 
 typedef enum {
@@ -26,5 +40,16 @@ typedef struct s {
     size_t seq;
     size_t nparms;
     tlhash_t *locals;
+    bool unused;                // Not reached from the entry function,
+                                // so not generated, see optimize.c
 } symbol_t;
+
+/* A binding hidden by a declaration in a nested scope, with the depth it
+ * was made at, to be restored when the scope ends
+ */
+typedef struct {
+    char *name;
+    symbol_t *binding;
+    uint32_t scope;
+} shadow_t;
 #endif
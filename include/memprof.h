@@ -0,0 +1,65 @@
+#ifndef MEMPROF_H
+#define MEMPROF_H
+#include <stddef.h>
+
+/* What the compiler allocates memory for */
+typedef enum {
+    MEM_NODES,          /* Syntax tree nodes */
+    MEM_CHILDREN,       /* Child arrays of nodes */
+    MEM_PAYLOADS,       /* String literals in nodes */
+    MEM_NAMES,          /* Interned identifiers */
+    MEM_HASH_TABLES,    /* Hash table headers, buckets and elements */
+    MEM_HASH_KEYS,      /* Key copies made by hash tables */
+    MEM_SCOPES,         /* Bindings shadowed by local scopes */
+    MEM_STRING_LIST,    /* Table of string literals */
+    MEM_SYMBOLS,        /* Symbol table entries */
+    MEM_SOURCE,         /* Loaded or mapped source text */
+    MEM_OUTPUT,         /* Generated assembly */
+    MEM_WORK,           /* Work space of passes over the tree */
+    MEM_CACHE,          /* Keys of cached code */
+    MEM_SSA,            /* Functions in SSA form */
+    MEM_PEEPHOLE,       /* Instructions read back for peephole rules */
+    MEM_N_CATEGORIES
+} mem_category_t;
+
+#define MEM_N_PHASES 8  /* Room for every stats_phase_t, checked in stats.h */
+
+typedef struct {
+    size_t count, bytes;    /* Allocations made, and their total size */
+    size_t live, peak;      /* Bytes in use now, and at most */
+} mem_usage_t;
+
+/* Allocations of one compilation, by category and by phase. The live
+ * bytes of a phase are not kept, its peak is that of all categories
+ * together while the phase ran.
+ */
+typedef struct {
+    mem_usage_t categories[MEM_N_CATEGORIES];
+    mem_usage_t phases[MEM_N_PHASES];
+    mem_usage_t total;
+    int phase;
+} mem_profile_t;
+
+extern const char *mem_category_names[MEM_N_CATEGORIES];
+
+/* Allocations are charged to the profile attached to the calling thread,
+ * and cost nothing more than a test when there is none
+ */
+void mem_profile_attach ( mem_profile_t *profile );
+mem_profile_t *mem_profile_current ( void );
+void mem_profile_phase ( mem_profile_t *profile, int phase );
+
+void *mem_alloc ( mem_category_t category, size_t size );
+void *mem_calloc ( mem_category_t category, size_t count, size_t size );
+void *mem_realloc (
+    mem_category_t category, void *block, size_t old_size, size_t size
+);
+void mem_free ( mem_category_t category, void *block, size_t size );
+
+/* Memory that is not allocated with malloc, such as arena allocations,
+ * is charged and credited separately
+ */
+void mem_track ( mem_category_t category, size_t size );
+void mem_untrack ( mem_category_t category, size_t size );
+void mem_release ( mem_category_t category );
+#endif
@@ -29,5 +29,17 @@ typedef enum {
     STRING_DATA
 } node_index_t;
 
-extern char *node_string[25];
+/* Operators of EXPRESSION and RELATION nodes, OP_NONE elsewhere. An
+ * expression with one child and OP_SUB is a negation, one with OP_NONE
+ * and two children is a function call.
+ */
+typedef enum {
+    OP_NONE,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV,
+    OP_LSHIFT, OP_RSHIFT, OP_AND, OP_OR, OP_XOR, OP_NOT,
+    OP_EQ, OP_LT, OP_GT
+} operator_t;
+
+extern char *node_string[26];
+extern char *operator_string[14];
 #endif
@@ -0,0 +1,48 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "memprof.h"
+#include "emitter.h"
+
+/* Peephole optimization of generated x86-64. The assembly of a function
+ * is read back into a list of instructions, with the registers each one
+ * reads and writes and those that are live after it. A table of rules is
+ * tried on a window of neighbouring instructions from each one in turn,
+ * over and over until no rule applies, and the list is written out again
+ * in place of the text it was read from.
+ */
+typedef enum {
+    PEEPHOLE_UNREACHABLE,       /* Code after a jump or return */
+    PEEPHOLE_JUMP_TO_NEXT,      /* jmp L, right before L: */
+    PEEPHOLE_SELF_MOVE,         /* movq %r, %r */
+    PEEPHOLE_DEAD_WRITE,        /* Writes to registers nothing reads */
+    PEEPHOLE_RELOAD,            /* Load of the slot just stored or loaded */
+    PEEPHOLE_PUSH_POP,          /* pushq a; ...; popq b as movq a, b */
+    PEEPHOLE_SWAP,              /* Exchange through a third register */
+    PEEPHOLE_FORWARD,           /* movq x, %r; op %r, y as op x, y */
+    PEEPHOLE_RETARGET,          /* movq x, %a; op y, %a; movq %a, %b */
+    PEEPHOLE_CONSTANT_SHIFT,    /* movq $k, %rcx; shl %cl, r as shl $k, r */
+    PEEPHOLE_COMPARE_ZERO,      /* cmp $0, r as test r, r */
+    PEEPHOLE_ZERO_REGISTER,     /* movq $0, r as xorl r, r */
+    PEEPHOLE_N_RULES
+} peephole_rule_t;
+
+const char *peephole_rule_name ( peephole_rule_t rule );
+
+/* The number of arguments a call to the named function passes, or -1 when
+ * the function is not known, in which case every argument register is
+ * taken to be read
+ */
+typedef int (*peephole_arguments_t) (
+    void *context, const char *name, size_t length
+);
+
+/* Rewrite the text of 'out' from 'start' on, which is the code of one
+ * function, adding how often each rule applied to 'hits'
+ */
+void peephole_optimize (
+    emitter_t *out, size_t start, peephole_arguments_t arguments,
+    void *context, size_t hits[PEEPHOLE_N_RULES]
+);
+#endif
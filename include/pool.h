@@ -0,0 +1,15 @@
+#ifndef POOL_H
+#define POOL_H
+#include <stddef.h>
+
+/* Run task(context, i) for every i below n_tasks, on up to n_threads
+ * threads with the calling thread as one of them. Tasks are handed out
+ * in order, but may finish in any order; pool_run returns when all of
+ * them have.
+ */
+typedef void pool_task_t ( void *context, size_t index );
+
+void pool_run (
+    size_t n_tasks, int n_threads, pool_task_t *task, void *context
+);
+#endif
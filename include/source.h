@@ -0,0 +1,23 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+#include <stddef.h>
+#include "memprof.h"
+
+/* Source text as the scanner reads it: the contents of the file followed
+ * by two NUL bytes, which flex needs to scan a buffer in place. Regular
+ * files are mapped into memory, anything else is read.
+ */
+typedef struct {
+    char *text;
+    size_t length;      /* Length of the contents, without the NULs */
+    size_t mapped;      /* Size of the mapping, 0 if the text was read */
+    size_t capacity;    /* Size of the buffer, if the text was read */
+} source_t;
+
+int source_open ( source_t *source, const char *path );
+void source_close ( source_t *source );
+
+#define SOURCE_SUCCESS 0    /* Success */
+#define SOURCE_ENOMEM 1     /* No memory available */
+#define SOURCE_EIO 2        /* The file could not be opened or read */
+#endif
@@ -0,0 +1,95 @@
+#ifndef SSA_H
+#define SSA_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "memprof.h"
+
+/* Static single assignment form of a function, between its bound syntax
+ * tree and the generated assembly. Instructions are three-address: each
+ * defines at most one value, named by the index of the instruction, from
+ * the values of its operands. They are linked in order in basic blocks,
+ * which end in a jump, branch or return and make up the control flow
+ * graph of the function. Needs node_t, symbol_t and emitter_t.
+ */
+
+#define SSA_NONE UINT32_MAX     /* No instruction or block */
+
+typedef enum {
+    SSA_CONST,          /* data.number */
+    SSA_UNDEF,          /* A local before it is assigned, lowered as 0 */
+    SSA_PARAM,          /* Parameter data.index of the function */
+    SSA_LOAD,           /* Global data.symbol */
+    SSA_STORE,          /* Global data.symbol := operand 0 */
+    SSA_UNARY,          /* op operand 0 */
+    SSA_BINARY,         /* operand 0 op operand 1 */
+    SSA_CALL,           /* Function data.symbol, the operands are arguments */
+    SSA_PRINT,          /* Prints operand 0 */
+    SSA_PRINT_STRING,   /* Prints string data.index */
+    SSA_NEWLINE,        /* Ends a printed line */
+    SSA_PHI,            /* Operand i when entered from predecessor i */
+    /* Terminators, exactly one of them ends every block */
+    SSA_JUMP,           /* To successor 0 */
+    SSA_BRANCH,         /* To successor 0 if operand 0 op operand 1, else 1 */
+    SSA_RETURN          /* Returns operand 0 */
+} ssa_opcode_t;
+
+typedef struct {
+    uint8_t opcode;             /* ssa_opcode_t */
+    uint8_t op;                 /* operator_t of unary, binary and branch */
+    uint32_t block;             /* SSA_NONE once removed */
+    uint32_t prev, next;        /* Neighbours in the block, or SSA_NONE */
+    uint32_t n_operands;
+    uint32_t operands;          /* First operand in the pool of the function */
+    union {
+        int64_t number;
+        size_t index;
+        symbol_t *symbol;
+    } data;
+} ssa_instruction_t;
+
+typedef struct {
+    uint32_t first, last;       /* Instructions, SSA_NONE while empty */
+    uint32_t *predecessors;     /* In the order of the operands of phis */
+    uint32_t n_predecessors, predecessors_capacity;
+    uint32_t successors[2];
+    uint32_t n_successors;
+} ssa_block_t;
+
+/* Block 0 is the entry. Removed instructions keep their index, so values
+ * are named the same from construction to lowering.
+ */
+typedef struct {
+    symbol_t *symbol;
+    ssa_instruction_t *instructions;
+    uint32_t n_instructions, instructions_capacity;
+    ssa_block_t *blocks;
+    uint32_t n_blocks, blocks_capacity;
+    uint32_t *operands;         /* Operand pool of all instructions */
+    uint32_t n_operands, operands_capacity;
+} ssa_function_t;
+
+#define SSA_OPERAND(function, instruction, i) \
+    ((function)->operands[(instruction)->operands + (i)])
+
+/* Construction from the bound tree of a function symbol, which leaves
+ * no trivial phis and no unreachable blocks
+ */
+void ssa_build ( ssa_function_t *function, symbol_t *symbol );
+void ssa_finalize ( ssa_function_t *function );
+
+/* Whether instructions with an opcode have a value */
+bool ssa_defines_value ( uint8_t opcode );
+
+/* Checks the structure of the graph and that every value dominates its
+ * uses. Problems are described on 'errors', and counted.
+ */
+size_t ssa_verify ( ssa_function_t *function, FILE *errors );
+
+/* Text dump of a function, or of every function of a program */
+void ssa_print ( ssa_function_t *function, emitter_t *out );
+void ssa_print_program ( compiler_t *compiler, emitter_t *out );
+
+/* Lowering to x86-64, see lower.c */
+void ssa_generate ( ssa_function_t *function, emitter_t *out, bool optimize );
+#endif
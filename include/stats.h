@@ -0,0 +1,49 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+#include "memprof.h"
+#include "peephole.h"
+
+/* Phases of a compilation that are timed */
+typedef enum {
+    STATS_LOAD, STATS_PARSE, STATS_SIMPLIFY, STATS_BIND, STATS_INLINE,
+    STATS_OPTIMIZE, STATS_GENERATE, STATS_TEARDOWN, STATS_N_PHASES
+} stats_phase_t;
+
+/* Allocations are profiled by phase, so a phase added here needs room in
+ * MEM_N_PHASES, or this array has a negative size
+ */
+typedef char stats_phases_fit_profile[
+    (STATS_N_PHASES <= MEM_N_PHASES) ? 1 : -1
+];
+
+typedef struct {
+    double wall, cpu;       /* Seconds */
+} stats_time_t;
+
+/* What --stats reports about one compilation */
+typedef struct {
+    stats_time_t phases[STATS_N_PHASES];
+    size_t tokens;
+    size_t nodes_parsed, nodes_simplified;
+    size_t symbols, strings;
+    size_t instructions, bytes;
+    size_t cache_hits, cache_misses;    /* Functions found in the cache */
+    size_t calls_inlined;
+    size_t peephole_hits[PEEPHOLE_N_RULES];     /* Rewrites by each rule */
+    mem_profile_t *allocations;     /* NULL unless allocations are tracked */
+} stats_t;
+
+/* Start of a phase */
+typedef struct {
+    stats_phase_t phase;
+    struct timespec wall, cpu;
+} stats_clock_t;
+
+void stats_begin ( stats_t *stats, stats_clock_t *clock, stats_phase_t phase );
+void stats_end ( stats_t *stats, stats_clock_t *clock );
+size_t stats_count_instructions ( const char *text, size_t size );
+void stats_write ( FILE *file, const char *input, stats_t *stats );
+#endif
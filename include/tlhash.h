@@ -1,18 +1,40 @@
 #ifndef TLHASH_H
 #define TLHASH_H
 #include <stddef.h>
-typedef struct el {
+#include <stdint.h>
+#include "arena.h"
+#include "memprof.h"
+
+/* Elements are kept densely in an array, the buckets index into it by
+ * open addressing. Each bucket also records the hash of its element, so
+ * probing rarely has to touch the element or compare keys.
+ */
+typedef struct {
     void *key, *value;
     size_t key_length;
-    struct el *next;
+    uint32_t hash;
 } tlhash_element_t;
 
+typedef struct {
+    uint32_t hash;
+    uint32_t element;   /* Index of element + 1, 0 marks an empty bucket */
+} tlhash_bucket_t;
+
 typedef struct {
     size_t n_buckets, size;
-    tlhash_element_t **buckets;
+    tlhash_bucket_t *buckets;
+    tlhash_element_t *elements;
+    arena_t keys;       /* Key copies, freed with the table */
+    size_t key_bytes;   /* Size of the key copies */
+    int ordered;        /* Removal keeps the insertion order */
 } tlhash_t;
 
+/* Position of an iteration, start it at TLHASH_CURSOR_INIT */
+typedef size_t tlhash_cursor_t;
+#define TLHASH_CURSOR_INIT 0
+
 int tlhash_init ( tlhash_t *tab, size_t n_buckets );
+int tlhash_init_ordered ( tlhash_t *tab, size_t n_buckets );
 int tlhash_finalize ( tlhash_t *tab );
 int tlhash_insert ( tlhash_t *tab, void *key, size_t keylen, void *val );
 int tlhash_lookup ( tlhash_t *tab, void *key, size_t keylen, void **val );
@@ -20,6 +42,17 @@ int tlhash_remove ( tlhash_t *tab, void *key, size_t key_length );
 size_t tlhash_size ( tlhash_t *tab );
 void tlhash_keys ( tlhash_t *tab, void **keys );
 void tlhash_values ( tlhash_t *tab, void **values );
+uint32_t tlhash_hash ( const void *key, size_t key_length );
+int tlhash_insert_hashed (
+    tlhash_t *tab, void *key, size_t keylen, uint32_t hash, void *val
+);
+int tlhash_lookup_hashed (
+    tlhash_t *tab, void *key, size_t keylen, uint32_t hash, void **val
+);
+int tlhash_next (
+    tlhash_t *tab, tlhash_cursor_t *cursor,
+    void **key, size_t *key_length, void **value
+);
 
 #define TLHASH_SUCCESS 0    /* Success */
 #define TLHASH_ENOMEM 1     /* No memory available */
@@ -8,36 +8,101 @@
 #include <stdarg.h>
 
 #include "tlhash.h"
+#include "arena.h"
+#include "intern.h"
+#include "emitter.h"
+#include "source.h"
+#include "pool.h"
+#include "stats.h"
+#include "cache.h"
 #include "nodetypes.h"
 #include "ir.h"
-#include "y.tab.h"
-#include "generator.h"
+#include "walk.h"
+#include "ssa.h"
+
+/* Cached code is only reused by the version that generated it */
+#define VSLC_VERSION "1.1"
 
-int yyerror ( const char *error );
-extern int yylineno;
-extern int yylex ( void );
-extern char yytext[];
+/* Everything one compilation works on. Compilations share no state, so
+ * separate contexts can be compiled by separate threads.
+ */
+#define MAX_SPARE_ORDER 64
+struct compiler {
+    /* Input */
+    source_t source;
+    void *scanner;              // Reentrant scanner, see scanner.l
 
-extern node_t *root;
+    /* Syntax tree */
+    arena_t tree_arena;         // Nodes, child arrays and node payloads
+    intern_t names;             // Interned identifiers
+    node_t *root;
+    node_t *free_nodes;         // Discarded nodes, for node_alloc to reuse
+    node_t **spare_children[MAX_SPARE_ORDER];  // Outgrown list arrays
 
-/* Global state */
-extern node_t *root;
+    /* Symbol tables */
+    tlhash_t *global_names;
+    char **string_list;         // List of strings in the source
+    size_t n_string_list;       // String list capacity (grow on demand)
+    size_t stringc;             // String count
+    shadow_t *shadowed;         // Bindings hidden by local declarations
+    size_t n_shadowed, shadowed_capacity;
+    uint32_t scope_depth;       // 0 for globals, 1 for parameters
 
-// Moving global defs to global header
+    /* Code generation */
+    int n_jobs;                 // Threads to generate functions on
+    const char *cache_directory;    // Cache of generated functions, or NULL
+    const char *build;          // Stamp of the build, so caches do not outlive it
+    bool optimize;              // Optimize the tree, and the code generated for it
+    int inline_budget;          // Nodes an inlined call may cost, see inline.c
+    bool via_ir;                // Generate functions from their SSA form
+    bool emit_ir;               // Write the SSA form instead of assembly
 
-extern tlhash_t *global_names;  // Defined in ir.c, used by generator.c
-extern char **string_list;      // Defined in ir.c, used by generator.c
-extern size_t stringc;          // Defined in ir.c, used by generator.c
+    stats_t *stats;             // NULL unless statistics are collected
+};
 
-/* Global routines, called from main in vslc.c */
-void simplify_tree (node_t **simplified, node_t *root);
+#include "y.tab.h"
+#include "generator.h"
+
+/* Scanner, reading the loaded source of a compilation */
+int scanner_begin ( compiler_t *compiler );
+void scanner_end ( compiler_t *compiler );
+char *scanner_text ( compiler_t *compiler );
+size_t scanner_length ( compiler_t *compiler );
+int scanner_line ( compiler_t *compiler );
+int yylex ( YYSTYPE *lval, void *scanner );
+int yyerror ( compiler_t *compiler, void *scanner, const char *error );
+
+/* Syntax tree */
+void simplify_tree (
+    compiler_t *compiler, node_t **simplified, node_t *root
+);
 void node_print(node_t *root, int nesting);
-void destroy_subtree ( node_t *discard );
+size_t node_count ( node_t *root );
+node_t *node_alloc ( compiler_t *compiler, uint64_t n_children );
+node_t *node_append ( compiler_t *compiler, node_t *list, node_t *child );
+void node_finalize ( compiler_t *compiler, node_t *discard );
+void destroy_syntax_tree ( compiler_t *compiler );
+
+/* Symbol tables */
+void create_symbol_table ( compiler_t *compiler );
+void print_symbol_table ( compiler_t *compiler );
+void destroy_symbol_table ( compiler_t *compiler );
+size_t count_symbols ( compiler_t *compiler );
+int64_t variable_index ( symbol_t *function, symbol_t *symbol );
+symbol_t *new_local ( symbol_t *function, char *name );
+
+/* Constant propagation and simplification of the bound tree */
+void optimize_tree ( compiler_t *compiler );
+int power_of_two ( int64_t value );
+bool fold_operator ( operator_t op, int64_t *x, int64_t y );
+void *grow_array (
+    void *array, uint32_t count, uint32_t *capacity, size_t size
+);
 
-void create_symbol_table ( void );
-void print_symbol_table ( void );
-void destroy_symbol_table ( void );
+/* Inlining of calls into the bound tree */
+#define INLINE_BUDGET 16
+void inline_calls ( compiler_t *compiler );
 
-void generate_program(void);
+void generate_program ( compiler_t *compiler, emitter_t *output );
 
 #endif
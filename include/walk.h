@@ -0,0 +1,37 @@
+#ifndef WALK_H
+#define WALK_H
+#include <stddef.h>
+#include <stdint.h>
+#include "memprof.h"
+
+/* Depth first traversal of a syntax tree on a stack of its own, so the
+ * depth of the tree is not limited by the C stack. Each frame holds the
+ * slot a node hangs in, so a pass can replace the node, and how far the
+ * pass has come with it. Needs node_t from ir.h.
+ */
+typedef struct {
+    node_t **slot;      /* Where the node is kept in its parent */
+    uint32_t stage;     /* Progress of the pass with the node */
+    uint32_t mark;      /* Free for the pass to use */
+} walk_frame_t;
+
+typedef struct {
+    walk_frame_t *frames;
+    size_t depth, capacity;
+} walk_t;
+
+/* What walk_next found: a node before its children, one after them, or
+ * the end of the tree
+ */
+typedef enum {
+    WALK_DONE, WALK_ENTER, WALK_LEAVE
+} walk_event_t;
+
+void walk_init ( walk_t *walk, node_t **root );
+void walk_finalize ( walk_t *walk );
+void walk_push ( walk_t *walk, node_t **slot );
+walk_event_t walk_next ( walk_t *walk, node_t ***slot );
+void walk_skip ( walk_t *walk );
+
+#define WALK_TOP(walk) (&(walk)->frames[(walk)->depth-1])
+#endif
@@ -0,0 +1,93 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <arena.h>
+
+
+static arena_chunk_t *new_chunk ( arena_t *arena, size_t size );
+
+
+/* Initializer - no memory is taken before the first allocation */
+void
+arena_init ( arena_t *arena, size_t chunk_size )
+{
+    arena->chunk_size = chunk_size;
+    arena->chunks = NULL;
+}
+
+
+/* Allocation - bump the pointer in the current chunk, start a new one
+ * when it runs out. Requests larger than a chunk get a chunk of their own.
+ * Returns
+ *  NULL - if a new chunk could not be allocated
+ */
+void *
+arena_alloc ( arena_t *arena, size_t size )
+{
+    size = (size + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+    arena_chunk_t *chunk = arena->chunks;
+    if ( chunk == NULL || chunk->size - chunk->used < size )
+    {
+        chunk = new_chunk (
+            arena, (size > arena->chunk_size) ? size : arena->chunk_size
+        );
+        if ( chunk == NULL )
+            return NULL;
+    }
+    void *block = chunk->data + chunk->used;
+    chunk->used += size;
+    return block;
+}
+
+
+char *
+arena_strdup ( arena_t *arena, const char *string )
+{
+    size_t length = strlen ( string ) + 1;
+    char *copy = arena_alloc ( arena, length );
+    if ( copy != NULL )
+        memcpy ( copy, string, length );
+    return copy;
+}
+
+
+/* Finalizer - everything allocated from the arena goes at once */
+void
+arena_release ( arena_t *arena )
+{
+    arena_chunk_t *chunk = arena->chunks, *next;
+    while ( chunk != NULL )
+    {
+        next = chunk->next;
+        free ( chunk );
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
+
+
+static arena_chunk_t *
+new_chunk ( arena_t *arena, size_t size )
+{
+    arena_chunk_t *chunk = malloc ( sizeof(arena_chunk_t) + size );
+    if ( chunk == NULL )
+        return NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    /* An oversized chunk is full from the start, so keep filling the
+     * current one instead of leaving its tail unused
+     */
+    if ( arena->chunks != NULL && size > arena->chunk_size )
+    {
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+    }
+    else
+    {
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    return chunk;
+}
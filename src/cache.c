@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cache.h>
+
+#define KEY_CAPACITY 1024
+#define PATH_SIZE 4096
+
+/* An entry is the size of its key, the key, and then the cached text */
+typedef struct {
+    uint64_t key_size;
+} entry_header_t;
+
+
+void
+cache_key_init ( cache_key_t *key )
+{
+    *key = (cache_key_t) {
+        .bytes = mem_alloc ( MEM_CACHE, KEY_CAPACITY ),
+        .size = 0,
+        .capacity = KEY_CAPACITY
+    };
+}
+
+
+void
+cache_key_finalize ( cache_key_t *key )
+{
+    mem_free ( MEM_CACHE, key->bytes, key->capacity );
+    key->bytes = NULL;
+    key->size = key->capacity = 0;
+}
+
+
+void
+cache_key_bytes ( cache_key_t *key, const void *bytes, size_t size )
+{
+    if ( key->size + size > key->capacity )
+    {
+        size_t capacity = key->capacity;
+        while ( key->size + size > capacity )
+            capacity *= 2;
+        key->bytes = mem_realloc (
+            MEM_CACHE, key->bytes, key->capacity, capacity
+        );
+        key->capacity = capacity;
+    }
+    memcpy ( key->bytes + key->size, bytes, size );
+    key->size += size;
+}
+
+
+void
+cache_key_int ( cache_key_t *key, int64_t value )
+{
+    cache_key_bytes ( key, &value, sizeof(value) );
+}
+
+
+/* Strings are preceded by their length, so keys can not run together */
+void
+cache_key_string ( cache_key_t *key, const char *string )
+{
+    size_t length = strlen ( string );
+    cache_key_int ( key, length );
+    cache_key_bytes ( key, string, length );
+}
+
+
+/* Path of the entry for a key, named by its 64-bit FNV-1a hash */
+static void
+entry_path ( const char *directory, cache_key_t *key, char *path )
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for ( size_t i=0; i<key->size; i++ )
+        hash = (hash ^ key->bytes[i]) * 1099511628211ULL;
+    snprintf ( path, PATH_SIZE, "%s/%016llx.vslc",
+        directory, (unsigned long long) hash
+    );
+}
+
+
+/* Append the text cached for a key to an output.
+ * Returns
+ *  ENOENT - if there is no entry for the key, or it is unreadable
+ */
+int
+cache_load ( const char *directory, cache_key_t *key, emitter_t *out )
+{
+    char path[PATH_SIZE];
+    entry_path ( directory, key, path );
+    int fd = open ( path, O_RDONLY );
+    if ( fd < 0 )
+        return CACHE_ENOENT;
+
+    struct stat info;
+    size_t size = 0;
+    void *entry = MAP_FAILED;
+    if ( fstat ( fd, &info ) == 0 && info.st_size > 0 )
+    {
+        size = info.st_size;
+        entry = mmap ( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+    close ( fd );
+    if ( entry == MAP_FAILED )
+        return CACHE_ENOENT;
+
+    int status = CACHE_ENOENT;
+    size_t text_start = sizeof(entry_header_t) + key->size;
+    if ( size >= text_start )
+    {
+        entry_header_t header;
+        memcpy ( &header, entry, sizeof(header) );
+        if ( header.key_size == key->size && memcmp (
+            (char *)entry + sizeof(header), key->bytes, key->size
+        ) == 0 )
+        {
+            emit_text ( out, (char *)entry + text_start, size - text_start );
+            status = CACHE_SUCCESS;
+        }
+    }
+    munmap ( entry, size );
+    return status;
+}
+
+
+/* Store the text generated for a key. Entries are written to a temporary
+ * file and renamed into place, so other compilations never see one that
+ * is half written.
+ * Returns
+ *  EIO - if the entry can not be written, errno tells why
+ */
+int
+cache_store (
+    const char *directory, cache_key_t *key, const char *text, size_t size
+)
+{
+    char path[PATH_SIZE], temporary[PATH_SIZE];
+    entry_path ( directory, key, path );
+    snprintf ( temporary, PATH_SIZE, "%s/.entry-XXXXXX", directory );
+    int fd = mkstemp ( temporary );
+    if ( fd < 0 )
+        return CACHE_EIO;
+
+    entry_header_t header = { .key_size = key->size };
+    FILE *entry = fdopen ( fd, "w" );
+    int written = entry != NULL &&
+        fwrite ( &header, sizeof(header), 1, entry ) == 1 &&
+        fwrite ( key->bytes, 1, key->size, entry ) == key->size &&
+        fwrite ( text, 1, size, entry ) == size;
+    if ( entry != NULL )
+        written = (fclose ( entry ) == 0) && written;
+    else
+        close ( fd );
+    if ( !written || rename ( temporary, path ) != 0 )
+    {
+        unlink ( temporary );
+        return CACHE_EIO;
+    }
+    return CACHE_SUCCESS;
+}
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <emitter.h>
+
+
+static void reserve ( emitter_t *out, size_t length );
+static size_t format_uint ( char *end, uint64_t value );
+
+/* Append a string literal without measuring it at run time */
+#define APPEND_LITERAL(out,lit) emit_text ( out, lit, sizeof(lit)-1 )
+
+
+/********************************
+ * Buffer management and output *
+ ********************************/
+
+
+/* Initializer
+ * Returns
+ *  ENOMEM - if the initial buffer can not be allocated
+ */
+int
+emitter_init ( emitter_t *out, size_t capacity )
+{
+    out->size = 0;
+    out->capacity = capacity;
+    out->text = mem_alloc ( MEM_OUTPUT, capacity );
+    if ( out->text == NULL )
+        return EMITTER_ENOMEM;
+    return EMITTER_SUCCESS;
+}
+
+
+void
+emitter_finalize ( emitter_t *out )
+{
+    mem_free ( MEM_OUTPUT, out->text, out->capacity );
+    out->text = NULL;
+    out->size = out->capacity = 0;
+}
+
+
+/* Flush - write the whole buffer to a file descriptor, and empty it
+ * Returns
+ *  EIO - if the descriptor does not accept the text
+ */
+int
+emitter_flush ( emitter_t *out, int fd )
+{
+    size_t written = 0;
+    while ( written < out->size )
+    {
+        ssize_t n = write ( fd, out->text + written, out->size - written );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return EMITTER_EIO;
+        written += n;
+    }
+    out->size = 0;
+    return EMITTER_SUCCESS;
+}
+
+
+/* Make room for at least 'length' more bytes, doubling the buffer.
+ * Running out of memory while generating code is fatal.
+ */
+static void
+reserve ( emitter_t *out, size_t length )
+{
+    if ( out->capacity - out->size >= length )
+        return;
+    size_t capacity = (out->capacity > 0) ? out->capacity : EMITTER_CAPACITY;
+    while ( capacity - out->size < length )
+        capacity *= 2;
+    char *text = mem_realloc (
+        MEM_OUTPUT, out->text, out->capacity, capacity
+    );
+    if ( text == NULL )
+    {
+        fprintf ( stderr, "Out of memory for generated assembly\n" );
+        exit ( EXIT_FAILURE );
+    }
+    out->text = text;
+    out->capacity = capacity;
+}
+
+
+/**************
+ * Plain text *
+ **************/
+
+
+void
+emit_text ( emitter_t *out, const char *text, size_t length )
+{
+    reserve ( out, length );
+    memcpy ( out->text + out->size, text, length );
+    out->size += length;
+}
+
+
+void
+emit_string ( emitter_t *out, const char *string )
+{
+    emit_text ( out, string, strlen(string) );
+}
+
+
+/* Like puts, the line is terminated by a newline */
+void
+emit_line ( emitter_t *out, const char *line )
+{
+    size_t length = strlen ( line );
+    reserve ( out, length + 1 );
+    memcpy ( out->text + out->size, line, length );
+    out->text[out->size+length] = '\n';
+    out->size += length + 1;
+}
+
+
+/* Write digits backwards from 'end', return how many there were */
+static size_t
+format_uint ( char *end, uint64_t value )
+{
+    char *digit = end;
+    do
+    {
+        *--digit = '0' + (value % 10);
+        value /= 10;
+    } while ( value != 0 );
+    return end - digit;
+}
+
+
+void
+emit_uint ( emitter_t *out, uint64_t value )
+{
+    char digits[20];
+    size_t n = format_uint ( digits + sizeof(digits), value );
+    emit_text ( out, digits + sizeof(digits) - n, n );
+}
+
+
+void
+emit_int ( emitter_t *out, int64_t value )
+{
+    char digits[21];
+    uint64_t magnitude = (value < 0) ? -(uint64_t)value : (uint64_t)value;
+    size_t n = format_uint ( digits + sizeof(digits), magnitude );
+    if ( value < 0 )
+        digits[sizeof(digits) - ++n] = '-';
+    emit_text ( out, digits + sizeof(digits) - n, n );
+}
+
+
+/* General case, for anything without a shape of its own */
+void
+emitf ( emitter_t *out, const char *format, ... )
+{
+    va_list args;
+    va_start ( args, format );
+    int length = vsnprintf (
+        out->text + out->size, out->capacity - out->size, format, args
+    );
+    va_end ( args );
+    if ( length < 0 )
+        return;
+    if ( (size_t)length >= out->capacity - out->size )
+    {
+        reserve ( out, length + 1 );
+        va_start ( args, format );
+        vsnprintf ( out->text + out->size, length + 1, format, args );
+        va_end ( args );
+    }
+    out->size += length;
+}
+
+
+/**********************
+ * Instruction shapes *
+ **********************/
+
+
+/* "\top operands\n" */
+void
+emit_instr ( emitter_t *out, const char *op, const char *operands )
+{
+    APPEND_LITERAL ( out, "\t" );
+    emit_string ( out, op );
+    APPEND_LITERAL ( out, " " );
+    emit_line ( out, operands );
+}
+
+
+/* "\top src, dst\n" */
+void
+emit_instr_rr (
+    emitter_t *out, const char *op, const char *src, const char *dst
+)
+{
+    APPEND_LITERAL ( out, "\t" );
+    emit_string ( out, op );
+    APPEND_LITERAL ( out, " " );
+    emit_string ( out, src );
+    APPEND_LITERAL ( out, ", " );
+    emit_line ( out, dst );
+}
+
+
+/* "\top $imm, dst\n" */
+void
+emit_instr_ir ( emitter_t *out, const char *op, int64_t imm, const char *dst )
+{
+    APPEND_LITERAL ( out, "\t" );
+    emit_string ( out, op );
+    APPEND_LITERAL ( out, " $" );
+    emit_int ( out, imm );
+    APPEND_LITERAL ( out, ", " );
+    emit_line ( out, dst );
+}
+
+
+/* "\top offset(base), dst\n" */
+void
+emit_instr_mr (
+    emitter_t *out, const char *op,
+    int64_t offset, const char *base, const char *dst
+)
+{
+    APPEND_LITERAL ( out, "\t" );
+    emit_string ( out, op );
+    APPEND_LITERAL ( out, " " );
+    emit_int ( out, offset );
+    APPEND_LITERAL ( out, "(" );
+    emit_string ( out, base );
+    APPEND_LITERAL ( out, "), " );
+    emit_line ( out, dst );
+}
+
+
+/* "\top src, offset(base)\n" */
+void
+emit_instr_rm (
+    emitter_t *out, const char *op,
+    const char *src, int64_t offset, const char *base
+)
+{
+    APPEND_LITERAL ( out, "\t" );
+    emit_string ( out, op );
+    APPEND_LITERAL ( out, " " );
+    emit_string ( out, src );
+    APPEND_LITERAL ( out, ", " );
+    emit_int ( out, offset );
+    APPEND_LITERAL ( out, "(" );
+    emit_string ( out, base );
+    APPEND_LITERAL ( out, ")\n" );
+}
+
+
+/* "\top <prefix><id><suffix>\n", for jumps to numbered labels */
+void
+emit_instr_label (
+    emitter_t *out, const char *op,
+    const char *prefix, int64_t id, const char *suffix
+)
+{
+    APPEND_LITERAL ( out, "\t" );
+    emit_string ( out, op );
+    APPEND_LITERAL ( out, " " );
+    emit_string ( out, prefix );
+    emit_int ( out, id );
+    emit_line ( out, suffix );
+}
+
+
+/* "<prefix><id><suffix>:\n" */
+void
+emit_label (
+    emitter_t *out, const char *prefix, int64_t id, const char *suffix
+)
+{
+    emit_string ( out, prefix );
+    emit_int ( out, id );
+    emit_string ( out, suffix );
+    APPEND_LITERAL ( out, ":\n" );
+}
@@ -1,770 +1,1658 @@
-#include "vslc.h"
-#include "generator.h"
-
-#define MIN(a, b) (((a) < (b)) ? (a) : (b))
-
-// Used for generating unique label names for `if` and `while` statements
-int while_id = 0;
-int if_id = 0;
-
-/**
- * Generates the string table containing all strings used by the program
- */
-static void generate_stringtable(void)
-{
-    /* These can be used to emit numbers, strings and a run-time
-	 * error msg. from main
-	 */
-    puts(".data");
-    puts("intout: .asciz \"\%ld\"");
-    puts("strout: .asciz \"\%s\"");
-    puts("newline: .asciz \"\\n\"");
-    puts("errout: .asciz \"Wrong number of arguments\"");
-
-    // Go through all strings from the program and put them in the data section
-    for (int i = 0; i < stringc; i++)
-    {
-        printf("STR%d:\t.asciz %s\n", i, string_list[i]);
-    }
-}
-
-/**
- * Reserves space for every global variable in mutable memory
- * Note that all global names have the prefix "__vslc_"
- */
-static void generate_global_vars(void)
-{
-    puts(".data");
-    size_t gname_size = tlhash_size(global_names);
-    symbol_t **gnames = malloc(gname_size * sizeof(symbol_t *));
-    tlhash_values(global_names, (void **)gnames);
-    for (int i = 0; i < gname_size; i++)
-    {
-        symbol_t *curr_sym = gnames[i];
-        if (curr_sym->type == SYM_GLOBAL_VAR)
-        {
-            printf("__vslc_%s:\t.zero 8\n", curr_sym->name);
-        }
-    }
-    free(gnames);
-}
-
-/**
- * Generates an entry point for the program that handles boilerplate such as reading and validating program input
- * 
- * @arg first The first function of the program to be executed
- */
-static void generate_main(symbol_t *first)
-{
-    puts(".globl main");
-    puts(".text");
-    puts("main:");
-    puts("\tpushq %rbp");
-    puts("\tmovq %rsp, %rbp");
-
-    puts("\tsubq $1, %rdi");
-    printf("\tcmpq $%zu,%%rdi\n", first->nparms);
-    puts("\tjne ABORT");
-    puts("\tcmpq $0, %rdi");
-    puts("\tjz SKIP_ARGS");
-
-    puts("\tmovq %rdi, %rcx");
-    printf("\taddq $%zu, %%rsi\n", 8 * first->nparms);
-    puts("PARSE_ARGV:");
-    puts("\tpushq %rcx");
-    puts("\tpushq %rsi");
-
-    puts("\tmovq (%rsi), %rdi");
-    puts("\tmovq $0, %rsi");
-    puts("\tmovq $10, %rdx");
-    puts("\tcall strtol");
-
-    /*  Now a new argument is an integer in rax */
-    puts("\tpopq %rsi");
-    puts("\tpopq %rcx");
-    puts("\tpushq %rax");
-    puts("\tsubq $8, %rsi");
-    puts("\tloop PARSE_ARGV");
-
-    /* Now the arguments are in order on stack */
-    for (int arg = 0; arg < MIN(6, first->nparms); arg++)
-        printf("\tpopq\t%s\n", record[arg]);
-
-    puts("SKIP_ARGS:");
-    printf("\tcall __vslc_%s\n", first->name);
-    puts("\tjmp END");
-    puts("ABORT:");
-    puts("\tmovq $errout, %rdi");
-    puts("\tcall puts");
-
-    puts("END:");
-    puts("\tmovq %rax, %rdi");
-    puts("\tcall exit");
-}
-
-/**
- * Generates code for accessing a global variable
- * The value of the accessed global is stored in %rax
- * 
- * @arg symbol   The symbol table entry for the global to access
- * @arg function The symbol table entry for the global's enclosing function
- */
-static void generate_global_access(symbol_t *symbol)
-{
-    printf("\tmovq __vslc_%s(%%rip), %%rax\n", symbol->name);
-}
-
-/**
- * Generates code for accessing a local variable (param/otherwise)
- * The value of the accessed variable is stored in %rax
- * 
- * @arg symbol   The symbol table entry for the variable to access
- * @arg function The symbol table entry for the variable's enclosing function
- */
-static void generate_variable_access(symbol_t *symbol, symbol_t *function)
-{
-#if DEBUG_GENERATOR == 1
-    printf("# Access variable (%s, seq: %lu) #\n", symbol->name, symbol->seq);
-#endif
-    // x86 decrements the stack pointer before moving values onto the stack
-    // This means that %rsp is the pointer to the data on the top of the stack, not where the next value is placed
-    // So we need to add 1 to the sequence number to index the correct data on the stack
-    // Additionally, parameters and locals are stored in different places on the stack
-    int rbp_offset = -((symbol->seq + 1) * 8 + ((symbol->type == SYM_PARAMETER) ? 0 : ALIGNED_VARIABLES(function->nparms)));
-    printf("\tmovq %d(%%rbp), %%rax\n", rbp_offset);
-}
-
-/**
- * Generates access to a variable
- * Delegates the job of generating code to the correct function based on symbol type
- * 
- * @arg symbol   The symbol table entry for the symbol to access
- * @arg function The symbol table entry for the symbol's enclosing function
- */
-static void generate_access(symbol_t *symbol, symbol_t *function)
-{
-    switch (symbol->type)
-    {
-    case SYM_GLOBAL_VAR:
-        generate_global_access(symbol);
-        break;
-    case SYM_PARAMETER:
-        generate_variable_access(symbol, function);
-        break;
-    case SYM_LOCAL_VAR:
-        generate_variable_access(symbol, function);
-        break;
-    }
-}
-
-/**
- * Generates code for performing a comparison between two expressions
- * Does this by evaluating the expressions and having them placed into %rax/%r10
- *
- * @arg root     The comparison node to generate code for
- * @arg function The symbol table entry for the comparison's enclosing function
- * @arg s        The function scope containing if/while IDs
- */
-static void generate_comparison(node_t *root, symbol_t *function, scope s)
-{
-    generate_expression(root->children[0], function, s);
-    puts("\tpushq %rax");
-    generate_expression(root->children[1], function, s);
-    puts("\tpopq %r10");
-    puts("\tcmp %rax, %r10");
-}
-
-/**
- * Generates code for evaluating an arbitrary expression
- *
- * @arg node     The expression node to generate code for
- * @arg function The symbol table entry for the expression's enclosing function
- * @arg s        The function scope containing if/while IDs
- */
-static void generate_expression(node_t *node, symbol_t *function, scope s)
-{
-    if (node == NULL)
-    {
-        return;
-    }
-    switch (node->type)
-    {
-    case IDENTIFIER_DATA:
-    {
-        if (node->entry != NULL && node->entry->type != SYM_FUNCTION)
-            return generate_access(node->entry, function);
-        break;
-    }
-    case NUMBER_DATA:
-    {
-        printf("\tmovq $%ld, %%rax\n", *(long *)node->data);
-        return;
-    }
-    case EXPRESSION:
-    {
-        // Expressions with data = NULL are always function calls
-        if (node->data == NULL)
-        {
-            return generate_function_call(node, function, s);
-        }
-        generate_expression(node->children[0], function, s);
-        if (node->n_children > 1)
-        {
-            puts("\tpushq %rax");
-            generate_expression(node->children[1], function, s);
-            puts("\tpopq %r10");
-            switch (*(char *)node->data)
-            {
-            case '+':
-            {
-#if DEBUG_GENERATOR == 1
-                printf("# Addition of %s and %s #\n", (char *)node->children[0]->data, (char *)node->children[1]->data);
-#endif
-                puts("\taddq %r10, %rax");
-                break;
-            }
-            case '-':
-            {
-#if DEBUG_GENERATOR == 1
-                printf("# Subtraction of %s by %s #\n", (char *)node->children[0]->data, (char *)node->children[1]->data);
-#endif
-                puts("\tsubq %rax, %r10");
-                puts("\tmovq %r10, %rax");
-                break;
-            }
-            case '*':
-            {
-#if DEBUG_GENERATOR == 1
-                printf("# Multiplication of %s by %s #\n", (char *)node->children[0]->data, (char *)node->children[1]->data);
-#endif
-                puts("\timulq %r10");
-                break;
-            }
-            case '/':
-            {
-#if DEBUG_GENERATOR == 1
-                printf("# Division of %s by %s #\n", (char *)node->children[0]->data, (char *)node->children[1]->data);
-#endif
-                puts("\tmovq %rax, %rdx");
-                puts("\tmovq %r10, %rax");
-                puts("\tmovq %rdx, %r10");
-                puts("\tcqto"); //Extend sign from %rax into %rdx.
-                puts("\tidivq %r10");
-                break;
-            }
-            case '<':
-            {
-#if DEBUG_GENERATOR == 1
-                printf("# Bitwise left shift of %s by %s #\n", (char *)node->children[0]->data, (char *)node->children[1]->data);
-#endif
-                puts("\tmovq %rax, %rcx");
-                puts("\tmovq %r10, %rax");
-                puts("\tshl %cl, %rax");
-                break;
-            }
-            case '>':
-            {
-#if DEBUG_GENERATOR == 1
-                printf("# Bitwise right shift of %s by %s #\n", (char *)node->children[0]->data, (char *)node->children[1]->data);
-#endif
-                puts("\tmovq %rax, %rcx");
-                puts("\tmovq %r10, %rax");
-                puts("\tshr %cl, %rax");
-                break;
-            }
-            case '&':
-            {
-#if DEBUG_GENERATOR == 1
-                printf("# Bitwise and of %s and %s #\n", (char *)node->children[0]->data, (char *)node->children[1]->data);
-#endif
-                puts("\tand %r10, %rax");
-                break;
-            }
-            case '|':
-            {
-#if DEBUG_GENERATOR == 1
-                printf("# Bitwise or of %s and %s #\n", (char *)node->children[0]->data, (char *)node->children[1]->data);
-#endif
-                puts("\tor %r10, %rax");
-                break;
-            }
-            case '^':
-            {
-#if DEBUG_GENERATOR == 1
-                printf("# Bitwise xor of %s and %s #\n", (char *)node->children[0]->data, (char *)node->children[1]->data);
-#endif
-                puts("\txor %r10, %rax");
-                break;
-            }
-            }
-        }
-        else
-        {
-            switch (*(char *)node->data)
-            {
-            case '-':
-            {
-#if DEBUG_GENERATOR == 1
-                printf("# Unary negation of %s #\n", (char *)node->children[0]->data);
-#endif
-                puts("\tneg %rax");
-                break;
-            }
-            case '~':
-            {
-#if DEBUG_GENERATOR == 1
-                printf("# Unary bitwise not of %s #\n", (char *)node->children[0]->data);
-#endif
-                puts("\tnot %rax");
-            }
-            }
-        }
-        break;
-    }
-    }
-}
-
-/**
- * Generates code to assign a value to a global
- * The value in %rax is used for the assignment
- * 
- * @arg symbol   The symbol table entry for the global to perform an assignment for
- */
-static void generate_global_assignment(symbol_t *symbol)
-{
-    printf("\tmovq %%rax, __vslc_%s(%%rip)\n", symbol->name);
-}
-
-/**
- * Generates code to assign a value to a variable
- * The value in %rax is used for the assignment
- * 
- * @arg symbol   The symbol table entry for the variable to perform an assignment for
- * @arg function The symbol table entry for the variable's enclosing function
- */
-static void generate_variable_assignment(symbol_t *symbol, symbol_t *function)
-{
-#if DEBUG_GENERATOR == 1
-    printf("# Variable assignment of %s #\n", symbol->name);
-#endif
-    // See generate_variable_access. This is the exact same arithmetic
-    int rbp_offset = -((symbol->seq + 1) * 8 + ((symbol->type == SYM_PARAMETER) ? 0 : ALIGNED_VARIABLES(function->nparms)));
-    printf("\tmovq %%rax, %d(%%rbp)\n", rbp_offset);
-}
-
-/**
- * Generates code to assign the value of an expression to a variable
- * This generates the expression value and assigns it to the given variable
- * 
- * @arg node     The assignment node to generate code for
- * @arg function The symbol table entry for the assignment's enclosing function
- * @arg s        The function scope containing if/while IDs
- */
-static void generate_assignment(node_t *node, symbol_t *function, scope s)
-{
-    generate_expression(node->children[1], function, s);
-    switch (node->children[0]->entry->type)
-    {
-    case SYM_GLOBAL_VAR:
-        generate_global_assignment(node->children[0]->entry);
-        break;
-    case SYM_PARAMETER:
-        generate_variable_assignment(node->children[0]->entry, function);
-        break;
-    case SYM_LOCAL_VAR:
-        generate_variable_assignment(node->children[0]->entry, function);
-        break;
-    }
-}
-
-/**
- * Generates code to perform a conditional branch
- * 
- * @arg root     The if statement node to generate code for
- * @arg function The symbol table entry for the if statement's enclosing function
- * @arg s        The function scope containing if/while IDs
- */
-static void generate_if_statement(node_t *root, symbol_t *function, scope s)
-{
-    s.if_id = ++if_id;
-    printf("__vslif_%d_top:\n", s.if_id);
-    generate_comparison(root->children[0], function, s);
-    char *jmp_instr;
-
-    switch (*(char *)(root->children[0]->data))
-    {
-    case '=':
-    {
-        jmp_instr = "jne";
-        break;
-    }
-    case '<':
-    {
-        jmp_instr = "jnl";
-        break;
-    }
-    case '>':
-    {
-        jmp_instr = "jng";
-        break;
-    }
-    }
-    if (root->n_children == 2)
-    {
-        // No Else
-        printf("\t%s __vslif_%d_bottom\n", jmp_instr, s.if_id);
-        generate_statements(root->children[1], function, s);
-    }
-    else if (root->n_children > 2)
-    {
-        // With Else
-        printf("\t%s __vslif_%d_else\n", jmp_instr, s.if_id);
-        generate_statements(root->children[1], function, s);
-        printf("\tjmp __vslif_%d_bottom\n", s.if_id);
-        printf("__vslif_%d_else:\n", s.if_id);
-        generate_statements(root->children[2], function, s);
-    }
-    printf("__vslif_%d_bottom:\n", s.if_id);
-}
-
-/**
- * Generates code to perform a while loop
- * 
- * @arg root     The while statement node to generate code for
- * @arg function The symbol table entry for the while statement's enclosing function
- * @arg s        The function scope containing if/while IDs
- */
-static void generate_while_statement(node_t *root, symbol_t *function, scope s)
-{
-    s.while_id = ++while_id;
-    printf("__vslwhile_%d_top:\n", s.while_id);
-    generate_comparison(root->children[0], function, s);
-    char *jmp_instr;
-
-    switch (*(char *)(root->children[0]->data))
-    {
-    case '=':
-    {
-        jmp_instr = "jne";
-        break;
-    }
-    case '<':
-    {
-        jmp_instr = "jnl";
-        break;
-    }
-    case '>':
-    {
-        jmp_instr = "jng";
-        break;
-    }
-    }
-    // No Else
-    printf("\t%s __vslwhile_%d_bottom\n", jmp_instr, s.while_id);
-    generate_statements(root->children[1], function, s);
-    printf("\tjmp __vslwhile_%d_top\n", s.while_id);
-    printf("__vslwhile_%d_bottom:\n", s.while_id);
-}
-
-/**
- * Generates code to print a statement
- * 
- * @arg root     The print statement node to generate code for
- * @arg function The symbol table entry for the print statement's enclosing function
- * @arg s        The function scope containing if/while IDs
- */
-static void generate_print_statement(node_t *root, symbol_t *function, scope s)
-{
-
-    for (int i = 0; i < root->n_children; i++)
-    {
-        node_t *child = root->children[i];
-        switch (child->type)
-        {
-        case STRING_DATA:
-        {
-#if DEBUG_GENERATOR == 1
-            puts("# Loading string from data #");
-#endif
-            puts("\tlea strout(%rip), %rdi");
-            printf("\tlea STR%ld(%%rip), %%rsi\n", *(size_t *)child->data);
-            break;
-        }
-        case IDENTIFIER_DATA:
-        case NUMBER_DATA:
-        case EXPRESSION:
-        {
-#if DEBUG_GENERATOR == 1
-        printf("# Evaluating expression before print #\n");
-#endif
-            generate_expression(child, function, s);
-            puts("\tlea intout(%rip), %rdi");
-            puts("\tmovq %rax, %rsi");
-            break;
-        }
-        }
-#if DEBUG_GENERATOR == 1
-        printf("# Printing statement %d/%lu #\n", i, root->n_children);
-#endif
-        puts("\tpushq %rax");
-        puts("\tmovq $0, %rax");
-        puts("\tcall printf");
-        puts("\tpopq %rax");
-    };
-#if DEBUG_GENERATOR == 1
-    puts("# Newline at end of print statement #");
-#endif
-    puts("\tlea newline(%rip), %rdi");
-    puts("\tpushq %rax");
-    puts("\tmovq $0, %rax");
-    puts("\tcall printf");
-    puts("\tpopq %rax");
-}
-
-/**
- * Generates code for an arbitrary statement
- * If the given node is not any type of statement, statements are recursively
- * generated for all of the node's children. Note that this means generate_statements
- * is able to generate the entirety of function bodies.
- * 
- * @arg root     The node to generate statements for
- * @arg function The symbol table entry for the statement's enclosing function
- * @arg s        The function scope containing if/while IDs
- */
-static void generate_statements(node_t *root, symbol_t *function, scope s)
-{
-    switch (root->type)
-    {
-    case DECLARATION_LIST:
-    {
-        break;
-    }
-    case ASSIGNMENT_STATEMENT:
-    {
-        return generate_assignment(root, function, s);
-    }
-    case PRINT_STATEMENT:
-    {
-        return generate_print_statement(root, function, s);
-    }
-    case RETURN_STATEMENT:
-    {
-        if (root->n_children > 0)
-        {
-            generate_expression(root->children[0], function, s);
-            puts("\tleave");
-            puts("\tret");
-            return;
-        }
-        return;
-    }
-    case IF_STATEMENT:
-    {
-        return generate_if_statement(root, function, s);
-    }
-    case WHILE_STATEMENT:
-    {
-        return generate_while_statement(root, function, s);
-    }
-    case NULL_STATEMENT:
-    { // Why is continue called a NULL statement?
-        printf("\tjmp __vslwhile_%d_top\n", s.while_id);
-        return;
-    }
-    default:
-    {
-        for (int i = 0; i < root->n_children; i++)
-        {
-            if (root->children[i] != NULL)
-                generate_statements(root->children[i], function, s);
-        }
-        break;
-    }
-    }
-}
-
-/**
- * Comparison function for two symbol table entries. Sorts by the symbols' sequence numbers
- * 
- * @arg e1 The first symbol to compare
- * @arg e2 The second symbol to compare
- */
-int seq_comp(const void *e1, const void *e2)
-{
-    if (((symbol_t *)e1)->seq > ((symbol_t *)e2)->seq)
-        return 1;
-    if (((symbol_t *)e1)->seq < ((symbol_t *)e2)->seq)
-        return -1;
-    return 0;
-}
-
-/**
- * Generates a function prologue, body and exit code for a given symbol
- * 
- * @arg symbol The function symbol to generate code for
- */
-static void generate_function(symbol_t *symbol)
-{
-    printf(".globl __vslc_%s\n", symbol->name);
-    puts(".text");
-    printf("__vslc_%s:\n", symbol->name);
-
-    // Push the basepointer so we can use the stack dynamically.
-    // The stack pointer is stored in the base pointer from the mov-instruction above, so this practically stores the old stack frame
-    puts("\tpushq %rbp");
-    // Move the current stack pointer into the base pointer register before we allocate space on the stack
-    puts("\tmovq %rsp, %rbp");
-
-    size_t nlocals = tlhash_size(symbol->locals);
-    // Push all function arguments to the bottom of the stack in reverse order
-    symbol_t **locals = (symbol_t **) malloc(sizeof(symbol_t *) * nlocals);
-    tlhash_values(symbol->locals, (void **) locals);
-    // Sort to ensure correct pushing order
-    qsort(locals, nlocals, sizeof(symbol_t *), seq_comp);
-
-    int status;
-    for (int argn = 0; argn < symbol->nparms; argn++)
-    {
-#if DEBUG_GENERATOR == 1
-        printf("# Push argument %d to function stack frame #\n", argn);
-#endif
-        if (argn <= 5)
-        {
-            printf("\tpushq %s\n", record[argn]);
-        }
-        else if(symbol->nparms > 6)
-        {
-            // Which arg this is relative to the register-loaded arguments, starting at 0
-            // I.e. if this is arg #7, it's relative seq is 0, if it's #8, the relative seq is 1, and so on
-            // This tells us how far back to go on the stack from where the stack arguments are
-            int relative_seq = argn - 7;
-
-            // The rest of the arguments are stored on the stack before the return address
-            // Initial offset:
-            // +  8 bytes to leave current stack frame
-            // +  8 bytes to skip %rbp
-            // +  8 bytes to skip return address
-            // = 24 byte
-            // Then we go back 8 bytes for each argument
-            int sp_offset = 24 + (relative_seq * 8);
-#if DEBUG_GENERATOR == 1
-            printf("# Retrieve argument %d from preceding stack frame #\n", argn);
-#endif
-            // %rdi has already been pushed to the stack and is safe to use
-            printf("\tmovq %d(%%rbp), %%rdi\n", sp_offset);
-            puts("\tpushq %rdi");
-        }
-    }
-    free(locals);
-
-    // Allocate the function's stack frame and align the stack pointer to a 16-byte boundary
-    // The function call pushes the return address (8 bytes), and we need 8 bytes for each local variable
-    // So the SP needs to be aligned by allocating 8 more bytes if nlocals is an even number
-    size_t stack_frame_size = (nlocals % 2 == 1) ? nlocals * 8 : nlocals * 8 + 8;
-
-#if DEBUG_GENERATOR == 1
-    printf("# Allocate %lu bytes on the stack for %lu locals (aligned: %s) #\n",
-        stack_frame_size,
-        nlocals,
-        (nlocals % 2 == 1) ? "no" : "yes"
-    );
-#endif
-    printf("\tsubq $%lu, %%rsp\n", stack_frame_size);
-
-#if DEBUG_GENERATOR == 1
-    printf("# Function body (%s) #\n", symbol->name);
-#endif
-    // Setup function scope for if and while labels and generate the meat & potatoes of the function
-    scope s;
-    s.if_id = 0;
-    s.while_id = 0;
-    generate_statements(symbol->node, symbol, s);
-
-    // The leave instruction restores the stack for us by setting %rsp = %rbp and popping into %rbp
-    puts("\tleave");
-    puts("\tret");
-}
-
-// Takes a calling expression and generates code to call the function from a given caller
-/**
- * Generates code for calling a given function, including passing arguments
- * 
- * @arg call_node The expression node representing the function call
- * @arg caller    The symbol table entry for the calling function
- * @arg s         The calling function's scope containing if/while IDs
- */
-static void generate_function_call(node_t *call_node, symbol_t *caller, scope s)
-{
-    // Identifier node for the function to be called
-    node_t *func_identifier = call_node->children[0];
-    // Expression list for the function arguments
-    node_t *arg_list = call_node->children[1];
-
-#if DEBUG_GENERATOR == 1
-    printf("# Function call (%s) #\n", (char *)func_identifier->data);
-#endif
-
-    // If the arglist is null the function takes no parameters
-    if (arg_list != NULL)
-    {
-        // Reverse order because args should be pushed onto the stack in reverse order
-        for (int argn = arg_list->n_children - 1; argn >= 0; argn--)
-        {
-            // Generate code that resolves the value of the argument
-#if DEBUG_GENERATOR == 1
-            printf("# Resolve value of argument %d #\n", argn);
-#endif
-            generate_expression(arg_list->children[argn], caller, s);
-
-            // First 6 arguments go into registers
-            if (argn <= 5)
-            {
-                const char *param_register = record[argn];
-                printf("\tmovq %%rax, %s\n", param_register);
-            }
-            // Remaining args go to the stack
-            else if (argn > 5)
-            {
-                puts("\tpushq %rax");
-            }
-        }
-    }
-
-    // Perform the call
-    symbol_t *function = func_identifier->entry;
-    printf("\tcall __vslc_%s\n", function->name);
-}
-
-/**
- * Generates all functions in the program
- */
-static void generate_functions(void)
-{
-    size_t gname_size = tlhash_size(global_names);
-    symbol_t **gnames = malloc(gname_size * sizeof(symbol_t *));
-    tlhash_values(global_names, (void **)gnames);
-    for (int i = 0; i < tlhash_size(global_names); i++)
-    {
-        symbol_t *curr_sym = gnames[i];
-        if (curr_sym->type == SYM_FUNCTION)
-        {
-            if (curr_sym->seq == 0)
-            {
-                generate_main(curr_sym);
-                puts("");
-            }
-            generate_function(curr_sym);
-        }
-    }
-    free(gnames);
-}
-
-/**
- * Generates code for the entire program
- */
-void generate_program(void)
-{
-    generate_stringtable();
-    generate_global_vars();
-    generate_functions();
-}
+#include "vslc.h"
+#include "generator.h"
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+// Initial output capacity of a function that is generated on its own
+#define FUNCTION_CAPACITY 4096
+
+// Every generator function takes the generator state of the function it
+// generates code for, see generator_t. Generated code is collected in
+// gen->out until the program is complete
+
+/**
+ * Generates the string table containing all strings used by the program
+ */
+static void generate_stringtable(generator_t *gen)
+{
+    /* These can be used to emit numbers, strings and a run-time
+	 * error msg. from main
+	 */
+    emit_line(gen->out, ".data");
+    emit_line(gen->out, "intout: .asciz \"\%ld\"");
+    emit_line(gen->out, "strout: .asciz \"\%s\"");
+    emit_line(gen->out, "newline: .asciz \"\\n\"");
+    emit_line(gen->out, "errout: .asciz \"Wrong number of arguments\"");
+
+    // Go through all strings from the program and put them in the data section
+    for (int i = 0; i < gen->compiler->stringc; i++)
+    {
+        emit_string(gen->out, "STR");
+        emit_int(gen->out, i);
+        emit_string(gen->out, ":\t.asciz ");
+        emit_line(gen->out, gen->compiler->string_list[i]);
+    }
+}
+
+/**
+ * Reserves space for every global variable in mutable memory, but those the
+ * program never refers to
+ * Note that all global names have the prefix "__vslc_"
+ */
+static void generate_global_vars(generator_t *gen)
+{
+    emit_line(gen->out, ".data");
+    symbol_t *curr_sym;
+    tlhash_cursor_t cursor = TLHASH_CURSOR_INIT;
+    while (tlhash_next(gen->compiler->global_names, &cursor, NULL, NULL, (void **)&curr_sym) == TLHASH_SUCCESS)
+    {
+        if (curr_sym->type == SYM_GLOBAL_VAR && !curr_sym->unused)
+        {
+            emit_string(gen->out, "__vslc_");
+            emit_string(gen->out, curr_sym->name);
+            emit_line(gen->out, ":\t.zero 8");
+        }
+    }
+}
+
+/**
+ * Generates an entry point for the program that handles boilerplate such as reading and validating program input
+ * 
+ * @arg first The first function of the program to be executed
+ */
+static void generate_main(generator_t *gen, symbol_t *first)
+{
+    emit_line(gen->out, ".globl main");
+    emit_line(gen->out, ".text");
+    emit_line(gen->out, "main:");
+    emit_line(gen->out, "\tpushq %rbp");
+    emit_line(gen->out, "\tmovq %rsp, %rbp");
+
+    emit_line(gen->out, "\tsubq $1, %rdi");
+    emitf(gen->out, "\tcmpq $%zu,%%rdi\n", first->nparms);
+    emit_line(gen->out, "\tjne ABORT");
+    emit_line(gen->out, "\tcmpq $0, %rdi");
+    emit_line(gen->out, "\tjz SKIP_ARGS");
+
+    emit_line(gen->out, "\tmovq %rdi, %rcx");
+    emit_instr_ir(gen->out, "addq", 8 * first->nparms, "%rsi");
+    emit_line(gen->out, "PARSE_ARGV:");
+    emit_line(gen->out, "\tpushq %rcx");
+    emit_line(gen->out, "\tpushq %rsi");
+
+    emit_line(gen->out, "\tmovq (%rsi), %rdi");
+    emit_line(gen->out, "\tmovq $0, %rsi");
+    emit_line(gen->out, "\tmovq $10, %rdx");
+    emit_line(gen->out, "\tcall strtol");
+
+    /*  Now a new argument is an integer in rax */
+    emit_line(gen->out, "\tpopq %rsi");
+    emit_line(gen->out, "\tpopq %rcx");
+    emit_line(gen->out, "\tpushq %rax");
+    emit_line(gen->out, "\tsubq $8, %rsi");
+    emit_line(gen->out, "\tloop PARSE_ARGV");
+
+    /* Now the arguments are in order on stack */
+    for (int arg = 0; arg < MIN(6, first->nparms); arg++)
+        emitf(gen->out, "\tpopq\t%s\n", record[arg]);
+
+    emit_line(gen->out, "SKIP_ARGS:");
+    emit_string(gen->out, "\tcall __vslc_");
+    emit_line(gen->out, first->name);
+    emit_line(gen->out, "\tjmp END");
+    emit_line(gen->out, "ABORT:");
+    emit_line(gen->out, "\tmovq $errout, %rdi");
+    emit_line(gen->out, "\tcall puts");
+
+    emit_line(gen->out, "END:");
+    emit_line(gen->out, "\tmovq %rax, %rdi");
+    emit_line(gen->out, "\tcall exit");
+}
+
+/**
+ * Generates code for accessing a global variable
+ * 
+ * @arg symbol   The symbol table entry for the global to access
+ * @arg reg      The register to store the value of the global in
+ */
+static void generate_global_access(generator_t *gen, symbol_t *symbol, const char *reg)
+{
+    emit_string(gen->out, "\tmovq __vslc_");
+    emit_string(gen->out, symbol->name);
+    emit_string(gen->out, "(%rip), ");
+    emit_line(gen->out, reg);
+}
+
+/**
+ * Generates code for accessing a local variable (param/otherwise)
+ * 
+ * @arg symbol   The symbol table entry for the variable to access
+ * @arg function The symbol table entry for the variable's enclosing function
+ * @arg reg      The register to store the value of the variable in
+ */
+static void generate_variable_access(generator_t *gen, symbol_t *symbol, symbol_t *function, const char *reg)
+{
+#if DEBUG_GENERATOR == 1
+    emitf(gen->out, "# Access variable (%s, seq: %lu) #\n", symbol->name, symbol->seq);
+#endif
+    const char *home = gen->homes[variable_index(function, symbol)];
+    if (home != NULL)
+    {
+        emit_instr_rr(gen->out, "movq", home, reg);
+        return;
+    }
+    // x86 decrements the stack pointer before moving values onto the stack
+    // This means that %rsp is the pointer to the data on the top of the stack, not where the next value is placed
+    // So we need to add 1 to the sequence number to index the correct data on the stack
+    // Additionally, parameters and locals are stored in different places on the stack
+    int rbp_offset = -((symbol->seq + 1) * 8 + ((symbol->type == SYM_PARAMETER) ? 0 : ALIGNED_VARIABLES(function->nparms)));
+    emit_instr_mr(gen->out, "movq", rbp_offset, "%rbp", reg);
+}
+
+/**
+ * Generates access to a variable
+ * Delegates the job of generating code to the correct function based on symbol type
+ * 
+ * @arg symbol   The symbol table entry for the symbol to access
+ * @arg function The symbol table entry for the symbol's enclosing function
+ * @arg reg      The register to store the value of the symbol in
+ */
+static void generate_access(generator_t *gen, symbol_t *symbol, symbol_t *function, const char *reg)
+{
+    switch (symbol->type)
+    {
+    case SYM_GLOBAL_VAR:
+        generate_global_access(gen, symbol, reg);
+        break;
+    case SYM_PARAMETER:
+        generate_variable_access(gen, symbol, function, reg);
+        break;
+    case SYM_LOCAL_VAR:
+        generate_variable_access(gen, symbol, function, reg);
+        break;
+    }
+}
+
+// The tree of a function is generated on the walk stack in gen->walk rather
+// than by recursion, so deeply nested statements and expressions cannot
+// exhaust the C stack. Each generate_ function below takes the frame of a
+// node, emits the code that comes before its next child, and returns the
+// slot of that child, or NULL when the node is complete. The stage of the
+// frame records how far the node has come, its mark holds its label number,
+// or for expressions the number of the value they compute, see scratch
+
+/**
+ * Finds whether a node divides by a constant power of two, which is done by
+ * shifting when optimizing. The divisor is then an immediate, and takes no
+ * register
+ *
+ * @arg node The node to look at
+ * @return   The power k of the divisor 2^k, or 0
+ */
+static int divisor_shift(generator_t *gen, node_t *node)
+{
+    if (!gen->compiler->optimize || node->type != EXPRESSION || node->op != OP_DIV
+        || node->n_children != 2 || node->children[1]->type != NUMBER_DATA)
+        return 0;
+    return power_of_two(node->children[1]->data.number);
+}
+
+/**
+ * Labels a node whose children are labelled with the registers it takes to
+ * evaluate, by Sethi-Ullman numbering, and with the effects it may have
+ *
+ * @arg node The node to label
+ */
+static void label_expression(generator_t *gen, node_t *node)
+{
+    node->effects = 0;
+    for (uint32_t c = 0; c < node->n_children; c++)
+    {
+        if (node->children[c] != NULL)
+            node->effects |= node->children[c]->effects;
+    }
+    switch (node->type)
+    {
+    case IDENTIFIER_DATA:
+        if (node->entry != NULL && node->entry->type == SYM_GLOBAL_VAR)
+            node->effects |= EFFECT_GLOBAL;
+        node->registers = 1;
+        break;
+    case NUMBER_DATA:
+        node->registers = 1;
+        break;
+    case EXPRESSION:
+    case RELATION:
+        if (node->op == OP_NONE)
+        {
+            // Calls save every value held across them, so none are left
+            node->effects |= EFFECT_CALL;
+            node->registers = N_SCRATCH + 1;
+        }
+        else if (node->n_children == 1 || divisor_shift(gen, node) > 0)
+            node->registers = node->children[0]->registers;
+        else
+        {
+            int left = node->children[0]->registers, right = node->children[1]->registers;
+            node->registers = MIN((left == right) ? left + 1 : MAX(left, right), UINT8_MAX);
+        }
+        break;
+    default:
+        node->registers = 0;
+        break;
+    }
+}
+
+/**
+ * Labels every node in a function body, children before their parents, and
+ * finds whether the body loops back to its start through a tail call
+ *
+ * @arg root     The slot of the function body
+ * @arg function The symbol table entry for the function
+ */
+static void label_expressions(generator_t *gen, node_t **root, symbol_t *function)
+{
+    walk_event_t event;
+    node_t **slot;
+    gen->tail_loop = false;
+    if (*root != NULL)
+        walk_push(&gen->walk, root);
+    while ((event = walk_next(&gen->walk, &slot)) != WALK_DONE)
+    {
+        if (event != WALK_LEAVE)
+            continue;
+        label_expression(gen, *slot);
+        gen->tail_loop |= (tail_callee(gen, *slot, function) == function);
+    }
+}
+
+/**
+ * Finds the function a return statement can jump to rather than call, as
+ * the value it returns is that of the call. The function itself loops back
+ * to the start of its body, and a function taking every argument in a
+ * register takes over the frame, returning to the caller in its place
+ *
+ * @arg node     The node to look at, which may be any statement
+ * @arg function The symbol table entry for the enclosing function
+ * @return       The function called, or NULL if it is not a tail call
+ */
+static symbol_t *tail_callee(generator_t *gen, node_t *node, symbol_t *function)
+{
+    if (!gen->compiler->optimize || node->type != RETURN_STATEMENT || node->n_children == 0)
+        return NULL;
+    node_t *value = node->children[0];
+    if (value->type != EXPRESSION || value->op != OP_NONE || value->n_children != 2)
+        return NULL;
+    symbol_t *callee = value->children[0]->entry;
+    size_t n_args = (value->children[1] != NULL) ? value->children[1]->n_children : 0;
+    if (callee == function)
+        return (n_args == function->nparms) ? callee : NULL;
+    return (n_args <= N_PARAM_REGISTERS) ? callee : NULL;
+}
+
+/**
+ * Tells whether the right operand of a node is generated before the left
+ * The operand that takes more registers goes first, so fewer are held while
+ * it is evaluated, unless the order makes a difference to the program
+ *
+ * @arg node The node with two operands
+ */
+static bool operands_swapped(node_t *node)
+{
+    node_t *left = node->children[0], *right = node->children[1];
+    if (right->registers <= left->registers)
+        return false;
+    // Calls on the left must come first, and a call on the right may assign
+    // a global that the left reads
+    if (left->effects & EFFECT_CALL)
+        return false;
+    return !((right->effects & EFFECT_CALL) && (left->effects & EFFECT_GLOBAL));
+}
+
+/**
+ * Generates both operands of a node into registers, and takes the first of
+ * them for the value of the node. When the first operand is in the last
+ * scratch register, it is spilled to the stack while the second is evaluated
+ *
+ * @arg frame    The frame of the node with two operands
+ * @arg left     Set to the register of the left operand once both are done
+ * @arg right    Set to the register of the right operand once both are done
+ */
+static node_t **generate_operands(generator_t *gen, walk_frame_t *frame, const char **left, const char **right)
+{
+    node_t *node = *frame->slot;
+    bool immediate = divisor_shift(gen, node) > 0;
+    bool swapped = !immediate && operands_swapped(node);
+    int value = frame->mark;
+    switch (frame->stage++)
+    {
+    case 0:
+        return &node->children[swapped];
+    case 1:
+        // A constant divisor is not generated, see divisor_shift
+        if (immediate)
+        {
+            *left = scratch[value];
+            *right = NULL;
+            gen->live = value + 1;
+            return NULL;
+        }
+        if (value + 1 == N_SCRATCH)
+        {
+            emit_instr(gen->out, "pushq", scratch[value]);
+            gen->live = value;
+        }
+        return &node->children[!swapped];
+    default:
+    {
+        const char *first = scratch[value], *second;
+        if (value + 1 == N_SCRATCH)
+        {
+            emit_instr_rr(gen->out, "movq", first, spill);
+            emit_instr(gen->out, "popq", first);
+            second = spill;
+        }
+        else
+            second = scratch[value + 1];
+        *left = swapped ? second : first;
+        *right = swapped ? first : second;
+        gen->live = value + 1;
+        return NULL;
+    }
+    }
+}
+
+/**
+ * Generates code that moves values between registers all at once, where
+ * the destinations may be read by other moves. Moves that overwrite no
+ * pending source go first, the rest are cycles broken by exchanges
+ *
+ * @arg sources      The registers to move from, all different
+ * @arg destinations The registers to move to, all different
+ * @arg n            The number of moves, at most N_PARAM_REGISTERS
+ */
+static void generate_parallel_move(generator_t *gen, const char **sources, const char **destinations, int n)
+{
+    const char *from[N_PARAM_REGISTERS], *to[N_PARAM_REGISTERS];
+    int pending = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (strcmp(sources[i], destinations[i]) != 0)
+        {
+            from[pending] = sources[i];
+            to[pending++] = destinations[i];
+        }
+    }
+    while (pending > 0)
+    {
+        // Look for a move whose destination no other move reads
+        int m;
+        for (m = 0; m < pending; m++)
+        {
+            bool read = false;
+            for (int k = 0; k < pending; k++)
+                read |= (strcmp(from[k], to[m]) == 0);
+            if (!read)
+                break;
+        }
+        if (m < pending)
+            emit_instr_rr(gen->out, "movq", from[m], to[m]);
+        else
+        {
+            // The value in the destination moves to the source, where
+            // the move reading it will find it
+            m = 0;
+            emit_instr_rr(gen->out, "xchgq", from[m], to[m]);
+            for (int k = 0; k < pending; k++)
+            {
+                if (strcmp(from[k], to[m]) == 0)
+                    from[k] = from[m];
+            }
+        }
+        pending -= 1;
+        from[m] = from[pending];
+        to[m] = to[pending];
+    }
+}
+
+/**
+ * Generates code to assign a value to a global
+ * The value in %rax is used for the assignment
+ *
+ * @arg symbol   The symbol table entry for the global to perform an assignment for
+ */
+static void generate_global_assignment(generator_t *gen, symbol_t *symbol)
+{
+    emit_string(gen->out, "\tmovq %rax, __vslc_");
+    emit_string(gen->out, symbol->name);
+    emit_line(gen->out, "(%rip)");
+}
+
+/**
+ * Generates code to assign a value to a variable
+ * The value in %rax is used for the assignment
+ *
+ * @arg symbol   The symbol table entry for the variable to perform an assignment for
+ * @arg function The symbol table entry for the variable's enclosing function
+ */
+static void generate_variable_assignment(generator_t *gen, symbol_t *symbol, symbol_t *function)
+{
+#if DEBUG_GENERATOR == 1
+    emitf(gen->out, "# Variable assignment of %s #\n", symbol->name);
+#endif
+    const char *home = gen->homes[variable_index(function, symbol)];
+    if (home != NULL)
+    {
+        emit_instr_rr(gen->out, "movq", "%rax", home);
+        return;
+    }
+    // See generate_variable_access. This is the exact same arithmetic
+    int rbp_offset = -((symbol->seq + 1) * 8 + ((symbol->type == SYM_PARAMETER) ? 0 : ALIGNED_VARIABLES(function->nparms)));
+    emit_instr_rm(gen->out, "movq", "%rax", rbp_offset, "%rbp");
+}
+
+/**
+ * Generates code for performing a comparison between two expressions
+ * Does this by evaluating the expressions into registers, and comparing them
+ *
+ * @arg frame    The frame of the comparison node to generate code for
+ */
+static node_t **generate_comparison(generator_t *gen, walk_frame_t *frame)
+{
+    const char *left, *right;
+    if (frame->stage == 0)
+        frame->mark = gen->live;
+    node_t **operand = generate_operands(gen, frame, &left, &right);
+    if (operand == NULL)
+    {
+        emit_instr_rr(gen->out, "cmp", right, left);
+        gen->live = frame->mark;
+    }
+    return operand;
+}
+
+#if DEBUG_GENERATOR == 1
+/**
+ * Describes an operand for the comments in debug output
+ *
+ * @arg node The operand node
+ */
+static const char *operand_name(node_t *node)
+{
+    if (node->type == IDENTIFIER_DATA)
+        return node->data.name;
+    if (node->type == EXPRESSION && node->op != OP_NONE)
+        return operator_string[node->op];
+    return node_string[node->type];
+}
+#endif
+
+/**
+ * Generates code for the operator of an expression, once its operands are in registers
+ * The result is left in one of the operand registers, and the other one is free
+ *
+ * @arg node     The expression node to generate code for
+ * @arg left     The register holding the left operand
+ * @arg right    The register holding the right operand
+ * @arg result   The operand register to leave the result in
+ */
+static void generate_binary_operator(generator_t *gen, node_t *node, const char *left, const char *right, const char *result)
+{
+    // Operands of commutative operators are combined into the result directly
+    const char *other = (result == left) ? right : left;
+    switch (node->op)
+    {
+    case OP_ADD:
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Addition of %s and %s #\n", operand_name(node->children[0]), operand_name(node->children[1]));
+#endif
+        emit_instr_rr(gen->out, "addq", other, result);
+        break;
+    }
+    case OP_SUB:
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Subtraction of %s by %s #\n", operand_name(node->children[0]), operand_name(node->children[1]));
+#endif
+        emit_instr_rr(gen->out, "subq", right, left);
+        if (result != left)
+            emit_instr_rr(gen->out, "movq", left, result);
+        break;
+    }
+    case OP_MUL:
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Multiplication of %s by %s #\n", operand_name(node->children[0]), operand_name(node->children[1]));
+#endif
+        emit_instr_rr(gen->out, "imulq", other, result);
+        break;
+    }
+    case OP_DIV:
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Division of %s by %s #\n", operand_name(node->children[0]), operand_name(node->children[1]));
+#endif
+        // Division by 2^k is an arithmetic shift by k, once 2^k - 1 is
+        // added to a negative dividend so the quotient rounds towards zero
+        int shift = divisor_shift(gen, node);
+        if (shift > 0)
+        {
+            emit_instr_rr(gen->out, "movq", left, "%rcx");
+            emit_instr_ir(gen->out, "sarq", 63, "%rcx");
+            emit_instr_ir(gen->out, "shrq", 64 - shift, "%rcx");
+            emit_instr_rr(gen->out, "addq", "%rcx", left);
+            emit_instr_ir(gen->out, "sarq", shift, left);
+            if (result != left)
+                emit_instr_rr(gen->out, "movq", left, result);
+            break;
+        }
+        // The dividend goes in %rax, and a value held there is exchanged
+        // with it. Either way, the quotient ends up in 'quotient'
+        const char *quotient = left;
+        if (left == scratch[0])
+        {
+            emit_line(gen->out, "\tcqto"); //Extend sign from %rax into %rdx.
+            emit_instr(gen->out, "idivq", right);
+        }
+        else if (right == scratch[0])
+        {
+            emit_instr_rr(gen->out, "xchgq", left, "%rax");
+            emit_line(gen->out, "\tcqto");
+            emit_instr(gen->out, "idivq", left);
+            quotient = right;
+        }
+        else
+        {
+            emit_instr_rr(gen->out, "xchgq", left, "%rax");
+            emit_line(gen->out, "\tcqto");
+            emit_instr(gen->out, "idivq", right);
+            emit_instr_rr(gen->out, "xchgq", left, "%rax");
+        }
+        if (result != quotient)
+            emit_instr_rr(gen->out, "movq", quotient, result);
+        break;
+    }
+    case OP_LSHIFT:
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Bitwise left shift of %s by %s #\n", operand_name(node->children[0]), operand_name(node->children[1]));
+#endif
+        emit_instr_rr(gen->out, "movq", right, "%rcx");
+        emit_instr_rr(gen->out, "shl", "%cl", left);
+        if (result != left)
+            emit_instr_rr(gen->out, "movq", left, result);
+        break;
+    }
+    case OP_RSHIFT:
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Bitwise right shift of %s by %s #\n", operand_name(node->children[0]), operand_name(node->children[1]));
+#endif
+        emit_instr_rr(gen->out, "movq", right, "%rcx");
+        emit_instr_rr(gen->out, "shr", "%cl", left);
+        if (result != left)
+            emit_instr_rr(gen->out, "movq", left, result);
+        break;
+    }
+    case OP_AND:
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Bitwise and of %s and %s #\n", operand_name(node->children[0]), operand_name(node->children[1]));
+#endif
+        emit_instr_rr(gen->out, "and", other, result);
+        break;
+    }
+    case OP_OR:
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Bitwise or of %s and %s #\n", operand_name(node->children[0]), operand_name(node->children[1]));
+#endif
+        emit_instr_rr(gen->out, "or", other, result);
+        break;
+    }
+    case OP_XOR:
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Bitwise xor of %s and %s #\n", operand_name(node->children[0]), operand_name(node->children[1]));
+#endif
+        emit_instr_rr(gen->out, "xor", other, result);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/**
+ * Generates code for a unary operator, once its operand is in a register
+ *
+ * @arg node     The expression node to generate code for
+ * @arg reg      The register holding the operand, and then the result
+ */
+static void generate_unary_operator(generator_t *gen, node_t *node, const char *reg)
+{
+    switch (node->op)
+    {
+    case OP_SUB:
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Unary negation of %s #\n", operand_name(node->children[0]));
+#endif
+        emit_instr(gen->out, "neg", reg);
+        break;
+    }
+    case OP_NOT:
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Unary bitwise not of %s #\n", operand_name(node->children[0]));
+#endif
+        emit_instr(gen->out, "not", reg);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/**
+ * Generates code for calling a given function, including passing arguments
+ * The arguments are evaluated from the last to the first. Those passed on
+ * the stack are pushed as they are done, the others are held in scratch
+ * registers and moved to their parameter registers right before the call
+ *
+ * @arg frame     The frame of the expression node representing the function call
+ * @arg function  The symbol table entry for the call's enclosing function
+ */
+static node_t **generate_function_call(generator_t *gen, walk_frame_t *frame, symbol_t *function)
+{
+    node_t *call_node = *frame->slot;
+    // Identifier node for the function to be called
+    node_t *func_identifier = call_node->children[0];
+    // Expression list for the function arguments, if the function takes any
+    node_t *arg_list = call_node->children[1];
+    int n_args = (arg_list != NULL) ? arg_list->n_children : 0;
+    int n_register_args = MIN(n_args, N_PARAM_REGISTERS);
+    int value = frame->mark;
+    int stage = frame->stage++;
+
+    if (stage == 0)
+    {
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Function call (%s) #\n", func_identifier->data.name);
+#endif
+        // The callee may change any scratch register, so values held are saved
+        for (int v = 0; v < value; v++)
+            emit_instr(gen->out, "pushq", scratch[v]);
+        gen->live = 0;
+    }
+    // The argument generated in the last stage is in the last scratch
+    // register taken, and arguments past the first 6 go to the stack
+    else if (n_args - stage >= N_PARAM_REGISTERS)
+    {
+        emit_instr(gen->out, "pushq", scratch[0]);
+        gen->live = 0;
+    }
+
+    // Reverse order because args should be pushed onto the stack in reverse order
+    if (stage < n_args)
+    {
+        // Generate code that resolves the value of the argument
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Resolve value of argument %d #\n", n_args - 1 - stage);
+#endif
+        return &arg_list->children[n_args - 1 - stage];
+    }
+
+    // The value of a call a return statement jumps to is never held
+    walk_frame_t *parent = (gen->walk.depth > 1) ? &gen->walk.frames[gen->walk.depth - 2] : NULL;
+    if (parent != NULL && (*parent->slot)->type == RETURN_STATEMENT && parent->mark)
+    {
+        generate_tail_call(gen, func_identifier->entry, n_args, function);
+        gen->live = 0;
+        return NULL;
+    }
+
+    // Argument i was generated as value n_register_args - 1 - i
+    const char *arguments[N_PARAM_REGISTERS];
+    for (int argn = 0; argn < n_register_args; argn++)
+        arguments[argn] = scratch[n_register_args - 1 - argn];
+    generate_parallel_move(gen, arguments, record, n_register_args);
+
+    // Perform the call, and drop the stack arguments
+    emit_string(gen->out, "\tcall __vslc_");
+    emit_line(gen->out, func_identifier->entry->name);
+    if (n_args > N_PARAM_REGISTERS)
+        emit_instr_ir(gen->out, "addq", 8 * (n_args - N_PARAM_REGISTERS), "%rsp");
+
+    if (value > 0)
+        emit_instr_rr(gen->out, "movq", "%rax", scratch[value]);
+    for (int v = value - 1; v >= 0; v--)
+        emit_instr(gen->out, "popq", scratch[v]);
+    gen->live = value + 1;
+    return NULL;
+}
+
+/**
+ * Generates the jump a return statement makes to the function it calls,
+ * once the arguments are evaluated as for a call, see tail_callee. The
+ * function itself takes its arguments in its parameters, the first of the
+ * stack arguments on top, and starts its body again. Any other function
+ * takes them in registers, and the frame is left before jumping to it, so
+ * it returns to the caller of this one
+ *
+ * @arg callee   The symbol table entry for the function called
+ * @arg n_args   The number of arguments passed
+ * @arg function The symbol table entry for the call's enclosing function
+ */
+static void generate_tail_call(generator_t *gen, symbol_t *callee, int n_args, symbol_t *function)
+{
+    int n_register_args = MIN(n_args, N_PARAM_REGISTERS);
+    const char *arguments[N_PARAM_REGISTERS];
+    for (int argn = 0; argn < n_register_args; argn++)
+        arguments[argn] = scratch[n_register_args - 1 - argn];
+    if (callee != function)
+    {
+        generate_parallel_move(gen, arguments, record, n_register_args);
+        generate_leave(gen);
+        emit_string(gen->out, "\tjmp __vslc_");
+        emit_line(gen->out, callee->name);
+        return;
+    }
+
+    // Parameters are kept in variable registers or on the stack, never in
+    // the scratch registers the arguments are in
+    for (int argn = N_PARAM_REGISTERS; argn < n_args; argn++)
+    {
+        if (gen->homes[argn] != NULL)
+            emit_instr(gen->out, "popq", gen->homes[argn]);
+        else
+            emitf(gen->out, "\tpopq %d(%%rbp)\n", -(argn + 1) * 8);
+    }
+    for (int argn = 0; argn < n_register_args; argn++)
+    {
+        if (gen->homes[argn] != NULL)
+            emit_instr_rr(gen->out, "movq", arguments[argn], gen->homes[argn]);
+        else
+            emit_instr_rm(gen->out, "movq", arguments[argn], -(argn + 1) * 8, "%rbp");
+    }
+    emit_instr_label(gen->out, "jmp", "__vsltail_", function->seq, "");
+}
+
+/**
+ * Generates code for evaluating an arbitrary expression
+ * The value of the expression is left in scratch[v], where v is the number
+ * of values held when it starts, and kept in the mark of its frame
+ *
+ * @arg frame    The frame of the expression node to generate code for
+ * @arg function The symbol table entry for the expression's enclosing function
+ */
+static node_t **generate_expression(generator_t *gen, walk_frame_t *frame, symbol_t *function)
+{
+    node_t *node = *frame->slot;
+    if (frame->stage == 0)
+        frame->mark = gen->live;
+    const char *reg = scratch[frame->mark];
+    switch (node->type)
+    {
+    case IDENTIFIER_DATA:
+    {
+        if (node->entry != NULL && node->entry->type != SYM_FUNCTION)
+            generate_access(gen, node->entry, function, reg);
+        gen->live = frame->mark + 1;
+        return NULL;
+    }
+    case NUMBER_DATA:
+    {
+        emit_instr_ir(gen->out, "movq", node->data.number, reg);
+        gen->live = frame->mark + 1;
+        return NULL;
+    }
+    default:
+        break;
+    }
+
+    // Expressions without an operator are always function calls
+    if (node->op == OP_NONE)
+        return generate_function_call(gen, frame, function);
+
+    if (node->n_children == 1)
+    {
+        if (frame->stage++ == 0)
+            return &node->children[0];
+        generate_unary_operator(gen, node, reg);
+        return NULL;
+    }
+
+    const char *left, *right;
+    node_t **operand = generate_operands(gen, frame, &left, &right);
+    if (operand == NULL)
+        generate_binary_operator(gen, node, left, right, reg);
+    return operand;
+}
+
+/**
+ * Generates code to assign the value of an expression to a variable
+ * This generates the expression value and assigns it to the given variable
+ *
+ * @arg frame    The frame of the assignment node to generate code for
+ * @arg function The symbol table entry for the assignment's enclosing function
+ */
+static node_t **generate_assignment(generator_t *gen, walk_frame_t *frame, symbol_t *function)
+{
+    node_t *node = *frame->slot;
+    if (frame->stage++ == 0)
+        return &node->children[1];
+
+    switch (node->children[0]->entry->type)
+    {
+    case SYM_GLOBAL_VAR:
+        generate_global_assignment(gen, node->children[0]->entry);
+        break;
+    case SYM_PARAMETER:
+        generate_variable_assignment(gen, node->children[0]->entry, function);
+        break;
+    case SYM_LOCAL_VAR:
+        generate_variable_assignment(gen, node->children[0]->entry, function);
+        break;
+    }
+    gen->live = 0;
+    return NULL;
+}
+
+/**
+ * Gives the jump taken when a relation does not hold
+ *
+ * @arg relation The relation node of an if or while statement
+ */
+static char *negated_jump(node_t *relation)
+{
+    switch (relation->op)
+    {
+    case OP_EQ:
+        return "jne";
+    case OP_LT:
+        return "jnl";
+    case OP_GT:
+        return "jng";
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * Generates code to perform a conditional branch
+ *
+ * @arg frame    The frame of the if statement node to generate code for
+ */
+static node_t **generate_if_statement(generator_t *gen, walk_frame_t *frame)
+{
+    node_t *root = *frame->slot;
+    switch (frame->stage++)
+    {
+    case 0:
+        frame->mark = ++gen->if_id;
+        emit_label(gen->out, gen->if_prefix, frame->mark, "_top");
+        return &root->children[0];
+    case 1:
+        if (root->n_children == 2)
+        {
+            // No Else
+            emit_instr_label(gen->out, negated_jump(root->children[0]), gen->if_prefix, frame->mark, "_bottom");
+        }
+        else
+        {
+            // With Else
+            emit_instr_label(gen->out, negated_jump(root->children[0]), gen->if_prefix, frame->mark, "_else");
+        }
+        return &root->children[1];
+    case 2:
+        if (root->n_children > 2)
+        {
+            emit_instr_label(gen->out, "jmp", gen->if_prefix, frame->mark, "_bottom");
+            emit_label(gen->out, gen->if_prefix, frame->mark, "_else");
+            return &root->children[2];
+        }
+        // Fall through, there is no else
+    default:
+        emit_label(gen->out, gen->if_prefix, frame->mark, "_bottom");
+        return NULL;
+    }
+}
+
+/**
+ * Generates code to perform a while loop
+ *
+ * @arg frame    The frame of the while statement node to generate code for
+ */
+static node_t **generate_while_statement(generator_t *gen, walk_frame_t *frame)
+{
+    node_t *root = *frame->slot;
+    switch (frame->stage++)
+    {
+    case 0:
+        frame->mark = ++gen->while_id;
+        emit_label(gen->out, gen->while_prefix, frame->mark, "_top");
+        return &root->children[0];
+    case 1:
+        // No Else
+        emit_instr_label(gen->out, negated_jump(root->children[0]), gen->while_prefix, frame->mark, "_bottom");
+        return &root->children[1];
+    default:
+        emit_instr_label(gen->out, "jmp", gen->while_prefix, frame->mark, "_top");
+        emit_label(gen->out, gen->while_prefix, frame->mark, "_bottom");
+        return NULL;
+    }
+}
+
+/**
+ * Generates code to continue the innermost while loop
+ * Loops that enclose the statement are on the walk stack below it
+ */
+static void generate_null_statement(generator_t *gen)
+{
+    int while_id = 0;
+    for (size_t depth = gen->walk.depth; depth > 0 && while_id == 0; depth--)
+    {
+        walk_frame_t *frame = &gen->walk.frames[depth - 1];
+        if ((*frame->slot)->type == WHILE_STATEMENT)
+            while_id = frame->mark;
+    }
+    emit_instr_label(gen->out, "jmp", gen->while_prefix, while_id, "_top");
+}
+
+/**
+ * Generates code to print a statement
+ * Item i is started at stage 2i, and printed at stage 2i+1 once an
+ * expression is evaluated
+ *
+ * @arg frame    The frame of the print statement node to generate code for
+ */
+static node_t **generate_print_statement(generator_t *gen, walk_frame_t *frame)
+{
+    node_t *root = *frame->slot;
+    while (frame->stage < 2 * root->n_children)
+    {
+        int i = frame->stage / 2;
+        node_t *child = root->children[i];
+        if (frame->stage % 2 == 0)
+        {
+            switch (child->type)
+            {
+            case STRING_DATA:
+            {
+#if DEBUG_GENERATOR == 1
+                emit_line(gen->out, "# Loading string from data #");
+#endif
+                emit_line(gen->out, "\tlea strout(%rip), %rdi");
+                emit_instr_label(gen->out, "lea", "STR", child->data.string_index, "(%rip), %rsi");
+                break;
+            }
+            case IDENTIFIER_DATA:
+            case NUMBER_DATA:
+            case EXPRESSION:
+            {
+#if DEBUG_GENERATOR == 1
+                emitf(gen->out, "# Evaluating expression before print #\n");
+#endif
+                frame->stage += 1;
+                return &root->children[i];
+            }
+            }
+        }
+        else
+        {
+            emit_line(gen->out, "\tlea intout(%rip), %rdi");
+            emit_line(gen->out, "\tmovq %rax, %rsi");
+            gen->live = 0;
+        }
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Printing statement %d/%u #\n", i, root->n_children);
+#endif
+        emit_line(gen->out, "\tpushq %rax");
+        emit_line(gen->out, "\tmovq $0, %rax");
+        emit_line(gen->out, "\tcall printf");
+        emit_line(gen->out, "\tpopq %rax");
+        frame->stage = 2 * (i + 1);
+    }
+#if DEBUG_GENERATOR == 1
+    emit_line(gen->out, "# Newline at end of print statement #");
+#endif
+    emit_line(gen->out, "\tlea newline(%rip), %rdi");
+    emit_line(gen->out, "\tpushq %rax");
+    emit_line(gen->out, "\tmovq $0, %rax");
+    emit_line(gen->out, "\tcall printf");
+    emit_line(gen->out, "\tpopq %rax");
+    return NULL;
+}
+
+/**
+ * Generates code for the node of a frame, up to its next child
+ * Nodes that are not any type of statement or expression generate their
+ * children in order. Note that this means generate_statements is able to
+ * generate the entirety of function bodies.
+ *
+ * @arg frame    The frame of the node to generate code for
+ * @arg function The symbol table entry for the node's enclosing function
+ */
+static node_t **generate_node(generator_t *gen, walk_frame_t *frame, symbol_t *function)
+{
+    node_t *root = *frame->slot;
+    switch (root->type)
+    {
+    case DECLARATION_LIST:
+    {
+        return NULL;
+    }
+    case ASSIGNMENT_STATEMENT:
+    {
+        return generate_assignment(gen, frame, function);
+    }
+    case PRINT_STATEMENT:
+    {
+        return generate_print_statement(gen, frame);
+    }
+    case RETURN_STATEMENT:
+    {
+        if (root->n_children == 0)
+            return NULL;
+        if (frame->stage++ == 0)
+        {
+            // A tail call leaves the function itself, see generate_tail_call
+            frame->mark = (tail_callee(gen, root, function) != NULL);
+            return &root->children[0];
+        }
+        gen->live = 0;
+        if (!frame->mark)
+            generate_epilogue(gen);
+        return NULL;
+    }
+    case IF_STATEMENT:
+    {
+        return generate_if_statement(gen, frame);
+    }
+    case WHILE_STATEMENT:
+    {
+        return generate_while_statement(gen, frame);
+    }
+    case NULL_STATEMENT:
+    { // Why is continue called a NULL statement?
+        generate_null_statement(gen);
+        return NULL;
+    }
+    case RELATION:
+    {
+        return generate_comparison(gen, frame);
+    }
+    case EXPRESSION:
+    case IDENTIFIER_DATA:
+    case NUMBER_DATA:
+    {
+        return generate_expression(gen, frame, function);
+    }
+    default:
+    {
+        while (frame->stage < root->n_children)
+        {
+            node_t **child = &root->children[frame->stage++];
+            if (*child != NULL)
+                return child;
+        }
+        return NULL;
+    }
+    }
+}
+
+/**
+ * Generates code for a statement and everything in it
+ *
+ * @arg root     The slot of the node to generate statements for
+ * @arg function The symbol table entry for the statement's enclosing function
+ */
+static void generate_statements(generator_t *gen, node_t **root, symbol_t *function)
+{
+    if (*root == NULL)
+        return;
+    walk_push(&gen->walk, root);
+    while (gen->walk.depth > 0)
+    {
+        node_t **child = generate_node(gen, WALK_TOP(&gen->walk), function);
+        if (child != NULL)
+            walk_push(&gen->walk, child);
+        else
+            gen->walk.depth--;
+    }
+}
+
+/**
+ * Finds where the parameters and locals of a function are live, numbering
+ * the nodes of its body in pre-order. A variable used in a loop is live
+ * through all of the outermost loop around it, as its value may be read
+ * again in the next iteration
+ *
+ * @arg function  The function symbol to find the live intervals of
+ * @arg intervals Set to the interval of each variable, see variable_index
+ * @arg order     Set to the indices of the used variables, by start
+ * @return        The number of used variables
+ */
+static int find_live_intervals(generator_t *gen, symbol_t *function, interval_t *intervals, int *order)
+{
+    size_t nlocals = tlhash_size(function->locals);
+    int n_used = 0;
+    // Parameters hold their values from the start, locals from their first use
+    for (size_t v = 0; v < nlocals; v++)
+        intervals[v] = (interval_t){.start = (v < function->nparms) ? 0 : -1, .end = 0, .loop = -1};
+
+    // Positions where the outermost loops start and end
+    size_t loops_capacity = 16;
+    int *loops = mem_alloc(MEM_WORK, loops_capacity * 2 * sizeof(int));
+    int n_loops = 0, loop_depth = 0, position = 0;
+
+    walk_event_t event;
+    node_t **slot;
+    if (function->node != NULL)
+        walk_push(&gen->walk, &function->node);
+    while ((event = walk_next(&gen->walk, &slot)) != WALK_DONE)
+    {
+        node_t *node = *slot;
+        if (node->type == WHILE_STATEMENT)
+        {
+            if (event == WALK_ENTER && loop_depth++ == 0)
+            {
+                if (n_loops == loops_capacity)
+                {
+                    loops = mem_realloc(MEM_WORK, loops, loops_capacity * 2 * sizeof(int), loops_capacity * 4 * sizeof(int));
+                    loops_capacity *= 2;
+                }
+                loops[2 * n_loops++] = position;
+            }
+            else if (event == WALK_LEAVE && --loop_depth == 0)
+                loops[2 * n_loops - 1] = position;
+        }
+        if (event != WALK_ENTER)
+            continue;
+        position += 1;
+        if (node->type != IDENTIFIER_DATA || node->entry == NULL)
+            continue;
+        if (node->entry->type != SYM_PARAMETER && node->entry->type != SYM_LOCAL_VAR)
+            continue;
+
+        int v = variable_index(function, node->entry);
+        if (intervals[v].start < 0)
+        {
+            intervals[v].start = (loop_depth > 0) ? loops[2 * (n_loops - 1)] : position;
+            order[n_used++] = v;
+        }
+        intervals[v].end = position;
+        if (loop_depth > 0)
+            intervals[v].loop = n_loops - 1;
+    }
+
+    // The parameters that are used go before the locals, in the order of their starts
+    int n_parameters = 0;
+    for (size_t p = 0; p < function->nparms; p++)
+        n_parameters += (intervals[p].end > 0);
+    memmove(order + n_parameters, order, n_used * sizeof(int));
+    n_used += n_parameters;
+    for (size_t p = 0, u = 0; p < function->nparms; p++)
+    {
+        if (intervals[p].end > 0)
+            order[u++] = p;
+    }
+
+    for (int u = 0; u < n_used; u++)
+    {
+        interval_t *interval = &intervals[order[u]];
+        if (interval->loop >= 0)
+            interval->end = MAX(interval->end, loops[2 * interval->loop + 1]);
+    }
+    mem_free(MEM_WORK, loops, loops_capacity * 2 * sizeof(int));
+    return n_used;
+}
+
+/**
+ * Allocates the variable registers to the parameters and locals of a function
+ * by linear scan over their live intervals. When every register is taken,
+ * the variable that stays live the longest is left on the stack
+ *
+ * @arg function The function symbol to allocate registers for
+ */
+static void allocate_registers(generator_t *gen, symbol_t *function)
+{
+    size_t nlocals = tlhash_size(function->locals);
+    gen->homes = mem_alloc(MEM_WORK, nlocals * sizeof(const char *));
+    interval_t *intervals = mem_alloc(MEM_WORK, nlocals * sizeof(interval_t));
+    int *order = mem_alloc(MEM_WORK, nlocals * sizeof(int));
+    for (size_t v = 0; v < nlocals; v++)
+        gen->homes[v] = NULL;
+    int n_used = find_live_intervals(gen, function, intervals, order);
+
+    // Variables holding a register, by the end of their intervals
+    int active[N_VARIABLE_REGISTERS], n_active = 0;
+    int owner[N_VARIABLE_REGISTERS]; // The variable in each register, or -1
+    for (int r = 0; r < N_VARIABLE_REGISTERS; r++)
+        owner[r] = -1;
+    gen->n_saved = 0;
+
+    for (int u = 0; u < n_used; u++)
+    {
+        int v = order[u];
+        interval_t *interval = &intervals[v];
+
+        // Registers of variables that are no longer live become free
+        int expired = 0;
+        while (expired < n_active && intervals[active[expired]].end < interval->start)
+        {
+            for (int r = 0; r < N_VARIABLE_REGISTERS; r++)
+            {
+                if (owner[r] == active[expired])
+                    owner[r] = -1;
+            }
+            expired += 1;
+        }
+        n_active -= expired;
+        memmove(active, active + expired, n_active * sizeof(int));
+
+        int r = 0;
+        while (r < N_VARIABLE_REGISTERS && owner[r] >= 0)
+            r += 1;
+        if (r == N_VARIABLE_REGISTERS)
+        {
+            // Take the register of the active variable that ends last, if
+            // it ends after this one
+            int last = active[n_active - 1];
+            if (intervals[last].end <= interval->end)
+                continue;
+            for (r = 0; owner[r] != last; r++)
+                ;
+            gen->homes[last] = NULL;
+            n_active -= 1;
+        }
+        owner[r] = v;
+        gen->homes[v] = variable_registers[r];
+        gen->n_saved = MAX(gen->n_saved, r + 1);
+
+        int a = n_active++;
+        while (a > 0 && intervals[active[a - 1]].end > interval->end)
+        {
+            active[a] = active[a - 1];
+            a -= 1;
+        }
+        active[a] = v;
+    }
+    mem_free(MEM_WORK, order, nlocals * sizeof(int));
+    mem_free(MEM_WORK, intervals, nlocals * sizeof(interval_t));
+}
+
+/**
+ * Generates code to restore the callee-saved registers and leave the frame
+ */
+static void generate_leave(generator_t *gen)
+{
+    for (int r = 0; r < gen->n_saved; r++)
+        emit_instr_mr(gen->out, "movq", gen->save_offset + 8 * r, "%rbp", variable_registers[r]);
+    // The leave instruction restores the stack for us by setting %rsp = %rbp and popping into %rbp
+    emit_line(gen->out, "\tleave");
+}
+
+/**
+ * Generates code to restore the callee-saved registers and return
+ */
+static void generate_epilogue(generator_t *gen)
+{
+    generate_leave(gen);
+    emit_line(gen->out, "\tret");
+}
+
+/**
+ * Generates a function by lowering its SSA form, see lower.c
+ *
+ * @arg symbol The function symbol to generate code for
+ */
+static void generate_function_ssa(generator_t *gen, symbol_t *symbol)
+{
+    ssa_function_t function;
+    ssa_build(&function, symbol);
+    if (ssa_verify(&function, stderr) > 0)
+    {
+        fprintf(stderr, "Invalid SSA form of %s\n", symbol->name);
+        exit(EXIT_FAILURE);
+    }
+    ssa_generate(&function, gen->out, gen->compiler->optimize);
+    ssa_finalize(&function);
+}
+
+/**
+ * Generates a function prologue, body and exit code for a given symbol
+ * 
+ * @arg symbol The function symbol to generate code for
+ */
+static void generate_function(generator_t *gen, symbol_t *symbol)
+{
+    if (gen->compiler->via_ir)
+    {
+        generate_function_ssa(gen, symbol);
+        return;
+    }
+
+    // Labels are numbered from the start of every function
+    gen->if_id = gen->while_id = 0;
+    snprintf(gen->if_prefix, sizeof(gen->if_prefix), "__vslif_%zu_", symbol->seq);
+    snprintf(gen->while_prefix, sizeof(gen->while_prefix), "__vslwhile_%zu_", symbol->seq);
+
+    emit_string(gen->out, ".globl __vslc_");
+    emit_line(gen->out, symbol->name);
+    emit_line(gen->out, ".text");
+    emit_string(gen->out, "__vslc_");
+    emit_string(gen->out, symbol->name);
+    emit_line(gen->out, ":");
+
+    // Push the basepointer so we can use the stack dynamically.
+    // The stack pointer is stored in the base pointer from the mov-instruction above, so this practically stores the old stack frame
+    emit_line(gen->out, "\tpushq %rbp");
+    // Move the current stack pointer into the base pointer register before we allocate space on the stack
+    emit_line(gen->out, "\tmovq %rsp, %rbp");
+
+    size_t nlocals = tlhash_size(symbol->locals);
+
+    // Allocate the function's stack frame and align the stack pointer to a 16-byte boundary
+    // The function call pushes the return address (8 bytes), and we need 8 bytes for each local variable
+    // So the SP needs to be aligned by allocating 8 more bytes if nlocals is an even number
+    // The parameters come first, at the bottom of the frame, each at -(argn+1)*8(%rbp)
+    size_t stack_frame_size = (nlocals % 2 == 1) ? nlocals * 8 : nlocals * 8 + 8;
+    stack_frame_size += symbol->nparms * 8;
+
+#if DEBUG_GENERATOR == 1
+    emitf(gen->out, "# Allocate %lu bytes on the stack for %lu locals (aligned: %s) #\n",
+        stack_frame_size,
+        nlocals,
+        (nlocals % 2 == 1) ? "no" : "yes"
+    );
+#endif
+    // The callee-saved registers that variables are allocated to are saved
+    // below the variables, in a space that keeps the stack aligned the same way
+    walk_init(&gen->walk, NULL);
+    allocate_registers(gen, symbol);
+    gen->save_offset = -(int)(stack_frame_size + ALIGN_BYTES(gen->n_saved * 8));
+    stack_frame_size += ALIGN_BYTES(gen->n_saved * 8);
+    emit_instr_ir(gen->out, "subq", stack_frame_size, "%rsp");
+    for (int r = 0; r < gen->n_saved; r++)
+        emit_instr_rm(gen->out, "movq", variable_registers[r], gen->save_offset + 8 * r, "%rbp");
+    // Parameters are moved into the registers allocated to them, and only
+    // the others are stored in their slots
+    for (int argn = 0; argn < symbol->nparms; argn++)
+    {
+        // Arguments after the sixth are above the return address and %rbp
+        int caller_offset = 16 + (argn - N_PARAM_REGISTERS) * 8;
+        if (gen->homes[argn] != NULL)
+        {
+#if DEBUG_GENERATOR == 1
+            emitf(gen->out, "# Parameter %d is kept in %s #\n", argn, gen->homes[argn]);
+#endif
+            if (argn < N_PARAM_REGISTERS)
+                emit_instr_rr(gen->out, "movq", record[argn], gen->homes[argn]);
+            else
+                emit_instr_mr(gen->out, "movq", caller_offset, "%rbp", gen->homes[argn]);
+            continue;
+        }
+#if DEBUG_GENERATOR == 1
+        emitf(gen->out, "# Store argument %d in the stack frame #\n", argn);
+#endif
+        if (argn < N_PARAM_REGISTERS)
+            emit_instr_rm(gen->out, "movq", record[argn], -(argn + 1) * 8, "%rbp");
+        else
+        {
+            // %rax holds no argument, and the argument registers stay intact
+            emit_instr_mr(gen->out, "movq", caller_offset, "%rbp", "%rax");
+            emit_instr_rm(gen->out, "movq", "%rax", -(argn + 1) * 8, "%rbp");
+        }
+    }
+
+#if DEBUG_GENERATOR == 1
+    emitf(gen->out, "# Function body (%s) #\n", symbol->name);
+#endif
+    // Generate the meat & potatoes of the function
+    label_expressions(gen, &symbol->node, symbol);
+    if (gen->tail_loop)
+        emit_label(gen->out, "__vsltail_", symbol->seq, "");
+    gen->live = 0;
+    generate_statements(gen, &symbol->node, symbol);
+    walk_finalize(&gen->walk);
+
+    generate_epilogue(gen);
+    mem_free(MEM_WORK, gen->homes, nlocals * sizeof(const char *));
+    gen->homes = NULL;
+}
+
+/**
+ * Builds the cache key of a function from everything its code depends on:
+ * the generator, the function's place and frame, its simplified tree, and
+ * the symbols and strings the tree refers to
+ *
+ * @arg symbol The function symbol to build the key of
+ * @arg key    The key, which is appended to
+ */
+static void function_key(generator_t *gen, symbol_t *symbol, cache_key_t *key)
+{
+    cache_key_string(key, gen->compiler->build);
+    cache_key_int(key, DEBUG_GENERATOR);
+    cache_key_int(key, gen->compiler->via_ir);
+    cache_key_int(key, gen->compiler->optimize);
+    cache_key_string(key, symbol->name);
+    cache_key_int(key, symbol->seq);
+    cache_key_int(key, symbol->nparms);
+    cache_key_int(key, tlhash_size(symbol->locals));
+
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    walk_init(&walk, &symbol->node);
+    while ((event = walk_next(&walk, &slot)) != WALK_DONE)
+    {
+        node_t *node = *slot;
+        if (event != WALK_ENTER)
+            continue;
+        uint8_t shape[2] = {node->type, node->op};
+        cache_key_bytes(key, shape, sizeof(shape));
+        // Which children are there, so the walk order is unambiguous
+        cache_key_int(key, node->n_children);
+        for (uint32_t c = 0; c < node->n_children; c++)
+        {
+            uint8_t present = (node->children[c] != NULL);
+            cache_key_bytes(key, &present, 1);
+        }
+        switch (node->type)
+        {
+        case NUMBER_DATA:
+            cache_key_int(key, node->data.number);
+            break;
+        case STRING_DATA:
+            cache_key_int(key, node->data.string_index);
+            break;
+        case IDENTIFIER_DATA:
+            cache_key_string(key, node->data.name);
+            break;
+        }
+        if (node->entry != NULL)
+        {
+            cache_key_string(key, node->entry->name);
+            cache_key_int(key, node->entry->type);
+            cache_key_int(key, node->entry->seq);
+            cache_key_int(key, node->entry->nparms);
+        }
+    }
+    walk_finalize(&walk);
+}
+
+/**
+ * Tells the peephole rules how many arguments a call passes, so that the
+ * argument registers a function does not take are free before calls to it
+ *
+ * @arg context The compiler whose functions are called
+ * @arg name    The called label, a function is named __vslc_<name>
+ * @arg length  The length of the label
+ * @return      The parameters of the function, or -1 for other labels
+ */
+static int call_arguments(void *context, const char *name, size_t length)
+{
+    compiler_t *compiler = context;
+    const size_t prefix = sizeof("__vslc_") - 1;
+    symbol_t *symbol;
+    if (length <= prefix || memcmp(name, "__vslc_", prefix) != 0)
+        return -1;
+    if (tlhash_lookup(compiler->global_names, (void *)(name + prefix), length - prefix, (void **)&symbol) != TLHASH_SUCCESS
+        || symbol->type != SYM_FUNCTION)
+        return -1;
+    return (int)symbol->nparms;
+}
+
+/**
+ * Generates a function, or takes its code from the cache if the function
+ * was generated before; newly generated code is passed through the peephole
+ * rules when optimizing, and then stored in the cache
+ *
+ * @arg symbol The function symbol to generate code for
+ * @return     Whether the code was found in the cache
+ */
+static bool generate_cached_function(generator_t *gen, symbol_t *symbol)
+{
+    const char *directory = gen->compiler->cache_directory;
+    cache_key_t key;
+    bool hit = false;
+    if (directory != NULL)
+    {
+        cache_key_init(&key);
+        function_key(gen, symbol, &key);
+        hit = (cache_load(directory, &key, gen->out) == CACHE_SUCCESS);
+    }
+    if (!hit)
+    {
+        size_t start = gen->out->size;
+        generate_function(gen, symbol);
+        if (gen->compiler->optimize)
+            peephole_optimize(gen->out, start, call_arguments, gen->compiler, gen->peephole_hits);
+        // A cache that can not be written only costs the next compilation
+        if (directory != NULL)
+            cache_store(directory, &key, gen->out->text + start, gen->out->size - start);
+    }
+    if (directory != NULL)
+        cache_key_finalize(&key);
+    return hit;
+}
+
+// The functions of a program, generated in parallel into outputs of their own
+typedef struct
+{
+    compiler_t *compiler;
+    symbol_t **functions;
+    emitter_t *outputs;
+    bool *cached;
+    size_t (*peephole_hits)[PEEPHOLE_N_RULES];
+    mem_profile_t *profile;
+} function_tasks_t;
+
+/**
+ * Generates one function into its own output, as a task of pool_run
+ *
+ * @arg context The function_tasks_t of the program
+ * @arg index   The position of the function in the program
+ */
+static void generate_function_task(void *context, size_t index)
+{
+    function_tasks_t *tasks = context;
+    emitter_t *output = &tasks->outputs[index];
+    mem_profile_attach(tasks->profile);
+    if (emitter_init(output, FUNCTION_CAPACITY) != EMITTER_SUCCESS)
+    {
+        fprintf(stderr, "Out of memory for generated assembly\n");
+        exit(EXIT_FAILURE);
+    }
+    generator_t gen = {.compiler = tasks->compiler, .out = output};
+    tasks->cached[index] = generate_cached_function(&gen, tasks->functions[index]);
+    memcpy(tasks->peephole_hits[index], gen.peephole_hits, sizeof(gen.peephole_hits));
+}
+
+/**
+ * Generates all functions in the program that can be called
+ * With more than one job, every function is generated into an output of its own
+ * on a pool of threads, and the outputs are joined in the order of the functions
+ */
+static void generate_functions(generator_t *gen)
+{
+    compiler_t *compiler = gen->compiler;
+    size_t n_functions = 0;
+    symbol_t **functions = malloc(tlhash_size(compiler->global_names) * sizeof(symbol_t *));
+    symbol_t *curr_sym;
+    tlhash_cursor_t cursor = TLHASH_CURSOR_INIT;
+    while (tlhash_next(compiler->global_names, &cursor, NULL, NULL, (void **)&curr_sym) == TLHASH_SUCCESS)
+    {
+        if (curr_sym->type == SYM_FUNCTION && !curr_sym->unused)
+            functions[n_functions++] = curr_sym;
+    }
+
+    emitter_t *outputs = NULL;
+    bool *cached = calloc(n_functions, sizeof(bool));
+    size_t (*peephole_hits)[PEEPHOLE_N_RULES] = NULL;
+    if (compiler->n_jobs > 1 && n_functions > 1)
+    {
+        outputs = malloc(n_functions * sizeof(emitter_t));
+        peephole_hits = calloc(n_functions, sizeof(*peephole_hits));
+        function_tasks_t tasks = {
+            .compiler = compiler,
+            .functions = functions,
+            .outputs = outputs,
+            .cached = cached,
+            .peephole_hits = peephole_hits,
+            .profile = mem_profile_current()};
+        pool_run(n_functions, compiler->n_jobs, generate_function_task, &tasks);
+    }
+
+    size_t n_cached = 0;
+    for (size_t f = 0; f < n_functions; f++)
+    {
+        if (functions[f]->seq == 0)
+        {
+            generate_main(gen, functions[f]);
+            emit_line(gen->out, "");
+        }
+        if (outputs != NULL)
+        {
+            emit_text(gen->out, outputs[f].text, outputs[f].size);
+            emitter_finalize(&outputs[f]);
+            for (int r = 0; r < PEEPHOLE_N_RULES; r++)
+                gen->peephole_hits[r] += peephole_hits[f][r];
+        }
+        else
+            cached[f] = generate_cached_function(gen, functions[f]);
+        n_cached += cached[f];
+    }
+    if (compiler->stats != NULL && compiler->cache_directory != NULL)
+    {
+        compiler->stats->cache_hits += n_cached;
+        compiler->stats->cache_misses += n_functions - n_cached;
+    }
+    if (compiler->stats != NULL)
+    {
+        for (int r = 0; r < PEEPHOLE_N_RULES; r++)
+            compiler->stats->peephole_hits[r] += gen->peephole_hits[r];
+    }
+    free(peephole_hits);
+    free(cached);
+    free(outputs);
+    free(functions);
+}
+
+/**
+ * Generates code for the entire program
+ *
+ * @arg compiler The compilation to generate code for, after binding names
+ * @arg output   The emitter that receives the generated assembly
+ */
+void generate_program(compiler_t *compiler, emitter_t *output)
+{
+    generator_t gen = {.compiler = compiler, .out = output};
+    generate_stringtable(&gen);
+    generate_global_vars(&gen);
+    generate_functions(&gen);
+}
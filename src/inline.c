@@ -0,0 +1,806 @@
+#include <vslc.h>
+
+/* Inlining of calls into the bound tree, before it is optimized, so that
+ * the constants a call passes are propagated through the body it is
+ * replaced by. Functions are visited callees first, by the strongly
+ * connected components of the call graph, so the bodies that are copied
+ * have their own calls inlined already. A function that calls itself,
+ * directly or through others, is never inlined.
+ *
+ * A call is replaced in one of two ways:
+ *  - A function whose body only returns an expression is replaced by the
+ *    expression, with the arguments in place of the parameters, wherever
+ *    the call is. The arguments must be as good evaluated where the
+ *    parameters are used as before the call, which the effects of the
+ *    arguments, gathered on the way up the tree, tell.
+ *  - A function that returns on every path is replaced by its body where
+ *    the call is the value of an assignment or return statement. The
+ *    arguments are assigned to new locals of the caller, the locals of the
+ *    body are renamed to new locals as well, and for an assignment the
+ *    returns become assignments of the target. That needs every return to
+ *    be the last thing its path does, which an if statement whose then
+ *    branch returns can be made to be by taking the rest of its list as
+ *    its else branch.
+ *
+ * The cost of a call is the number of nodes it adds, less what the call
+ * itself costs, and less again for constant arguments. A call is inlined
+ * if the cost is within the budget, and if the caller has not grown past
+ * twice its size already. The only call of a function costs nothing, as
+ * the function is left out once it is not called.
+ */
+
+/* What a call costs beyond the function it calls, in nodes: the prologue
+ * and epilogue, and moving each argument into place. A constant argument
+ * may let the body fold away.
+ */
+#define CALL_COST 8
+#define ARGUMENT_COST 2
+#define CONSTANT_BONUS 4
+#define TEMPORARY_COST 2
+
+/* A caller may grow by its own size, and by this many nodes besides */
+#define INLINE_SLACK 64
+
+/* Shapes of statements, see shape_statement */
+#define RETURNS 1u          /* Every path through it returns */
+#define HAS_RETURN 2u       /* Some path through it returns */
+#define TAIL 4u             /* Its paths return only as the last thing */
+#define THEN_RETURNS 8u     /* An if without else whose then branch returns */
+
+/* Effects of evaluating an expression */
+#define IMPURE 1u           /* It calls or divides, so it must be evaluated */
+#define READS_GLOBALS 2u
+
+typedef struct {
+    uint32_t uses;          /* In the returned expression */
+    bool assigned;          /* Anywhere in the body */
+} parameter_t;
+
+/* What a function looks like to its callers */
+typedef struct {
+    uint32_t size;          /* Nodes in the body */
+    uint32_t shape;         /* Of the body */
+    uint32_t calls;         /* Call sites in the program */
+    bool recursive;
+    node_t *value;          /* The expression the body only returns, or NULL */
+    uint32_t value_size;
+    bool value_calls;       /* Whether the expression calls anything */
+    uint32_t value_effects;
+    parameter_t *parameters;
+} callee_t;
+
+/* A call being inlined, and what the variables of the function called
+ * become in the caller
+ */
+typedef struct {
+    symbol_t *caller, *callee;
+    node_t **arguments;     /* What each parameter is replaced by, or NULL */
+    symbol_t **renamed;     /* Locals of the caller, made on first use */
+} site_t;
+
+typedef struct {
+    compiler_t *compiler;
+    symbol_t **functions;   /* By sequence number */
+    callee_t *callees;
+    uint32_t n_functions;
+    int64_t budget;
+    int64_t room;           /* Nodes the caller may still grow by */
+    size_t inlined;
+    node_t **copies;        /* Copies of the nodes on a walk, see copy_tree */
+    uint32_t copies_capacity;
+} inliner_t;
+
+
+static bool
+is_call ( node_t *node )
+{
+    return node->type == EXPRESSION && node->op == OP_NONE
+        && node->n_children == 2 && node->children[0]->entry != NULL
+        && node->children[0]->entry->type == SYM_FUNCTION;
+}
+
+
+static uint32_t
+n_arguments ( node_t *call )
+{
+    return (call->children[1] != NULL) ? call->children[1]->n_children : 0;
+}
+
+
+/**************
+ * Trees      *
+ **************/
+
+
+/* A node like another, without its children */
+static node_t *
+duplicate_node ( inliner_t *in, node_t *node )
+{
+    node_t *duplicate = node_alloc ( in->compiler, node->n_children );
+    node_t **children = duplicate->children;
+    *duplicate = *node;
+    duplicate->children = children;
+    for ( uint32_t c = 0; c < node->n_children; c++ )
+        children[c] = NULL;
+    return duplicate;
+}
+
+
+/* A copy of a tree from the body of the function called at a site, in
+ * terms of the caller. Arguments that are leaves are copied for every use
+ * of their parameter, others are moved, and so must be used once.
+ * Declarations are left out, as the names are bound already.
+ */
+static node_t *
+copy_tree ( inliner_t *in, site_t *site, node_t *root )
+{
+    node_t *copy = NULL;
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    walk_init ( &walk, &root );
+    while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+    {
+        if ( event != WALK_ENTER )
+            continue;
+        node_t *node = *slot;
+        uint32_t depth = walk.depth - 1;
+        node_t **target = (depth == 0) ? &copy : &in->copies[depth - 1]
+            ->children[walk.frames[depth - 1].stage - 2];
+        int64_t var = variable_index ( site->callee, node->entry );
+        node_t **argument = (var >= 0 && site->arguments != NULL
+            && var < site->callee->nparms) ? &site->arguments[var] : NULL;
+        if ( node->type == DECLARATION_LIST )
+        {
+            walk_skip ( &walk );
+            continue;
+        }
+        if ( argument != NULL && *argument != NULL )
+        {
+            if ( (*argument)->n_children == 0 )
+                *target = duplicate_node ( in, *argument );
+            else
+            {
+                *target = *argument;
+                *argument = NULL;
+            }
+            walk_skip ( &walk );
+            continue;
+        }
+
+        node_t *duplicate = duplicate_node ( in, node );
+        if ( var >= 0 )
+        {
+            if ( site->renamed[var] == NULL )
+                site->renamed[var] = new_local ( site->caller, node->entry->name );
+            duplicate->entry = site->renamed[var];
+        }
+        *target = duplicate;
+        in->copies = grow_array ( in->copies, depth, &in->copies_capacity,
+            sizeof(node_t *) );
+        in->copies[depth] = duplicate;
+    }
+    walk_finalize ( &walk );
+    return copy;
+}
+
+
+static void
+free_tree ( inliner_t *in, node_t *root )
+{
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    walk_init ( &walk, &root );
+    while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+        if ( event == WALK_LEAVE )
+            node_finalize ( in->compiler, *slot );
+    walk_finalize ( &walk );
+}
+
+
+/* The effects of a node of an expression, apart from its children */
+static uint32_t
+effects ( node_t *node )
+{
+    if ( node->type == EXPRESSION && (node->op == OP_DIV
+            || (node->op == OP_NONE && node->n_children == 2)) )
+        return IMPURE;
+    if ( node->entry != NULL && node->entry->type == SYM_GLOBAL_VAR )
+        return READS_GLOBALS;
+    return 0;
+}
+
+
+/**************
+ * Shapes     *
+ **************/
+
+
+/* An if statement without else whose then branch returns, followed by
+ * statements from 'first' on in its list, takes them as its else branch
+ */
+static node_t *
+add_else ( inliner_t *in, node_t *list, uint32_t first )
+{
+    compiler_t *compiler = in->compiler;
+    node_t *statement = list->children[first - 1];
+    node_t *rest = node_alloc ( compiler, 0 );
+    node_init ( rest, STATEMENT_LIST, OP_NONE, 0 );
+    for ( uint32_t s = first; s < list->n_children; s++ )
+        node_append ( compiler, rest, list->children[s] );
+    node_t *branch = node_alloc ( compiler, 3 );
+    node_init ( branch, IF_STATEMENT, OP_NONE, 3,
+        statement->children[0], statement->children[1], rest
+    );
+    node_finalize ( compiler, statement );
+    return branch;
+}
+
+
+/* A list returns if any statement in it does, and only as the last thing
+ * if the statements before the last return only as the last thing, or
+ * not at all, or only from a then branch that can take the rest as its
+ * else branch. The statements after one that always returns are never
+ * run, and with 'restructure' they are left out.
+ */
+static node_t **
+shape_list ( inliner_t *in, walk_frame_t *frame, uint32_t stage,
+    uint32_t *shape, bool restructure )
+{
+    node_t *node = *frame->slot;
+    if ( stage == 0 )
+        frame->mark = TAIL;
+    else
+    {
+        uint32_t statement = *shape;
+        bool last = stage >= node->n_children;
+        frame->mark |= statement & (RETURNS | HAS_RETURN);
+        bool ends = last || (statement & (RETURNS | THEN_RETURNS));
+        if ( ends ? !(statement & TAIL) : (statement & HAS_RETURN) )
+            frame->mark &= ~TAIL;
+        if ( !last && (statement & RETURNS) )
+        {
+            if ( restructure )
+            {
+                for ( uint32_t s = stage; s < node->n_children; s++ )
+                    free_tree ( in, node->children[s] );
+                node->n_children = stage;
+            }
+            *shape = frame->mark;
+            return NULL;
+        }
+        if ( !last && (statement & THEN_RETURNS) && restructure )
+        {
+            node->children[stage - 1] = add_else ( in, node, stage );
+            node->n_children = stage;
+            return &node->children[stage - 1]->children[2];
+        }
+    }
+    while ( stage < node->n_children && node->children[stage] == NULL )
+        stage += 1;
+    if ( stage < node->n_children )
+    {
+        frame->stage = stage + 1;
+        return &node->children[stage];
+    }
+    *shape = frame->mark;
+    return NULL;
+}
+
+
+static node_t **
+shape_node ( inliner_t *in, walk_frame_t *frame, uint32_t *shape,
+    bool restructure )
+{
+    node_t *node = *frame->slot;
+    uint32_t stage = frame->stage++;
+    switch ( node->type )
+    {
+        case RETURN_STATEMENT:
+            *shape = RETURNS | HAS_RETURN | TAIL;
+            return NULL;
+        case IF_STATEMENT:
+            if ( stage == 0 )
+                return &node->children[1];
+            if ( stage == 1 && node->n_children > 2 )
+            {
+                frame->mark = *shape;
+                return &node->children[2];
+            }
+            if ( stage == 1 )
+                *shape = (*shape & (HAS_RETURN | TAIL))
+                    | ((*shape & RETURNS) ? THEN_RETURNS : 0);
+            else
+                *shape = (frame->mark & *shape & (RETURNS | TAIL))
+                    | ((frame->mark | *shape) & HAS_RETURN);
+            return NULL;
+        case WHILE_STATEMENT:
+            /* A loop may run again after a path through it */
+            if ( stage == 0 )
+                return &node->children[1];
+            *shape = (*shape & HAS_RETURN) ? HAS_RETURN : TAIL;
+            return NULL;
+        case BLOCK:
+        case STATEMENT_LIST:
+            return shape_list ( in, frame, stage, shape, restructure );
+        default:
+            *shape = TAIL;
+            return NULL;
+    }
+}
+
+
+/* How a statement returns, as RETURNS, HAS_RETURN, TAIL and THEN_RETURNS.
+ * With 'restructure', the statement is changed so that its returns are
+ * all the last thing their paths do, if they can be.
+ */
+static uint32_t
+shape_statement ( inliner_t *in, node_t **root, bool restructure )
+{
+    uint32_t shape = TAIL;
+    walk_t walk;
+    walk_init ( &walk, root );
+    while ( walk.depth > 0 )
+    {
+        node_t **child = shape_node (
+            in, WALK_TOP ( &walk ), &shape, restructure
+        );
+        if ( child != NULL )
+            walk_push ( &walk, child );
+        else
+            walk.depth -= 1;
+    }
+    walk_finalize ( &walk );
+    return shape;
+}
+
+
+/* Turn the returns of a statement, which are the last thing their paths
+ * do, into assignments of their values to a copy of 'target'
+ */
+static void
+to_assignments ( inliner_t *in, node_t **root, node_t *target )
+{
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    walk_init ( &walk, root );
+    while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+    {
+        node_t *node = *slot;
+        if ( event != WALK_ENTER || node->type != RETURN_STATEMENT )
+            continue;
+        node_t *assignment = node_alloc ( in->compiler, 2 );
+        node_init ( assignment, ASSIGNMENT_STATEMENT, OP_NONE, 2,
+            duplicate_node ( in, target ), node->children[0]
+        );
+        node_finalize ( in->compiler, node );
+        *slot = assignment;
+        walk_skip ( &walk );
+    }
+    walk_finalize ( &walk );
+}
+
+
+/**************
+ * Callees    *
+ **************/
+
+
+/* The expression a body does nothing but return, or NULL */
+static node_t *
+returned_value ( node_t *node )
+{
+    while ( node != NULL )
+    {
+        if ( node->type == BLOCK )
+            node = node->children[node->n_children - 1];
+        else if ( node->type == STATEMENT_LIST && node->n_children == 1 )
+            node = node->children[0];
+        else if ( node->type == RETURN_STATEMENT )
+            return node->children[0];
+        else
+            return NULL;
+    }
+    return NULL;
+}
+
+
+/* Find what a function looks like to its callers, once the calls in it
+ * are inlined
+ */
+static void
+describe_callee ( inliner_t *in, symbol_t *function )
+{
+    callee_t *callee = &in->callees[function->seq];
+    callee->size = node_count ( function->node );
+    callee->shape = shape_statement ( in, &function->node, false );
+    callee->value = returned_value ( function->node );
+    callee->parameters = mem_calloc (
+        MEM_WORK, function->nparms + 1, sizeof(parameter_t)
+    );
+
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    walk_init ( &walk, &function->node );
+    while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+    {
+        node_t *node = *slot;
+        if ( event == WALK_ENTER && node->type == ASSIGNMENT_STATEMENT
+            && node->children[0]->entry->type == SYM_PARAMETER )
+            callee->parameters[node->children[0]->entry->seq].assigned = true;
+    }
+
+    /* An expression that reads locals reads them before they are set */
+    if ( callee->value != NULL )
+        walk_push ( &walk, &callee->value );
+    while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+    {
+        node_t *node = *slot;
+        if ( event != WALK_ENTER )
+            continue;
+        callee->value_size += 1;
+        callee->value_effects |= effects ( node );
+        if ( is_call ( node ) )
+            callee->value_calls = true;
+        else if ( node->entry != NULL && node->entry->type == SYM_LOCAL_VAR )
+            callee->value = NULL;
+        else if ( node->entry != NULL && node->entry->type == SYM_PARAMETER )
+            callee->parameters[node->entry->seq].uses += 1;
+    }
+    walk_finalize ( &walk );
+}
+
+
+/* The functions that call each other in a cycle are found by Tarjan's
+ * algorithm, on a stack of its own. The components come out callees
+ * first, which is the order the functions are inlined into.
+ */
+static void
+find_order (
+    inliner_t *in, uint32_t *first, uint32_t *targets, uint32_t *order
+)
+{
+    uint32_t n = in->n_functions, counter = 0, n_order = 0;
+    uint32_t *index = mem_alloc ( MEM_WORK, (n + 1) * sizeof(uint32_t) );
+    uint32_t *low = mem_alloc ( MEM_WORK, (n + 1) * sizeof(uint32_t) );
+    uint32_t *stack = mem_alloc ( MEM_WORK, (n + 1) * sizeof(uint32_t) );
+    uint32_t *path = mem_alloc ( MEM_WORK, (n + 1) * sizeof(uint32_t) );
+    uint32_t *next = mem_alloc ( MEM_WORK, (n + 1) * sizeof(uint32_t) );
+    bool *on_stack = mem_calloc ( MEM_WORK, n + 1, sizeof(bool) );
+    uint32_t n_stack = 0, n_path = 0;
+    for ( uint32_t f = 0; f < n; f++ )
+        index[f] = UINT32_MAX;
+
+    for ( uint32_t root = 0; root < n; root++ )
+    {
+        if ( index[root] != UINT32_MAX )
+            continue;
+        path[n_path] = root;
+        next[n_path++] = first[root];
+        index[root] = low[root] = counter++;
+        stack[n_stack++] = root;
+        on_stack[root] = true;
+        while ( n_path > 0 )
+        {
+            uint32_t v = path[n_path - 1];
+            if ( next[n_path - 1] < first[v + 1] )
+            {
+                uint32_t w = targets[next[n_path - 1]++];
+                if ( w == v )
+                    in->callees[v].recursive = true;
+                if ( index[w] == UINT32_MAX )
+                {
+                    path[n_path] = w;
+                    next[n_path++] = first[w];
+                    index[w] = low[w] = counter++;
+                    stack[n_stack++] = w;
+                    on_stack[w] = true;
+                }
+                else if ( on_stack[w] && index[w] < low[v] )
+                    low[v] = index[w];
+                continue;
+            }
+            n_path -= 1;
+            if ( n_path > 0 && low[v] < low[path[n_path - 1]] )
+                low[path[n_path - 1]] = low[v];
+            if ( low[v] != index[v] )
+                continue;
+            uint32_t component = n_order, w;
+            do
+            {
+                w = stack[--n_stack];
+                on_stack[w] = false;
+                order[n_order++] = w;
+            } while ( w != v );
+            if ( n_order - component > 1 )
+                for ( uint32_t c = component; c < n_order; c++ )
+                    in->callees[order[c]].recursive = true;
+        }
+    }
+    mem_free ( MEM_WORK, index, (n + 1) * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, low, (n + 1) * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, stack, (n + 1) * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, path, (n + 1) * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, next, (n + 1) * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, on_stack, (n + 1) * sizeof(bool) );
+}
+
+
+/* Count the calls of every function, and put the functions in the order
+ * they are inlined into
+ */
+static void
+build_call_graph ( inliner_t *in, uint32_t *order )
+{
+    uint32_t n = in->n_functions;
+    struct { uint32_t from, to; } *edges = NULL;
+    uint32_t n_edges = 0, edges_capacity = 0;
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    walk_init ( &walk, NULL );
+    for ( uint32_t f = 0; f < n; f++ )
+    {
+        if ( in->functions[f]->node != NULL )
+            walk_push ( &walk, &in->functions[f]->node );
+        while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+        {
+            if ( event != WALK_ENTER || !is_call ( *slot ) )
+                continue;
+            uint32_t callee = (*slot)->children[0]->entry->seq;
+            in->callees[callee].calls += 1;
+            edges = grow_array ( edges, n_edges, &edges_capacity, sizeof(*edges) );
+            edges[n_edges].from = f;
+            edges[n_edges++].to = callee;
+        }
+    }
+    walk_finalize ( &walk );
+
+    /* The callees of function f are targets[first[f]] to targets[first[f+1]] */
+    uint32_t *first = mem_calloc ( MEM_WORK, n + 2, sizeof(uint32_t) );
+    uint32_t *targets = mem_alloc ( MEM_WORK, (n_edges + 1) * sizeof(uint32_t) );
+    for ( uint32_t e = 0; e < n_edges; e++ )
+        first[edges[e].from + 2] += 1;
+    for ( uint32_t f = 0; f < n; f++ )
+        first[f + 2] += first[f + 1];
+    for ( uint32_t e = 0; e < n_edges; e++ )
+        targets[first[edges[e].from + 1]++] = edges[e].to;
+    mem_free ( MEM_WORK, edges, edges_capacity * sizeof(*edges) );
+
+    find_order ( in, first, targets, order );
+    mem_free ( MEM_WORK, first, (n + 2) * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, targets, (n_edges + 1) * sizeof(uint32_t) );
+}
+
+
+/**************
+ * Call sites *
+ **************/
+
+
+/* Whether a call may be inlined at all, and pays off if it adds 'size'
+ * nodes to the caller
+ */
+static bool
+worth_inlining (
+    inliner_t *in, symbol_t *caller, node_t *call, int64_t size
+)
+{
+    symbol_t *function = call->children[0]->entry;
+    callee_t *callee = &in->callees[function->seq];
+    uint32_t n = n_arguments ( call );
+    if ( function == caller || callee->recursive || function->node == NULL
+        || n != function->nparms || size > in->room )
+        return false;
+    int64_t benefit = CALL_COST + ARGUMENT_COST * n;
+    for ( uint32_t a = 0; a < n; a++ )
+        if ( call->children[1]->children[a]->type == NUMBER_DATA )
+            benefit += CONSTANT_BONUS;
+    if ( callee->calls == 1 && function->seq != 0 )
+        benefit += callee->size;
+    return size - benefit <= in->budget;
+}
+
+
+/* Replace a call of a function that only returns an expression by the
+ * expression, and give the effects of what the call is replaced by. The
+ * arguments are evaluated where the parameters are used, so those that
+ * are not leaves must be used once, and none may have effects, or read a
+ * global that a call in the expression may assign.
+ */
+static uint32_t
+inline_expression (
+    inliner_t *in, symbol_t *caller, node_t **slot, uint32_t arguments_effects
+)
+{
+    node_t *call = *slot;
+    symbol_t *function = call->children[0]->entry;
+    callee_t *callee = &in->callees[function->seq];
+    uint32_t unchanged = arguments_effects | IMPURE;
+    if ( callee->value == NULL || (arguments_effects & IMPURE)
+        || (callee->value_calls && (arguments_effects & READS_GLOBALS))
+        || !worth_inlining ( in, caller, call, callee->value_size ) )
+        return unchanged;
+    node_t **arguments = (call->children[1] != NULL) ?
+        call->children[1]->children : NULL;
+    for ( uint32_t p = 0; p < function->nparms; p++ )
+        if ( arguments[p]->n_children > 0 && callee->parameters[p].uses > 1 )
+            return unchanged;
+
+    site_t site = {
+        .caller = caller, .callee = function, .arguments = arguments
+    };
+    node_t *value = copy_tree ( in, &site, callee->value );
+    free_tree ( in, call );
+    *slot = value;
+    in->room -= callee->value_size;
+    in->inlined += 1;
+    return arguments_effects | callee->value_effects;
+}
+
+
+/* Replace an assignment or return statement whose value is a call by the
+ * body of the function, after assignments of the arguments to its
+ * parameters. Arguments are evaluated from the last to the first, as they
+ * are for a call.
+ */
+static void
+inline_statement ( inliner_t *in, symbol_t *caller, node_t **slot )
+{
+    node_t *statement = *slot;
+    bool assigns = statement->type == ASSIGNMENT_STATEMENT;
+    node_t *call = statement->children[assigns ? 1 : 0];
+    symbol_t *function = call->children[0]->entry;
+    callee_t *callee = &in->callees[function->seq];
+    uint32_t wanted = assigns ? (RETURNS | TAIL) : RETURNS;
+    uint32_t n = function->nparms;
+    if ( (callee->shape & wanted) != wanted || !worth_inlining (
+            in, caller, call, callee->size + TEMPORARY_COST * (int64_t) n ) )
+        return;
+
+    compiler_t *compiler = in->compiler;
+    size_t n_variables = tlhash_size ( function->locals );
+    site_t site = {
+        .caller = caller, .callee = function,
+        .arguments = mem_calloc ( MEM_WORK, n + 1, sizeof(node_t *) ),
+        .renamed = mem_calloc ( MEM_WORK, n_variables + 1, sizeof(symbol_t *) )
+    };
+    symbol_t **parameters = mem_alloc ( MEM_WORK, (n + 1) * sizeof(symbol_t *) );
+    symbol_t *symbol;
+    tlhash_cursor_t cursor = TLHASH_CURSOR_INIT;
+    while ( tlhash_next (
+        function->locals, &cursor, NULL, NULL, (void **)&symbol
+    ) == TLHASH_SUCCESS )
+        if ( symbol->type == SYM_PARAMETER )
+            parameters[symbol->seq] = symbol;
+
+    /* Constants and variables of the caller stand in for parameters that
+     * are never assigned, the other arguments go to new locals
+     */
+    node_t *list = node_alloc ( compiler, 0 );
+    node_init ( list, STATEMENT_LIST, OP_NONE, 0 );
+    node_t **arguments = (n > 0) ? call->children[1]->children : NULL;
+    for ( uint32_t p = n; p-- > 0; )
+    {
+        node_t *argument = arguments[p];
+        if ( !callee->parameters[p].assigned
+            && (argument->type == NUMBER_DATA
+                || variable_index ( caller, argument->entry ) >= 0) )
+        {
+            site.arguments[p] = argument;
+            continue;
+        }
+        site.renamed[p] = new_local ( caller, parameters[p]->name );
+        node_t *name = node_alloc ( compiler, 0 );
+        node_init ( name, IDENTIFIER_DATA, OP_NONE, 0 );
+        name->data.name = parameters[p]->name;
+        name->entry = site.renamed[p];
+        node_t *assignment = node_alloc ( compiler, 2 );
+        node_init ( assignment, ASSIGNMENT_STATEMENT, OP_NONE, 2,
+            name, argument
+        );
+        node_append ( compiler, list, assignment );
+        arguments[p] = NULL;
+    }
+
+    node_t *body = copy_tree ( in, &site, function->node );
+    if ( assigns )
+    {
+        shape_statement ( in, &body, true );
+        to_assignments ( in, &body, statement->children[0] );
+    }
+    node_append ( compiler, list, body );
+    free_tree ( in, statement );
+    *slot = list;
+    in->room -= callee->size + TEMPORARY_COST * (int64_t) n;
+    in->inlined += 1;
+
+    mem_free ( MEM_WORK, site.arguments, (n + 1) * sizeof(node_t *) );
+    mem_free ( MEM_WORK, site.renamed, (n_variables + 1) * sizeof(symbol_t *) );
+    mem_free ( MEM_WORK, parameters, (n + 1) * sizeof(symbol_t *) );
+}
+
+
+/* Inline the calls in a function, from the innermost out, so that calls
+ * in arguments are inlined before the calls they are passed to
+ */
+static void
+inline_function ( inliner_t *in, symbol_t *function )
+{
+    in->room = node_count ( function->node ) + INLINE_SLACK;
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    walk_init ( &walk, &function->node );
+    while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+    {
+        node_t *node = *slot;
+        if ( event != WALK_LEAVE )
+            continue;
+        /* The frame just popped has the effects of the children */
+        uint32_t children = walk.frames[walk.depth].mark;
+        uint32_t result = children | effects ( node );
+        if ( is_call ( node ) )
+            result = inline_expression ( in, function, slot, children );
+        else if ( (node->type == ASSIGNMENT_STATEMENT
+                && is_call ( node->children[1] ))
+            || (node->type == RETURN_STATEMENT && node->n_children > 0
+                && is_call ( node->children[0] )) )
+            inline_statement ( in, function, slot );
+        if ( walk.depth > 0 )
+            WALK_TOP ( &walk )->mark |= result;
+    }
+    walk_finalize ( &walk );
+}
+
+
+void
+inline_calls ( compiler_t *compiler )
+{
+    uint32_t n = 0;
+    symbol_t *symbol;
+    tlhash_cursor_t cursor = TLHASH_CURSOR_INIT;
+    while ( tlhash_next (
+        compiler->global_names, &cursor, NULL, NULL, (void **)&symbol
+    ) == TLHASH_SUCCESS )
+        n += (symbol->type == SYM_FUNCTION);
+
+    inliner_t in = {
+        .compiler = compiler,
+        .functions = mem_alloc ( MEM_WORK, (n + 1) * sizeof(symbol_t *) ),
+        .callees = mem_calloc ( MEM_WORK, n + 1, sizeof(callee_t) ),
+        .n_functions = n,
+        .budget = compiler->inline_budget
+    };
+    cursor = TLHASH_CURSOR_INIT;
+    while ( tlhash_next (
+        compiler->global_names, &cursor, NULL, NULL, (void **)&symbol
+    ) == TLHASH_SUCCESS )
+        if ( symbol->type == SYM_FUNCTION )
+            in.functions[symbol->seq] = symbol;
+
+    uint32_t *order = mem_alloc ( MEM_WORK, (n + 1) * sizeof(uint32_t) );
+    build_call_graph ( &in, order );
+    for ( uint32_t f = 0; f < n; f++ )
+    {
+        symbol = in.functions[order[f]];
+        if ( symbol->node == NULL )
+            continue;
+        inline_function ( &in, symbol );
+        describe_callee ( &in, symbol );
+    }
+    if ( compiler->stats != NULL )
+        compiler->stats->calls_inlined = in.inlined;
+
+    for ( uint32_t f = 0; f < n; f++ )
+        if ( in.callees[f].parameters != NULL )
+            mem_free ( MEM_WORK, in.callees[f].parameters,
+                (in.functions[f]->nparms + 1) * sizeof(parameter_t) );
+    mem_free ( MEM_WORK, order, (n + 1) * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, in.copies, in.copies_capacity * sizeof(node_t *) );
+    mem_free ( MEM_WORK, in.callees, (n + 1) * sizeof(callee_t) );
+    mem_free ( MEM_WORK, in.functions, (n + 1) * sizeof(symbol_t *) );
+}
@@ -0,0 +1,56 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include <intern.h>
+
+
+/* Initializer - interned names are allocated from the given arena
+ * Returns
+ *  ENOMEM - if the table can not be allocated
+ */
+int
+intern_init ( intern_t *table, arena_t *arena )
+{
+    table->storage = arena;
+    return tlhash_init ( &table->names, 256 );
+}
+
+
+/* Canonical copy of a name, made the first time the name is seen.
+ * Returns
+ *  NULL - if the copy can not be allocated
+ */
+char *
+intern ( intern_t *table, const char *text, size_t length )
+{
+    uint32_t hash = tlhash_hash ( text, length );
+    char *name;
+    if ( tlhash_lookup_hashed (
+        &table->names, (void *)text, length, hash, (void **)&name
+    ) == TLHASH_SUCCESS )
+        return name;
+
+    intern_header_t *header = arena_alloc (
+        table->storage, sizeof(intern_header_t) + length + 1
+    );
+    if ( header == NULL )
+        return NULL;
+    mem_track ( MEM_NAMES, sizeof(intern_header_t) + length + 1 );
+    *header = (intern_header_t) { .hash = hash, .length = length };
+    name = (char *)(header + 1);
+    memcpy ( name, text, length );
+    name[length] = '\0';
+    if ( tlhash_insert_hashed (
+        &table->names, name, length, hash, name
+    ) != TLHASH_SUCCESS )
+        return NULL;
+    return name;
+}
+
+
+void
+intern_finalize ( intern_t *table )
+{
+    tlhash_finalize ( &table->names );
+    table->storage = NULL;
+}
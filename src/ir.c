@@ -1,166 +1,195 @@
 #include <vslc.h>
 
-// Externally visible, for the generator
-extern tlhash_t *global_names;
-extern char **string_list;
-extern size_t n_string_list,stringc;
-
-/* Stack of tables for local scopes */
-static tlhash_t **scopes = NULL;        /* Dynamic array of tables*/
-static size_t
-n_scopes = 1,       /* Size of the table */
-  scope_depth = 0;    /* Number of scopes presently on stack */
+/* The symbol tables, string table and stack of shadowed bindings
+ * all belong to the compiler context
+ */
 
 /* External interface */
 
-void create_symbol_table(void);
-void print_symbol_table(void);
-void print_symbols(void);
-void print_bindings(node_t *root);
-void destroy_symbol_table(void);
-void find_globals(void);
-void bind_names(symbol_t *function, node_t *root);
-void destroy_symtab(void);
+void create_symbol_table(compiler_t *compiler);
+void print_symbol_table(compiler_t *compiler);
+void print_symbols(compiler_t *compiler);
+void print_bindings(compiler_t *compiler, node_t *root);
+void destroy_symbol_table(compiler_t *compiler);
+void find_globals(compiler_t *compiler);
+void bind_names(compiler_t *compiler, symbol_t *function, node_t *root);
+void destroy_symtab(compiler_t *compiler);
 
 
 
 void
-create_symbol_table ( void )
+create_symbol_table ( compiler_t *compiler )
 {
-  find_globals();
-  size_t n_globals = tlhash_size ( global_names );
-  symbol_t *global_list[n_globals];
-  tlhash_values ( global_names, (void **)&global_list );
-  for ( size_t i=0; i<n_globals; i++ )
-      if ( global_list[i]->type == SYM_FUNCTION )
-          bind_names ( global_list[i], global_list[i]->node );
+  find_globals ( compiler );
+  symbol_t *global;
+  tlhash_cursor_t cursor = TLHASH_CURSOR_INIT;
+  while ( tlhash_next (
+      compiler->global_names, &cursor, NULL, NULL, (void **)&global
+  ) == TLHASH_SUCCESS )
+      if ( global->type == SYM_FUNCTION )
+          bind_names ( compiler, global, global->node );
 }
 
 
 
 
 void
-print_symbol_table ( void )
+print_symbol_table ( compiler_t *compiler )
 {
-	print_symbols();
-	print_bindings(root);
+	print_symbols(compiler);
+	print_bindings(compiler, compiler->root);
 }
 
+/* Names are interned, so tables keyed on them reuse the stored hash */
 void
 insert_symbol ( tlhash_t *tab, symbol_t *sym )
 {
-  tlhash_insert ( tab, sym->name, strlen(sym->name), sym );
+  tlhash_insert_hashed (
+    tab, sym->name, INTERN_LENGTH(sym->name), INTERN_HASH(sym->name), sym
+  );
 }
 
+/* The symbol a name is bound to in the innermost scope declaring it is
+ * kept in the name's intern header, so resolving a name is one load. A
+ * declaration in a nested scope saves the binding it shadows on a stack,
+ * and the bindings are restored as the scope ends. Globals are declared
+ * at depth 0, parameters at depth 1, and blocks nest below.
+ */
 void
-push_scope ( void )
+declare_symbol ( compiler_t *compiler, symbol_t *symbol )
 {
-  if ( scopes == NULL )
-    scopes = malloc ( n_scopes * sizeof(tlhash_t *) );
-  tlhash_t *new_scope = malloc ( sizeof(tlhash_t) );
-  tlhash_init ( new_scope, 32 );
-  scopes[scope_depth] = new_scope;
-
-  scope_depth += 1;
-  if ( scope_depth >= n_scopes )
+  intern_header_t *header = INTERN_HEADER ( symbol->name );
+
+  /* The first declaration of a name in a scope is the one in effect */
+  if ( header->binding != NULL && header->scope == compiler->scope_depth )
+    return;
+
+  /* Globals are bound for the whole compilation, and never restored */
+  if ( compiler->scope_depth > 0 )
     {
-      n_scopes *= 2;
-      scopes = realloc ( scopes, n_scopes*sizeof(tlhash_t **) );
+      if ( compiler->n_shadowed == compiler->shadowed_capacity )
+        {
+          size_t capacity = 2 * compiler->shadowed_capacity;
+          if ( capacity == 0 )
+            capacity = 64;
+          compiler->shadowed = mem_realloc (
+            MEM_SCOPES, compiler->shadowed,
+            compiler->shadowed_capacity * sizeof(shadow_t),
+            capacity * sizeof(shadow_t)
+          );
+          compiler->shadowed_capacity = capacity;
+        }
+      compiler->shadowed[compiler->n_shadowed++] = (shadow_t) {
+        .name = symbol->name,
+        .binding = header->binding,
+        .scope = header->scope
+      };
     }
+  header->binding = symbol;
+  header->scope = compiler->scope_depth;
+}
 
+void
+push_scope ( compiler_t *compiler )
+{
+  compiler->scope_depth += 1;
 }
 
 symbol_t *
-lookup_local ( char *name )
+lookup_name ( char *name )
 {
-  symbol_t *result = NULL;
-  size_t depth = scope_depth;
-  while ( result == NULL && depth > 0 )
-    {
-      depth -= 1;
-      tlhash_lookup ( scopes[depth], name, strlen(name), (void **)&result );
-    }
-  return result;
+  return INTERN_HEADER ( name )->binding;
 }
 
 void
-add_string ( node_t *string )
+add_string ( compiler_t *compiler, node_t *string )
 {
   /* Move string from node to table */
-  string_list[stringc] = string->data;
+  compiler->string_list[compiler->stringc] = string->data.string;
   /* Put index in node instead */
-  string->data = malloc ( sizeof(size_t) );
-  *((size_t *)string->data) = stringc;
-  stringc++;
+  string->data.string_index = compiler->stringc;
+  compiler->stringc++;
 
   /* Resize the table if it is full */
-  if ( stringc >= n_string_list )
+  if ( compiler->stringc >= compiler->n_string_list )
     {
-      n_string_list *= 2;
-      string_list = realloc ( string_list, n_string_list * sizeof(char *) );
+      compiler->n_string_list *= 2;
+      compiler->string_list = mem_realloc (
+        MEM_STRING_LIST, compiler->string_list,
+        compiler->n_string_list/2 * sizeof(char *),
+        compiler->n_string_list * sizeof(char *)
+      );
     }
         
 }
 
 
 
+/* Names declared in the scope are the ones on top of the stack, as the
+ * scopes nested in it have ended already
+ */
 void
-pop_scope ( void )
+pop_scope ( compiler_t *compiler )
 {
-  scope_depth -= 1;
-  tlhash_finalize ( scopes[scope_depth] );
-  free ( scopes[scope_depth] );
-  scopes[scope_depth] = NULL;
+  while ( compiler->n_shadowed > 0 )
+    {
+      shadow_t *shadow = &compiler->shadowed[compiler->n_shadowed - 1];
+      intern_header_t *header = INTERN_HEADER ( shadow->name );
+      if ( header->scope != compiler->scope_depth )
+        break;
+      header->binding = shadow->binding;
+      header->scope = shadow->scope;
+      compiler->n_shadowed -= 1;
+    }
+  compiler->scope_depth -= 1;
 }
 
 
 void
-print_symbols ( void )
+print_symbols ( compiler_t *compiler )
 {
     printf ( "String table:\n" );
-    for ( size_t s=0; s<stringc; s++ )
-        printf  ( "%zu: %s\n", s, string_list[s] );
+    for ( size_t s=0; s<compiler->stringc; s++ )
+        printf  ( "%zu: %s\n", s, compiler->string_list[s] );
     printf ( "-- \n" );
 
     printf ( "Globals:\n" );
-    size_t n_globals = tlhash_size(global_names);
-    symbol_t *global_list[n_globals];
-    tlhash_values ( global_names, (void **)&global_list );
-    for ( size_t g=0; g<n_globals; g++ )
+    symbol_t *global, *local;
+    tlhash_cursor_t g = TLHASH_CURSOR_INIT, l;
+    while ( tlhash_next (
+        compiler->global_names, &g, NULL, NULL, (void **)&global
+    ) == TLHASH_SUCCESS )
     {
-        switch ( global_list[g]->type )
+        switch ( global->type )
         {
             case SYM_FUNCTION:
-                printf (
-                    "%s: function %zu:\n",
-                    global_list[g]->name, global_list[g]->seq
-                );
-                if ( global_list[g]->locals != NULL )
+                printf ( "%s: function %zu:\n", global->name, global->seq );
+                if ( global->locals != NULL )
                 {
-                    size_t localsize = tlhash_size( global_list[g]->locals );
                     printf (
                         "\t%zu local variables, %zu are parameters:\n",
-                        localsize, global_list[g]->nparms
+                        tlhash_size ( global->locals ), global->nparms
                     );
-                    symbol_t *locals[localsize];
-                    tlhash_values(global_list[g]->locals, (void **)locals );
-                    for ( size_t i=0; i<localsize; i++ )
+                    l = TLHASH_CURSOR_INIT;
+                    while ( tlhash_next (
+                        global->locals, &l, NULL, NULL, (void **)&local
+                    ) == TLHASH_SUCCESS )
                     {
-                        printf ( "\t%s: ", locals[i]->name );
-                        switch ( locals[i]->type )
+                        printf ( "\t%s: ", local->name );
+                        switch ( local->type )
                         {
                             case SYM_PARAMETER:
-                                printf ( "parameter %zu\n", locals[i]->seq );
+                                printf ( "parameter %zu\n", local->seq );
                                 break;
                             case SYM_LOCAL_VAR:
-                                printf ( "local var %zu\n", locals[i]->seq );
+                                printf ( "local var %zu\n", local->seq );
                                 break;
                         }
                     }
                 }
                 break;
             case SYM_GLOBAL_VAR:
-                printf ( "%s: global variable\n", global_list[g]->name );
+                printf ( "%s: global variable\n", global->name );
                 break;
         }
     }
@@ -168,12 +197,10 @@ print_symbols ( void )
 }
 
 
-void
-print_bindings ( node_t *root )
+static void
+print_binding ( compiler_t *compiler, node_t *root )
 {
-    if ( root == NULL )
-        return;
-    else if ( root->entry != NULL )
+    if ( root->entry != NULL )
     {
         switch ( root->entry->type )
         {
@@ -197,35 +224,106 @@ print_bindings ( node_t *root )
                 break;
         }
     } else if ( root->type == STRING_DATA ) {
-        size_t string_index = *((size_t *)root->data);
-        if ( string_index < stringc )
-            printf ( "Linked string %zu\n", *((size_t *)root->data) );
+        size_t string_index = root->data.string_index;
+        if ( string_index < compiler->stringc )
+            printf ( "Linked string %zu\n", string_index );
         else
             printf ( "(Not an indexed string)\n" );
     }
-    for ( size_t c=0; c<root->n_children; c++ )
-        print_bindings ( root->children[c] );
 }
 
 
 void
-destroy_symbol_table ( void )
+print_bindings ( compiler_t *compiler, node_t *root )
+{
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    walk_init ( &walk, &root );
+    while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+        if ( event == WALK_ENTER )
+            print_binding ( compiler, *slot );
+    walk_finalize ( &walk );
+}
+
+
+void
+destroy_symbol_table ( compiler_t *compiler )
+{
+      destroy_symtab(compiler);
+}
+
+
+/* Number of symbols: globals, functions, and their parameters and locals */
+size_t
+count_symbols ( compiler_t *compiler )
+{
+    size_t count = tlhash_size ( compiler->global_names );
+    symbol_t *global;
+    tlhash_cursor_t cursor = TLHASH_CURSOR_INIT;
+    while ( tlhash_next (
+        compiler->global_names, &cursor, NULL, NULL, (void **)&global
+    ) == TLHASH_SUCCESS )
+        if ( global->locals != NULL )
+            count += tlhash_size ( global->locals );
+    return count;
+}
+
+
+/* The place of a parameter or local among the variables of a function,
+ * parameters first, or -1 for any other symbol
+ */
+int64_t
+variable_index ( symbol_t *function, symbol_t *symbol )
 {
-      destroy_symtab();
+    if ( symbol == NULL )
+        return -1;
+    if ( symbol->type == SYM_PARAMETER )
+        return symbol->seq;
+    if ( symbol->type == SYM_LOCAL_VAR )
+        return function->nparms + symbol->seq;
+    return -1;
+}
+
+
+/* A new local of a function, numbered after those it has */
+symbol_t *
+new_local ( symbol_t *function, char *name )
+{
+    size_t local_num = tlhash_size ( function->locals ) - function->nparms;
+    symbol_t *symbol = mem_alloc ( MEM_SYMBOLS, sizeof(symbol_t) );
+    *symbol = (symbol_t) {
+        .type = SYM_LOCAL_VAR,
+        .name = name,
+        .node = NULL,
+        .seq = local_num,
+        .nparms = 0,
+        .locals = NULL
+    };
+    /* Index function's table on index number instead of string, to avoid
+     * name clashes. This is to retain pointers to the symbols after all
+     * names are bound, the bindings of the names disappear as the scopes
+     * end.
+     */
+    tlhash_insert ( function->locals, &local_num, sizeof(size_t), symbol );
+    return symbol;
 }
 
 
 void
-find_globals ( void )
+find_globals ( compiler_t *compiler )
 {
     /* Initialize dynamic lists/tables */
-    global_names = malloc ( sizeof(tlhash_t) );
-    tlhash_init ( global_names, 32 );
-    string_list = malloc ( n_string_list * sizeof(char * ) );
+    tlhash_t *global_names = mem_alloc ( MEM_HASH_TABLES, sizeof(tlhash_t) );
+    tlhash_init_ordered ( global_names, 32 );
+    compiler->global_names = global_names;
+    compiler->string_list = mem_alloc (
+        MEM_STRING_LIST, compiler->n_string_list * sizeof(char * )
+    );
     size_t n_functions = 0;
 
     /* Go through the children of the root program node, i.e. the globals */
-    node_t *global_list = root->children[0];
+    node_t *global_list = compiler->root->children[0];
     for ( uint64_t g=0; g<global_list->n_children; g++ )
     {
         node_t
@@ -237,40 +335,43 @@ find_globals ( void )
             /* Functions: */
             case FUNCTION:
                 /* Set up the entry for the function itself */
-                symbol = malloc ( sizeof(symbol_t) );
+                symbol = mem_alloc ( MEM_SYMBOLS, sizeof(symbol_t) );
                 *symbol = (symbol_t) {
                     .type = SYM_FUNCTION,
-                    .name = global->children[0]->data,
+                    .name = global->children[0]->data.name,
                     .node = global->children[2],
                     .seq = n_functions,
                     .nparms = 0,
-                    .locals = malloc ( sizeof(tlhash_t) )
+                    .locals = mem_alloc ( MEM_HASH_TABLES, sizeof(tlhash_t) )
                 };
                 n_functions++;
 
-                /* Initialize its local table, and fill in the parameters */
-                tlhash_init ( symbol->locals, 32 );
+                /* Initialize its local table, and fill in the parameters.
+                 * Parameters and locals are entered in order of their
+                 * sequence numbers, which the ordered table retains.
+                 */
+                tlhash_init_ordered ( symbol->locals, 32 );
                 if ( global->children[1] != NULL )
                 {
                     symbol->nparms = global->children[1]->n_children;
                     for ( int p=0; p<symbol->nparms; p++ )
                     {
                         node_t *param = global->children[1]->children[p];
-                        symbol_t *psym = malloc ( sizeof(symbol_t) );
+                        symbol_t *psym =
+                            mem_alloc ( MEM_SYMBOLS, sizeof(symbol_t) );
                         *psym = (symbol_t) {
                             .type = SYM_PARAMETER,
-                            .name = param->data,
+                            .name = param->data.name,
                             .node = NULL,
                             .seq = p,
                             .nparms = 0,
                             .locals = NULL
                         };
-                        tlhash_insert (
-                            symbol->locals, psym->name, strlen(psym->name), psym
-                        );
+                        insert_symbol ( symbol->locals, psym );
                     }
                 }
                 insert_symbol ( global_names, symbol );
+                declare_symbol ( compiler, symbol );
                 break;
             /* Global variables */
             case DECLARATION:
@@ -279,69 +380,53 @@ find_globals ( void )
                 for ( uint64_t d=0; d<namelist->n_children; d++ )
                 {
                     /* Create symbol and insert in global nametab */
-                    symbol = malloc ( sizeof(symbol_t) );
+                    symbol = mem_alloc ( MEM_SYMBOLS, sizeof(symbol_t) );
                     *symbol = (symbol_t) {
                         .type = SYM_GLOBAL_VAR,
-                        .name = namelist->children[d]->data,
+                        .name = namelist->children[d]->data.name,
                         .node = NULL,
                         .seq = 0,
                         .nparms = 0,
                         .locals = NULL
                     };
                     insert_symbol ( global_names, symbol );
+                    declare_symbol ( compiler, symbol );
                 }
                 break;
         }
     }
 }
 
-void
-bind_names ( symbol_t *function, node_t *root )
+/* Bind one node as the walk enters it */
+static void
+bind_node (
+    compiler_t *compiler, symbol_t *function, walk_t *walk, node_t *root
+)
 {
-    if ( root == NULL )
-        return;
-    else switch ( root->type )
+    switch ( root->type )
     {
         node_t *namelist;
         symbol_t *entry;
 
-        /* Blocks initiate a new nested scope, recur into its statements */
+        /* Blocks initiate a new nested scope, which ends as the walk
+         * leaves them
+         */
         case BLOCK:
-            push_scope();
-            for ( size_t c=0; c<root->n_children; c++ )
-                bind_names ( function, root->children[c] );
-            pop_scope();
+            push_scope ( compiler );
             break;
 
-        /* Declarations enter string-indexed symbols on the stack,
-         * and retain pointers in the function's table as well
+        /* Declarations bind their names in the current scope, and
+         * retain pointers in the function's table as well
          */
         case DECLARATION:
             namelist = root->children[0];
             for ( uint64_t d=0; d<namelist->n_children; d++ )
             {
                 node_t *varname = namelist->children[d];
-                size_t local_num =
-                    tlhash_size(function->locals) - function->nparms;
-                symbol_t *symbol = malloc ( sizeof(symbol_t) );
-                *symbol = (symbol_t) {
-                    .type = SYM_LOCAL_VAR,
-                    .name = varname->data,
-                    .node = NULL,
-                    .seq = local_num,
-                    .nparms = 0,
-                    .locals = NULL
-                };
-                /* Index function's table on index number instead of string,
-                 * to avoid name clashes. This is to retain pointers to the
-                 * symbols after all names are bound, the local scope tables
-                 * disappear as the scopes end.
-                 */
-                tlhash_insert (
-                    function->locals, &local_num, sizeof(size_t), symbol
-                );
-                insert_symbol ( scopes[scope_depth-1], symbol );
+                symbol_t *symbol = new_local ( function, varname->data.name );
+                declare_symbol ( compiler, symbol );
             }
+            walk_skip ( walk );
             break;
 
         /* Since declarations don't recur, finding identifiers must correspond
@@ -349,27 +434,14 @@ bind_names ( symbol_t *function, node_t *root )
          * the tree node.
          */
         case IDENTIFIER_DATA:
-            /* Is it a local variable? */
-            entry = lookup_local ( root->data );
-
-            /* Otherwise, is it a parameter? */
-            if ( entry == NULL )
-                tlhash_lookup (
-                    function->locals, root->data,
-                    strlen(root->data), (void**)&entry
-                );
-
-            /* Otherwise, is it a global name? */
-            if ( entry == NULL )
-                tlhash_lookup (
-                    global_names,root->data,strlen(root->data),(void**)&entry
-                );
+            /* The innermost local variable, parameter or global name */
+            entry = lookup_name ( root->data.name );
 
             /* Name wasn't found anywhere, crash and burn */
             if ( entry == NULL )
             {
                 fprintf ( stderr, "Identifier '%s' does not exist in scope\n",
-                    (char *)root->data
+                    root->data.name
                 );
                 exit ( EXIT_FAILURE );
             }
@@ -380,44 +452,81 @@ bind_names ( symbol_t *function, node_t *root )
 
         /* Strings: put them in the string table */
         case STRING_DATA:
-            add_string ( root );
+            add_string ( compiler, root );
             break;
 
-        /* If this was not a node otherwise handled, recur into its children */
+        /* Other nodes only hold the ones above */
         default:
-            for ( size_t c=0; c<root->n_children; c++ )
-                bind_names ( function, root->children[c] );
             break;
     }
 }
 
+
+/* Bind the names in a function body, in the order they appear */
+void
+bind_names ( compiler_t *compiler, symbol_t *function, node_t *root )
+{
+    /* Parameters are the only locals so far, and shadow the globals */
+    symbol_t *parameter;
+    tlhash_cursor_t cursor = TLHASH_CURSOR_INIT;
+    push_scope ( compiler );
+    while ( tlhash_next (
+        function->locals, &cursor, NULL, NULL, (void **)&parameter
+    ) == TLHASH_SUCCESS )
+        declare_symbol ( compiler, parameter );
+
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    walk_init ( &walk, &root );
+    while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+    {
+        if ( event == WALK_ENTER )
+            bind_node ( compiler, function, &walk, *slot );
+        else if ( (*slot)->type == BLOCK )
+            pop_scope ( compiler );
+    }
+    walk_finalize ( &walk );
+    pop_scope ( compiler );
+}
+
 void
-destroy_symtab ( void )
+destroy_symtab ( compiler_t *compiler )
 {
-  for ( size_t i=0; i<stringc; i++ )
-    free ( string_list[i] );
-  free ( string_list );
-
-  size_t n_globals = tlhash_size ( global_names );
-  symbol_t *global_list[n_globals];
-  tlhash_values ( global_names, (void **)&global_list );
-  for ( size_t g=0; g<n_globals; g++ )
+  /* The strings themselves belong to the tree arena */
+  mem_free (
+    MEM_STRING_LIST, compiler->string_list,
+    compiler->n_string_list * sizeof(char *)
+  );
+  compiler->string_list = NULL;
+  compiler->stringc = 0;
+
+  symbol_t *glob, *local;
+  tlhash_cursor_t g = TLHASH_CURSOR_INIT, l;
+  while ( tlhash_next (
+      compiler->global_names, &g, NULL, NULL, (void **)&glob
+  ) == TLHASH_SUCCESS )
     {
-      symbol_t *glob = global_list[g];
       if ( glob->locals != NULL )
         {
-          size_t n_locals = tlhash_size ( glob->locals );
-          symbol_t *locals[n_locals];
-          tlhash_values ( glob->locals, (void **)&locals );
-          for ( size_t l=0; l<n_locals; l++ )
-            free ( locals[l] );
+          l = TLHASH_CURSOR_INIT;
+          while ( tlhash_next (
+              glob->locals, &l, NULL, NULL, (void **)&local
+          ) == TLHASH_SUCCESS )
+            mem_free ( MEM_SYMBOLS, local, sizeof(symbol_t) );
           tlhash_finalize ( glob->locals );
-          free ( glob->locals );
+          mem_free ( MEM_HASH_TABLES, glob->locals, sizeof(tlhash_t) );
         }
-      free ( glob );
+      mem_free ( MEM_SYMBOLS, glob, sizeof(symbol_t) );
     }
-  tlhash_finalize ( global_names );
-  free ( global_names );
-  free ( scopes );
+  tlhash_finalize ( compiler->global_names );
+  mem_free ( MEM_HASH_TABLES, compiler->global_names, sizeof(tlhash_t) );
+  compiler->global_names = NULL;
+  mem_free (
+    MEM_SCOPES, compiler->shadowed,
+    compiler->shadowed_capacity * sizeof(shadow_t)
+  );
+  compiler->shadowed = NULL;
+  compiler->n_shadowed = compiler->shadowed_capacity = 0;
 
 }
@@ -0,0 +1,579 @@
+#include <vslc.h>
+
+/* Lowering of the SSA form of a function to x86-64. Values live in stack
+ * slots, which values that are never live at once share. Phis take the
+ * values of a predecessor through a second area at the end of it, so that
+ * phis which take each other's values are copied at once. Operands are
+ * loaded into %rax and %r10, and results stored from %rax. When optimizing,
+ * a call whose value is returned right away is a jump to the function called.
+ */
+
+typedef struct {
+    ssa_function_t *function;
+    emitter_t *out;
+    bool optimize;              /* Whether to choose cheaper instructions */
+    bool jumped;                /* The return after the last call is not reached */
+    char prefix[32];            /* "__vslssa_<seq>_", labels of blocks */
+    uint32_t *slots;            /* Slot of each value */
+    uint32_t n_slots;           /* Slots of values, the phi area below */
+    uint32_t n_phi_slots;       /* Most phis of a block */
+} lowering_t;
+
+/* Live ranges of values, as the first and last positions they cover when
+ * the instructions are counted in the order blocks are laid out. Blocks
+ * have positions of their own before and after their instructions.
+ */
+typedef struct {
+    ssa_function_t *function;
+    uint32_t *start, *end;      /* Of each value, start is SSA_NONE if none */
+    uint32_t *block_start, *block_end;
+    uint32_t *seen;             /* Value + 1 that a block passed on */
+    uint32_t *stack;            /* Blocks to pass a value on from */
+} ranges_t;
+
+
+static int64_t
+value_slot ( lowering_t *l, uint32_t value )
+{
+    return -8 * ((int64_t) l->slots[value] + 1);
+}
+
+
+static int64_t
+phi_slot ( lowering_t *l, uint32_t n )
+{
+    return -8 * ((int64_t) l->n_slots + n + 1);
+}
+
+
+static void
+load ( lowering_t *l, uint32_t value, const char *reg )
+{
+    emit_instr_mr ( l->out, "movq", value_slot ( l, value ), "%rbp", reg );
+}
+
+
+static void
+store ( lowering_t *l, const char *reg, uint32_t value )
+{
+    emit_instr_rm ( l->out, "movq", reg, value_slot ( l, value ), "%rbp" );
+}
+
+
+static void
+load_operand ( lowering_t *l, ssa_instruction_t *instruction, uint32_t o,
+    const char *reg )
+{
+    load ( l, SSA_OPERAND ( l->function, instruction, o ), reg );
+}
+
+
+static void
+global_access ( lowering_t *l, const char *op, symbol_t *symbol,
+    const char *before, const char *after )
+{
+    emitf ( l->out, "\t%s %s__vslc_%s(%%rip)%s\n", op, before, symbol->name, after );
+}
+
+
+static void
+call_printf ( lowering_t *l )
+{
+    emit_line ( l->out, "\tmovq $0, %rax" );
+    emit_line ( l->out, "\tcall printf" );
+}
+
+
+/* Whether a call can jump to the function it calls: its value is returned
+ * by the next instruction, and its arguments on the stack fit where those
+ * of the function itself were passed
+ */
+static bool
+tail_call ( lowering_t *l, uint32_t i, ssa_instruction_t *instruction,
+    uint32_t n_stack )
+{
+    symbol_t *function = l->function->symbol;
+    if ( !l->optimize || instruction->next == SSA_NONE )
+        return false;
+    ssa_instruction_t *next = &l->function->instructions[instruction->next];
+    if ( next->opcode != SSA_RETURN || SSA_OPERAND ( l->function, next, 0 ) != i )
+        return false;
+    return n_stack == 0 || (function->nparms > N_PARAM_REGISTERS
+        && n_stack <= function->nparms - N_PARAM_REGISTERS);
+}
+
+
+/* The callee of a tail call takes over the frame, and returns to the
+ * caller in its place. Its stack arguments overwrite those passed to this
+ * function, which are in value slots by now.
+ */
+static void
+lower_tail_call ( lowering_t *l, ssa_instruction_t *instruction )
+{
+    uint32_t n_arguments = instruction->n_operands;
+    for ( uint32_t a = N_PARAM_REGISTERS; a < n_arguments; a++ )
+    {
+        load_operand ( l, instruction, a, "%rax" );
+        emit_instr_rm ( l->out, "movq", "%rax",
+            16 + 8 * (a - N_PARAM_REGISTERS), "%rbp" );
+    }
+    for ( uint32_t a = 0; a < n_arguments && a < N_PARAM_REGISTERS; a++ )
+        load_operand ( l, instruction, a, record[a] );
+    emit_line ( l->out, "\tleave" );
+    emitf ( l->out, "\tjmp __vslc_%s\n", instruction->data.symbol->name );
+    l->jumped = true;
+}
+
+
+/* The stack stays aligned to 16 bytes from the prologue on, so arguments
+ * on the stack are padded to an even number
+ */
+static void
+lower_call ( lowering_t *l, uint32_t i, ssa_instruction_t *instruction )
+{
+    uint32_t n_arguments = instruction->n_operands;
+    uint32_t n_stack = (n_arguments > N_PARAM_REGISTERS) ?
+        n_arguments - N_PARAM_REGISTERS : 0;
+    if ( tail_call ( l, i, instruction, n_stack ) )
+    {
+        lower_tail_call ( l, instruction );
+        return;
+    }
+    uint32_t padding = 8 * (n_stack % 2);
+    if ( padding > 0 )
+        emit_instr_ir ( l->out, "subq", padding, "%rsp" );
+    for ( uint32_t a = n_arguments; a-- > N_PARAM_REGISTERS; )
+    {
+        uint32_t value = SSA_OPERAND ( l->function, instruction, a );
+        emitf ( l->out, "\tpushq %lld(%%rbp)\n", (long long) value_slot ( l, value ) );
+    }
+    for ( uint32_t a = 0; a < n_arguments && a < N_PARAM_REGISTERS; a++ )
+        load_operand ( l, instruction, a, record[a] );
+    emitf ( l->out, "\tcall __vslc_%s\n", instruction->data.symbol->name );
+    if ( n_stack > 0 )
+        emit_instr_ir ( l->out, "addq", 8 * n_stack + padding, "%rsp" );
+    store ( l, "%rax", i );
+}
+
+
+/* The k of a division by a constant 2^k when optimizing, or 0 */
+static int
+division_shift ( lowering_t *l, ssa_instruction_t *instruction )
+{
+    if ( !l->optimize || instruction->op != OP_DIV )
+        return 0;
+    ssa_instruction_t *divisor = &l->function->instructions[
+        SSA_OPERAND ( l->function, instruction, 1 )];
+    return (divisor->opcode == SSA_CONST) ?
+        power_of_two ( divisor->data.number ) : 0;
+}
+
+
+static void
+lower_binary ( lowering_t *l, uint32_t i, ssa_instruction_t *instruction )
+{
+    int shift = division_shift ( l, instruction );
+    load_operand ( l, instruction, 0, "%rax" );
+    if ( shift == 0 )
+        load_operand ( l, instruction, 1, "%r10" );
+    switch ( instruction->op )
+    {
+        case OP_ADD: emit_instr_rr ( l->out, "addq", "%r10", "%rax" ); break;
+        case OP_SUB: emit_instr_rr ( l->out, "subq", "%r10", "%rax" ); break;
+        case OP_MUL: emit_instr_rr ( l->out, "imulq", "%r10", "%rax" ); break;
+        case OP_AND: emit_instr_rr ( l->out, "and", "%r10", "%rax" ); break;
+        case OP_OR: emit_instr_rr ( l->out, "or", "%r10", "%rax" ); break;
+        case OP_XOR: emit_instr_rr ( l->out, "xor", "%r10", "%rax" ); break;
+        case OP_DIV:
+        {
+            /* By 2^k, an arithmetic shift that rounds towards zero */
+            if ( shift > 0 )
+            {
+                emit_instr_rr ( l->out, "movq", "%rax", "%rcx" );
+                emit_instr_ir ( l->out, "sarq", 63, "%rcx" );
+                emit_instr_ir ( l->out, "shrq", 64 - shift, "%rcx" );
+                emit_instr_rr ( l->out, "addq", "%rcx", "%rax" );
+                emit_instr_ir ( l->out, "sarq", shift, "%rax" );
+                break;
+            }
+            emit_line ( l->out, "\tcqto" );
+            emit_instr ( l->out, "idivq", "%r10" );
+            break;
+        }
+        case OP_LSHIFT:
+        case OP_RSHIFT:
+            emit_instr_rr ( l->out, "movq", "%r10", "%rcx" );
+            emit_instr_rr ( l->out, (instruction->op == OP_LSHIFT) ?
+                "shl" : "shr", "%cl", "%rax" );
+            break;
+    }
+    store ( l, "%rax", i );
+}
+
+
+/* Give the phis of a block the values they take from 'predecessor' */
+static void
+copy_phis ( lowering_t *l, uint32_t predecessor, uint32_t successor )
+{
+    ssa_function_t *function = l->function;
+    ssa_block_t *block = &function->blocks[successor];
+    uint32_t from = 0;
+    while ( block->predecessors[from] != predecessor )
+        from += 1;
+    for ( int pass = 0; pass < 2; pass++ )
+    {
+        uint32_t n = 0;
+        for ( uint32_t i = block->first; i != SSA_NONE; n++ )
+        {
+            ssa_instruction_t *phi = &function->instructions[i];
+            if ( phi->opcode != SSA_PHI )
+                break;
+            if ( pass == 0 )
+            {
+                load_operand ( l, phi, from, "%rax" );
+                emit_instr_rm ( l->out, "movq", "%rax", phi_slot ( l, n ), "%rbp" );
+            }
+            else
+            {
+                emit_instr_mr ( l->out, "movq", phi_slot ( l, n ), "%rbp", "%rax" );
+                store ( l, "%rax", i );
+            }
+            i = phi->next;
+        }
+    }
+}
+
+
+static const char *
+jump_if ( uint8_t op, bool holds )
+{
+    switch ( op )
+    {
+        case OP_EQ: return holds ? "je" : "jne";
+        case OP_LT: return holds ? "jl" : "jnl";
+        case OP_GT: return holds ? "jg" : "jng";
+        default: return "jmp";
+    }
+}
+
+
+/* Blocks are laid out in order, so a jump to the next one falls through */
+static void
+lower_terminator ( lowering_t *l, uint32_t k, ssa_instruction_t *instruction )
+{
+    ssa_block_t *block = &l->function->blocks[k];
+    switch ( instruction->opcode )
+    {
+        case SSA_JUMP:
+            copy_phis ( l, k, block->successors[0] );
+            if ( block->successors[0] != k + 1 )
+                emit_instr_label ( l->out, "jmp", l->prefix,
+                    block->successors[0], "" );
+            break;
+        case SSA_BRANCH:
+            load_operand ( l, instruction, 0, "%rax" );
+            load_operand ( l, instruction, 1, "%r10" );
+            emit_instr_rr ( l->out, "cmp", "%r10", "%rax" );
+            if ( block->successors[0] == k + 1 )
+                emit_instr_label ( l->out, jump_if ( instruction->op, false ),
+                    l->prefix, block->successors[1], "" );
+            else
+            {
+                emit_instr_label ( l->out, jump_if ( instruction->op, true ),
+                    l->prefix, block->successors[0], "" );
+                if ( block->successors[1] != k + 1 )
+                    emit_instr_label ( l->out, "jmp", l->prefix,
+                        block->successors[1], "" );
+            }
+            break;
+        case SSA_RETURN:
+            if ( l->jumped )
+            {
+                l->jumped = false;
+                break;
+            }
+            load_operand ( l, instruction, 0, "%rax" );
+            emit_line ( l->out, "\tleave" );
+            emit_line ( l->out, "\tret" );
+            break;
+    }
+}
+
+
+static void
+lower_instruction ( lowering_t *l, uint32_t i )
+{
+    ssa_instruction_t *instruction = &l->function->instructions[i];
+    switch ( instruction->opcode )
+    {
+        case SSA_CONST:
+            emit_instr_ir ( l->out, "movq", instruction->data.number, "%rax" );
+            store ( l, "%rax", i );
+            break;
+        case SSA_UNDEF:
+            emit_instr_ir ( l->out, "movq", 0, "%rax" );
+            store ( l, "%rax", i );
+            break;
+        case SSA_PARAM:
+        {
+            size_t p = instruction->data.index;
+            if ( p < N_PARAM_REGISTERS )
+                store ( l, record[p], i );
+            else
+            {
+                /* Past the saved %rbp and the return address */
+                emit_instr_mr ( l->out, "movq",
+                    16 + 8 * (p - N_PARAM_REGISTERS), "%rbp", "%rax" );
+                store ( l, "%rax", i );
+            }
+            break;
+        }
+        case SSA_LOAD:
+            global_access ( l, "movq", instruction->data.symbol, "", ", %rax" );
+            store ( l, "%rax", i );
+            break;
+        case SSA_STORE:
+            load_operand ( l, instruction, 0, "%rax" );
+            global_access ( l, "movq", instruction->data.symbol, "%rax, ", "" );
+            break;
+        case SSA_UNARY:
+            load_operand ( l, instruction, 0, "%rax" );
+            emit_instr ( l->out, (instruction->op == OP_SUB) ? "neg" : "not",
+                "%rax" );
+            store ( l, "%rax", i );
+            break;
+        case SSA_BINARY:
+            lower_binary ( l, i, instruction );
+            break;
+        case SSA_CALL:
+            lower_call ( l, i, instruction );
+            break;
+        case SSA_PRINT:
+            emit_line ( l->out, "\tlea intout(%rip), %rdi" );
+            load_operand ( l, instruction, 0, "%rsi" );
+            call_printf ( l );
+            break;
+        case SSA_PRINT_STRING:
+            emit_line ( l->out, "\tlea strout(%rip), %rdi" );
+            emit_instr_label ( l->out, "lea", "STR",
+                instruction->data.index, "(%rip), %rsi" );
+            call_printf ( l );
+            break;
+        case SSA_NEWLINE:
+            emit_line ( l->out, "\tlea newline(%rip), %rdi" );
+            call_printf ( l );
+            break;
+        case SSA_PHI:
+            break;
+        default:
+            lower_terminator ( l, instruction->block, instruction );
+            break;
+    }
+}
+
+
+static void
+cover ( ranges_t *r, uint32_t value, uint32_t position )
+{
+    if ( position < r->start[value] )
+        r->start[value] = position;
+    if ( position > r->end[value] )
+        r->end[value] = position;
+}
+
+
+/* A value used in block k but defined in another is live from the start of
+ * k, and through every block on the way back to its definition
+ */
+static void
+live_in ( ranges_t *r, uint32_t value, uint32_t k )
+{
+    ssa_function_t *function = r->function;
+    uint32_t definition = function->instructions[value].block;
+    uint32_t depth = 0;
+    cover ( r, value, r->block_start[k] );
+    if ( r->seen[k] == value + 1 )
+        return;
+    r->seen[k] = value + 1;
+    r->stack[depth++] = k;
+    while ( depth > 0 )
+    {
+        ssa_block_t *block = &function->blocks[r->stack[--depth]];
+        for ( uint32_t p = 0; p < block->n_predecessors; p++ )
+        {
+            uint32_t predecessor = block->predecessors[p];
+            cover ( r, value, r->block_end[predecessor] );
+            if ( predecessor == definition || r->seen[predecessor] == value + 1 )
+                continue;
+            cover ( r, value, r->block_start[predecessor] );
+            r->seen[predecessor] = value + 1;
+            r->stack[depth++] = predecessor;
+        }
+    }
+}
+
+
+/* Ranges of the values of a function, returning the number of positions.
+ * A phi is written at the end of each predecessor, and its operands read
+ * there.
+ */
+static uint32_t
+find_ranges ( ranges_t *r )
+{
+    ssa_function_t *function = r->function;
+    uint32_t position = 0;
+    for ( uint32_t i = 0; i < function->n_instructions; i++ )
+    {
+        r->start[i] = SSA_NONE;
+        r->end[i] = 0;
+    }
+    for ( uint32_t k = 0; k < function->n_blocks; k++ )
+    {
+        r->block_start[k] = position++;
+        for ( uint32_t i = function->blocks[k].first; i != SSA_NONE; position++ )
+        {
+            ssa_instruction_t *instruction = &function->instructions[i];
+            if ( ssa_defines_value ( instruction->opcode ) )
+                r->start[i] = r->end[i] = position;
+            i = instruction->next;
+        }
+        r->block_end[k] = position++;
+    }
+
+    position = 0;
+    for ( uint32_t k = 0; k < function->n_blocks; k++ )
+    {
+        ssa_block_t *block = &function->blocks[k];
+        position++;
+        for ( uint32_t i = block->first; i != SSA_NONE; position++ )
+        {
+            ssa_instruction_t *instruction = &function->instructions[i];
+            for ( uint32_t o = 0; o < instruction->n_operands; o++ )
+            {
+                uint32_t value = SSA_OPERAND ( function, instruction, o );
+                uint32_t user = k;
+                if ( instruction->opcode == SSA_PHI )
+                {
+                    user = block->predecessors[o];
+                    cover ( r, value, r->block_end[user] );
+                    cover ( r, i, r->block_end[user] );
+                }
+                else
+                    cover ( r, value, position );
+                if ( function->instructions[value].block != user )
+                    live_in ( r, value, user );
+            }
+            i = instruction->next;
+        }
+        position++;
+    }
+    return position;
+}
+
+
+/* Slots by a linear scan over the ranges: a value takes a slot that no
+ * value live at its start holds, and gives it back after its end
+ */
+static void
+allocate_slots ( lowering_t *l )
+{
+    ssa_function_t *function = l->function;
+    size_t size = (function->n_instructions + 1) * sizeof(uint32_t);
+    size_t block_size = (function->n_blocks + 1) * sizeof(uint32_t);
+    ranges_t r = {
+        .function = function,
+        .start = mem_alloc ( MEM_WORK, size ),
+        .end = mem_alloc ( MEM_WORK, size ),
+        .block_start = mem_alloc ( MEM_WORK, block_size ),
+        .block_end = mem_alloc ( MEM_WORK, block_size ),
+        .seen = mem_calloc ( MEM_WORK, 1, block_size ),
+        .stack = mem_alloc ( MEM_WORK, block_size ),
+    };
+    uint32_t n_positions = find_ranges ( &r );
+
+    /* Values chained by the positions they start and end at */
+    size_t position_size = (n_positions + 1) * sizeof(uint32_t);
+    uint32_t *starting = mem_alloc ( MEM_WORK, position_size );
+    uint32_t *ending = mem_alloc ( MEM_WORK, position_size );
+    uint32_t *next_starting = mem_alloc ( MEM_WORK, size );
+    uint32_t *next_ending = mem_alloc ( MEM_WORK, size );
+    uint32_t *free_slots = mem_alloc ( MEM_WORK, size );
+    for ( uint32_t p = 0; p < n_positions; p++ )
+        starting[p] = ending[p] = SSA_NONE;
+    for ( uint32_t i = 0; i < function->n_instructions; i++ )
+    {
+        if ( r.start[i] == SSA_NONE )
+            continue;
+        next_starting[i] = starting[r.start[i]];
+        starting[r.start[i]] = i;
+        next_ending[i] = ending[r.end[i]];
+        ending[r.end[i]] = i;
+    }
+
+    uint32_t n_free = 0;
+    l->slots = mem_alloc ( MEM_WORK, size );
+    l->n_slots = 0;
+    for ( uint32_t p = 0; p < n_positions; p++ )
+    {
+        for ( uint32_t i = starting[p]; i != SSA_NONE; i = next_starting[i] )
+            l->slots[i] = (n_free > 0) ? free_slots[--n_free] : l->n_slots++;
+        for ( uint32_t i = ending[p]; i != SSA_NONE; i = next_ending[i] )
+            free_slots[n_free++] = l->slots[i];
+    }
+
+    l->n_phi_slots = 0;
+    for ( uint32_t k = 0; k < function->n_blocks; k++ )
+    {
+        uint32_t n = 0;
+        for ( uint32_t i = function->blocks[k].first; i != SSA_NONE
+            && function->instructions[i].opcode == SSA_PHI; n++ )
+            i = function->instructions[i].next;
+        if ( n > l->n_phi_slots )
+            l->n_phi_slots = n;
+    }
+
+    mem_free ( MEM_WORK, r.start, size );
+    mem_free ( MEM_WORK, r.end, size );
+    mem_free ( MEM_WORK, r.block_start, block_size );
+    mem_free ( MEM_WORK, r.block_end, block_size );
+    mem_free ( MEM_WORK, r.seen, block_size );
+    mem_free ( MEM_WORK, r.stack, block_size );
+    mem_free ( MEM_WORK, starting, position_size );
+    mem_free ( MEM_WORK, ending, position_size );
+    mem_free ( MEM_WORK, next_starting, size );
+    mem_free ( MEM_WORK, next_ending, size );
+    mem_free ( MEM_WORK, free_slots, size );
+}
+
+
+void
+ssa_generate ( ssa_function_t *function, emitter_t *out, bool optimize )
+{
+    lowering_t l = { .function = function, .out = out, .optimize = optimize };
+    symbol_t *symbol = function->symbol;
+    snprintf ( l.prefix, sizeof(l.prefix), "__vslssa_%zu_", symbol->seq );
+    allocate_slots ( &l );
+
+    emitf ( out, ".globl __vslc_%s\n", symbol->name );
+    emit_line ( out, ".text" );
+    emitf ( out, "__vslc_%s:\n", symbol->name );
+    emit_line ( out, "\tpushq %rbp" );
+    emit_line ( out, "\tmovq %rsp, %rbp" );
+    int64_t frame = 8 * ((int64_t) l.n_slots + l.n_phi_slots);
+    frame = (frame + 15) & ~(int64_t) 15;
+    if ( frame > 0 )
+        emit_instr_ir ( out, "subq", frame, "%rsp" );
+
+    for ( uint32_t k = 0; k < function->n_blocks; k++ )
+    {
+        if ( k > 0 )
+            emit_label ( out, l.prefix, k, "" );
+        for ( uint32_t i = function->blocks[k].first; i != SSA_NONE; )
+        {
+            lower_instruction ( &l, i );
+            i = function->instructions[i].next;
+        }
+    }
+    mem_free ( MEM_WORK, l.slots,
+        (function->n_instructions + 1) * sizeof(uint32_t) );
+}
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+
+#include <memprof.h>
+
+
+static void charge ( mem_category_t category, size_t size );
+static void credit ( mem_category_t category, size_t size );
+static void raise_peak ( size_t *peak, size_t live );
+
+
+const char *mem_category_names[MEM_N_CATEGORIES] = {
+    [MEM_NODES] = "nodes",
+    [MEM_CHILDREN] = "children",
+    [MEM_PAYLOADS] = "payloads",
+    [MEM_NAMES] = "names",
+    [MEM_HASH_TABLES] = "hash_tables",
+    [MEM_HASH_KEYS] = "hash_keys",
+    [MEM_SCOPES] = "scopes",
+    [MEM_STRING_LIST] = "string_list",
+    [MEM_SYMBOLS] = "symbols",
+    [MEM_SOURCE] = "source",
+    [MEM_OUTPUT] = "output",
+    [MEM_WORK] = "work",
+    [MEM_CACHE] = "cache",
+    [MEM_SSA] = "ssa",
+    [MEM_PEEPHOLE] = "peephole"
+};
+
+
+/* Threads that generate functions in parallel share the profile of their
+ * compilation, so its counters are only updated atomically
+ */
+static __thread mem_profile_t *current = NULL;
+
+#define ADD(counter,n) __atomic_add_fetch ( &(counter), (n), __ATOMIC_RELAXED )
+#define SUB(counter,n) __atomic_sub_fetch ( &(counter), (n), __ATOMIC_RELAXED )
+
+
+void
+mem_profile_attach ( mem_profile_t *profile )
+{
+    current = profile;
+}
+
+
+mem_profile_t *
+mem_profile_current ( void )
+{
+    return current;
+}
+
+
+/* Later allocations belong to the given phase. Its peak starts out at
+ * what is live when it begins.
+ */
+void
+mem_profile_phase ( mem_profile_t *profile, int phase )
+{
+    profile->phase = phase;
+    raise_peak (
+        &profile->phases[phase].peak,
+        __atomic_load_n ( &profile->total.live, __ATOMIC_RELAXED )
+    );
+}
+
+
+void *
+mem_alloc ( mem_category_t category, size_t size )
+{
+    void *block = malloc ( size );
+    if ( block != NULL )
+        charge ( category, size );
+    return block;
+}
+
+
+void *
+mem_calloc ( mem_category_t category, size_t count, size_t size )
+{
+    void *block = calloc ( count, size );
+    if ( block != NULL )
+        charge ( category, count * size );
+    return block;
+}
+
+
+/* A reallocation counts as a new allocation of the new size */
+void *
+mem_realloc (
+    mem_category_t category, void *block, size_t old_size, size_t size
+)
+{
+    void *resized = realloc ( block, size );
+    if ( resized != NULL )
+    {
+        if ( block != NULL )
+            credit ( category, old_size );
+        charge ( category, size );
+    }
+    return resized;
+}
+
+
+void
+mem_free ( mem_category_t category, void *block, size_t size )
+{
+    if ( block != NULL )
+        credit ( category, size );
+    free ( block );
+}
+
+
+void
+mem_track ( mem_category_t category, size_t size )
+{
+    charge ( category, size );
+}
+
+
+void
+mem_untrack ( mem_category_t category, size_t size )
+{
+    credit ( category, size );
+}
+
+
+/* Everything in a category is gone, as when an arena is released */
+void
+mem_release ( mem_category_t category )
+{
+    mem_profile_t *profile = current;
+    if ( profile == NULL )
+        return;
+    size_t live = __atomic_exchange_n (
+        &profile->categories[category].live, 0, __ATOMIC_RELAXED
+    );
+    SUB ( profile->total.live, live );
+}
+
+
+static void
+charge ( mem_category_t category, size_t size )
+{
+    mem_profile_t *profile = current;
+    if ( profile == NULL )
+        return;
+    mem_usage_t
+        *usage = &profile->categories[category],
+        *phase = &profile->phases[profile->phase];
+
+    ADD ( usage->count, 1 );
+    ADD ( usage->bytes, size );
+    raise_peak ( &usage->peak, ADD ( usage->live, size ) );
+
+    ADD ( profile->total.count, 1 );
+    ADD ( profile->total.bytes, size );
+    size_t live = ADD ( profile->total.live, size );
+    raise_peak ( &profile->total.peak, live );
+
+    ADD ( phase->count, 1 );
+    ADD ( phase->bytes, size );
+    raise_peak ( &phase->peak, live );
+}
+
+
+static void
+credit ( mem_category_t category, size_t size )
+{
+    mem_profile_t *profile = current;
+    if ( profile == NULL )
+        return;
+    SUB ( profile->categories[category].live, size );
+    SUB ( profile->total.live, size );
+}
+
+
+static void
+raise_peak ( size_t *peak, size_t live )
+{
+    size_t seen = __atomic_load_n ( peak, __ATOMIC_RELAXED );
+    while ( live > seen && !__atomic_compare_exchange_n (
+        peak, &seen, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+    ) )
+        ;
+}
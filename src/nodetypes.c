@@ -1,4 +1,4 @@
-//#include "nodetypes.h"
+#include "nodetypes.h"
 #define STRING(x) #x
 char *node_string[26] = {
     STRING(PROGRAM),
@@ -29,3 +29,11 @@ char *node_string[26] = {
     STRING(STRING_DATA)
 };
 #undef STRING
+
+char *operator_string[14] = {
+    [OP_NONE] = "",
+    [OP_ADD] = "+", [OP_SUB] = "-", [OP_MUL] = "*", [OP_DIV] = "/",
+    [OP_LSHIFT] = "<<", [OP_RSHIFT] = ">>",
+    [OP_AND] = "&", [OP_OR] = "|", [OP_XOR] = "^", [OP_NOT] = "~",
+    [OP_EQ] = "=", [OP_LT] = "<", [OP_GT] = ">"
+};
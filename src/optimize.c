@@ -0,0 +1,691 @@
+#include <vslc.h>
+
+/* Constant propagation through the parameters and locals of functions,
+ * with folding and algebraic simplification of the expressions it makes
+ * constant. A function body is walked once, in the order it executes:
+ * the value a variable is known to have is kept as it is assigned, the
+ * branches of an if statement keep what they agree on, and a loop forgets
+ * the variables it assigns, as they may change in any iteration. Globals
+ * are never known, as calls may assign them.
+ *
+ * Code that is never run is left out on the way: statements that follow
+ * a return or continue in their list, and then the functions that no
+ * call from the entry function reaches, with globals only they refer to.
+ */
+
+#define OPTIMIZE_CAPACITY 16
+
+/* What is known about a variable, logged before it changes so the state
+ * where the branches of an if statement part can be restored
+ */
+typedef struct {
+    uint32_t var;
+    bool known;
+    int64_t value;
+} fact_t;
+
+typedef struct {
+    uint32_t changes;           /* Log entries made in the branches */
+    uint32_t held;              /* Facts at the end of the then branch */
+    bool dead, then_dead;       /* Whether the statement and the then
+                                   branch are unreachable at their ends */
+} branch_t;
+
+typedef struct {
+    uint32_t changes;           /* Log entries made in the loop */
+    bool dead;
+} loop_t;
+
+/* Pre-order positions a loop spans */
+typedef struct {
+    uint32_t start, end;
+} span_t;
+
+typedef struct {
+    compiler_t *compiler;
+    symbol_t *function;
+    uint32_t n_variables;       /* Parameters, then locals */
+    bool *known;
+    int64_t *values;
+    uint32_t *seen, *slots, serial;
+    bool dead;                  /* Whether the statement is unreachable */
+
+    /* Positions of the assignments to each variable, in order, from
+     * assignments[first[v]] to assignments[first[v+1]]
+     */
+    uint32_t *assignments, *first, n_assignments;
+    span_t *spans;              /* Loops in pre-order */
+    uint32_t n_spans, spans_capacity, next_loop;
+
+    fact_t *changes;
+    uint32_t n_changes, changes_capacity;
+    fact_t *held;
+    uint32_t n_held, held_capacity;
+    branch_t *branches;
+    uint32_t n_branches, branches_capacity;
+    loop_t *loops;
+    uint32_t n_loops, loops_capacity;
+    walk_t walk;
+} optimizer_t;
+
+
+/* Room for one more element in an array of 'size' byte elements, in the
+ * work space of passes over the tree
+ */
+void *
+grow_array ( void *array, uint32_t count, uint32_t *capacity, size_t size )
+{
+    if ( count < *capacity )
+        return array;
+    uint32_t grown = (*capacity > 0) ? 2 * *capacity : OPTIMIZE_CAPACITY;
+    array = mem_realloc ( MEM_WORK, array, *capacity * size, grown * size );
+    if ( array == NULL )
+    {
+        fprintf ( stderr, "Out of memory for a pass over the tree\n" );
+        exit ( EXIT_FAILURE );
+    }
+    *capacity = grown;
+    return array;
+}
+
+
+#define APPEND(opt, array, item) do { \
+    (opt)->array = grow_array ( (opt)->array, (opt)->n_##array, \
+        &(opt)->array##_capacity, sizeof(*(opt)->array) ); \
+    (opt)->array[(opt)->n_##array++] = (item); \
+} while ( false )
+
+
+/* The exponent k of a constant 2^k with 0 < k < 63, or else 0 */
+int
+power_of_two ( int64_t value )
+{
+    if ( value < 2 || (value & (value - 1)) != 0 )
+        return 0;
+    int k = 0;
+    while ( value > 1 )
+    {
+        value >>= 1;
+        k += 1;
+    }
+    return k;
+}
+
+
+static void
+set_fact ( optimizer_t *opt, uint32_t var, bool known, int64_t value )
+{
+    if ( opt->known[var] == known && (!known || opt->values[var] == value) )
+        return;
+    fact_t old = {
+        .var = var, .known = opt->known[var], .value = opt->values[var]
+    };
+    APPEND ( opt, changes, old );
+    opt->known[var] = known;
+    opt->values[var] = value;
+}
+
+
+/* Restore the facts logged from 'mark' on. With 'hold', the facts that
+ * are replaced are held first, once for every variable.
+ */
+static void
+undo_changes ( optimizer_t *opt, uint32_t mark, bool hold )
+{
+    opt->serial += 1;
+    for ( uint32_t c = opt->n_changes; c-- > mark; )
+    {
+        fact_t *change = &opt->changes[c];
+        if ( hold && opt->seen[change->var] != opt->serial )
+        {
+            opt->seen[change->var] = opt->serial;
+            fact_t held = {
+                .var = change->var,
+                .known = opt->known[change->var],
+                .value = opt->values[change->var]
+            };
+            APPEND ( opt, held, held );
+        }
+        opt->known[change->var] = change->known;
+        opt->values[change->var] = change->value;
+    }
+    opt->n_changes = mark;
+}
+
+
+static void
+join_fact (
+    optimizer_t *opt, bool then_dead, bool else_dead, fact_t then, fact_t other
+)
+{
+    if ( then_dead && else_dead )
+        return;
+    if ( then_dead )
+        then = other;
+    else if ( !else_dead )
+        then.known = then.known && other.known && then.value == other.value;
+    set_fact ( opt, then.var, then.known, then.value );
+}
+
+
+/* Keep what the branches of an if statement agree on, where they are
+ * reached. The facts at the end of the then branch are held from
+ * branch->held, those of the else branch are still current.
+ */
+static void
+join_branches ( optimizer_t *opt, branch_t *branch )
+{
+    bool then_dead = branch->then_dead, else_dead = opt->dead;
+    uint32_t else_held = opt->n_held;
+    undo_changes ( opt, branch->changes, true );
+
+    opt->serial += 1;
+    for ( uint32_t h = branch->held; h < else_held; h++ )
+    {
+        opt->seen[opt->held[h].var] = opt->serial;
+        opt->slots[opt->held[h].var] = h;
+    }
+    for ( uint32_t h = else_held; h < opt->n_held; h++ )
+    {
+        fact_t other = opt->held[h], then = other;
+        then.known = opt->known[other.var];
+        then.value = opt->values[other.var];
+        if ( opt->seen[other.var] == opt->serial )
+        {
+            then = opt->held[opt->slots[other.var]];
+            opt->seen[other.var] = 0;
+        }
+        join_fact ( opt, then_dead, else_dead, then, other );
+    }
+    for ( uint32_t h = branch->held; h < else_held; h++ )
+    {
+        fact_t then = opt->held[h], other = then;
+        if ( opt->seen[then.var] != opt->serial )
+            continue;
+        other.known = opt->known[then.var];
+        other.value = opt->values[then.var];
+        join_fact ( opt, then_dead, else_dead, then, other );
+    }
+    opt->n_held = branch->held;
+    opt->dead = then_dead && else_dead;
+}
+
+
+/* Whether a variable is assigned within the positions of a loop */
+static bool
+assigned_in ( optimizer_t *opt, uint32_t var, span_t *span )
+{
+    uint32_t low = opt->first[var], high = opt->first[var + 1];
+    while ( low < high )
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if ( opt->assignments[middle] < span->start )
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low < opt->first[var + 1] && opt->assignments[low] <= span->end;
+}
+
+
+/* Number the nodes of a function body in pre-order, and find where each
+ * loop is and where each variable is assigned
+ */
+static void
+find_assignments ( optimizer_t *opt )
+{
+    uint32_t n = opt->n_variables;
+    struct { uint32_t var, position; } *pairs = NULL;
+    uint32_t n_pairs = 0, pairs_capacity = 0;
+    uint32_t n_open = 0, open_capacity = 0, *open = NULL;
+    uint32_t position = 0;
+    walk_event_t event;
+    node_t **slot;
+    walk_init ( &opt->walk, &opt->function->node );
+    while ( (event = walk_next ( &opt->walk, &slot )) != WALK_DONE )
+    {
+        node_t *node = *slot;
+        if ( event == WALK_LEAVE )
+        {
+            if ( node->type == WHILE_STATEMENT )
+                opt->spans[open[--n_open]].end = position;
+            continue;
+        }
+        position += 1;
+        if ( node->type == WHILE_STATEMENT )
+        {
+            open = grow_array ( open, n_open, &open_capacity, sizeof(uint32_t) );
+            open[n_open++] = opt->n_spans;
+            span_t span = { .start = position, .end = position };
+            APPEND ( opt, spans, span );
+        }
+        int64_t var = (node->type == ASSIGNMENT_STATEMENT) ?
+            variable_index ( opt->function, node->children[0]->entry ) : -1;
+        if ( var >= 0 )
+        {
+            pairs = grow_array ( pairs, n_pairs, &pairs_capacity, sizeof(*pairs) );
+            pairs[n_pairs].var = var;
+            pairs[n_pairs++].position = position;
+        }
+    }
+    walk_finalize ( &opt->walk );
+
+    /* Sort the positions by variable, keeping their order */
+    opt->first = mem_calloc ( MEM_WORK, n + 2, sizeof(uint32_t) );
+    opt->assignments = mem_alloc ( MEM_WORK, (n_pairs + 1) * sizeof(uint32_t) );
+    opt->n_assignments = n_pairs;
+    for ( uint32_t p = 0; p < n_pairs; p++ )
+        opt->first[pairs[p].var + 2] += 1;
+    for ( uint32_t v = 0; v < n; v++ )
+        opt->first[v + 2] += opt->first[v + 1];
+    for ( uint32_t p = 0; p < n_pairs; p++ )
+        opt->assignments[opt->first[pairs[p].var + 1]++] = pairs[p].position;
+    mem_free ( MEM_WORK, pairs, pairs_capacity * sizeof(*pairs) );
+    mem_free ( MEM_WORK, open, open_capacity * sizeof(uint32_t) );
+}
+
+
+/* Whether evaluating an expression does nothing but give its value, so
+ * it can be left out: it calls nothing and divides by nothing
+ */
+static bool
+pure ( node_t *root )
+{
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    bool pure = true;
+    walk_init ( &walk, &root );
+    while ( pure && (event = walk_next ( &walk, &slot )) != WALK_DONE )
+    {
+        node_t *node = *slot;
+        if ( event == WALK_ENTER && node->type == EXPRESSION )
+            pure = node->op != OP_DIV
+                && !(node->op == OP_NONE && node->n_children == 2);
+    }
+    walk_finalize ( &walk );
+    return pure;
+}
+
+
+/* Fold an operator on constants as the generated code computes it: with
+ * wrapping arithmetic, shift counts taken modulo 64 and logical right
+ * shifts. Division that would trap is left to run.
+ */
+bool
+fold_operator ( operator_t op, int64_t *x, int64_t y )
+{
+    uint64_t a = *x, b = y;
+    switch ( op )
+    {
+        case OP_ADD: a += b; break;
+        case OP_SUB: a -= b; break;
+        case OP_MUL: a *= b; break;
+        case OP_DIV:
+            if ( y == 0 || (*x == INT64_MIN && y == -1) )
+                return false;
+            a = *x / y;
+            break;
+        case OP_LSHIFT: a <<= (b & 63); break;
+        case OP_RSHIFT: a >>= (b & 63); break;
+        case OP_AND: a &= b; break;
+        case OP_OR: a |= b; break;
+        case OP_XOR: a ^= b; break;
+        default: return false;
+    }
+    *x = (int64_t) a;
+    return true;
+}
+
+
+/* Replace an expression by one of its operands */
+static node_t *
+operand ( optimizer_t *opt, node_t *node, int kept )
+{
+    node_t *other = node->children[1 - kept];
+    node_t *result = node->children[kept];
+    if ( other->type == NUMBER_DATA )
+        node_finalize ( opt->compiler, other );
+    node_finalize ( opt->compiler, node );
+    return result;
+}
+
+
+/* Replace an expression by its constant operand 0, leaving out the other
+ * operand, which must be pure
+ */
+static node_t *
+zero ( optimizer_t *opt, node_t *node, int constant )
+{
+    node_t *result = node->children[constant];
+    node_finalize ( opt->compiler, node );
+    return result;
+}
+
+
+/* Simplify an expression whose operands are simplified, returning the
+ * node that replaces it. Identities drop an operand, and multiplication
+ * by a power of two becomes a left shift.
+ */
+static node_t *
+simplify_expression ( optimizer_t *opt, node_t *node )
+{
+    if ( node->op == OP_NONE )
+        return node;
+    node_t *left = node->children[0];
+    if ( node->n_children == 1 )
+    {
+        if ( left->type != NUMBER_DATA )
+            return node;
+        uint64_t x = left->data.number;
+        left->data.number = (node->op == OP_SUB) ? (int64_t) -x : (int64_t) ~x;
+        node_finalize ( opt->compiler, node );
+        return left;
+    }
+
+    node_t *right = node->children[1];
+    if ( left->type == NUMBER_DATA && right->type == NUMBER_DATA
+        && fold_operator ( node->op, &left->data.number, right->data.number ) )
+        return operand ( opt, node, 0 );
+
+    /* Operands that are constants, with the constant second where the
+     * operator commutes
+     */
+    int c = (right->type == NUMBER_DATA) ? 1
+        : (left->type == NUMBER_DATA) ? 0 : -1;
+    if ( c < 0 )
+        return node;
+    int64_t k = node->children[c]->data.number;
+    bool commutes = node->op == OP_ADD || node->op == OP_MUL
+        || node->op == OP_AND || node->op == OP_OR || node->op == OP_XOR;
+    if ( c == 0 && !commutes )
+        return node;
+    switch ( node->op )
+    {
+        case OP_ADD: case OP_SUB: case OP_OR: case OP_XOR:
+        case OP_LSHIFT: case OP_RSHIFT:
+            if ( k == 0 )
+                return operand ( opt, node, 1 - c );
+            break;
+        case OP_DIV:
+            if ( k == 1 )
+                return operand ( opt, node, 0 );
+            break;
+        case OP_AND:
+            if ( k == 0 && pure ( node->children[1 - c] ) )
+                return zero ( opt, node, c );
+            break;
+        case OP_MUL:
+            if ( k == 1 )
+                return operand ( opt, node, 1 - c );
+            if ( k == 0 && pure ( node->children[1 - c] ) )
+                return zero ( opt, node, c );
+            if ( power_of_two ( k ) > 0 )
+            {
+                node_t *constant = node->children[c];
+                constant->data.number = power_of_two ( k );
+                node->op = OP_LSHIFT;
+                node->children[0] = node->children[1 - c];
+                node->children[1] = constant;
+            }
+            break;
+        default:
+            break;
+    }
+    return node;
+}
+
+
+static node_t **
+optimize_if_statement ( optimizer_t *opt, walk_frame_t *frame )
+{
+    node_t *node = *frame->slot;
+    switch ( frame->stage++ )
+    {
+        case 0:
+            return &node->children[0];
+        case 1:
+        {
+            branch_t branch = {
+                .changes = opt->n_changes, .held = opt->n_held,
+                .dead = opt->dead
+            };
+            APPEND ( opt, branches, branch );
+            return &node->children[1];
+        }
+        case 2:
+        {
+            branch_t *branch = &opt->branches[opt->n_branches - 1];
+            branch->then_dead = opt->dead;
+            undo_changes ( opt, branch->changes, true );
+            opt->dead = branch->dead;
+            if ( node->n_children > 2 )
+                return &node->children[2];
+        }
+        /* Fall through, there is no else branch */
+        default:
+            join_branches ( opt, &opt->branches[--opt->n_branches] );
+            return NULL;
+    }
+}
+
+
+static node_t **
+optimize_while_statement ( optimizer_t *opt, walk_frame_t *frame )
+{
+    node_t *node = *frame->slot;
+    switch ( frame->stage++ )
+    {
+        case 0:
+        {
+            span_t *span = &opt->spans[opt->next_loop++];
+            for ( uint32_t v = 0; v < opt->n_variables; v++ )
+                if ( opt->known[v] && assigned_in ( opt, v, span ) )
+                    set_fact ( opt, v, false, 0 );
+            loop_t loop = { .changes = opt->n_changes, .dead = opt->dead };
+            APPEND ( opt, loops, loop );
+            return &node->children[0];
+        }
+        case 1:
+            return &node->children[1];
+        default:
+        {
+            /* The loop is left from its condition, where the facts are
+             * those it was entered with
+             */
+            loop_t *loop = &opt->loops[--opt->n_loops];
+            undo_changes ( opt, loop->changes, false );
+            opt->dead = loop->dead;
+            return NULL;
+        }
+    }
+}
+
+
+/* Leave out the statements of a list from 'first' on, which are never
+ * run. The loops among them are passed over in the spans of the function.
+ */
+static void
+drop_statements ( optimizer_t *opt, node_t *list, uint32_t first )
+{
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    walk_init ( &walk, NULL );
+    for ( uint32_t s = first; s < list->n_children; s++ )
+    {
+        walk_push ( &walk, &list->children[s] );
+        while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+        {
+            if ( event == WALK_ENTER && (*slot)->type == WHILE_STATEMENT )
+                opt->next_loop += 1;
+            else if ( event == WALK_LEAVE )
+                node_finalize ( opt->compiler, *slot );
+        }
+    }
+    walk_finalize ( &walk );
+    list->n_children = first;
+}
+
+
+/* Optimize the node of a frame, up to its next child */
+static node_t **
+optimize_node ( optimizer_t *opt, walk_frame_t *frame )
+{
+    node_t *node = *frame->slot;
+    int64_t var;
+    switch ( node->type )
+    {
+        case DECLARATION_LIST:
+            return NULL;
+        case IDENTIFIER_DATA:
+            var = variable_index ( opt->function, node->entry );
+            if ( var >= 0 && opt->known[var] )
+            {
+                node->type = NUMBER_DATA;
+                node->data.number = opt->values[var];
+                node->entry = NULL;
+            }
+            return NULL;
+        case ASSIGNMENT_STATEMENT:
+            if ( frame->stage++ == 0 )
+                return &node->children[1];
+            var = variable_index ( opt->function, node->children[0]->entry );
+            if ( var >= 0 )
+                set_fact ( opt, var, node->children[1]->type == NUMBER_DATA,
+                    node->children[1]->data.number
+                );
+            return NULL;
+        case NULL_STATEMENT:
+            opt->dead = true;
+            return NULL;
+        case IF_STATEMENT:
+            return optimize_if_statement ( opt, frame );
+        case WHILE_STATEMENT:
+            return optimize_while_statement ( opt, frame );
+        case STATEMENT_LIST:
+            /* The rest of a list after a return or continue */
+            if ( opt->dead && frame->stage > 0 )
+                drop_statements ( opt, node, frame->stage );
+            /* Fall through */
+        default:
+            while ( frame->stage < node->n_children )
+            {
+                node_t **child = &node->children[frame->stage++];
+                if ( *child != NULL )
+                    return child;
+            }
+            if ( node->type == EXPRESSION )
+                *frame->slot = simplify_expression ( opt, node );
+            else if ( node->type == RETURN_STATEMENT )
+                opt->dead = true;
+            return NULL;
+    }
+}
+
+
+static void
+optimize_function ( compiler_t *compiler, symbol_t *function )
+{
+    uint32_t n = tlhash_size ( function->locals );
+    optimizer_t opt = {
+        .compiler = compiler,
+        .function = function,
+        .n_variables = n,
+        .known = mem_calloc ( MEM_WORK, n + 1, sizeof(bool) ),
+        .values = mem_calloc ( MEM_WORK, n + 1, sizeof(int64_t) ),
+        .seen = mem_calloc ( MEM_WORK, n + 1, sizeof(uint32_t) ),
+        .slots = mem_alloc ( MEM_WORK, (n + 1) * sizeof(uint32_t) )
+    };
+    find_assignments ( &opt );
+
+    walk_init ( &opt.walk, &function->node );
+    while ( opt.walk.depth > 0 )
+    {
+        node_t **child = optimize_node ( &opt, WALK_TOP ( &opt.walk ) );
+        if ( child != NULL )
+            walk_push ( &opt.walk, child );
+        else
+            opt.walk.depth -= 1;
+    }
+    walk_finalize ( &opt.walk );
+
+    mem_free ( MEM_WORK, opt.known, (n + 1) * sizeof(bool) );
+    mem_free ( MEM_WORK, opt.values, (n + 1) * sizeof(int64_t) );
+    mem_free ( MEM_WORK, opt.seen, (n + 1) * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, opt.slots, (n + 1) * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, opt.first, (n + 2) * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, opt.assignments,
+        (opt.n_assignments + 1) * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, opt.spans, opt.spans_capacity * sizeof(span_t) );
+    mem_free ( MEM_WORK, opt.changes, opt.changes_capacity * sizeof(fact_t) );
+    mem_free ( MEM_WORK, opt.held, opt.held_capacity * sizeof(fact_t) );
+    mem_free ( MEM_WORK, opt.branches, opt.branches_capacity * sizeof(branch_t) );
+    mem_free ( MEM_WORK, opt.loops, opt.loops_capacity * sizeof(loop_t) );
+}
+
+
+/* Mark the functions and globals that the entry function does not reach
+ * through calls as unused. Functions are visited once each, from a list
+ * of those found and not yet visited.
+ */
+static void
+find_unused_symbols ( compiler_t *compiler )
+{
+    size_t n_globals = tlhash_size ( compiler->global_names );
+    symbol_t **found = mem_alloc ( MEM_WORK, (n_globals + 1) * sizeof(symbol_t *) );
+    size_t n_found = 0;
+    symbol_t *symbol;
+    tlhash_cursor_t cursor = TLHASH_CURSOR_INIT;
+    while ( tlhash_next (
+        compiler->global_names, &cursor, NULL, NULL, (void **)&symbol
+    ) == TLHASH_SUCCESS )
+    {
+        symbol->unused = true;
+        if ( symbol->type == SYM_FUNCTION && symbol->seq == 0 )
+        {
+            symbol->unused = false;
+            found[n_found++] = symbol;
+        }
+    }
+
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    walk_init ( &walk, NULL );
+    while ( n_found > 0 )
+    {
+        symbol = found[--n_found];
+        if ( symbol->node != NULL )
+            walk_push ( &walk, &symbol->node );
+        while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+        {
+            symbol_t *entry = (*slot)->entry;
+            if ( event != WALK_ENTER || entry == NULL || !entry->unused )
+                continue;
+            if ( entry->type == SYM_FUNCTION )
+                found[n_found++] = entry;
+            if ( entry->type == SYM_FUNCTION || entry->type == SYM_GLOBAL_VAR )
+                entry->unused = false;
+        }
+    }
+    walk_finalize ( &walk );
+    mem_free ( MEM_WORK, found, (n_globals + 1) * sizeof(symbol_t *) );
+}
+
+
+/* Optimize the bound tree of every function, then find what is unused */
+void
+optimize_tree ( compiler_t *compiler )
+{
+    symbol_t *symbol;
+    tlhash_cursor_t cursor = TLHASH_CURSOR_INIT;
+    while ( tlhash_next (
+        compiler->global_names, &cursor, NULL, NULL, (void **)&symbol
+    ) == TLHASH_SUCCESS )
+    {
+        if ( symbol->type == SYM_FUNCTION && symbol->node != NULL )
+            optimize_function ( compiler, symbol );
+    }
+    find_unused_symbols ( compiler );
+}
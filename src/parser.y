@@ -1,21 +1,33 @@
 %{
 #include <vslc.h>
 
-#define N0C(n,t,d) do { \
-    node_init ( n = malloc(sizeof(node_t)), t, d, 0 ); \
+/* The parser stack grows on the heap, as deep as the program nests */
+#define YYMAXDEPTH (1 << 24)
+
+#define N0C(n,t,o) do { \
+    n = node_alloc ( compiler, 0 ); \
+    node_init ( n, t, o, 0 ); \
 } while ( false )
-#define N1C(n,t,d,a) do { \
-    node_init ( n = malloc(sizeof(node_t)), t, d, 1, a ); \
+#define N1C(n,t,o,a) do { \
+    n = node_alloc ( compiler, 1 ); \
+    node_init ( n, t, o, 1, a ); \
 } while ( false )
-#define N2C(n,t,d,a,b) do { \
-    node_init ( n = malloc(sizeof(node_t)), t, d, 2, a, b ); \
+#define N2C(n,t,o,a,b) do { \
+    n = node_alloc ( compiler, 2 ); \
+    node_init ( n, t, o, 2, a, b ); \
 } while ( false )
-#define N3C(n,t,d,a,b,c) do { \
-    node_init ( n = malloc(sizeof(node_t)), t, d, 3, a, b, c ); \
+#define N3C(n,t,o,a,b,c) do { \
+    n = node_alloc ( compiler, 3 ); \
+    node_init ( n, t, o, 3, a, b, c ); \
 } while ( false )
 
 %}
 
+/* Reentrant, the tree is built in the context passed to yyparse */
+%define api.pure full
+%parse-param { compiler_t *compiler } { void *scanner }
+%lex-param { void *scanner }
+
 %left '|'
 %left '^'
 %left '&'
@@ -31,148 +43,160 @@
 
 %%
 program :
-      global_list { N1C ( root, PROGRAM, NULL, $1 ); }
+      global_list { N1C ( compiler->root, PROGRAM, OP_NONE, $1 ); }
     ;
 global_list :
-      global { N1C ( $$, GLOBAL_LIST, NULL, $1 ); }
-    | global_list global { N2C ( $$, GLOBAL_LIST, NULL, $1, $2 ); }
+      global { N1C ( $$, GLOBAL_LIST, OP_NONE, $1 ); }
+    | global_list global { $$ = node_append ( compiler, $1, $2 ); }
     ;
 global:
-      function { N1C ( $$, GLOBAL, NULL, $1 ); }
-    | declaration { N1C ( $$, GLOBAL, NULL, $1 ); }
+      function { N1C ( $$, GLOBAL, OP_NONE, $1 ); }
+    | declaration { N1C ( $$, GLOBAL, OP_NONE, $1 ); }
     ;
 statement_list :
-      statement { N1C ( $$, STATEMENT_LIST, NULL, $1 ); }
-    | statement_list statement { N2C ( $$, STATEMENT_LIST, NULL, $1, $2 ); }
+      statement { N1C ( $$, STATEMENT_LIST, OP_NONE, $1 ); }
+    | statement_list statement { $$ = node_append ( compiler, $1, $2 ); }
     ;
 print_list :
-      print_item { N1C ( $$, PRINT_LIST, NULL, $1 ); }
-    | print_list ',' print_item { N2C ( $$, PRINT_LIST, NULL, $1, $3 ); }
+      print_item { N1C ( $$, PRINT_LIST, OP_NONE, $1 ); }
+    | print_list ',' print_item { $$ = node_append ( compiler, $1, $3 ); }
     ;
 expression_list :
-      expression { N1C ( $$, EXPRESSION_LIST, NULL, $1 ); }
-    | expression_list ',' expression { N2C($$, EXPRESSION_LIST, NULL, $1, $3); }
+      expression { N1C ( $$, EXPRESSION_LIST, OP_NONE, $1 ); }
+    | expression_list ',' expression { $$ = node_append ( compiler, $1, $3 ); }
     ;
 variable_list :
-      identifier { N1C ( $$, VARIABLE_LIST, NULL, $1 ); }
-    | variable_list ',' identifier { N2C ( $$, VARIABLE_LIST, NULL, $1, $3 ); }
+      identifier { N1C ( $$, VARIABLE_LIST, OP_NONE, $1 ); }
+    | variable_list ',' identifier { $$ = node_append ( compiler, $1, $3 ); }
     ;
 argument_list :
-      expression_list { N1C ( $$, ARGUMENT_LIST, NULL, $1 ); }
+      expression_list { N1C ( $$, ARGUMENT_LIST, OP_NONE, $1 ); }
     | /* epsilon */ { $$ = NULL; }
     ;
 parameter_list :
-      variable_list { N1C ( $$, PARAMETER_LIST, NULL, $1 ); }
+      variable_list { N1C ( $$, PARAMETER_LIST, OP_NONE, $1 ); }
     | /* epsilon */ { $$ = NULL; }
     ;
 declaration_list :
-      declaration { N1C ( $$, DECLARATION_LIST, NULL, $1 ); }
-    | declaration_list declaration { N2C ($$, DECLARATION_LIST, NULL, $1, $2); }
+      declaration { N1C ( $$, DECLARATION_LIST, OP_NONE, $1 ); }
+    | declaration_list declaration { $$ = node_append ( compiler, $1, $2 ); }
     ;
 function :
       FUNC identifier '(' parameter_list ')' statement
-        { N3C ( $$, FUNCTION, NULL, $2, $4, $6 ); }
+        { N3C ( $$, FUNCTION, OP_NONE, $2, $4, $6 ); }
     ;
 statement :
-      assignment_statement { N1C ( $$, STATEMENT, NULL, $1 ); }
-    | return_statement { N1C ( $$, STATEMENT, NULL, $1 ); }
-    | print_statement { N1C ( $$, STATEMENT, NULL, $1 ); }
-    | if_statement { N1C ( $$, STATEMENT, NULL, $1 ); }
-    | while_statement { N1C ( $$, STATEMENT, NULL, $1 ); }
-    | null_statement { N1C ( $$, STATEMENT, NULL, $1 ); }
-    | block { N1C ( $$, STATEMENT, NULL, $1 ); }
+      assignment_statement { N1C ( $$, STATEMENT, OP_NONE, $1 ); }
+    | return_statement { N1C ( $$, STATEMENT, OP_NONE, $1 ); }
+    | print_statement { N1C ( $$, STATEMENT, OP_NONE, $1 ); }
+    | if_statement { N1C ( $$, STATEMENT, OP_NONE, $1 ); }
+    | while_statement { N1C ( $$, STATEMENT, OP_NONE, $1 ); }
+    | null_statement { N1C ( $$, STATEMENT, OP_NONE, $1 ); }
+    | block { N1C ( $$, STATEMENT, OP_NONE, $1 ); }
     ;
 block :
       OPENBLOCK declaration_list statement_list CLOSEBLOCK
-        { N2C ($$, BLOCK, NULL, $2, $3); }
-    | OPENBLOCK statement_list CLOSEBLOCK { N1C ($$, BLOCK, NULL, $2 ); }
+        { N2C ($$, BLOCK, OP_NONE, $2, $3); }
+    | OPENBLOCK statement_list CLOSEBLOCK { N1C ($$, BLOCK, OP_NONE, $2 ); }
     ;
 assignment_statement :
       identifier ':' '=' expression
-        { N2C ( $$, ASSIGNMENT_STATEMENT, NULL, $1, $4 ); }
+        { N2C ( $$, ASSIGNMENT_STATEMENT, OP_NONE, $1, $4 ); }
     ;
 return_statement :
       RETURN expression
-        { N1C ( $$, RETURN_STATEMENT, NULL, $2 ); }
+        { N1C ( $$, RETURN_STATEMENT, OP_NONE, $2 ); }
     ;
 print_statement :
       PRINT print_list
-        { N1C ( $$, PRINT_STATEMENT, NULL, $2 ); }
+        { N1C ( $$, PRINT_STATEMENT, OP_NONE, $2 ); }
     ;
 null_statement :
       CONTINUE
-        { N0C ( $$, NULL_STATEMENT, NULL ); }
+        { N0C ( $$, NULL_STATEMENT, OP_NONE ); }
     ;
 if_statement :
       IF relation THEN statement
-        { N2C ( $$, IF_STATEMENT, NULL, $2, $4 ); }
+        { N2C ( $$, IF_STATEMENT, OP_NONE, $2, $4 ); }
     | IF relation THEN statement ELSE statement
-        { N3C ( $$, IF_STATEMENT, NULL, $2, $4, $6 ); }
+        { N3C ( $$, IF_STATEMENT, OP_NONE, $2, $4, $6 ); }
     ;
 while_statement :
       WHILE relation DO statement
-        { N2C ( $$, WHILE_STATEMENT, NULL, $2, $4 ); }
+        { N2C ( $$, WHILE_STATEMENT, OP_NONE, $2, $4 ); }
     ;
 relation:
       expression '=' expression
-        { N2C ( $$, RELATION, strdup("="), $1, $3 ); }
+        { N2C ( $$, RELATION, OP_EQ, $1, $3 ); }
     | expression '<' expression
-        { N2C ( $$, RELATION, strdup("<"), $1, $3 ); }
+        { N2C ( $$, RELATION, OP_LT, $1, $3 ); }
     | expression '>' expression
-        { N2C ( $$, RELATION, strdup(">"), $1, $3 ); }
+        { N2C ( $$, RELATION, OP_GT, $1, $3 ); }
     ;
 expression :
       expression '|' expression
-        { N2C ( $$, EXPRESSION, strdup("|"), $1, $3 ); }
+        { N2C ( $$, EXPRESSION, OP_OR, $1, $3 ); }
     | expression '^' expression
-        { N2C ( $$, EXPRESSION, strdup("^"), $1, $3 ); }
+        { N2C ( $$, EXPRESSION, OP_XOR, $1, $3 ); }
     | expression '&' expression
-        { N2C ( $$, EXPRESSION, strdup("&"), $1, $3 ); }
+        { N2C ( $$, EXPRESSION, OP_AND, $1, $3 ); }
     | expression RSHIFT expression
-        { N2C ( $$, EXPRESSION, strdup(">>"), $1, $3 ); }
+        { N2C ( $$, EXPRESSION, OP_RSHIFT, $1, $3 ); }
     | expression LSHIFT expression
-        { N2C ( $$, EXPRESSION, strdup("<<"), $1, $3 ); }
+        { N2C ( $$, EXPRESSION, OP_LSHIFT, $1, $3 ); }
     |  expression '+' expression
-        { N2C ( $$, EXPRESSION, strdup("+"), $1, $3 ); }
+        { N2C ( $$, EXPRESSION, OP_ADD, $1, $3 ); }
     | expression '-' expression
-        { N2C ( $$, EXPRESSION, strdup("-"), $1, $3 ); }
+        { N2C ( $$, EXPRESSION, OP_SUB, $1, $3 ); }
     | expression '*' expression
-        { N2C ( $$, EXPRESSION, strdup("*"), $1, $3 ); }
+        { N2C ( $$, EXPRESSION, OP_MUL, $1, $3 ); }
     | expression '/' expression
-        { N2C ( $$, EXPRESSION, strdup("/"), $1, $3 ); }
+        { N2C ( $$, EXPRESSION, OP_DIV, $1, $3 ); }
     | '-' expression %prec UMINUS
-        { N1C ( $$, EXPRESSION, strdup("-"), $2 ); }
+        { N1C ( $$, EXPRESSION, OP_SUB, $2 ); }
     | '~' expression %prec UMINUS
-        { N1C ( $$, EXPRESSION, strdup("~"), $2 ); }
+        { N1C ( $$, EXPRESSION, OP_NOT, $2 ); }
     | '(' expression ')' { $$ = $2; }
-    | number { N1C ( $$, EXPRESSION, NULL, $1 ); }
+    | number { N1C ( $$, EXPRESSION, OP_NONE, $1 ); }
     | identifier
-        { N1C ( $$, EXPRESSION, NULL, $1 ); }
+        { N1C ( $$, EXPRESSION, OP_NONE, $1 ); }
     | identifier '(' argument_list ')'
-        { N2C ( $$, EXPRESSION, NULL, $1, $3 ); }
+        { N2C ( $$, EXPRESSION, OP_NONE, $1, $3 ); }
     ;
 declaration :
-      VAR variable_list { N1C ( $$, DECLARATION, NULL, $2 ); }
+      VAR variable_list { N1C ( $$, DECLARATION, OP_NONE, $2 ); }
     ;
 print_item :
       expression
-        { N1C ( $$, PRINT_ITEM, NULL, $1 ); }
+        { N1C ( $$, PRINT_ITEM, OP_NONE, $1 ); }
     | string
-        { N1C ( $$, PRINT_ITEM, NULL, $1 ); }
+        { N1C ( $$, PRINT_ITEM, OP_NONE, $1 ); }
     ;
-identifier: IDENTIFIER { N0C($$, IDENTIFIER_DATA, strdup(yytext) ); }
+identifier: IDENTIFIER
+      {
+        N0C($$, IDENTIFIER_DATA, OP_NONE);
+        $$->data.name = intern (
+            &compiler->names, scanner_text(compiler), scanner_length(compiler)
+        );
+      }
 number: NUMBER
       {
-        int64_t *value = malloc ( sizeof(int64_t) );
-        *value = strtol ( yytext, NULL, 10 );
-        N0C($$, NUMBER_DATA, value );
+        N0C($$, NUMBER_DATA, OP_NONE);
+        $$->data.number = strtol ( scanner_text(compiler), NULL, 10 );
+      }
+string: STRING
+      {
+        N0C($$, STRING_DATA, OP_NONE);
+        $$->data.string = arena_strdup (
+            &compiler->tree_arena, scanner_text(compiler)
+        );
+        mem_track ( MEM_PAYLOADS, scanner_length(compiler) + 1 );
       }
-string: STRING { N0C($$, STRING_DATA, strdup(yytext) ); }
 %%
 
 int
-yyerror ( const char *error )
+yyerror ( compiler_t *compiler, void *scanner, const char *error )
 {
-    fprintf ( stderr, "%s on line %d\n", error, yylineno );
+    fprintf ( stderr, "%s on line %d\n", error, scanner_line ( compiler ) );
     exit ( EXIT_FAILURE );
 }
@@ -0,0 +1,1205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <tlhash.h>
+#include <peephole.h>
+
+/* Registers are numbered as they are encoded. Sets of registers are bit
+ * masks, where the flags count as one more register.
+ */
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15, N_REGISTERS
+};
+
+#define NO_REGISTER UINT8_MAX
+#define BIT(r) (1u << (r))
+#define FLAGS BIT(N_REGISTERS)
+#define ALL_REGISTERS (BIT(N_REGISTERS + 1) - 1)
+
+/* The frame registers are always live, no rule takes them */
+#define FRAME (BIT(RSP) | BIT(RBP))
+#define ARGUMENTS \
+    (BIT(RDI) | BIT(RSI) | BIT(RDX) | BIT(RCX) | BIT(R8) | BIT(R9))
+#define CALLER_SAVED (ARGUMENTS | BIT(RAX) | BIT(R10) | BIT(R11) | FLAGS)
+#define CALLEE_SAVED \
+    (FRAME | BIT(RBX) | BIT(R12) | BIT(R13) | BIT(R14) | BIT(R15))
+
+/* printf is only called with a format and at most one value */
+#define PRINTF_ARGUMENTS (BIT(RDI) | BIT(RSI) | BIT(RAX))
+
+/* Registers of the arguments in order, as passed by the System V ABI */
+static const uint8_t argument_registers[] = { RDI, RSI, RDX, RCX, R8, R9 };
+#define N_ARGUMENT_REGISTERS \
+    (sizeof(argument_registers) / sizeof(argument_registers[0]))
+
+static const char *registers[N_REGISTERS] = {
+    "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+    "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"
+};
+static const char *registers32[N_REGISTERS] = {
+    "%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
+    "%r8d", "%r9d", "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d"
+};
+
+#define MAX_PASSES 16
+#define NO_LINE UINT32_MAX
+
+/* How many instructions a value is forwarded over */
+#define FORWARD_DISTANCE 4
+
+/* What an instruction does, as far as the rules are concerned. Anything
+ * not known is taken to read every register.
+ */
+typedef enum {
+    C_OTHER, C_MOVE, C_LEA, C_ARITHMETIC, C_COMPARE, C_SHIFT, C_NEGATE,
+    C_NOT, C_SIGN_EXTEND, C_DIVIDE, C_PUSH, C_POP, C_EXCHANGE, C_ZERO,
+    C_CALL, C_RETURN, C_LEAVE, C_JUMP, C_BRANCH
+} class_t;
+
+/* Mnemonics without a size suffix have the name of the sized form, for
+ * instructions left with no register operand to give their size
+ */
+static const struct {
+    const char *name;
+    uint8_t class, n_operands;
+    const char *sized;
+} mnemonics[] = {
+    { "movq", C_MOVE, 2, NULL },
+    { "lea", C_LEA, 2, NULL },
+    { "leaq", C_LEA, 2, NULL },
+    { "addq", C_ARITHMETIC, 2, NULL },
+    { "subq", C_ARITHMETIC, 2, NULL },
+    { "imulq", C_ARITHMETIC, 2, NULL },
+    { "and", C_ARITHMETIC, 2, "andq" },
+    { "andq", C_ARITHMETIC, 2, NULL },
+    { "or", C_ARITHMETIC, 2, "orq" },
+    { "orq", C_ARITHMETIC, 2, NULL },
+    { "xor", C_ARITHMETIC, 2, "xorq" },
+    { "xorq", C_ARITHMETIC, 2, NULL },
+    { "cmp", C_COMPARE, 2, "cmpq" },
+    { "cmpq", C_COMPARE, 2, NULL },
+    { "test", C_COMPARE, 2, "testq" },
+    { "testq", C_COMPARE, 2, NULL },
+    { "shl", C_SHIFT, 2, "shlq" },
+    { "shlq", C_SHIFT, 2, NULL },
+    { "shr", C_SHIFT, 2, "shrq" },
+    { "shrq", C_SHIFT, 2, NULL },
+    { "sar", C_SHIFT, 2, "sarq" },
+    { "sarq", C_SHIFT, 2, NULL },
+    { "neg", C_NEGATE, 1, "negq" },
+    { "negq", C_NEGATE, 1, NULL },
+    { "not", C_NOT, 1, "notq" },
+    { "notq", C_NOT, 1, NULL },
+    { "cqto", C_SIGN_EXTEND, 0, NULL },
+    { "idivq", C_DIVIDE, 1, NULL },
+    { "pushq", C_PUSH, 1, NULL },
+    { "popq", C_POP, 1, NULL },
+    { "xchgq", C_EXCHANGE, 2, NULL },
+    { "xorl", C_ZERO, 2, NULL },
+    { "call", C_CALL, 1, NULL },
+    { "ret", C_RETURN, 0, NULL },
+    { "leave", C_LEAVE, 0, NULL },
+    { "jmp", C_JUMP, 1, NULL },
+    { "je", C_BRANCH, 1, NULL },
+    { "jne", C_BRANCH, 1, NULL },
+    { "jz", C_BRANCH, 1, NULL },
+    { "jnz", C_BRANCH, 1, NULL },
+    { "jl", C_BRANCH, 1, NULL },
+    { "jnl", C_BRANCH, 1, NULL },
+    { "jge", C_BRANCH, 1, NULL },
+    { "jg", C_BRANCH, 1, NULL },
+    { "jng", C_BRANCH, 1, NULL },
+    { "jle", C_BRANCH, 1, NULL }
+};
+#define N_MNEMONICS (sizeof(mnemonics) / sizeof(mnemonics[0]))
+#define NO_MNEMONIC UINT8_MAX
+
+typedef enum {
+    OPERAND_REGISTER, OPERAND_IMMEDIATE, OPERAND_MEMORY, OPERAND_LABEL,
+    OPERAND_OTHER
+} operand_kind_t;
+
+typedef struct {
+    uint8_t kind;           /* operand_kind_t */
+    uint8_t reg;            /* The register, or the base of memory */
+    bool byte;              /* %cl, the low byte of %rcx */
+    int64_t value;          /* Of an immediate */
+    const char *text;       /* As written, for memory and labels */
+    uint32_t length;
+} operand_t;
+
+typedef enum {
+    LINE_INSTRUCTION, LINE_LABEL, LINE_OTHER
+} line_kind_t;
+
+typedef struct {
+    uint8_t kind;           /* line_kind_t */
+    uint8_t mnemonic;       /* In mnemonics, or NO_MNEMONIC */
+    uint8_t class;          /* class_t */
+    uint8_t n_operands;
+    bool removed, rewritten;
+    uint32_t pass;          /* When a rule last changed it */
+    operand_t operands[2];
+    const char *text;       /* The line as written, without its newline */
+    uint32_t length;
+    uint32_t target;        /* The label line a jump goes to, or NO_LINE */
+    uint32_t references;    /* Jumps to a label */
+    uint32_t uses, defines; /* Registers read and written */
+    uint32_t live_in, live_out;
+} line_t;
+
+typedef struct {
+    line_t *lines;
+    uint32_t n_lines, lines_capacity;
+    uint32_t pass;          /* Counted from 1 */
+    tlhash_t labels;        /* Line + 1 of each label, by name */
+} peephole_t;
+
+typedef struct {
+    const char *name;
+    bool (*apply) ( peephole_t *p, line_t *line );
+} rule_t;
+
+
+/**************************
+ * Reading the assembly   *
+ **************************/
+
+
+static uint8_t
+find_register ( const char *text, uint32_t length, bool *byte )
+{
+    *byte = (length == 3 && memcmp ( text, "%cl", 3 ) == 0);
+    if ( *byte )
+        return RCX;
+    for ( uint8_t r = 0; r < N_REGISTERS; r++ )
+        if ( strlen ( registers[r] ) == length
+            && memcmp ( registers[r], text, length ) == 0 )
+            return r;
+    return NO_REGISTER;
+}
+
+
+static uint8_t
+find_mnemonic ( const char *text, uint32_t length )
+{
+    for ( uint8_t m = 0; m < N_MNEMONICS; m++ )
+        if ( strlen ( mnemonics[m].name ) == length
+            && memcmp ( mnemonics[m].name, text, length ) == 0 )
+            return m;
+    return NO_MNEMONIC;
+}
+
+
+/* A decimal integer, wrapping like the assembler does */
+static bool
+parse_number ( const char *text, uint32_t length, int64_t *value )
+{
+    bool negative = (length > 0 && text[0] == '-');
+    uint32_t i = negative;
+    uint64_t magnitude = 0;
+    if ( i == length )
+        return false;
+    for ( ; i < length; i++ )
+    {
+        if ( text[i] < '0' || text[i] > '9' )
+            return false;
+        magnitude = 10 * magnitude + (text[i] - '0');
+    }
+    *value = (int64_t) (negative ? -magnitude : magnitude);
+    return true;
+}
+
+
+static void
+parse_operand ( const char *text, uint32_t length, operand_t *operand )
+{
+    *operand = (operand_t) {
+        .kind = OPERAND_OTHER, .reg = NO_REGISTER,
+        .text = text, .length = length
+    };
+    if ( length == 0 )
+        return;
+    if ( text[0] == '%' )
+    {
+        operand->reg = find_register ( text, length, &operand->byte );
+        if ( operand->reg != NO_REGISTER )
+            operand->kind = OPERAND_REGISTER;
+        return;
+    }
+    if ( text[0] == '$' )
+    {
+        if ( parse_number ( text + 1, length - 1, &operand->value ) )
+            operand->kind = OPERAND_IMMEDIATE;
+        return;
+    }
+    const char *open = memchr ( text, '(', length );
+    if ( open == NULL )
+    {
+        if ( text[0] != '*' )
+            operand->kind = OPERAND_LABEL;
+        return;
+    }
+
+    /* offset(%base), or symbol(%rip), which no rule needs the base of */
+    const char *base = open + 1;
+    uint32_t base_length = text + length - base - 1;
+    if ( text[length - 1] != ')' )
+        return;
+    bool byte;
+    operand->reg = find_register ( base, base_length, &byte );
+    if ( operand->reg != NO_REGISTER && !byte )
+        operand->kind = OPERAND_MEMORY;
+    else if ( base_length == 4 && memcmp ( base, "%rip", 4 ) == 0 )
+    {
+        operand->reg = NO_REGISTER;
+        operand->kind = OPERAND_MEMORY;
+    }
+}
+
+
+/* Registers read for the value of an operand, and to find where it is */
+static uint32_t
+reads ( operand_t *operand )
+{
+    if ( operand->kind == OPERAND_MEMORY || operand->kind == OPERAND_REGISTER )
+        return (operand->reg != NO_REGISTER) ? BIT(operand->reg) : 0;
+    return 0;
+}
+
+
+static uint32_t
+address ( operand_t *operand )
+{
+    if ( operand->kind == OPERAND_MEMORY && operand->reg != NO_REGISTER )
+        return BIT(operand->reg);
+    return 0;
+}
+
+
+static uint32_t
+written ( operand_t *operand )
+{
+    return (operand->kind == OPERAND_REGISTER) ? BIT(operand->reg) : 0;
+}
+
+
+/* Whether the operands are of kinds the class of instruction takes */
+static bool
+valid_operands ( line_t *line )
+{
+    operand_t *first = &line->operands[0];
+    operand_t *last = &line->operands[line->n_operands - 1];
+    for ( uint8_t o = 0; o < line->n_operands; o++ )
+    {
+        operand_t *operand = &line->operands[o];
+        if ( operand->kind == OPERAND_OTHER )
+            return false;
+        if ( operand->byte && !(line->class == C_SHIFT && o == 0) )
+            return false;
+    }
+    switch ( line->class )
+    {
+        case C_CALL: case C_JUMP: case C_BRANCH:
+            return first->kind == OPERAND_LABEL;
+        case C_PUSH:
+            return first->kind != OPERAND_LABEL;
+        case C_LEA:
+            return first->kind == OPERAND_MEMORY
+                && last->kind == OPERAND_REGISTER;
+        case C_SHIFT:
+            return (first->kind == OPERAND_IMMEDIATE || first->byte)
+                && (last->kind == OPERAND_REGISTER || last->kind == OPERAND_MEMORY);
+        case C_ZERO:
+            return first->kind == OPERAND_REGISTER
+                && last->kind == OPERAND_REGISTER && first->reg == last->reg;
+        case C_SIGN_EXTEND: case C_RETURN: case C_LEAVE:
+            return true;
+        default:
+            if ( first->kind == OPERAND_LABEL )
+                return false;
+            return last->kind == OPERAND_REGISTER || last->kind == OPERAND_MEMORY;
+    }
+}
+
+
+/* Find the class of an instruction, and the registers it reads and writes */
+static void
+describe ( line_t *line )
+{
+    line->class = (line->mnemonic != NO_MNEMONIC
+        && mnemonics[line->mnemonic].n_operands == line->n_operands) ?
+        mnemonics[line->mnemonic].class : C_OTHER;
+    if ( line->class != C_OTHER && !valid_operands ( line ) )
+        line->class = C_OTHER;
+
+    operand_t *source = &line->operands[0];
+    operand_t *destination = &line->operands[line->n_operands - 1];
+    uint32_t uses = 0, defines = 0;
+    switch ( line->class )
+    {
+        case C_MOVE:
+            uses = reads ( source ) | address ( destination );
+            defines = written ( destination );
+            break;
+        case C_LEA:
+            uses = address ( source );
+            defines = written ( destination );
+            break;
+        case C_ARITHMETIC: case C_SHIFT:
+            uses = reads ( source ) | reads ( destination );
+            defines = written ( destination ) | FLAGS;
+            break;
+        case C_COMPARE:
+            uses = reads ( source ) | reads ( destination );
+            defines = FLAGS;
+            break;
+        case C_NEGATE:
+            uses = reads ( source );
+            defines = written ( source ) | FLAGS;
+            break;
+        case C_NOT:
+            uses = reads ( source );
+            defines = written ( source );
+            break;
+        case C_SIGN_EXTEND:
+            uses = BIT(RAX);
+            defines = BIT(RDX);
+            break;
+        case C_DIVIDE:
+            uses = BIT(RAX) | BIT(RDX) | reads ( source );
+            defines = BIT(RAX) | BIT(RDX) | FLAGS;
+            break;
+        case C_PUSH:
+            uses = reads ( source ) | BIT(RSP);
+            defines = BIT(RSP);
+            break;
+        case C_POP:
+            uses = address ( source ) | BIT(RSP);
+            defines = written ( source ) | BIT(RSP);
+            break;
+        case C_EXCHANGE:
+            uses = reads ( source ) | reads ( destination );
+            defines = written ( source ) | written ( destination );
+            break;
+        case C_ZERO:
+            defines = written ( destination ) | FLAGS;
+            break;
+        case C_CALL:
+            uses = (source->length == 6
+                && memcmp ( source->text, "printf", 6 ) == 0) ?
+                PRINTF_ARGUMENTS : ARGUMENTS | BIT(RAX);
+            uses |= BIT(RSP);
+            defines = CALLER_SAVED;
+            break;
+        case C_RETURN:
+            uses = BIT(RAX) | CALLEE_SAVED;
+            break;
+        case C_LEAVE:
+            uses = BIT(RBP);
+            defines = FRAME;
+            break;
+        case C_JUMP:
+            break;
+        case C_BRANCH:
+            uses = FLAGS;
+            break;
+        default:
+            uses = ALL_REGISTERS;
+            break;
+    }
+    line->uses = uses;
+    line->defines = defines;
+}
+
+
+/* "\tmnemonic operand, operand" */
+static void
+parse_instruction ( line_t *line )
+{
+    const char *text = line->text + 1, *end = line->text + line->length;
+    const char *word = text;
+    while ( text < end && *text != ' ' && *text != '\t' )
+        text += 1;
+    line->mnemonic = find_mnemonic ( word, text - word );
+
+    /* Operands are split at commas outside parentheses */
+    uint8_t n = 0;
+    bool extra = false;
+    while ( text < end )
+    {
+        while ( text < end && (*text == ' ' || *text == '\t') )
+            text += 1;
+        if ( text == end )
+            break;
+        const char *operand = text;
+        int depth = 0;
+        while ( text < end && (depth > 0 || *text != ',') )
+        {
+            depth += (*text == '(') - (*text == ')');
+            text += 1;
+        }
+        const char *operand_end = text;
+        while ( operand_end > operand
+            && (operand_end[-1] == ' ' || operand_end[-1] == '\t') )
+            operand_end -= 1;
+        if ( n < 2 )
+            parse_operand ( operand, operand_end - operand, &line->operands[n++] );
+        else
+            extra = true;
+        if ( text < end )
+            text += 1;
+    }
+    line->n_operands = n;
+    if ( extra )
+        line->mnemonic = NO_MNEMONIC;
+    describe ( line );
+}
+
+
+/* A call to a function whose arguments are known reads only theirs. A
+ * jump to one is a tail call, which returns from this function as well,
+ * and reads the registers kept for the caller besides.
+ */
+static void
+describe_call ( line_t *line, peephole_arguments_t arguments, void *context )
+{
+    operand_t *callee = &line->operands[0];
+    int n = (arguments != NULL && callee->kind == OPERAND_LABEL) ?
+        arguments ( context, callee->text, callee->length ) : -1;
+    if ( n < 0 )
+        return;
+    line->uses = BIT(RSP);
+    for ( size_t a = 0; a < (size_t) n && a < N_ARGUMENT_REGISTERS; a++ )
+        line->uses |= BIT(argument_registers[a]);
+    if ( line->class == C_JUMP )
+    {
+        line->class = C_RETURN;
+        line->uses |= CALLEE_SAVED;
+    }
+}
+
+
+static void
+read_lines ( peephole_t *p, const char *text, size_t size,
+    peephole_arguments_t arguments, void *context )
+{
+    uint32_t n = 0;
+    for ( size_t c = 0; c < size; c++ )
+        n += (text[c] == '\n');
+    p->lines_capacity = n + 1;
+    p->lines = mem_calloc ( MEM_PEEPHOLE, n + 1, sizeof(line_t) );
+    tlhash_init ( &p->labels, 2 * n + 8 );
+
+    const char *end = text + size;
+    while ( text < end )
+    {
+        const char *newline = memchr ( text, '\n', end - text );
+        if ( newline == NULL )
+            newline = end;
+        line_t *line = &p->lines[p->n_lines];
+        *line = (line_t) {
+            .kind = LINE_OTHER, .mnemonic = NO_MNEMONIC, .class = C_OTHER,
+            .text = text, .length = newline - text, .target = NO_LINE
+        };
+        if ( line->length > 0 && text[0] == '\t' )
+        {
+            line->kind = LINE_INSTRUCTION;
+            parse_instruction ( line );
+            if ( line->class == C_CALL || line->class == C_JUMP )
+                describe_call ( line, arguments, context );
+        }
+        else if ( line->length > 1 && text[line->length - 1] == ':'
+            && text[0] != '.' && text[0] != '#' )
+        {
+            line->kind = LINE_LABEL;
+            tlhash_insert ( &p->labels, (void *) text, line->length - 1,
+                (void *) (uintptr_t) (p->n_lines + 1) );
+        }
+        p->n_lines += 1;
+        text = newline + 1;
+    }
+
+    /* Jumps to labels outside the function keep their target unknown */
+    for ( uint32_t i = 0; i < p->n_lines; i++ )
+    {
+        line_t *line = &p->lines[i];
+        void *found;
+        if ( (line->class == C_JUMP || line->class == C_BRANCH)
+            && tlhash_lookup ( &p->labels, (void *) line->operands[0].text,
+                line->operands[0].length, &found ) == TLHASH_SUCCESS )
+        {
+            line->target = (uint32_t) (uintptr_t) found - 1;
+            p->lines[line->target].references += 1;
+        }
+    }
+}
+
+
+/*****************
+ * Live registers *
+ *****************/
+
+
+/* The registers live after each line, as the least solution of the data
+ * flow equations, iterated backwards until they hold. Code after the end
+ * and at labels outside the function may read anything.
+ */
+static void
+find_live_registers ( peephole_t *p )
+{
+    for ( uint32_t i = 0; i < p->n_lines; i++ )
+        p->lines[i].live_in = p->lines[i].live_out = 0;
+    bool changed = true;
+    while ( changed )
+    {
+        changed = false;
+        uint32_t next_in = ALL_REGISTERS;
+        for ( uint32_t i = p->n_lines; i-- > 0; )
+        {
+            line_t *line = &p->lines[i];
+            if ( line->removed )
+                continue;
+            uint32_t out = next_in, in = out;
+            if ( line->kind == LINE_INSTRUCTION )
+            {
+                uint32_t target = (line->target != NO_LINE) ?
+                    p->lines[line->target].live_in : ALL_REGISTERS;
+                if ( line->class == C_JUMP )
+                    out = target;
+                else if ( line->class == C_BRANCH )
+                    out |= target;
+                else if ( line->class == C_RETURN )
+                    out = 0;
+                in = line->uses | (out & ~line->defines) | FRAME;
+            }
+            line->live_out = out;
+            changed |= (in != line->live_in);
+            line->live_in = in;
+            next_in = in;
+        }
+    }
+}
+
+
+/***********
+ * Windows *
+ ***********/
+
+
+static uint32_t
+line_number ( peephole_t *p, line_t *line )
+{
+    return line - p->lines;
+}
+
+
+/* The line after one, passing over those that are removed */
+static line_t *
+next_line ( peephole_t *p, line_t *line )
+{
+    for ( uint32_t i = line_number ( p, line ) + 1; i < p->n_lines; i++ )
+        if ( !p->lines[i].removed )
+            return &p->lines[i];
+    return NULL;
+}
+
+
+/* The instruction right after another, if no label comes between them
+ * and no rule changed it in this pass, as its live registers are only
+ * known from before the pass
+ */
+static line_t *
+next_instruction ( peephole_t *p, line_t *line )
+{
+    line_t *next = next_line ( p, line );
+    if ( next == NULL || next->kind != LINE_INSTRUCTION || next->pass == p->pass )
+        return NULL;
+    return next;
+}
+
+
+static void
+remove_line ( peephole_t *p, line_t *line )
+{
+    line->removed = true;
+    line->pass = p->pass;
+    if ( line->kind == LINE_INSTRUCTION && line->target != NO_LINE )
+        p->lines[line->target].references -= 1;
+}
+
+
+/* Take the changed operands of a line, under a new mnemonic if 'name' is
+ * not NULL. A mnemonic without a size gets one if no register is left.
+ */
+static void
+rewrite ( peephole_t *p, line_t *line, const char *name )
+{
+    if ( name != NULL )
+        line->mnemonic = find_mnemonic ( name, strlen ( name ) );
+    bool sized = false;
+    for ( uint8_t o = 0; o < line->n_operands; o++ )
+        sized |= (line->operands[o].kind == OPERAND_REGISTER);
+    const char *sized_name = mnemonics[line->mnemonic].sized;
+    if ( !sized && sized_name != NULL )
+        line->mnemonic = find_mnemonic ( sized_name, strlen ( sized_name ) );
+    line->rewritten = true;
+    line->pass = p->pass;
+    describe ( line );
+}
+
+
+static void
+touch ( peephole_t *p, line_t *line )
+{
+    line->pass = p->pass;
+}
+
+
+static operand_t
+register_operand ( uint8_t reg )
+{
+    return (operand_t) { .kind = OPERAND_REGISTER, .reg = reg };
+}
+
+
+static operand_t
+immediate_operand ( int64_t value )
+{
+    return (operand_t) {
+        .kind = OPERAND_IMMEDIATE, .reg = NO_REGISTER, .value = value
+    };
+}
+
+
+static bool
+same_operand ( operand_t *a, operand_t *b )
+{
+    if ( a->kind != b->kind )
+        return false;
+    switch ( a->kind )
+    {
+        case OPERAND_REGISTER:
+            return a->reg == b->reg && a->byte == b->byte;
+        case OPERAND_IMMEDIATE:
+            return a->value == b->value;
+        default:
+            return a->length == b->length
+                && memcmp ( a->text, b->text, a->length ) == 0;
+    }
+}
+
+
+static bool
+is_register ( operand_t *operand, uint8_t reg )
+{
+    return operand->kind == OPERAND_REGISTER && !operand->byte
+        && operand->reg == reg;
+}
+
+
+/* Immediates of most instructions are 32 bits, sign extended */
+static bool
+fits_immediate ( int64_t value )
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+
+/*********
+ * Rules *
+ *********/
+
+
+/* Nothing falls through into the code after a jump or return, so it is
+ * only reached through a label that is jumped to
+ */
+static bool
+unreachable ( peephole_t *p, line_t *line )
+{
+    if ( line->class != C_JUMP && line->class != C_RETURN )
+        return false;
+    bool removed = false;
+    line_t *next;
+    while ( (next = next_line ( p, line )) != NULL
+        && (next->kind == LINE_INSTRUCTION
+            || (next->kind == LINE_LABEL && next->references == 0)) )
+    {
+        remove_line ( p, next );
+        removed = true;
+    }
+    return removed;
+}
+
+
+static bool
+jump_to_next ( peephole_t *p, line_t *line )
+{
+    if ( line->class != C_JUMP || line->target == NO_LINE )
+        return false;
+    for ( line_t *next = next_line ( p, line );
+        next != NULL && next->kind == LINE_LABEL; next = next_line ( p, next ) )
+    {
+        if ( line_number ( p, next ) == line->target )
+        {
+            remove_line ( p, line );
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static bool
+self_move ( peephole_t *p, line_t *line )
+{
+    if ( line->class != C_MOVE
+        || line->operands[0].kind != OPERAND_REGISTER
+        || !is_register ( &line->operands[1], line->operands[0].reg ) )
+        return false;
+    remove_line ( p, line );
+    return true;
+}
+
+
+/* Instructions that only write registers and flags that are not live */
+static bool
+dead_write ( peephole_t *p, line_t *line )
+{
+    switch ( line->class )
+    {
+        case C_MOVE: case C_LEA: case C_ARITHMETIC: case C_SHIFT:
+        case C_NEGATE: case C_NOT: case C_SIGN_EXTEND: case C_EXCHANGE:
+        case C_ZERO:
+            break;
+        default:
+            return false;
+    }
+    for ( uint8_t o = 0; o < line->n_operands; o++ )
+        if ( line->operands[o].kind == OPERAND_MEMORY
+            && (line->class == C_EXCHANGE || o == line->n_operands - 1) )
+            return false;
+    if ( line->defines & (line->live_out | FRAME) )
+        return false;
+    remove_line ( p, line );
+    return true;
+}
+
+
+/* A slot loaded right after it is stored or loaded is still in the
+ * register, and one stored right after it is loaded holds the value
+ */
+static bool
+reload ( peephole_t *p, line_t *line )
+{
+    line_t *next = next_instruction ( p, line );
+    if ( line->class != C_MOVE || next == NULL || next->class != C_MOVE )
+        return false;
+    operand_t *from = &line->operands[0], *to = &line->operands[1];
+    operand_t *source = &next->operands[0], *destination = &next->operands[1];
+    operand_t held;
+    if ( to->kind == OPERAND_MEMORY && same_operand ( to, source )
+        && (from->kind == OPERAND_REGISTER || from->kind == OPERAND_IMMEDIATE) )
+        held = *from;
+    else if ( from->kind == OPERAND_MEMORY && to->kind == OPERAND_REGISTER
+        && !(address ( from ) & BIT(to->reg)) )
+    {
+        if ( same_operand ( from, destination ) && is_register ( source, to->reg ) )
+        {
+            touch ( p, line );
+            remove_line ( p, next );
+            return true;
+        }
+        if ( !same_operand ( from, source ) )
+            return false;
+        held = *to;
+    }
+    else
+        return false;
+
+    touch ( p, line );
+    if ( is_register ( destination, held.reg ) )
+        remove_line ( p, next );
+    else
+    {
+        *source = held;
+        rewrite ( p, next, NULL );
+    }
+    return true;
+}
+
+
+/* A value pushed and popped again around code that leaves the stack and
+ * the registers alone is moved instead
+ */
+static bool
+push_pop ( peephole_t *p, line_t *line )
+{
+    if ( line->class != C_PUSH || line->operands[0].kind != OPERAND_REGISTER )
+        return false;
+    line_t *between = next_instruction ( p, line ), *pop = between;
+    if ( between != NULL && between->class != C_POP )
+        pop = next_instruction ( p, between );
+    else
+        between = NULL;
+    if ( pop == NULL || pop->class != C_POP
+        || pop->operands[0].kind != OPERAND_REGISTER )
+        return false;
+    uint8_t pushed = line->operands[0].reg, popped = pop->operands[0].reg;
+    if ( between != NULL )
+    {
+        uint32_t touched = between->uses | between->defines;
+        if ( between->class == C_JUMP || between->class == C_BRANCH
+            || (touched & BIT(RSP))
+            || (between->defines & BIT(pushed))
+            || (pushed != popped && (touched & BIT(popped))) )
+            return false;
+        touch ( p, between );
+    }
+    remove_line ( p, pop );
+    if ( pushed == popped )
+        remove_line ( p, line );
+    else
+    {
+        line->n_operands = 2;
+        line->operands[1] = register_operand ( popped );
+        rewrite ( p, line, "movq" );
+    }
+    return true;
+}
+
+
+/* movq %a, %t; movq %b, %a; movq %t, %b, where %t is not read after */
+static bool
+swap ( peephole_t *p, line_t *line )
+{
+    line_t *second = next_instruction ( p, line );
+    line_t *third = (second != NULL) ? next_instruction ( p, second ) : NULL;
+    if ( third == NULL )
+        return false;
+    line_t *moves[3] = { line, second, third };
+    for ( int m = 0; m < 3; m++ )
+        if ( moves[m]->class != C_MOVE
+            || moves[m]->operands[0].kind != OPERAND_REGISTER
+            || moves[m]->operands[1].kind != OPERAND_REGISTER )
+            return false;
+    uint8_t a = line->operands[0].reg, held = line->operands[1].reg;
+    uint8_t b = second->operands[0].reg;
+    if ( a == b || a == held || b == held
+        || second->operands[1].reg != a
+        || third->operands[0].reg != held || third->operands[1].reg != b
+        || (BIT(held) & (third->live_out | FRAME)) )
+        return false;
+    line->operands[1] = register_operand ( b );
+    rewrite ( p, line, "xchgq" );
+    remove_line ( p, second );
+    remove_line ( p, third );
+    return true;
+}
+
+
+/* Whether an instruction can run after one that reads 'value' into the
+ * register 'held' as well as before: it only writes registers, and none
+ * that either of them uses
+ */
+static bool
+independent ( line_t *line, operand_t *value, uint8_t held )
+{
+    switch ( line->class )
+    {
+        case C_MOVE: case C_LEA: case C_ARITHMETIC: case C_COMPARE:
+        case C_SHIFT: case C_NEGATE: case C_NOT: case C_ZERO:
+            break;
+        default:
+            return false;
+    }
+    if ( line->class != C_COMPARE
+        && line->operands[line->n_operands - 1].kind == OPERAND_MEMORY )
+        return false;
+    return !((line->uses | line->defines) & BIT(held))
+        && !(line->defines & reads ( value ));
+}
+
+
+/* A register that is set only for one instruction to read is left out,
+ * and the instruction reads its value where it came from. Instructions
+ * that have nothing to do with either may come between.
+ */
+static bool
+forward ( peephole_t *p, line_t *line )
+{
+    if ( line->class != C_MOVE || line->operands[1].kind != OPERAND_REGISTER )
+        return false;
+    operand_t value = line->operands[0];
+    uint8_t held = line->operands[1].reg;
+    line_t *between[FORWARD_DISTANCE];
+    int n_between = 0;
+    line_t *next = next_instruction ( p, line );
+    while ( next != NULL && !(next->uses & BIT(held)) )
+    {
+        if ( n_between == FORWARD_DISTANCE
+            || !independent ( next, &value, held ) )
+            return false;
+        between[n_between++] = next;
+        next = next_instruction ( p, next );
+    }
+    if ( next == NULL || (BIT(held) & (next->live_out | FRAME)) )
+        return false;
+
+    int used;
+    switch ( next->class )
+    {
+        case C_MOVE: case C_ARITHMETIC: case C_PUSH:
+            used = 0;
+            break;
+        case C_COMPARE:
+            used = is_register ( &next->operands[0], held ) ? 0 : 1;
+            break;
+        default:
+            return false;
+    }
+    if ( !is_register ( &next->operands[used], held ) )
+        return false;
+    operand_t *other = (next->n_operands > 1) ?
+        &next->operands[1 - used] : NULL;
+    if ( other != NULL && (reads ( other ) & BIT(held)) )
+        return false;
+
+    switch ( value.kind )
+    {
+        case OPERAND_IMMEDIATE:
+            if ( next->class == C_COMPARE && used == 1 )
+                return false;
+            if ( !fits_immediate ( value.value ) && !(next->class == C_MOVE
+                && other->kind == OPERAND_REGISTER) )
+                return false;
+            break;
+        case OPERAND_MEMORY:
+            if ( other != NULL && other->kind == OPERAND_MEMORY )
+                return false;
+            break;
+        case OPERAND_REGISTER:
+            break;
+        default:
+            return false;
+    }
+    for ( int b = 0; b < n_between; b++ )
+        touch ( p, between[b] );
+    remove_line ( p, line );
+    next->operands[used] = value;
+    rewrite ( p, next, NULL );
+    return true;
+}
+
+
+/* A result computed in one register only to be moved to another is
+ * computed in the other one
+ */
+static bool
+retarget ( peephole_t *p, line_t *line )
+{
+    line_t *operation = next_instruction ( p, line );
+    line_t *move = (operation != NULL) ? next_instruction ( p, operation ) : NULL;
+    if ( move == NULL || line->class != C_MOVE || move->class != C_MOVE
+        || line->operands[1].kind != OPERAND_REGISTER
+        || move->operands[1].kind != OPERAND_REGISTER )
+        return false;
+    switch ( operation->class )
+    {
+        case C_ARITHMETIC: case C_SHIFT: case C_NEGATE: case C_NOT:
+            break;
+        default:
+            return false;
+    }
+    uint8_t a = line->operands[1].reg, b = move->operands[1].reg;
+    operand_t *result = &operation->operands[operation->n_operands - 1];
+    uint32_t other = (operation->n_operands > 1) ?
+        reads ( &operation->operands[0] ) : 0;
+    if ( a == b || !is_register ( result, a )
+        || !is_register ( &move->operands[0], a )
+        || (other & (BIT(a) | BIT(b)))
+        || (BIT(a) & (move->live_out | FRAME)) || (BIT(b) & FRAME) )
+        return false;
+    line->operands[1] = register_operand ( b );
+    rewrite ( p, line, NULL );
+    *result = register_operand ( b );
+    rewrite ( p, operation, NULL );
+    remove_line ( p, move );
+    return true;
+}
+
+
+static bool
+constant_shift ( peephole_t *p, line_t *line )
+{
+    line_t *next = next_instruction ( p, line );
+    if ( line->class != C_MOVE || next == NULL || next->class != C_SHIFT
+        || line->operands[0].kind != OPERAND_IMMEDIATE
+        || !is_register ( &line->operands[1], RCX )
+        || !next->operands[0].byte
+        || (reads ( &next->operands[1] ) & BIT(RCX))
+        || (next->live_out & BIT(RCX)) )
+        return false;
+    remove_line ( p, line );
+    next->operands[0] = immediate_operand ( line->operands[0].value & 63 );
+    rewrite ( p, next, NULL );
+    return true;
+}
+
+
+/* cmp $0, r sets the flags as test r, r does */
+static bool
+compare_zero ( peephole_t *p, line_t *line )
+{
+    const char *name = mnemonics[line->mnemonic].name;
+    if ( line->class != C_COMPARE || strncmp ( name, "cmp", 3 ) != 0
+        || line->operands[0].kind != OPERAND_IMMEDIATE
+        || line->operands[0].value != 0
+        || line->operands[1].kind != OPERAND_REGISTER )
+        return false;
+    line->operands[0] = line->operands[1];
+    rewrite ( p, line, "test" );
+    return true;
+}
+
+
+/* xorl clears the whole register, in fewer bytes, where the flags it
+ * sets are not read
+ */
+static bool
+zero_register ( peephole_t *p, line_t *line )
+{
+    if ( line->class != C_MOVE
+        || line->operands[0].kind != OPERAND_IMMEDIATE
+        || line->operands[0].value != 0
+        || line->operands[1].kind != OPERAND_REGISTER
+        || (line->live_out & FLAGS) )
+        return false;
+    line->operands[0] = line->operands[1];
+    rewrite ( p, line, "xorl" );
+    return true;
+}
+
+
+/* Tried in order on every instruction, the first that applies wins */
+static const rule_t rules[PEEPHOLE_N_RULES] = {
+    [PEEPHOLE_UNREACHABLE] = { "unreachable", unreachable },
+    [PEEPHOLE_JUMP_TO_NEXT] = { "jump_to_next", jump_to_next },
+    [PEEPHOLE_SELF_MOVE] = { "self_move", self_move },
+    [PEEPHOLE_DEAD_WRITE] = { "dead_write", dead_write },
+    [PEEPHOLE_RELOAD] = { "reload", reload },
+    [PEEPHOLE_PUSH_POP] = { "push_pop", push_pop },
+    [PEEPHOLE_SWAP] = { "swap", swap },
+    [PEEPHOLE_FORWARD] = { "forward", forward },
+    [PEEPHOLE_RETARGET] = { "retarget", retarget },
+    [PEEPHOLE_CONSTANT_SHIFT] = { "constant_shift", constant_shift },
+    [PEEPHOLE_COMPARE_ZERO] = { "compare_zero", compare_zero },
+    [PEEPHOLE_ZERO_REGISTER] = { "zero_register", zero_register }
+};
+
+
+const char *
+peephole_rule_name ( peephole_rule_t rule )
+{
+    return rules[rule].name;
+}
+
+
+/**************************
+ * Writing the assembly   *
+ **************************/
+
+
+static void
+write_operand ( emitter_t *out, operand_t *operand, bool narrow )
+{
+    switch ( operand->kind )
+    {
+        case OPERAND_REGISTER:
+            if ( operand->byte )
+                emit_string ( out, "%cl" );
+            else
+                emit_string ( out, (narrow ? registers32 : registers)[operand->reg] );
+            break;
+        case OPERAND_IMMEDIATE:
+            emit_string ( out, "$" );
+            emit_int ( out, operand->value );
+            break;
+        default:
+            emit_text ( out, operand->text, operand->length );
+            break;
+    }
+}
+
+
+static void
+write_lines ( peephole_t *p, emitter_t *out )
+{
+    for ( uint32_t i = 0; i < p->n_lines; i++ )
+    {
+        line_t *line = &p->lines[i];
+        if ( line->removed )
+            continue;
+        if ( !line->rewritten )
+        {
+            emit_text ( out, line->text, line->length );
+            emit_text ( out, "\n", 1 );
+            continue;
+        }
+        emit_string ( out, "\t" );
+        emit_string ( out, mnemonics[line->mnemonic].name );
+        for ( uint8_t o = 0; o < line->n_operands; o++ )
+        {
+            emit_string ( out, (o == 0) ? " " : ", " );
+            write_operand ( out, &line->operands[o], line->class == C_ZERO );
+        }
+        emit_text ( out, "\n", 1 );
+    }
+}
+
+
+void
+peephole_optimize (
+    emitter_t *out, size_t start, peephole_arguments_t arguments,
+    void *context, size_t hits[PEEPHOLE_N_RULES]
+)
+{
+    size_t size = out->size - start;
+    char *text = mem_alloc ( MEM_PEEPHOLE, size + 1 );
+    memcpy ( text, out->text + start, size );
+
+    peephole_t p = { .lines = NULL };
+    read_lines ( &p, text, size, arguments, context );
+    for ( p.pass = 1; p.pass <= MAX_PASSES; p.pass++ )
+    {
+        find_live_registers ( &p );
+        bool changed = false;
+        for ( uint32_t i = 0; i < p.n_lines; i++ )
+        {
+            line_t *line = &p.lines[i];
+            if ( line->removed || line->kind != LINE_INSTRUCTION
+                || line->pass == p.pass )
+                continue;
+            for ( int r = 0; r < PEEPHOLE_N_RULES; r++ )
+            {
+                if ( rules[r].apply ( &p, line ) )
+                {
+                    hits[r] += 1;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+        if ( !changed )
+            break;
+    }
+
+    out->size = start;
+    write_lines ( &p, out );
+    tlhash_finalize ( &p.labels );
+    mem_free ( MEM_PEEPHOLE, p.lines, p.lines_capacity * sizeof(line_t) );
+    mem_free ( MEM_PEEPHOLE, text, size + 1 );
+}
@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <pool.h>
+
+
+/* Shared by the threads of a run, each takes the next task index */
+typedef struct {
+    size_t n_tasks, next;
+    pool_task_t *task;
+    void *context;
+    pthread_mutex_t lock;
+} pool_t;
+
+
+static void *
+worker ( void *argument )
+{
+    pool_t *pool = argument;
+    for ( ;; )
+    {
+        pthread_mutex_lock ( &pool->lock );
+        size_t index = pool->next++;
+        pthread_mutex_unlock ( &pool->lock );
+        if ( index >= pool->n_tasks )
+            return NULL;
+        pool->task ( pool->context, index );
+    }
+}
+
+
+void
+pool_run ( size_t n_tasks, int n_threads, pool_task_t *task, void *context )
+{
+    pool_t pool = {
+        .n_tasks = n_tasks,
+        .next = 0,
+        .task = task,
+        .context = context
+    };
+
+    /* Only start as many threads as there are tasks for */
+    size_t n_helpers = (n_threads > 1) ? n_threads - 1 : 0;
+    if ( n_helpers > n_tasks - (n_tasks > 0) )
+        n_helpers = n_tasks - (n_tasks > 0);
+    pthread_t *helpers = NULL;
+    if ( n_helpers > 0 )
+        helpers = malloc ( n_helpers * sizeof(pthread_t) );
+    if ( helpers == NULL )
+        n_helpers = 0;
+
+    pthread_mutex_init ( &pool.lock, NULL );
+    size_t started = 0;
+    while ( started < n_helpers && pthread_create (
+        &helpers[started], NULL, worker, &pool
+    ) == 0 )
+        started += 1;
+
+    /* The calling thread works too, and alone if no threads could start */
+    worker ( &pool );
+    for ( size_t t=0; t<started; t++ )
+        pthread_join ( helpers[t], NULL );
+    pthread_mutex_destroy ( &pool.lock );
+    free ( helpers );
+}
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <source.h>
+
+
+static int map_source ( source_t *source, int fd, size_t length );
+static int read_source ( source_t *source, int fd );
+
+
+/* Load a source file, or standard input if the path is NULL.
+ * Returns
+ *  EIO - if the file can not be opened or read, errno tells why
+ *  ENOMEM - if there is no memory to read it into
+ */
+int
+source_open ( source_t *source, const char *path )
+{
+    int fd = (path != NULL) ? open ( path, O_RDONLY ) : STDIN_FILENO;
+    if ( fd < 0 )
+        return SOURCE_EIO;
+
+    /* The two NULs after the text must land in the last page of the file,
+     * or touching them would fault. Files that end too close to a page
+     * boundary are read instead.
+     */
+    struct stat info;
+    size_t page = sysconf ( _SC_PAGESIZE ), tail;
+    int status;
+    if ( fstat ( fd, &info ) == 0 && S_ISREG ( info.st_mode ) &&
+         (tail = info.st_size % page) != 0 && tail <= page - 2
+    )
+        status = map_source ( source, fd, info.st_size );
+    else
+        status = read_source ( source, fd );
+
+    if ( path != NULL )
+        close ( fd );
+    return status;
+}
+
+
+void
+source_close ( source_t *source )
+{
+    if ( source->mapped > 0 )
+    {
+        munmap ( source->text, source->mapped );
+        mem_untrack ( MEM_SOURCE, source->mapped );
+    }
+    else
+        mem_free ( MEM_SOURCE, source->text, source->capacity );
+    source->text = NULL;
+    source->length = source->mapped = source->capacity = 0;
+}
+
+
+/* The mapping is private and writable, because flex writes into the buffer
+ * as it scans; only the pages it touches are copied.
+ */
+static int
+map_source ( source_t *source, int fd, size_t length )
+{
+    void *text = mmap (
+        NULL, length + 2, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0
+    );
+    if ( text == MAP_FAILED )
+        return read_source ( source, fd );
+    mem_track ( MEM_SOURCE, length + 2 );
+    source->text = text;
+    source->length = length;
+    source->mapped = length + 2;
+    source->capacity = 0;
+    return SOURCE_SUCCESS;
+}
+
+
+static int
+read_source ( source_t *source, int fd )
+{
+    size_t capacity = 64*1024, length = 0;
+    char *text = mem_alloc ( MEM_SOURCE, capacity );
+    for ( ;; )
+    {
+        if ( text == NULL )
+            return SOURCE_ENOMEM;
+        if ( capacity - length <= 2 )
+        {
+            char *larger = mem_realloc (
+                MEM_SOURCE, text, capacity, 2*capacity
+            );
+            if ( larger == NULL )
+                mem_free ( MEM_SOURCE, text, capacity );
+            text = larger;
+            capacity *= 2;
+            continue;
+        }
+        ssize_t n = read ( fd, text + length, capacity - length - 2 );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 )
+        {
+            mem_free ( MEM_SOURCE, text, capacity );
+            return SOURCE_EIO;
+        }
+        if ( n == 0 )
+            break;
+        length += n;
+    }
+    text[length] = text[length+1] = '\0';
+    source->text = text;
+    source->length = length;
+    source->mapped = 0;
+    source->capacity = capacity;
+    return SOURCE_SUCCESS;
+}
@@ -0,0 +1,1388 @@
+#include <vslc.h>
+
+/* Construction follows the structure of the tree in a single pass, in the
+ * manner of Brandis and Mössenböck: the current value of every parameter
+ * and local is kept as it is assigned, branches are joined by phis of the
+ * values that differ between them, and a loop header gets a phi for a
+ * variable as soon as the variable is read or assigned in the loop. The
+ * phis are completed when the loop ends, and those that turn out to
+ * choose between a single value are removed afterwards.
+ */
+
+#define SSA_CAPACITY 16
+
+/* An assignment of the current value of a variable, undone where the
+ * branches of an if statement part. Phis made for loops around the if are
+ * kept, and recorded with the loop level they were made for.
+ */
+typedef struct {
+    uint32_t var;
+    uint32_t value, level;      /* What the variable had before */
+    uint32_t loop;              /* Level of a loop header phi, or 0 */
+} change_t;
+
+/* The value a variable has at the end of a branch */
+typedef struct {
+    uint32_t var, value, level;
+} held_t;
+
+/* A header phi, with the value it takes from the loop entry */
+typedef struct {
+    uint32_t phi, var, value;
+    uint32_t loop;
+} header_phi_t;
+
+/* The value a header phi takes from a continue or the end of the body */
+typedef struct {
+    uint32_t phi, predecessor, value;
+} edge_value_t;
+
+typedef struct {
+    uint32_t header;
+    uint32_t phis, edges;       /* Where its phis and edge values start */
+    bool entered;               /* Whether predecessor 0 enters the loop */
+} loop_t;
+
+typedef struct {
+    uint32_t changes;           /* Log entries made in the branches */
+    uint32_t held;              /* Values at the end of the then branch */
+    uint32_t then_end;          /* Block the then branch ends in */
+} branch_t;
+
+typedef struct {
+    ssa_function_t *function;
+    symbol_t *symbol;
+    uint32_t block;             /* Block that instructions are appended to */
+
+    /* Per variable, parameters first: its value, the loop level that
+     * value is current in, and marks for finding variables once
+     */
+    uint32_t *defs, *levels, *seen, *slots;
+    uint32_t n_variables, serial;
+
+    change_t *changes;
+    uint32_t n_changes, changes_capacity;
+    held_t *held;
+    uint32_t n_held, held_capacity;
+    branch_t *branches;
+    uint32_t n_branches, branches_capacity;
+    loop_t *loops;              /* Loops around the statement being built */
+    uint32_t n_loops, loops_capacity;
+    header_phi_t *phis;
+    uint32_t n_phis, phis_capacity;
+    edge_value_t *edges;
+    uint32_t n_edges, edges_capacity;
+    uint32_t *values;           /* Values of expressions, for their parents */
+    uint32_t n_values, values_capacity;
+    walk_t walk;
+} builder_t;
+
+static const char *operator_names[] = {
+    "", "add", "sub", "mul", "div", "shl", "shr", "and", "or", "xor", "not",
+    "eq", "lt", "gt"
+};
+
+
+/* Make room for 'needed' more elements of 'size' bytes in an array holding
+ * 'count' of them
+ */
+static void *
+reserve (
+    mem_category_t category, void *array, uint32_t count, uint32_t needed,
+    uint32_t *capacity, size_t size
+)
+{
+    if ( count + needed <= *capacity )
+        return array;
+    uint32_t grown = (*capacity > 0) ? *capacity : SSA_CAPACITY;
+    while ( grown < count + needed )
+        grown *= 2;
+    array = mem_realloc ( category, array, *capacity * size, grown * size );
+    if ( array == NULL )
+    {
+        fprintf ( stderr, "Out of memory for the SSA form\n" );
+        exit ( EXIT_FAILURE );
+    }
+    *capacity = grown;
+    return array;
+}
+
+
+#define PUSH(b, array, item) do { \
+    (b)->array = reserve ( MEM_WORK, (b)->array, (b)->n_##array, 1, \
+        &(b)->array##_capacity, sizeof(*(b)->array) ); \
+    (b)->array[(b)->n_##array++] = (item); \
+} while ( false )
+
+
+static uint32_t
+new_block ( ssa_function_t *function )
+{
+    function->blocks = reserve ( MEM_SSA, function->blocks,
+        function->n_blocks, 1, &function->blocks_capacity, sizeof(ssa_block_t)
+    );
+    function->blocks[function->n_blocks] = (ssa_block_t) {
+        .first = SSA_NONE, .last = SSA_NONE, .predecessors = NULL
+    };
+    return function->n_blocks++;
+}
+
+
+static void
+add_edge ( ssa_function_t *function, uint32_t from, uint32_t to )
+{
+    ssa_block_t *source = &function->blocks[from];
+    source->successors[source->n_successors++] = to;
+    ssa_block_t *target = &function->blocks[to];
+    target->predecessors = reserve ( MEM_SSA, target->predecessors,
+        target->n_predecessors, 1, &target->predecessors_capacity,
+        sizeof(uint32_t)
+    );
+    target->predecessors[target->n_predecessors++] = from;
+}
+
+
+/* An instruction of 'block' with room for its operands, not linked in yet */
+static uint32_t
+new_instruction (
+    ssa_function_t *function, uint32_t block,
+    ssa_opcode_t opcode, uint32_t n_operands
+)
+{
+    function->instructions = reserve ( MEM_SSA, function->instructions,
+        function->n_instructions, 1, &function->instructions_capacity,
+        sizeof(ssa_instruction_t)
+    );
+    function->operands = reserve ( MEM_SSA, function->operands,
+        function->n_operands, n_operands, &function->operands_capacity,
+        sizeof(uint32_t)
+    );
+    function->instructions[function->n_instructions] = (ssa_instruction_t) {
+        .opcode = opcode, .op = OP_NONE, .block = block,
+        .prev = SSA_NONE, .next = SSA_NONE,
+        .n_operands = n_operands, .operands = function->n_operands
+    };
+    function->n_operands += n_operands;
+    return function->n_instructions++;
+}
+
+
+static void
+append ( ssa_function_t *function, uint32_t i )
+{
+    ssa_instruction_t *instruction = &function->instructions[i];
+    ssa_block_t *block = &function->blocks[instruction->block];
+    instruction->prev = block->last;
+    if ( block->last != SSA_NONE )
+        function->instructions[block->last].next = i;
+    else
+        block->first = i;
+    block->last = i;
+}
+
+
+static void
+prepend ( ssa_function_t *function, uint32_t i )
+{
+    ssa_instruction_t *instruction = &function->instructions[i];
+    ssa_block_t *block = &function->blocks[instruction->block];
+    instruction->next = block->first;
+    if ( block->first != SSA_NONE )
+        function->instructions[block->first].prev = i;
+    else
+        block->last = i;
+    block->first = i;
+}
+
+
+static void
+remove_instruction ( ssa_function_t *function, uint32_t i )
+{
+    ssa_instruction_t *instruction = &function->instructions[i];
+    ssa_block_t *block = &function->blocks[instruction->block];
+    if ( instruction->prev != SSA_NONE )
+        function->instructions[instruction->prev].next = instruction->next;
+    else
+        block->first = instruction->next;
+    if ( instruction->next != SSA_NONE )
+        function->instructions[instruction->next].prev = instruction->prev;
+    else
+        block->last = instruction->prev;
+    instruction->block = SSA_NONE;
+}
+
+
+/* Append an instruction to the block being built */
+static uint32_t
+add ( builder_t *b, ssa_opcode_t opcode, uint32_t n_operands )
+{
+    uint32_t i = new_instruction ( b->function, b->block, opcode, n_operands );
+    append ( b->function, i );
+    return i;
+}
+
+
+/* Only the entry and blocks that are jumped to are reached. Nothing is
+ * jumped to from a block that is not, so code after a return or continue
+ * ends up in blocks without predecessors, which are removed at the end.
+ */
+static bool
+reached ( builder_t *b, uint32_t block )
+{
+    return block == 0 || b->function->blocks[block].n_predecessors > 0;
+}
+
+
+static void
+jump ( builder_t *b, uint32_t target )
+{
+    if ( !reached ( b, b->block ) )
+        return;
+    add ( b, SSA_JUMP, 0 );
+    add_edge ( b->function, b->block, target );
+}
+
+
+static uint32_t
+pop_value ( builder_t *b )
+{
+    return b->values[--b->n_values];
+}
+
+
+/* Give a variable phis in the headers of the loops around it that it is
+ * not current in yet, before it is read or assigned
+ */
+static void
+touch ( builder_t *b, uint32_t var )
+{
+    for ( uint32_t level = b->levels[var] + 1; level <= b->n_loops; level++ )
+    {
+        loop_t *loop = &b->loops[level - 1];
+        uint32_t phi = new_instruction ( b->function, loop->header, SSA_PHI, 0 );
+        prepend ( b->function, phi );
+        header_phi_t header_phi = {
+            .phi = phi, .var = var, .value = b->defs[var], .loop = level
+        };
+        PUSH ( b, phis, header_phi );
+        change_t change = {
+            .var = var, .value = b->defs[var], .level = b->levels[var],
+            .loop = level
+        };
+        PUSH ( b, changes, change );
+        b->defs[var] = phi;
+        b->levels[var] = level;
+    }
+}
+
+
+static void
+assign ( builder_t *b, uint32_t var, uint32_t value, uint32_t level )
+{
+    change_t change = {
+        .var = var, .value = b->defs[var], .level = b->levels[var], .loop = 0
+    };
+    PUSH ( b, changes, change );
+    b->defs[var] = value;
+    b->levels[var] = level;
+}
+
+
+static uint32_t
+read_variable ( builder_t *b, symbol_t *symbol )
+{
+    if ( symbol == NULL || symbol->type == SYM_FUNCTION )
+        return add ( b, SSA_UNDEF, 0 );
+    if ( symbol->type == SYM_GLOBAL_VAR )
+    {
+        uint32_t load = add ( b, SSA_LOAD, 0 );
+        b->function->instructions[load].data.symbol = symbol;
+        return load;
+    }
+    uint32_t var = variable_index ( b->symbol, symbol );
+    touch ( b, var );
+    return b->defs[var];
+}
+
+
+static void
+write_variable ( builder_t *b, symbol_t *symbol, uint32_t value )
+{
+    if ( symbol->type == SYM_GLOBAL_VAR )
+    {
+        uint32_t store = add ( b, SSA_STORE, 1 );
+        b->function->instructions[store].data.symbol = symbol;
+        SSA_OPERAND ( b->function, &b->function->instructions[store], 0 ) = value;
+        return;
+    }
+    uint32_t var = variable_index ( b->symbol, symbol );
+    touch ( b, var );
+    assign ( b, var, value, b->n_loops );
+}
+
+
+/* Restore the values variables had where the branches of an if statement
+ * part, and hold the values they have now. Phis made for loops around the
+ * if statement stay, also in the log, for the statements around those.
+ */
+static void
+undo_changes ( builder_t *b, uint32_t mark )
+{
+    b->serial += 1;
+    for ( uint32_t c = b->n_changes; c-- > mark; )
+    {
+        change_t *change = &b->changes[c];
+        if ( change->loop != 0 && change->loop <= b->n_loops )
+            continue;
+        if ( b->seen[change->var] != b->serial )
+        {
+            b->seen[change->var] = b->serial;
+            held_t held = {
+                .var = change->var,
+                .value = b->defs[change->var],
+                .level = b->levels[change->var]
+            };
+            PUSH ( b, held, held );
+        }
+        b->defs[change->var] = change->value;
+        b->levels[change->var] = change->level;
+    }
+    uint32_t kept = mark;
+    for ( uint32_t c = mark; c < b->n_changes; c++ )
+    {
+        if ( b->changes[c].loop != 0 && b->changes[c].loop <= b->n_loops )
+            b->changes[kept++] = b->changes[c];
+    }
+    b->n_changes = kept;
+}
+
+
+/* Give a variable the value it has after the branches of an if statement
+ * join, from its values at the ends of the branches
+ */
+static void
+join_variable (
+    builder_t *b, uint32_t join, branch_t *branch, held_t then, held_t other
+)
+{
+    bool then_reached = reached ( b, branch->then_end );
+    bool else_reached = reached ( b, b->block );
+    held_t joined = then_reached ? then : other;
+    if ( !then_reached && !else_reached )
+        return;
+    if ( then_reached && else_reached && then.value != other.value )
+    {
+        ssa_function_t *function = b->function;
+        uint32_t phi = new_instruction ( function, join, SSA_PHI, 2 );
+        append ( function, phi );
+        SSA_OPERAND ( function, &function->instructions[phi], 0 ) = then.value;
+        SSA_OPERAND ( function, &function->instructions[phi], 1 ) = other.value;
+        joined = (held_t) { .var = then.var, .value = phi, .level = b->n_loops };
+    }
+    if ( joined.value != b->defs[joined.var] )
+        assign ( b, joined.var, joined.value, joined.level );
+}
+
+
+/* Join the branches of an if statement, with the values of the then
+ * branch held from branch->held, and those of the else branch after them
+ */
+static void
+join_branches ( builder_t *b, branch_t *branch )
+{
+    uint32_t else_held = b->n_held;
+    undo_changes ( b, branch->changes );
+    uint32_t join = new_block ( b->function );
+    uint32_t else_end = b->block;
+    b->block = branch->then_end;
+    jump ( b, join );
+    b->block = else_end;
+    jump ( b, join );
+
+    b->serial += 1;
+    for ( uint32_t h = branch->held; h < else_held; h++ )
+    {
+        b->seen[b->held[h].var] = b->serial;
+        b->slots[b->held[h].var] = h;
+    }
+    /* The then branch jumps to the join first, so its values come first */
+    for ( uint32_t h = else_held; h < b->n_held; h++ )
+    {
+        held_t other = b->held[h];
+        held_t then = { other.var, b->defs[other.var], b->levels[other.var] };
+        if ( b->seen[other.var] == b->serial )
+        {
+            then = b->held[b->slots[other.var]];
+            b->slots[other.var] = SSA_NONE;
+        }
+        join_variable ( b, join, branch, then, other );
+    }
+    for ( uint32_t h = branch->held; h < else_held; h++ )
+    {
+        held_t then = b->held[h];
+        if ( b->slots[then.var] == SSA_NONE )
+            continue;
+        held_t other = { then.var, b->defs[then.var], b->levels[then.var] };
+        join_variable ( b, join, branch, then, other );
+    }
+    b->n_held = branch->held;
+    b->block = join;
+}
+
+
+/* Branch on the values of a relation, to two new blocks */
+static void
+branch ( builder_t *b, node_t *relation, uint32_t *taken, uint32_t *not_taken )
+{
+    ssa_function_t *function = b->function;
+    uint32_t right = pop_value ( b ), left = pop_value ( b );
+    uint32_t i = add ( b, SSA_BRANCH, 2 );
+    function->instructions[i].op = relation->op;
+    SSA_OPERAND ( function, &function->instructions[i], 0 ) = left;
+    SSA_OPERAND ( function, &function->instructions[i], 1 ) = right;
+    *taken = new_block ( function );
+    *not_taken = new_block ( function );
+    if ( reached ( b, b->block ) )
+    {
+        add_edge ( function, b->block, *taken );
+        add_edge ( function, b->block, *not_taken );
+    }
+}
+
+
+/* Record the values the header phis of the innermost loop take when
+ * jumping back to it from the block being built
+ */
+static void
+continue_loop ( builder_t *b )
+{
+    loop_t *loop = &b->loops[b->n_loops - 1];
+    if ( !reached ( b, b->block ) )
+        return;
+    jump ( b, loop->header );
+    uint32_t predecessor = b->function->blocks[loop->header].n_predecessors - 1;
+    for ( uint32_t p = loop->phis; p < b->n_phis; p++ )
+    {
+        if ( b->phis[p].loop != b->n_loops )
+            continue;
+        edge_value_t edge = {
+            .phi = b->phis[p].phi, .predecessor = predecessor,
+            .value = b->defs[b->phis[p].var]
+        };
+        PUSH ( b, edges, edge );
+    }
+}
+
+
+/* Complete the header phis of the innermost loop, once all edges back to
+ * it are known. Phis made after an edge was taken are for variables the
+ * edge does not change, so they take their own value from it.
+ */
+static void
+end_loop ( builder_t *b )
+{
+    ssa_function_t *function = b->function;
+    uint32_t level = b->n_loops;
+    loop_t *loop = &b->loops[level - 1];
+    uint32_t n_predecessors = function->blocks[loop->header].n_predecessors;
+    for ( uint32_t p = loop->phis; p < b->n_phis; p++ )
+    {
+        header_phi_t *phi = &b->phis[p];
+        if ( phi->loop != level )
+            continue;
+        function->operands = reserve ( MEM_SSA, function->operands,
+            function->n_operands, n_predecessors, &function->operands_capacity,
+            sizeof(uint32_t)
+        );
+        ssa_instruction_t *instruction = &function->instructions[phi->phi];
+        instruction->operands = function->n_operands;
+        instruction->n_operands = n_predecessors;
+        function->n_operands += n_predecessors;
+        for ( uint32_t o = 0; o < n_predecessors; o++ )
+            SSA_OPERAND ( function, instruction, o ) = phi->phi;
+        if ( loop->entered )
+            SSA_OPERAND ( function, instruction, 0 ) = phi->value;
+    }
+    for ( uint32_t e = loop->edges; e < b->n_edges; e++ )
+    {
+        edge_value_t *edge = &b->edges[e];
+        ssa_instruction_t *instruction = &function->instructions[edge->phi];
+        SSA_OPERAND ( function, instruction, edge->predecessor ) = edge->value;
+    }
+
+    /* After the loop, variables have the values of its header */
+    uint32_t kept = loop->phis;
+    for ( uint32_t p = loop->phis; p < b->n_phis; p++ )
+    {
+        header_phi_t *phi = &b->phis[p];
+        if ( phi->loop == level )
+        {
+            b->defs[phi->var] = phi->phi;
+            b->levels[phi->var] = level - 1;
+        }
+        else
+            b->phis[kept++] = *phi;
+    }
+    b->n_phis = kept;
+    b->n_edges = loop->edges;
+    b->n_loops -= 1;
+}
+
+
+static node_t **
+build_if_statement ( builder_t *b, walk_frame_t *frame )
+{
+    node_t *node = *frame->slot;
+    uint32_t then, other;
+    switch ( frame->stage++ )
+    {
+        case 0:
+            return &node->children[0];
+        case 1:
+        {
+            branch ( b, node->children[0], &then, &other );
+            /* The else block is made even without an else branch, so no
+             * edge from the branch leads straight to a join with phis
+             */
+            frame->mark = other;
+            branch_t started = { .changes = b->n_changes, .held = b->n_held };
+            PUSH ( b, branches, started );
+            b->block = then;
+            return &node->children[1];
+        }
+        case 2:
+        {
+            branch_t *current = &b->branches[b->n_branches - 1];
+            current->then_end = b->block;
+            undo_changes ( b, current->changes );
+            b->block = frame->mark;
+            if ( node->n_children > 2 )
+                return &node->children[2];
+        }
+        /* Fall through, there is no else branch */
+        default:
+            join_branches ( b, &b->branches[--b->n_branches] );
+            return NULL;
+    }
+}
+
+
+static node_t **
+build_while_statement ( builder_t *b, walk_frame_t *frame )
+{
+    node_t *node = *frame->slot;
+    uint32_t body, exit;
+    switch ( frame->stage++ )
+    {
+        case 0:
+        {
+            uint32_t header = new_block ( b->function );
+            loop_t loop = {
+                .header = header, .phis = b->n_phis, .edges = b->n_edges,
+                .entered = reached ( b, b->block )
+            };
+            jump ( b, header );
+            PUSH ( b, loops, loop );
+            b->block = header;
+            return &node->children[0];
+        }
+        case 1:
+            branch ( b, node->children[0], &body, &exit );
+            frame->mark = exit;
+            b->block = body;
+            return &node->children[1];
+        default:
+            continue_loop ( b );
+            end_loop ( b );
+            b->block = frame->mark;
+            return NULL;
+    }
+}
+
+
+static node_t **
+build_print_statement ( builder_t *b, walk_frame_t *frame )
+{
+    node_t *node = *frame->slot;
+    ssa_function_t *function = b->function;
+    while ( frame->stage < 2 * node->n_children )
+    {
+        uint32_t item = frame->stage / 2;
+        node_t *child = node->children[item];
+        if ( frame->stage % 2 == 0 && child->type != STRING_DATA )
+        {
+            frame->stage += 1;
+            return &node->children[item];
+        }
+        if ( child->type == STRING_DATA )
+        {
+            uint32_t i = add ( b, SSA_PRINT_STRING, 0 );
+            function->instructions[i].data.index = child->data.string_index;
+        }
+        else
+        {
+            uint32_t value = pop_value ( b );
+            uint32_t i = add ( b, SSA_PRINT, 1 );
+            SSA_OPERAND ( function, &function->instructions[i], 0 ) = value;
+        }
+        frame->stage = 2 * (item + 1);
+    }
+    add ( b, SSA_NEWLINE, 0 );
+    return NULL;
+}
+
+
+/* Arguments are evaluated from the last to the first, like the tree
+ * generator does, so calls in them happen in the same order
+ */
+static node_t **
+build_call ( builder_t *b, walk_frame_t *frame )
+{
+    node_t *node = *frame->slot;
+    node_t *arguments = node->children[1];
+    uint32_t n_arguments = (arguments != NULL) ? arguments->n_children : 0;
+    uint32_t stage = frame->stage++;
+    if ( stage < n_arguments )
+        return &arguments->children[n_arguments - 1 - stage];
+
+    ssa_function_t *function = b->function;
+    uint32_t call = add ( b, SSA_CALL, n_arguments );
+    function->instructions[call].data.symbol = node->children[0]->entry;
+    for ( uint32_t a = 0; a < n_arguments; a++ )
+        SSA_OPERAND ( function, &function->instructions[call], a ) =
+            b->values[b->n_values - 1 - a];
+    b->n_values -= n_arguments;
+    PUSH ( b, values, call );
+    return NULL;
+}
+
+
+/* Build the node of a frame, up to its next child. Expressions leave
+ * their values on b->values, and statements take them from there.
+ */
+static node_t **
+build_node ( builder_t *b, walk_frame_t *frame )
+{
+    node_t *node = *frame->slot;
+    ssa_function_t *function = b->function;
+    uint32_t i;
+    switch ( node->type )
+    {
+        case DECLARATION_LIST:
+            return NULL;
+
+        case NUMBER_DATA:
+            i = add ( b, SSA_CONST, 0 );
+            function->instructions[i].data.number = node->data.number;
+            PUSH ( b, values, i );
+            return NULL;
+
+        case IDENTIFIER_DATA:
+            i = read_variable ( b, node->entry );
+            PUSH ( b, values, i );
+            return NULL;
+
+        case EXPRESSION:
+        case RELATION:
+            if ( node->type == EXPRESSION && node->op == OP_NONE )
+                return build_call ( b, frame );
+            if ( frame->stage < node->n_children )
+                return &node->children[frame->stage++];
+            if ( node->type == RELATION )
+                return NULL;
+            i = add ( b, (node->n_children == 1) ? SSA_UNARY : SSA_BINARY,
+                node->n_children
+            );
+            function->instructions[i].op = node->op;
+            for ( uint32_t o = node->n_children; o-- > 0; )
+                SSA_OPERAND ( function, &function->instructions[i], o ) =
+                    pop_value ( b );
+            PUSH ( b, values, i );
+            return NULL;
+
+        case ASSIGNMENT_STATEMENT:
+            if ( frame->stage++ == 0 )
+                return &node->children[1];
+            write_variable ( b, node->children[0]->entry, pop_value ( b ) );
+            return NULL;
+
+        case PRINT_STATEMENT:
+            return build_print_statement ( b, frame );
+
+        case RETURN_STATEMENT:
+        {
+            if ( frame->stage++ == 0 && node->n_children > 0 )
+                return &node->children[0];
+            uint32_t value = (node->n_children > 0) ?
+                pop_value ( b ) : add ( b, SSA_UNDEF, 0 );
+            i = add ( b, SSA_RETURN, 1 );
+            SSA_OPERAND ( function, &function->instructions[i], 0 ) = value;
+            b->block = new_block ( function );
+            return NULL;
+        }
+
+        case IF_STATEMENT:
+            return build_if_statement ( b, frame );
+
+        case WHILE_STATEMENT:
+            return build_while_statement ( b, frame );
+
+        case NULL_STATEMENT:
+            continue_loop ( b );
+            b->block = new_block ( function );
+            return NULL;
+
+        default:
+            while ( frame->stage < node->n_children )
+            {
+                node_t **child = &node->children[frame->stage++];
+                if ( *child != NULL )
+                    return child;
+            }
+            return NULL;
+    }
+}
+
+
+/* Find the value an operand stands for, once phis are replaced */
+static uint32_t
+forwarded ( uint32_t *forward, uint32_t value )
+{
+    uint32_t root = value;
+    while ( forward[root] != root )
+        root = forward[root];
+    while ( forward[value] != root )
+    {
+        uint32_t next = forward[value];
+        forward[value] = root;
+        value = next;
+    }
+    return root;
+}
+
+
+/* Remove the blocks that are not reached, numbering the others in order */
+static void
+remove_unreached_blocks ( ssa_function_t *function )
+{
+    size_t size = function->n_blocks * sizeof(uint32_t);
+    uint32_t *renumbered = mem_alloc ( MEM_WORK, size );
+    uint32_t n_blocks = 0;
+    for ( uint32_t k = 0; k < function->n_blocks; k++ )
+    {
+        ssa_block_t *block = &function->blocks[k];
+        if ( k == 0 || block->n_predecessors > 0 )
+        {
+            renumbered[k] = n_blocks;
+            function->blocks[n_blocks++] = *block;
+            continue;
+        }
+        renumbered[k] = SSA_NONE;
+        for ( uint32_t i = block->first; i != SSA_NONE; )
+        {
+            function->instructions[i].block = SSA_NONE;
+            i = function->instructions[i].next;
+        }
+        mem_free ( MEM_SSA, block->predecessors,
+            block->predecessors_capacity * sizeof(uint32_t)
+        );
+    }
+    for ( uint32_t k = 0; k < n_blocks; k++ )
+    {
+        ssa_block_t *block = &function->blocks[k];
+        for ( uint32_t s = 0; s < block->n_successors; s++ )
+            block->successors[s] = renumbered[block->successors[s]];
+        for ( uint32_t p = 0; p < block->n_predecessors; p++ )
+            block->predecessors[p] = renumbered[block->predecessors[p]];
+        for ( uint32_t i = block->first; i != SSA_NONE; )
+        {
+            function->instructions[i].block = k;
+            i = function->instructions[i].next;
+        }
+    }
+    function->n_blocks = n_blocks;
+    mem_free ( MEM_WORK, renumbered, size );
+}
+
+
+/* Remove phis that choose between their own value and one other, until
+ * none are left, and let their uses take the other value instead
+ */
+static void
+remove_trivial_phis ( ssa_function_t *function )
+{
+    uint32_t *forward = mem_alloc (
+        MEM_WORK, function->n_instructions * sizeof(uint32_t)
+    );
+    for ( uint32_t i = 0; i < function->n_instructions; i++ )
+        forward[i] = i;
+    bool removed = true;
+    while ( removed )
+    {
+        removed = false;
+        for ( uint32_t i = 0; i < function->n_instructions; i++ )
+        {
+            ssa_instruction_t *phi = &function->instructions[i];
+            if ( phi->opcode != SSA_PHI || phi->block == SSA_NONE )
+                continue;
+            uint32_t unique = SSA_NONE;
+            bool trivial = true;
+            for ( uint32_t o = 0; o < phi->n_operands && trivial; o++ )
+            {
+                uint32_t value = forwarded ( forward, SSA_OPERAND ( function, phi, o ) );
+                SSA_OPERAND ( function, phi, o ) = value;
+                if ( value == i || value == unique )
+                    continue;
+                trivial = (unique == SSA_NONE);
+                unique = value;
+            }
+            /* Only a loop that is never entered has a phi of itself */
+            if ( !trivial || unique == SSA_NONE )
+                continue;
+            forward[i] = unique;
+            remove_instruction ( function, i );
+            removed = true;
+        }
+    }
+    for ( uint32_t i = 0; i < function->n_instructions; i++ )
+    {
+        ssa_instruction_t *instruction = &function->instructions[i];
+        if ( instruction->block == SSA_NONE )
+            continue;
+        for ( uint32_t o = 0; o < instruction->n_operands; o++ )
+            SSA_OPERAND ( function, instruction, o ) =
+                forwarded ( forward, SSA_OPERAND ( function, instruction, o ) );
+    }
+    mem_free ( MEM_WORK, forward, function->n_instructions * sizeof(uint32_t) );
+}
+
+
+void
+ssa_build ( ssa_function_t *function, symbol_t *symbol )
+{
+    *function = (ssa_function_t) { .symbol = symbol };
+    uint32_t n_variables = tlhash_size ( symbol->locals );
+    builder_t b = {
+        .function = function,
+        .symbol = symbol,
+        .block = new_block ( function ),
+        .n_variables = n_variables,
+    };
+    size_t size = (n_variables > 0 ? n_variables : 1) * sizeof(uint32_t);
+    b.defs = mem_alloc ( MEM_WORK, size );
+    b.levels = mem_calloc ( MEM_WORK, 1, size );
+    b.seen = mem_calloc ( MEM_WORK, 1, size );
+    b.slots = mem_alloc ( MEM_WORK, size );
+
+    /* Locals are undefined until assigned, and then keep their values
+     * through the iterations of a loop, as they do on the stack
+     */
+    for ( uint32_t p = 0; p < symbol->nparms; p++ )
+    {
+        b.defs[p] = add ( &b, SSA_PARAM, 0 );
+        function->instructions[b.defs[p]].data.index = p;
+    }
+    if ( n_variables > symbol->nparms )
+    {
+        uint32_t undefined = add ( &b, SSA_UNDEF, 0 );
+        for ( uint32_t v = symbol->nparms; v < n_variables; v++ )
+            b.defs[v] = undefined;
+    }
+
+    walk_init ( &b.walk, NULL );
+    if ( symbol->node != NULL )
+        walk_push ( &b.walk, &symbol->node );
+    while ( b.walk.depth > 0 )
+    {
+        node_t **child = build_node ( &b, WALK_TOP ( &b.walk ) );
+        if ( child != NULL )
+            walk_push ( &b.walk, child );
+        else
+            b.walk.depth -= 1;
+    }
+    walk_finalize ( &b.walk );
+
+    /* Falling off the end returns 0 */
+    if ( reached ( &b, b.block ) )
+    {
+        uint32_t value = add ( &b, SSA_UNDEF, 0 );
+        uint32_t i = add ( &b, SSA_RETURN, 1 );
+        SSA_OPERAND ( function, &function->instructions[i], 0 ) = value;
+    }
+
+    remove_unreached_blocks ( function );
+    remove_trivial_phis ( function );
+
+    mem_free ( MEM_WORK, b.defs, size );
+    mem_free ( MEM_WORK, b.levels, size );
+    mem_free ( MEM_WORK, b.seen, size );
+    mem_free ( MEM_WORK, b.slots, size );
+    mem_free ( MEM_WORK, b.changes, b.changes_capacity * sizeof(change_t) );
+    mem_free ( MEM_WORK, b.held, b.held_capacity * sizeof(held_t) );
+    mem_free ( MEM_WORK, b.branches, b.branches_capacity * sizeof(branch_t) );
+    mem_free ( MEM_WORK, b.loops, b.loops_capacity * sizeof(loop_t) );
+    mem_free ( MEM_WORK, b.phis, b.phis_capacity * sizeof(header_phi_t) );
+    mem_free ( MEM_WORK, b.edges, b.edges_capacity * sizeof(edge_value_t) );
+    mem_free ( MEM_WORK, b.values, b.values_capacity * sizeof(uint32_t) );
+}
+
+
+void
+ssa_finalize ( ssa_function_t *function )
+{
+    for ( uint32_t k = 0; k < function->n_blocks; k++ )
+        mem_free ( MEM_SSA, function->blocks[k].predecessors,
+            function->blocks[k].predecessors_capacity * sizeof(uint32_t)
+        );
+    mem_free ( MEM_SSA, function->blocks,
+        function->blocks_capacity * sizeof(ssa_block_t)
+    );
+    mem_free ( MEM_SSA, function->instructions,
+        function->instructions_capacity * sizeof(ssa_instruction_t)
+    );
+    mem_free ( MEM_SSA, function->operands,
+        function->operands_capacity * sizeof(uint32_t)
+    );
+    *function = (ssa_function_t) { .symbol = NULL };
+}
+
+
+static bool
+is_terminator ( uint8_t opcode )
+{
+    return opcode == SSA_JUMP || opcode == SSA_BRANCH || opcode == SSA_RETURN;
+}
+
+
+bool
+ssa_defines_value ( uint8_t opcode )
+{
+    return !is_terminator ( opcode ) && opcode != SSA_STORE
+        && opcode != SSA_PRINT && opcode != SSA_PRINT_STRING
+        && opcode != SSA_NEWLINE;
+}
+
+
+/* Immediate dominators by the iterative algorithm of Cooper, Harvey and
+ * Kennedy, over blocks in reverse postorder. Blocks that are not reached
+ * from the entry are left with an idom of SSA_NONE.
+ */
+static void
+find_dominators (
+    ssa_function_t *function, uint32_t *idom, uint32_t *postorder
+)
+{
+    uint32_t n = function->n_blocks;
+    uint32_t *order = mem_alloc ( MEM_WORK, n * sizeof(uint32_t) );
+    uint32_t *stack = mem_alloc ( MEM_WORK, n * sizeof(uint32_t) );
+    uint32_t *next = mem_calloc ( MEM_WORK, n, sizeof(uint32_t) );
+    uint32_t n_ordered = 0, depth = 0;
+    for ( uint32_t k = 0; k < n; k++ )
+    {
+        idom[k] = SSA_NONE;
+        postorder[k] = SSA_NONE;
+    }
+    stack[depth++] = 0;
+    next[0] = 1;
+    while ( depth > 0 )
+    {
+        uint32_t k = stack[depth - 1];
+        ssa_block_t *block = &function->blocks[k];
+        if ( next[k] <= block->n_successors )
+        {
+            uint32_t s = block->successors[next[k]++ - 1];
+            if ( s < n && next[s] == 0 )
+            {
+                next[s] = 1;
+                stack[depth++] = s;
+            }
+            continue;
+        }
+        postorder[k] = n_ordered;
+        order[n_ordered++] = k;
+        depth -= 1;
+    }
+
+    idom[0] = 0;
+    bool changed = true;
+    while ( changed )
+    {
+        changed = false;
+        for ( uint32_t r = n_ordered - 1; r-- > 0; )
+        {
+            uint32_t k = order[r];
+            ssa_block_t *block = &function->blocks[k];
+            uint32_t dominator = SSA_NONE;
+            for ( uint32_t p = 0; p < block->n_predecessors; p++ )
+            {
+                uint32_t other = block->predecessors[p];
+                if ( other >= n || idom[other] == SSA_NONE )
+                    continue;
+                if ( dominator == SSA_NONE )
+                {
+                    dominator = other;
+                    continue;
+                }
+                while ( other != dominator )
+                {
+                    while ( postorder[other] < postorder[dominator] )
+                        other = idom[other];
+                    while ( postorder[dominator] < postorder[other] )
+                        dominator = idom[dominator];
+                }
+            }
+            if ( idom[k] != dominator )
+            {
+                idom[k] = dominator;
+                changed = true;
+            }
+        }
+    }
+    mem_free ( MEM_WORK, next, n * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, stack, n * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, order, n * sizeof(uint32_t) );
+}
+
+
+/* Number the dominator tree in preorder, with the last number below each
+ * block, so dominance is a comparison
+ */
+static void
+number_dominator_tree (
+    ssa_function_t *function, uint32_t *idom,
+    uint32_t *first, uint32_t *last
+)
+{
+    uint32_t n = function->n_blocks;
+    uint32_t *start = mem_calloc ( MEM_WORK, n + 1, sizeof(uint32_t) );
+    uint32_t *next = mem_alloc ( MEM_WORK, n * sizeof(uint32_t) );
+    uint32_t *children = mem_alloc ( MEM_WORK, n * sizeof(uint32_t) );
+    uint32_t *stack = mem_alloc ( MEM_WORK, n * sizeof(uint32_t) );
+    for ( uint32_t k = 1; k < n; k++ )
+        if ( idom[k] != SSA_NONE )
+            start[idom[k] + 1] += 1;
+    for ( uint32_t k = 0; k < n; k++ )
+    {
+        start[k + 1] += start[k];
+        next[k] = start[k];
+    }
+    for ( uint32_t k = 1; k < n; k++ )
+        if ( idom[k] != SSA_NONE )
+            children[next[idom[k]]++] = k;
+
+    uint32_t number = 0, depth = 0;
+    for ( uint32_t k = 0; k < n; k++ )
+    {
+        first[k] = last[k] = SSA_NONE;
+        next[k] = start[k];
+    }
+    stack[depth++] = 0;
+    first[0] = number++;
+    while ( depth > 0 )
+    {
+        uint32_t k = stack[depth - 1];
+        if ( next[k] < start[k + 1] )
+        {
+            uint32_t c = children[next[k]++];
+            first[c] = number++;
+            stack[depth++] = c;
+            continue;
+        }
+        last[k] = number - 1;
+        depth -= 1;
+    }
+    mem_free ( MEM_WORK, stack, n * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, children, n * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, next, n * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, start, (n + 1) * sizeof(uint32_t) );
+}
+
+
+#define SSA_ERROR(...) do { \
+    fprintf ( errors, "ssa: %s: ", function->symbol->name ); \
+    fprintf ( errors, __VA_ARGS__ ); \
+    fputc ( '\n', errors ); \
+    n_errors += 1; \
+} while ( false )
+
+
+static uint32_t
+count_edges ( uint32_t *blocks, uint32_t n, uint32_t block )
+{
+    uint32_t count = 0;
+    for ( uint32_t e = 0; e < n; e++ )
+        count += (blocks[e] == block);
+    return count;
+}
+
+
+size_t
+ssa_verify ( ssa_function_t *function, FILE *errors )
+{
+    size_t n_errors = 0;
+    uint32_t n = function->n_blocks;
+    uint32_t *position = mem_alloc (
+        MEM_WORK, (function->n_instructions + 1) * sizeof(uint32_t)
+    );
+
+    /* Blocks: phis first, then one terminator at the end, with the
+     * successors it needs, and edges listed at both ends
+     */
+    for ( uint32_t k = 0; k < n; k++ )
+    {
+        ssa_block_t *block = &function->blocks[k];
+        uint32_t at = 0;
+        bool past_phis = false;
+        for ( uint32_t i = block->first; i != SSA_NONE; )
+        {
+            ssa_instruction_t *instruction = &function->instructions[i];
+            position[i] = at++;
+            if ( instruction->block != k )
+                SSA_ERROR ( "v%u is listed in b%u but placed in b%u",
+                    i, k, instruction->block );
+            if ( instruction->opcode == SSA_PHI )
+            {
+                if ( past_phis )
+                    SSA_ERROR ( "phi v%u is not at the start of b%u", i, k );
+                if ( instruction->n_operands != block->n_predecessors )
+                    SSA_ERROR ( "phi v%u has %u operands for %u predecessors",
+                        i, instruction->n_operands, block->n_predecessors );
+            }
+            else
+                past_phis = true;
+            if ( is_terminator ( instruction->opcode ) != (i == block->last) )
+                SSA_ERROR ( "b%u does not end in its only terminator", k );
+            i = instruction->next;
+        }
+        if ( block->last == SSA_NONE )
+        {
+            SSA_ERROR ( "b%u is empty", k );
+            continue;
+        }
+        uint8_t opcode = function->instructions[block->last].opcode;
+        uint32_t needed = (opcode == SSA_BRANCH) ? 2 : (opcode == SSA_JUMP);
+        if ( block->n_successors != needed )
+            SSA_ERROR ( "b%u has %u successors for its terminator",
+                k, block->n_successors );
+        if ( k == 0 && block->n_predecessors > 0 )
+            SSA_ERROR ( "the entry block has predecessors" );
+        for ( uint32_t s = 0; s < block->n_successors; s++ )
+        {
+            uint32_t successor = block->successors[s];
+            if ( successor >= n )
+            {
+                SSA_ERROR ( "b%u jumps to missing b%u", k, successor );
+                continue;
+            }
+            ssa_block_t *target = &function->blocks[successor];
+            if ( count_edges ( target->predecessors, target->n_predecessors, k )
+                != count_edges ( block->successors, block->n_successors, successor ) )
+                SSA_ERROR ( "b%u -> b%u is not listed as a predecessor",
+                    k, successor );
+            if ( block->n_successors > 1 && target->n_predecessors > 1 )
+                SSA_ERROR ( "b%u -> b%u is a critical edge", k, successor );
+        }
+        for ( uint32_t p = 0; p < block->n_predecessors; p++ )
+        {
+            uint32_t predecessor = block->predecessors[p];
+            if ( predecessor >= n || count_edges (
+                    function->blocks[predecessor].successors,
+                    function->blocks[predecessor].n_successors, k ) == 0 )
+                SSA_ERROR ( "b%u -> b%u is not listed as a successor",
+                    predecessor, k );
+        }
+    }
+    if ( n_errors > 0 )
+    {
+        mem_free ( MEM_WORK, position,
+            (function->n_instructions + 1) * sizeof(uint32_t) );
+        return n_errors;
+    }
+
+    /* Values: defined by a placed instruction that dominates the use,
+     * at the end of the matching predecessor for a phi
+     */
+    uint32_t *idom = mem_alloc ( MEM_WORK, n * sizeof(uint32_t) );
+    uint32_t *postorder = mem_alloc ( MEM_WORK, n * sizeof(uint32_t) );
+    uint32_t *first = mem_alloc ( MEM_WORK, n * sizeof(uint32_t) );
+    uint32_t *last = mem_alloc ( MEM_WORK, n * sizeof(uint32_t) );
+    find_dominators ( function, idom, postorder );
+    number_dominator_tree ( function, idom, first, last );
+    for ( uint32_t k = 0; k < n; k++ )
+    {
+        ssa_block_t *block = &function->blocks[k];
+        if ( idom[k] == SSA_NONE )
+        {
+            SSA_ERROR ( "b%u is not reached from the entry", k );
+            continue;
+        }
+        for ( uint32_t i = block->first; i != SSA_NONE; )
+        {
+            ssa_instruction_t *instruction = &function->instructions[i];
+            for ( uint32_t o = 0; o < instruction->n_operands; o++ )
+            {
+                uint32_t value = SSA_OPERAND ( function, instruction, o );
+                if ( value >= function->n_instructions
+                    || function->instructions[value].block == SSA_NONE
+                    || !ssa_defines_value ( function->instructions[value].opcode ) )
+                {
+                    SSA_ERROR ( "v%u uses v%u, which is not a value", i, value );
+                    continue;
+                }
+                ssa_instruction_t *definition = &function->instructions[value];
+                uint32_t user = k, at = position[i];
+                if ( instruction->opcode == SSA_PHI )
+                {
+                    user = block->predecessors[o];
+                    at = position[function->blocks[user].last] + 1;
+                }
+                uint32_t d = definition->block;
+                bool dominated = (d == user) ? (position[value] < at)
+                    : (first[d] <= first[user] && first[user] <= last[d]);
+                if ( !dominated )
+                    SSA_ERROR ( "v%u does not dominate its use in v%u",
+                        value, i );
+            }
+            i = instruction->next;
+        }
+    }
+    mem_free ( MEM_WORK, last, n * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, first, n * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, postorder, n * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, idom, n * sizeof(uint32_t) );
+    mem_free ( MEM_WORK, position,
+        (function->n_instructions + 1) * sizeof(uint32_t) );
+    return n_errors;
+}
+
+
+static void
+print_operands (
+    ssa_function_t *function, ssa_instruction_t *instruction, emitter_t *out
+)
+{
+    for ( uint32_t o = 0; o < instruction->n_operands; o++ )
+        emitf ( out, "%sv%u", (o > 0) ? ", " : "",
+            SSA_OPERAND ( function, instruction, o ) );
+}
+
+
+/* One instruction per line, preceded by the value it defines:
+ *
+ *     v4 = add v2, v3
+ *     branch lt v4, v1, b2, b3
+ */
+void
+ssa_print ( ssa_function_t *function, emitter_t *out )
+{
+    symbol_t *symbol = function->symbol;
+    emitf ( out, "function %s(%zu)\n", symbol->name, symbol->nparms );
+    for ( uint32_t k = 0; k < function->n_blocks; k++ )
+    {
+        ssa_block_t *block = &function->blocks[k];
+        emitf ( out, "b%u:", k );
+        for ( uint32_t p = 0; p < block->n_predecessors; p++ )
+            emitf ( out, "%s b%u", (p > 0) ? "," : "\t; from",
+                block->predecessors[p] );
+        emit_line ( out, "" );
+        for ( uint32_t i = block->first; i != SSA_NONE; )
+        {
+            ssa_instruction_t *instruction = &function->instructions[i];
+            emit_string ( out, "\t" );
+            if ( ssa_defines_value ( instruction->opcode ) )
+                emitf ( out, "v%u = ", i );
+            switch ( instruction->opcode )
+            {
+                case SSA_CONST:
+                    emitf ( out, "const %lld",
+                        (long long) instruction->data.number );
+                    break;
+                case SSA_UNDEF:
+                    emit_string ( out, "undef" );
+                    break;
+                case SSA_PARAM:
+                    emitf ( out, "param %zu", instruction->data.index );
+                    break;
+                case SSA_LOAD:
+                    emitf ( out, "load %s", instruction->data.symbol->name );
+                    break;
+                case SSA_STORE:
+                    emitf ( out, "store %s, ", instruction->data.symbol->name );
+                    print_operands ( function, instruction, out );
+                    break;
+                case SSA_UNARY:
+                    emit_string ( out, (instruction->op == OP_SUB) ?
+                        "neg " : "not " );
+                    print_operands ( function, instruction, out );
+                    break;
+                case SSA_BINARY:
+                    emitf ( out, "%s ", operator_names[instruction->op] );
+                    print_operands ( function, instruction, out );
+                    break;
+                case SSA_CALL:
+                    emitf ( out, "call %s(", instruction->data.symbol->name );
+                    print_operands ( function, instruction, out );
+                    emit_string ( out, ")" );
+                    break;
+                case SSA_PRINT:
+                    emit_string ( out, "print " );
+                    print_operands ( function, instruction, out );
+                    break;
+                case SSA_PRINT_STRING:
+                    emitf ( out, "print STR%zu", instruction->data.index );
+                    break;
+                case SSA_NEWLINE:
+                    emit_string ( out, "newline" );
+                    break;
+                case SSA_PHI:
+                    emit_string ( out, "phi " );
+                    print_operands ( function, instruction, out );
+                    break;
+                case SSA_JUMP:
+                    emitf ( out, "jump b%u", block->successors[0] );
+                    break;
+                case SSA_BRANCH:
+                    emitf ( out, "branch %s ", operator_names[instruction->op] );
+                    print_operands ( function, instruction, out );
+                    emitf ( out, ", b%u, b%u",
+                        block->successors[0], block->successors[1] );
+                    break;
+                case SSA_RETURN:
+                    emit_string ( out, "return " );
+                    print_operands ( function, instruction, out );
+                    break;
+            }
+            emit_line ( out, "" );
+            i = instruction->next;
+        }
+    }
+}
+
+
+/* Dump the SSA form of every function, in the order they are generated */
+void
+ssa_print_program ( compiler_t *compiler, emitter_t *out )
+{
+    symbol_t *symbol;
+    tlhash_cursor_t cursor = TLHASH_CURSOR_INIT;
+    bool first = true;
+    while ( tlhash_next (
+        compiler->global_names, &cursor, NULL, NULL, (void **)&symbol
+    ) == TLHASH_SUCCESS )
+    {
+        if ( symbol->type != SYM_FUNCTION || symbol->unused )
+            continue;
+        ssa_function_t function;
+        ssa_build ( &function, symbol );
+        if ( ssa_verify ( &function, stderr ) > 0 )
+        {
+            fprintf ( stderr, "Invalid SSA form of %s\n", symbol->name );
+            exit ( EXIT_FAILURE );
+        }
+        if ( !first )
+            emit_line ( out, "" );
+        ssa_print ( &function, out );
+        ssa_finalize ( &function );
+        first = false;
+    }
+}
@@ -0,0 +1,193 @@
+#include <string.h>
+
+#include <stats.h>
+
+
+static double elapsed ( struct timespec *start, struct timespec *end );
+static void write_string ( FILE *file, const char *string );
+static void write_usage (
+    FILE *file, const char *name, mem_usage_t *usage, int live
+);
+static void write_allocations ( FILE *file, mem_profile_t *profile );
+
+
+/* Names of the phases in the JSON output */
+static const char *phase_names[STATS_N_PHASES] = {
+    [STATS_LOAD] = "load",
+    [STATS_PARSE] = "parse",
+    [STATS_SIMPLIFY] = "simplify",
+    [STATS_BIND] = "bind",
+    [STATS_INLINE] = "inline",
+    [STATS_OPTIMIZE] = "optimize",
+    [STATS_GENERATE] = "generate",
+    [STATS_TEARDOWN] = "teardown"
+};
+
+
+/* Phases are timed only when statistics are collected, i.e. when 'stats'
+ * is not NULL. CPU time is that of the whole process, so it includes the
+ * threads that generate functions, and other compilations of a batch
+ * running at the same time.
+ */
+void
+stats_begin ( stats_t *stats, stats_clock_t *clock, stats_phase_t phase )
+{
+    if ( stats == NULL )
+        return;
+    if ( stats->allocations != NULL )
+        mem_profile_phase ( stats->allocations, phase );
+    clock->phase = phase;
+    clock_gettime ( CLOCK_MONOTONIC, &clock->wall );
+    clock_gettime ( CLOCK_PROCESS_CPUTIME_ID, &clock->cpu );
+}
+
+
+void
+stats_end ( stats_t *stats, stats_clock_t *clock )
+{
+    stats_phase_t phase = clock->phase;
+    if ( stats == NULL )
+        return;
+    struct timespec wall, cpu;
+    clock_gettime ( CLOCK_MONOTONIC, &wall );
+    clock_gettime ( CLOCK_PROCESS_CPUTIME_ID, &cpu );
+    stats->phases[phase].wall += elapsed ( &clock->wall, &wall );
+    stats->phases[phase].cpu += elapsed ( &clock->cpu, &cpu );
+}
+
+
+static double
+elapsed ( struct timespec *start, struct timespec *end )
+{
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+
+/* Instructions are the lines of assembly that start with a tab, as
+ * opposed to labels and directives
+ */
+size_t
+stats_count_instructions ( const char *text, size_t size )
+{
+    size_t count = 0;
+    const char *line = text, *end = text + size;
+    while ( line < end )
+    {
+        if ( *line == '\t' )
+            count += 1;
+        const char *newline = memchr ( line, '\n', end - line );
+        if ( newline == NULL )
+            break;
+        line = newline + 1;
+    }
+    return count;
+}
+
+
+/* One JSON object on a line of its own, for the statistics of one input.
+ * Standard input is written as a null input.
+ */
+void
+stats_write ( FILE *file, const char *input, stats_t *stats )
+{
+    fputs ( "{\"input\": ", file );
+    write_string ( file, input );
+
+    fputs ( ", \"phases\": {", file );
+    stats_time_t total = { 0.0, 0.0 };
+    for ( int p=0; p<STATS_N_PHASES; p++ )
+    {
+        fprintf ( file, "\"%s\": {\"wall\": %.9f, \"cpu\": %.9f}, ",
+            phase_names[p], stats->phases[p].wall, stats->phases[p].cpu
+        );
+        total.wall += stats->phases[p].wall;
+        total.cpu += stats->phases[p].cpu;
+    }
+    fprintf ( file, "\"total\": {\"wall\": %.9f, \"cpu\": %.9f}}",
+        total.wall, total.cpu
+    );
+
+    fprintf ( file,
+        ", \"counts\": {\"tokens\": %zu, \"nodes_parsed\": %zu, "
+        "\"nodes_simplified\": %zu, \"symbols\": %zu, \"strings\": %zu, "
+        "\"instructions\": %zu, \"bytes\": %zu, "
+        "\"cache_hits\": %zu, \"cache_misses\": %zu, "
+        "\"calls_inlined\": %zu}",
+        stats->tokens, stats->nodes_parsed, stats->nodes_simplified,
+        stats->symbols, stats->strings, stats->instructions, stats->bytes,
+        stats->cache_hits, stats->cache_misses, stats->calls_inlined
+    );
+    fputs ( ", \"peephole\": {", file );
+    for ( int r=0; r<PEEPHOLE_N_RULES; r++ )
+        fprintf ( file, "%s\"%s\": %zu", (r > 0) ? ", " : "",
+            peephole_rule_name ( r ), stats->peephole_hits[r]
+        );
+    fputs ( "}", file );
+    if ( stats->allocations != NULL )
+        write_allocations ( file, stats->allocations );
+    fputs ( "}\n", file );
+}
+
+
+/* Allocations by category and by phase, and of the whole compilation */
+static void
+write_allocations ( FILE *file, mem_profile_t *profile )
+{
+    fputs ( ", \"allocations\": {", file );
+    write_usage ( file, "total", &profile->total, 1 );
+
+    fputs ( ", \"categories\": {", file );
+    for ( int c=0; c<MEM_N_CATEGORIES; c++ )
+    {
+        if ( c > 0 )
+            fputs ( ", ", file );
+        write_usage (
+            file, mem_category_names[c], &profile->categories[c], 1
+        );
+    }
+
+    fputs ( "}, \"phases\": {", file );
+    for ( int p=0; p<STATS_N_PHASES; p++ )
+    {
+        if ( p > 0 )
+            fputs ( ", ", file );
+        write_usage ( file, phase_names[p], &profile->phases[p], 0 );
+    }
+    fputs ( "}}", file );
+}
+
+
+/* Live bytes are those still in use at the end, phases have none */
+static void
+write_usage ( FILE *file, const char *name, mem_usage_t *usage, int live )
+{
+    fprintf ( file, "\"%s\": {\"count\": %zu, \"bytes\": %zu, ",
+        name, usage->count, usage->bytes
+    );
+    if ( live )
+        fprintf ( file, "\"live\": %zu, ", usage->live );
+    fprintf ( file, "\"peak\": %zu}", usage->peak );
+}
+
+
+static void
+write_string ( FILE *file, const char *string )
+{
+    if ( string == NULL )
+    {
+        fputs ( "null", file );
+        return;
+    }
+    putc ( '"', file );
+    for ( const unsigned char *c = (const unsigned char *)string; *c; c++ )
+    {
+        if ( *c == '"' || *c == '\\' )
+            fprintf ( file, "\\%c", *c );
+        else if ( *c < 0x20 )
+            fprintf ( file, "\\u%04x", *c );
+        else
+            putc ( *c, file );
+    }
+    putc ( '"', file );
+}
@@ -4,17 +4,42 @@
 
 #include <tlhash.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define HAVE_SSE42_CRC32
+#endif
+
 /*********************************************************************
  * Declarations of the utility functions for obtaining hashes, found *
  * at the bottom of this file.                                       *
  *********************************************************************/
 
-/* Little-endian, for x86-s */
-#define CRC32_IEEE802_3 (0xedb88320)
-static const uint32_t crc32_ieee802_3[256];
-static const uint32_t *crc_table = (uint32_t *)crc32_ieee802_3;
+/* CRC32C (Castagnoli), little-endian. This is the polynomial computed by
+ * the SSE4.2 crc32 instruction; the table gives the same hashes on CPUs
+ * without it.
+ */
+#define CRC32_CASTAGNOLI (0x82f63b78)
+static const uint32_t crc32c_castagnoli[256];
+static const uint32_t *crc_table = (uint32_t *)crc32c_castagnoli;
+
+static uint32_t crc32 ( const void *input, size_t length );
+
+
+/********************************************
+ * Declarations of the internal helpers,    *
+ * found between the interface and hashing  *
+ ********************************************/
 
-static uint32_t crc32 ( void *input, size_t length );
+/* Buckets are kept at most 3/4 full, the element array holds exactly that */
+#define MAX_LOAD(n_buckets) ((n_buckets) - (n_buckets)/4)
+#define MIN_BUCKETS 8
+#define MIN_KEY_CHUNK 256
+
+static int resize ( tlhash_t *tab, size_t n_buckets );
+static size_t probe (
+    tlhash_t *tab, const void *key, size_t key_length, uint32_t hash
+);
+static size_t bucket_of ( tlhash_t *tab, uint32_t element );
 
 
 /********************************
@@ -22,24 +47,39 @@ static uint32_t crc32 ( void *input, size_t length );
  ********************************/
 
 
-/* Initializer 
+/* Initializer - the bucket count is only a starting point, it is rounded
+ * up to a power of two, and doubled whenever the table gets too full.
  * Returns
  *  ENOMEM - if allocation of table entries fails.
  */
 int
 tlhash_init ( tlhash_t *tab, size_t n_buckets )
 {
-    size_t i;
-    tab->n_buckets = n_buckets;
+    size_t n = MIN_BUCKETS;
+    while ( n < n_buckets )
+        n *= 2;
+    tab->n_buckets = 0;
     tab->size = 0;
-    tab->buckets = (tlhash_element_t **) calloc (
-        n_buckets, sizeof(tlhash_element_t *)
-    );
-    if ( tab->buckets == NULL )
-        return TLHASH_ENOMEM;
-    for ( i=0; i<n_buckets; i++ )
-        tab->buckets[i] = NULL;
-    return TLHASH_SUCCESS;
+    tab->buckets = NULL;
+    tab->elements = NULL;
+    tab->ordered = 0;
+    tab->key_bytes = 0;
+    arena_init ( &tab->keys, MIN_KEY_CHUNK );
+    return resize ( tab, n );
+}
+
+
+/* Initializer for tables that iterate in insertion order even after
+ * removals, which makes removal linear in the table size.
+ * Returns
+ *  ENOMEM - if allocation of table entries fails.
+ */
+int
+tlhash_init_ordered ( tlhash_t *tab, size_t n_buckets )
+{
+    int status = tlhash_init ( tab, n_buckets );
+    tab->ordered = 1;
+    return status;
 }
 
 
@@ -50,28 +90,27 @@ tlhash_init ( tlhash_t *tab, size_t n_buckets )
 int
 tlhash_finalize ( tlhash_t *tab )
 {
-    size_t i;
     if ( tab == NULL )
         return TLHASH_ENOENT;
-    for ( i=0; i<tab->n_buckets; i++ )
-    {
-        tlhash_element_t *element = tab->buckets[i], *next;
-        while ( element != NULL )
-        {
-            next = element->next;
-            free ( element->key );
-            free ( element );
-            tab->size -= 1;
-            element = next;
-        }
-    }
-
-    free ( tab->buckets );
+    mem_free (
+        MEM_HASH_TABLES, tab->buckets,
+        tab->n_buckets * sizeof(tlhash_bucket_t)
+    );
+    mem_free (
+        MEM_HASH_TABLES, tab->elements,
+        MAX_LOAD(tab->n_buckets) * sizeof(tlhash_element_t)
+    );
+    arena_release ( &tab->keys );
+    mem_untrack ( MEM_HASH_KEYS, tab->key_bytes );
+    tab->key_bytes = 0;
+    tab->buckets = NULL;
+    tab->elements = NULL;
+    tab->n_buckets = tab->size = 0;
     return TLHASH_SUCCESS;
 }
 
 
-/* Insert - find hash value, modulate over buckets, append to linked list
+/* Insert - find hash value, probe for a free bucket, append the element
  * Returns
  *  EEXIST - if an element is already indexed by this key
  *  ENOMEM - if allocation of element or key copy fails
@@ -81,33 +120,56 @@ tlhash_insert (
     tlhash_t *tab, void *key, size_t key_length, void *value
 )
 {
-    void *test_entry;
-    int test = tlhash_lookup ( tab, key, key_length, &test_entry );
-    if ( test != TLHASH_ENOENT )
-        return TLHASH_EEXIST;
     uint32_t hash = crc32 ( key, key_length );
-    size_t bucket = hash % tab->n_buckets;
-    tlhash_element_t *element = malloc ( sizeof(tlhash_element_t) );
-    if ( element == NULL )
-        return TLHASH_ENOMEM;
-    void *key_copy = malloc ( key_length );
+    if ( tab->buckets[probe(tab,key,key_length,hash)].element != 0 )
+        return TLHASH_EEXIST;
+    void *key_copy = arena_alloc ( &tab->keys, key_length );
     if ( key_copy == NULL )
-    {
-        free ( element );
         return TLHASH_ENOMEM;
-    }
+    mem_track ( MEM_HASH_KEYS, key_length );
+    tab->key_bytes += key_length;
     memcpy ( key_copy, key, key_length );
-    element->key         = key_copy;
-    element->key_length  = key_length;
-    element->value       = value;
-    element->next        = tab->buckets[bucket];
-    tab->buckets[bucket] = element;
+    return tlhash_insert_hashed ( tab, key_copy, key_length, hash, value );
+}
+
+
+/* Insert with a hash the caller already has from tlhash_hash. The key is
+ * not copied, so it must stay valid for as long as the table is in use.
+ * Returns
+ *  EEXIST - if an element is already indexed by this key
+ *  ENOMEM - if the table can not grow to hold the element
+ */
+int
+tlhash_insert_hashed (
+    tlhash_t *tab, void *key, size_t key_length, uint32_t hash, void *value
+)
+{
+    size_t b = probe ( tab, key, key_length, hash );
+    if ( tab->buckets[b].element != 0 )
+        return TLHASH_EEXIST;
+
+    if ( tab->size + 1 > MAX_LOAD(tab->n_buckets) )
+    {
+        if ( resize ( tab, 2 * tab->n_buckets ) != TLHASH_SUCCESS )
+            return TLHASH_ENOMEM;
+        b = probe ( tab, key, key_length, hash );
+    }
+
+    tab->elements[tab->size] = (tlhash_element_t) {
+        .key = key,
+        .value = value,
+        .key_length = key_length,
+        .hash = hash
+    };
     tab->size += 1;
+    tab->buckets[b] = (tlhash_bucket_t) {
+        .hash = hash, .element = tab->size
+    };
     return TLHASH_SUCCESS;
 }
 
 
-/* Lookup - find hash value, modulate over buckets, search linked list
+/* Lookup - find hash value, probe until the key or an empty bucket
  * Returns
  *  ENOENT - if no element is indexed by this key
  */
@@ -116,28 +178,36 @@ tlhash_lookup (
     tlhash_t *tab, void *key, size_t key_length, void **value
 )
 {
-    uint32_t hash = crc32 ( key, key_length );
-    size_t bucket = hash % tab->n_buckets;
-    tlhash_element_t *el = tab->buckets[bucket];
+    return tlhash_lookup_hashed (
+        tab, key, key_length, crc32 ( key, key_length ), value
+    );
+}
+
 
-    *value = NULL;
-    while ( el != NULL )
+/* Lookup with a hash the caller already has from tlhash_hash
+ * Returns
+ *  ENOENT - if no element is indexed by this key
+ */
+int
+tlhash_lookup_hashed (
+    tlhash_t *tab, void *key, size_t key_length, uint32_t hash, void **value
+)
+{
+    tlhash_bucket_t *bucket = &tab->buckets[probe(tab,key,key_length,hash)];
+    if ( bucket->element == 0 )
     {
-        if ( el->key_length == key_length && ! memcmp(el->key,key,key_length) )
-        {
-            *value = el->value;
-            break;
-        }
-        el = el->next;
-    }
-    if ( el != NULL )
-        return TLHASH_SUCCESS;
-    else
+        *value = NULL;
         return TLHASH_ENOENT;
+    }
+    *value = tab->elements[bucket->element-1].value;
+    return TLHASH_SUCCESS;
 }
 
 
-/* Removal - find hash value, modulate over buckets, delete entry
+/* Removal - find hash value, probe for the key, delete entry. The buckets
+ * after it in the probe sequence are shifted back so no tombstones are
+ * needed. The last element is moved into the hole it leaves, or in an
+ * ordered table, all the elements after it move down one place.
  * Returns
  *  ENOENT - no such element to remove was found.
  */
@@ -145,33 +215,54 @@ int
 tlhash_remove ( tlhash_t *tab, void *key, size_t key_length )
 {
     uint32_t hash = crc32 ( key, key_length );
-    size_t bucket = hash % tab->n_buckets;
-    tlhash_element_t *el = tab->buckets[bucket], *prev = NULL;
+    size_t mask = tab->n_buckets - 1, hole = probe(tab,key,key_length,hash);
+    uint32_t element = tab->buckets[hole].element;
+    if ( element == 0 )
+        return TLHASH_ENOENT;
 
-    while ( el != NULL )
+    /* Close the gap in the probe sequence */
+    size_t b = hole;
+    for ( ;; )
     {
-        if ( el->key_length == key_length && ! memcmp(el->key,key,key_length) )
-        {
-            /* We have a match. */
-            if ( prev != NULL ) /* Remove from list if it's not the head */
-                prev->next = (void *)el->next;
-            else                /* Substitute it if it IS the head */
-                tab->buckets[bucket] = el->next;
-            /* Free the container and key copy allocated by this lib */
-            free ( el->key );
-            free ( el );
+        b = (b + 1) & mask;
+        if ( tab->buckets[b].element == 0 )
             break;
+        size_t home = tab->buckets[b].hash & mask;
+        /* Only move a bucket back if its home is not between hole and b */
+        if ( ((b - home) & mask) >= ((b - hole) & mask) )
+        {
+            tab->buckets[hole] = tab->buckets[b];
+            hole = b;
         }
-        prev = el;
-        el = el->next;
     }
-    if ( el == NULL )
-        return TLHASH_ENOENT;
-    else
+    tab->buckets[hole].element = 0;
+
+    /* Keep the elements dense */
+    if ( element != tab->size && tab->ordered )
+    {
+        memmove (
+            &tab->elements[element-1], &tab->elements[element],
+            (tab->size - element) * sizeof(tlhash_element_t)
+        );
+        for ( b=0; b<tab->n_buckets; b++ )
+            if ( tab->buckets[b].element > element )
+                tab->buckets[b].element -= 1;
+    }
+    else if ( element != tab->size )
     {
-        tab->size -= 1;
-        return TLHASH_SUCCESS;
+        tab->buckets[bucket_of(tab,tab->size)].element = element;
+        tab->elements[element-1] = tab->elements[tab->size-1];
     }
+    tab->size -= 1;
+    return TLHASH_SUCCESS;
+}
+
+
+/* The hash the table computes for a key, for use with the _hashed calls */
+uint32_t
+tlhash_hash ( const void *key, size_t key_length )
+{
+    return crc32 ( key, key_length );
 }
 
 
@@ -185,44 +276,148 @@ tlhash_size ( tlhash_t *tab )
 void
 tlhash_keys ( tlhash_t *tab, void **keys )
 {
-    size_t b, i = 0;
-    for ( b=0; b<tab->n_buckets; b++ )
-    {
-        tlhash_element_t *el = tab->buckets[b];
-        while ( el != NULL )
-        {
-            keys[i] = el->key;
-            i += 1;
-            el = el->next;
-        }
-    }
+    for ( size_t i=0; i<tab->size; i++ )
+        keys[i] = tab->elements[i].key;
 }
 
 
 void
 tlhash_values ( tlhash_t *tab, void **values )
 {
-    size_t b, i = 0;
-    for ( b=0; b<tab->n_buckets; b++ )
+    for ( size_t i=0; i<tab->size; i++ )
+        values[i] = tab->elements[i].value;
+}
+
+
+/* Iteration - visit the elements in place, without copying them out.
+ * Elements come in insertion order, unless an unordered table has had
+ * removals. The table must not change while it is being iterated over.
+ * Any of key, key_length and value may be NULL if they are not wanted.
+ * Returns
+ *  ENOENT - when there are no more elements, nothing is stored then
+ */
+int
+tlhash_next (
+    tlhash_t *tab, tlhash_cursor_t *cursor,
+    void **key, size_t *key_length, void **value
+)
+{
+    if ( *cursor >= tab->size )
+        return TLHASH_ENOENT;
+    tlhash_element_t *el = &tab->elements[*cursor];
+    if ( key != NULL )
+        *key = el->key;
+    if ( key_length != NULL )
+        *key_length = el->key_length;
+    if ( value != NULL )
+        *value = el->value;
+    *cursor += 1;
+    return TLHASH_SUCCESS;
+}
+
+
+/********************
+ * Internal helpers *
+ ********************/
+
+
+/* Grow the bucket and element arrays, rebuilding the buckets from the
+ * stored hashes (the keys are not hashed again)
+ */
+static int
+resize ( tlhash_t *tab, size_t n_buckets )
+{
+    /* The element array keeps its size unless the buckets grow with it,
+     * as its size is taken from the number of buckets
+     */
+    tlhash_bucket_t *buckets = mem_calloc (
+        MEM_HASH_TABLES, n_buckets, sizeof(tlhash_bucket_t)
+    );
+    if ( buckets == NULL )
+        return TLHASH_ENOMEM;
+    tlhash_element_t *elements = mem_realloc (
+        MEM_HASH_TABLES, tab->elements,
+        MAX_LOAD(tab->n_buckets) * sizeof(tlhash_element_t),
+        MAX_LOAD(n_buckets) * sizeof(tlhash_element_t)
+    );
+    if ( elements == NULL )
+    {
+        mem_free (
+            MEM_HASH_TABLES, buckets, n_buckets * sizeof(tlhash_bucket_t)
+        );
+        return TLHASH_ENOMEM;
+    }
+
+    size_t mask = n_buckets - 1;
+    for ( size_t i=0; i<tab->size; i++ )
+    {
+        size_t b = elements[i].hash & mask;
+        while ( buckets[b].element != 0 )
+            b = (b + 1) & mask;
+        buckets[b] = (tlhash_bucket_t) {
+            .hash = elements[i].hash, .element = i+1
+        };
+    }
+    mem_free (
+        MEM_HASH_TABLES, tab->buckets,
+        tab->n_buckets * sizeof(tlhash_bucket_t)
+    );
+    tab->buckets = buckets;
+    tab->elements = elements;
+    tab->n_buckets = n_buckets;
+
+    /* Larger tables get larger chunks for their keys */
+    if ( n_buckets * 4 > tab->keys.chunk_size )
+        tab->keys.chunk_size = n_buckets * 4;
+    return TLHASH_SUCCESS;
+}
+
+
+/* Index of the bucket holding the key, or of the empty bucket where it
+ * would go. Keys that were inserted without a copy match on identity
+ * before their bytes are compared.
+ */
+static size_t
+probe ( tlhash_t *tab, const void *key, size_t key_length, uint32_t hash )
+{
+    size_t mask = tab->n_buckets - 1, b = hash & mask;
+    for ( ;; b = (b + 1) & mask )
     {
-        tlhash_element_t *el = tab->buckets[b];
-        while ( el != NULL )
+        tlhash_bucket_t *bucket = &tab->buckets[b];
+        if ( bucket->element == 0 )
+            return b;
+        if ( bucket->hash == hash )
         {
-            values[i] = el->value;
-            i += 1;
-            el = el->next;
+            tlhash_element_t *el = &tab->elements[bucket->element-1];
+            if ( el->key_length == key_length &&
+                 ( el->key == key || ! memcmp ( el->key, key, key_length ) )
+            )
+                return b;
         }
     }
 }
 
 
+/* Index of the bucket referring to an element (numbered from 1) */
+static size_t
+bucket_of ( tlhash_t *tab, uint32_t element )
+{
+    size_t mask = tab->n_buckets - 1;
+    size_t b = tab->elements[element-1].hash & mask;
+    while ( tab->buckets[b].element != element )
+        b = (b + 1) & mask;
+    return b;
+}
+
+
 /***************************************
- * Hashing function and IEEE data blob *
+ * Hashing function and Castagnoli     *
+ * data blob                           *
  ***************************************/
 
 
 static uint32_t
-crc32 ( void *input, size_t length )
+crc32_table ( const void *input, size_t length )
 {
     const uint8_t *data = (uint8_t *)input;
     size_t i = 0;
@@ -233,49 +428,89 @@ crc32 ( void *input, size_t length )
 }
 
 
+#ifdef HAVE_SSE42_CRC32
+/* Eight bytes per instruction, then the tail one at a time */
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32_sse42 ( const void *input, size_t length )
+{
+    const uint8_t *data = (uint8_t *)input;
+    uint32_t hash = 0xFFFFFFFF;
+#ifdef __x86_64__
+    for ( ; length >= 8; length -= 8, data += 8 )
+    {
+        uint64_t word;
+        memcpy ( &word, data, 8 );
+        hash = (uint32_t) _mm_crc32_u64 ( hash, word );
+    }
+#endif
+    for ( ; length >= 4; length -= 4, data += 4 )
+    {
+        uint32_t word;
+        memcpy ( &word, data, 4 );
+        hash = _mm_crc32_u32 ( hash, word );
+    }
+    for ( ; length > 0; length -= 1, data += 1 )
+        hash = _mm_crc32_u8 ( hash, *data );
+    return (hash^0xFFFFFFFF);
+}
+#endif
+
+
+static uint32_t
+crc32 ( const void *input, size_t length )
+{
+#ifdef HAVE_SSE42_CRC32
+    if ( __builtin_cpu_supports ( "sse4.2" ) )
+        return crc32_sse42 ( input, length );
+#endif
+    return crc32_table ( input, length );
+}
+
+
 static const uint32_t
-crc32_ieee802_3[256] = {
-    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
-    0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-    0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
-    0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
-    0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-    0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
-    0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
-    0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-    0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
-    0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
-    0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-    0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
-    0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
-    0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-    0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
-    0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
-    0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-    0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
-    0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
-    0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-    0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
-    0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
-    0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-    0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
-    0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
-    0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-    0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
-    0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
-    0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-    0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
-    0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
-    0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-    0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+crc32c_castagnoli[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+    0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+    0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+    0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+    0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+    0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+    0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+    0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+    0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+    0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+    0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+    0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+    0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+    0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+    0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+    0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+    0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+    0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+    0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+    0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+    0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+    0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
 };
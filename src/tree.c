@@ -4,35 +4,64 @@
 void
 node_print ( node_t *root, int nesting )
 {
-    if ( root != NULL )
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    if ( root == NULL )
+        printf ( "# %*c%p\n", nesting, ' ', root );
+    walk_init ( &walk, &root );
+    while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
     {
-        printf ( "# %*c%s", nesting, ' ', node_string[root->type] );
-        if ( root->type == IDENTIFIER_DATA ||
-             root->type == STRING_DATA ||
-             root->type == RELATION ||
-             root->type == EXPRESSION ) 
-            printf ( "# (%s)", (char *) root->data );
-        else if ( root->type == NUMBER_DATA )
-            printf ( "# (%ld)", *((int64_t *)root->data) );
+        node_t *node = *slot;
+        if ( event != WALK_ENTER )
+            continue;
+        printf ( "# %*c%s", nesting + (int) walk.depth - 1, ' ',
+            node_string[node->type]
+        );
+        if ( node->type == IDENTIFIER_DATA )
+            printf ( "# (%s)", node->data.name );
+        else if ( node->type == STRING_DATA )
+            printf ( "# (%s)", node->data.string );
+        else if ( node->type == RELATION || node->type == EXPRESSION )
+            printf ( "# (%s)", operator_string[node->op] );
+        else if ( node->type == NUMBER_DATA )
+            printf ( "# (%ld)", node->data.number );
         putchar ( '\n' );
-        for ( int64_t i=0; i<root->n_children; i++ )
-            node_print ( root->children[i], nesting+1 );
     }
-    else
-        printf ( "# %*c%p\n", nesting, ' ', root );
+    walk_finalize ( &walk );
+}
+
+
+/* Number of nodes in a tree */
+size_t
+node_count ( node_t *root )
+{
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    size_t count = 0;
+    walk_init ( &walk, &root );
+    while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+        count += (event == WALK_ENTER);
+    walk_finalize ( &walk );
+    return count;
 }
 
 
+/* Fill in a node from node_alloc, which made room for its children */
 void
-node_init (node_t *nd, node_index_t type, void *data, uint64_t n_children, ...)
+node_init (
+    node_t *nd, node_index_t type, operator_t op, uint64_t n_children, ...
+)
 {
     va_list child_list;
+    node_t **children = nd->children;
     *nd = (node_t) {
         .type = type,
-        .data = data,
+        .op = op,
         .entry = NULL,
         .n_children = n_children,
-        .children = (node_t **) malloc ( n_children * sizeof(node_t *) )
+        .children = children
     };
     va_start ( child_list, n_children );
     for ( uint64_t i=0; i<n_children; i++ )
@@ -41,182 +70,129 @@ node_init (node_t *nd, node_index_t type, void *data, uint64_t n_children, ...)
 }
 
 
-void
-node_finalize ( node_t *discard )
+/* New nodes are allocated with their children right after them, so a
+ * pass over the tree finds them on the same cache line. Discarded nodes
+ * are kept on a free list for node_alloc to reuse, with a child array of
+ * their own; children stay in the arena until the tree is destroyed.
+ */
+node_t *
+node_alloc ( compiler_t *compiler, uint64_t n_children )
 {
-    if ( discard != NULL )
+    size_t children_size = n_children * sizeof(node_t *);
+    node_t *node = compiler->free_nodes;
+    if ( node != NULL )
+    {
+        compiler->free_nodes = (node_t *) node->children;
+        node->children = arena_alloc ( &compiler->tree_arena, children_size );
+    }
+    else
     {
-        free ( discard->data );
-        free ( discard->children );
-        free ( discard );
+        node = arena_alloc (
+            &compiler->tree_arena, sizeof(node_t) + children_size
+        );
+        node->children = (node_t **) (node + 1);
+        mem_track ( MEM_NODES, sizeof(node_t) );
     }
+    mem_track ( MEM_CHILDREN, children_size );
+    return node;
 }
 
 
 void
-destroy_subtree ( node_t *discard )
+node_finalize ( compiler_t *compiler, node_t *discard )
 {
     if ( discard != NULL )
     {
-        for ( uint64_t i=0; i<discard->n_children; i++ )
-            destroy_subtree ( discard->children[i] );
-        node_finalize ( discard );
+        discard->children = (node_t **) compiler->free_nodes;
+        compiler->free_nodes = discard;
     }
 }
 
 
-void
-simplify_tree ( node_t **simplified, node_t *root )
-{
-    if ( root == NULL )
-        return;
+/* Child arrays that lists have grown out of are kept by capacity. The
+ * capacities are powers of two, and an array is reused by the next list
+ * to grow to its size, so lists waste at most the unused tail of their
+ * last array.
+ */
 
-    /* Simplify subtrees before examining this node */
-    for ( uint64_t i=0; i<root->n_children; i++ )
-        simplify_tree ( &root->children[i], root->children[i] );
 
-    node_t *discard, *result = root;
-    switch ( root->type )
+/* Append a child to a list, in amortized constant time. Arrays are only
+ * ever filled up to a power of two before they are replaced by one twice
+ * the size, so the capacity need not be stored.
+ */
+node_t *
+node_append ( compiler_t *compiler, node_t *list, node_t *child )
+{
+    uint64_t n = list->n_children;
+    if ( (n & (n-1)) == 0 )
     {
-        /* Structures of purely syntactic function */
-        case PARAMETER_LIST: case ARGUMENT_LIST:
-        case STATEMENT: case PRINT_ITEM: case GLOBAL:
-            result = root->children[0];
-            node_finalize ( root );
-            break;
-        case PRINT_STATEMENT:
-            result = root->children[0];
-            result->type = PRINT_STATEMENT;
-            node_finalize(root);
-        /* Flatten lists:
-         * Take left child, append right child, substitute left for root.
-         */
-        case STATEMENT_LIST: case DECLARATION_LIST: case GLOBAL_LIST:
-        case PRINT_LIST: case EXPRESSION_LIST: case VARIABLE_LIST:
-            if ( root->n_children >= 2 )
-            {
-                result = root->children[0];
-                result->n_children += 1;
-                result->children = realloc (
-                    result->children, result->n_children * sizeof(node_t *)
-                );
-                result->children[result->n_children-1] = root->children[1];
-                node_finalize ( root );
-            }
-            break;
-        case EXPRESSION:
-            switch ( root->n_children )
-            {
-                case 1:
-                    if ( root->children[0]->type == NUMBER_DATA )
-                    {
-                        result = root->children[0];
-                        if ( root->data != NULL )
-                            *((int64_t *)result->data) *= -1;
-                        node_finalize (root);
-                    }
-                    else if ( root->data == NULL )
-                    {
-                        result = root->children[0];
-                        node_finalize (root);
-                    }
-                    break;
-                case 2:
-                    if ( root->children[0]->type == NUMBER_DATA &&
-                         root->children[1]->type == NUMBER_DATA
-                    ) {
-                        result = root->children[0];
-                        int64_t
-                            *x = result->data,
-                            *y = root->children[1]->data;
-                       // Evaluate the expressiongs for this
-		       
-			char *cc = ((char *)root->data);
-	
-			// strcmp for leftshift and rightshift
-			
-			if((strcmp(cc,"+")==0)){
-			*x += *y; 
-			}else if ((strcmp(cc,"-")==0)){
-			*x -= *y; 
-			}else if ((strcmp(cc,"*")==0)){
-			*x *= *y; 
-			}else if ((strcmp(cc,"/")==0)){
-			*x /= *y; 
-			}else if ((strcmp(cc,"<<")==0)){
-			*x =  *x << *y; 
-			}else if ((strcmp(cc,">>")==0)){
-			*x =  *x >> *y; 
-			}else if ((strcmp(cc,"&")==0)){
-			*x =  *x & *y;
-			}else if ((strcmp(cc,"^")==0)){
-			*x =  *x ^ *y;
-			}else if ((strcmp(cc,"|")==0)){
-			*x =  *x | *y;
-			}else{
-			// do nothing
-			}
-		
-			
-			/*
-			switch ( *((char *)root->data) )
-			{
-                            case '+': *x += *y; break;
-                            case '-': *x -= *y; break;
-                            case '*': *x *= *y; break;
-                            case '/': *x /= *y; break;
-			  //  case '<<': *x  = *x << *y; break; 
-                        }
-			*/
-
-                        node_finalize ( root->children[1] );
-                        node_finalize ( root );
-                    }
-                    break;
-            }
+        size_t capacity = (n > 0) ? 2*n : 1;
+        int order = 0;
+        while ( ((size_t)1 << order) < capacity )
+            order += 1;
+
+        node_t ***spare = compiler->spare_children;
+        node_t **children = spare[order];
+        if ( children != NULL )
+            spare[order] = (node_t **) children[0];
+        else
+        {
+            children = arena_alloc (
+                &compiler->tree_arena, capacity * sizeof(node_t *)
+            );
+            mem_track ( MEM_CHILDREN, capacity * sizeof(node_t *) );
+        }
+        memcpy ( children, list->children, n * sizeof(node_t *) );
+
+        /* The old array is spare now, unless it was empty */
+        if ( n > 0 )
+        {
+            list->children[0] = (node_t *) spare[order-1];
+            spare[order-1] = list->children;
+        }
+        list->children = children;
     }
-
-    *simplified = result;
+    list->children[n] = child;
+    list->n_children = n + 1;
+    return list;
 }
 
+
 void
-simplify_tree2 ( node_t **simplified, node_t *root )
+destroy_syntax_tree ( compiler_t *compiler )
 {
-    if ( root == NULL )
-        return;
+    compiler->free_nodes = NULL;
+    memset (
+        compiler->spare_children, 0, sizeof(compiler->spare_children)
+    );
+    arena_release ( &compiler->tree_arena );
+    mem_release ( MEM_NODES );
+    mem_release ( MEM_CHILDREN );
+    mem_release ( MEM_PAYLOADS );
+    mem_release ( MEM_NAMES );
+    compiler->root = NULL;
+}
 
-    /* Simplify subtrees before examining this node */
-    for ( uint64_t i=0; i<root->n_children; i++ )
-        simplify_tree ( &root->children[i], root->children[i] );
 
-    node_t *discard, *result = root;
+/* Simplify one node whose children are simplified, returning the node
+ * that replaces it
+ */
+static node_t *
+simplify_node ( compiler_t *compiler, node_t *root )
+{
+    node_t *result = root;
     switch ( root->type )
     {
         /* Structures of purely syntactic function */
         case PARAMETER_LIST: case ARGUMENT_LIST:
         case STATEMENT: case PRINT_ITEM: case GLOBAL:
             result = root->children[0];
-            node_finalize ( root );
+            node_finalize ( compiler, root );
             break;
         case PRINT_STATEMENT:
             result = root->children[0];
             result->type = PRINT_STATEMENT;
-            node_finalize(root);
-        /* Flatten lists:
-         * Take left child, append right child, substitute left for root.
-         */
-        case STATEMENT_LIST: case DECLARATION_LIST: case GLOBAL_LIST:
-        case PRINT_LIST: case EXPRESSION_LIST: case VARIABLE_LIST:
-            if ( root->n_children >= 2 )
-            {
-                result = root->children[0];
-                result->n_children += 1;
-                result->children = realloc (
-                    result->children, result->n_children * sizeof(node_t *)
-                );
-                result->children[result->n_children-1] = root->children[1];
-                node_finalize ( root );
-            }
+            node_finalize(compiler, root);
             break;
         case EXPRESSION:
             switch ( root->n_children )
@@ -225,36 +201,54 @@ simplify_tree2 ( node_t **simplified, node_t *root )
                     if ( root->children[0]->type == NUMBER_DATA )
                     {
                         result = root->children[0];
-                        if ( root->data != NULL )
-                            *((int64_t *)result->data) *= -1;
-                        node_finalize (root);
+                        uint64_t x = result->data.number;
+                        if ( root->op == OP_SUB )
+                            result->data.number = (int64_t) -x;
+                        else if ( root->op == OP_NOT )
+                            result->data.number = (int64_t) ~x;
+                        node_finalize (compiler, root);
                     }
-                    else if ( root->data == NULL )
+                    else if ( root->op == OP_NONE )
                     {
                         result = root->children[0];
-                        node_finalize (root);
+                        node_finalize (compiler, root);
                     }
                     break;
                 case 2:
+                    /* Folded as the generated code computes, which leaves
+                     * a division that would trap to run
+                     */
                     if ( root->children[0]->type == NUMBER_DATA &&
-                         root->children[1]->type == NUMBER_DATA
+                         root->children[1]->type == NUMBER_DATA &&
+                         fold_operator ( root->op,
+                             &root->children[0]->data.number,
+                             root->children[1]->data.number )
                     ) {
                         result = root->children[0];
-                        int64_t
-                            *x = result->data,
-                            *y = root->children[1]->data;
-                        switch ( *((char *)root->data) )
-                        {
-                            case '+': *x += *y; break;
-                            case '-': *x -= *y; break;
-                            case '*': *x *= *y; break;
-                            case '/': *x /= *y; break;
-                        }
-                        node_finalize ( root->children[1] );
-                        node_finalize ( root );
+                        node_finalize ( compiler, root->children[1] );
+                        node_finalize ( compiler, root );
                     }
                     break;
             }
     }
-    *simplified = result;
+
+    return result;
+}
+
+
+/* Simplify a tree from the leaves up, so every node is examined after its
+ * children. The simplified tree is put in 'simplified'.
+ */
+void
+simplify_tree ( compiler_t *compiler, node_t **simplified, node_t *root )
+{
+    walk_t walk;
+    walk_event_t event;
+    node_t **slot;
+    *simplified = root;
+    walk_init ( &walk, simplified );
+    while ( (event = walk_next ( &walk, &slot )) != WALK_DONE )
+        if ( event == WALK_LEAVE )
+            *slot = simplify_node ( compiler, *slot );
+    walk_finalize ( &walk );
 }
@@ -1,31 +1,354 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/stat.h>
 #include <vslc.h>
 
 
-node_t *root;               // Syntax tree                  
-tlhash_t *global_names;     // Symbol table        
-char **string_list;         // List of strings in the source
-size_t n_string_list = 8;   // Initial string list capacity (grow on demand)                                            
-size_t stringc = 0;         // Initial string count
+static void
+usage ( const char *program )
+{
+    fprintf ( stderr,
+        "Usage: %s [-o output.s] [input.vsl]\n"
+        "       %s [--jobs N] input.vsl... (each written to input.s)\n"
+        "       --jobs N compiles with N threads\n"
+        "       --stats[=file.json] writes statistics as JSON lines\n"
+        "       --alloc-stats[=file.json] adds allocations to the statistics\n"
+        "       --cache=DIR reuses the code of unchanged functions from DIR\n"
+        "       --no-optimize generates code for the tree as it is written\n"
+        "       --inline-budget=N inlines calls that add up to N nodes more\n"
+        "       --via-ir generates functions from their SSA form\n"
+        "       --emit-ir writes the SSA form of functions instead of assembly\n",
+        program, program
+    );
+    exit ( EXIT_FAILURE );
+}
 
 
+/* Output name for an input when several are compiled: foo.vsl -> foo.s */
+static char *
+output_name ( const char *input )
+{
+    size_t length = strlen ( input );
+    if ( length > 4 && strcmp ( input + length - 4, ".vsl" ) == 0 )
+        length -= 4;
+    char *name = malloc ( length + 3 );
+    memcpy ( name, input, length );
+    strcpy ( name + length, ".s" );
+    return name;
+}
 
-int
-main ( int argc, char **argv )
+
+/* How the command line asks for inputs to be compiled */
+typedef struct {
+    int n_jobs;
+    const char *cache_directory;
+    bool optimize, via_ir, emit_ir;
+    int inline_budget;
+} options_t;
+
+
+/* Code from another build is not taken from the cache, even if the version
+ * is the same. This file is compiled again whenever vslc is linked, so the
+ * stamp changes with any part of the code generator.
+ */
+static const char *vslc_build = VSLC_VERSION " " __DATE__ " " __TIME__;
+
+
+static void
+compiler_init ( compiler_t *compiler, const options_t *options )
 {
-    yyparse();
-    simplify_tree ( &root, root );
-    //node_print ( root, 0 );
+    *compiler = (compiler_t) {
+        .n_string_list = 8,
+        .n_jobs = options->n_jobs,
+        .cache_directory = options->cache_directory,
+        .build = vslc_build,
+        .optimize = options->optimize,
+        .inline_budget = options->inline_budget,
+        .via_ir = options->via_ir,
+        .emit_ir = options->emit_ir
+    };
+}
+
+
+/* Compile one source file into an emitter. A NULL input path reads
+ * standard input.
+ */
+static void
+compile ( compiler_t *compiler, const char *input_path, emitter_t *output )
+{
+    stats_t *stats = compiler->stats;
+    stats_clock_t clock;
+
+    stats_begin ( stats, &clock, STATS_LOAD );
+    if ( source_open ( &compiler->source, input_path ) != SOURCE_SUCCESS )
+    {
+        perror ( (input_path != NULL) ? input_path : "stdin" );
+        exit ( EXIT_FAILURE );
+    }
+    arena_init ( &compiler->tree_arena, ARENA_CHUNK_SIZE );
+    intern_init ( &compiler->names, &compiler->tree_arena );
+    stats_end ( stats, &clock );
+
+    stats_begin ( stats, &clock, STATS_PARSE );
+    if ( scanner_begin ( compiler ) != 0 )
+    {
+        fprintf ( stderr, "Out of memory for the scanner\n" );
+        exit ( EXIT_FAILURE );
+    }
+    yyparse ( compiler, compiler->scanner );
+    scanner_end ( compiler );
+    stats_end ( stats, &clock );
+
+    if ( stats != NULL )
+        stats->nodes_parsed = node_count ( compiler->root );
+    stats_begin ( stats, &clock, STATS_SIMPLIFY );
+    simplify_tree ( compiler, &compiler->root, compiler->root );
+    stats_end ( stats, &clock );
+    //node_print ( compiler->root, 0 );
+
+    if ( stats != NULL )
+        stats->nodes_simplified = node_count ( compiler->root );
+    stats_begin ( stats, &clock, STATS_BIND );
   // call function to create symbol table
-    create_symbol_table();
-//    print_symbol_table();
+    create_symbol_table ( compiler );
+    stats_end ( stats, &clock );
+//    print_symbol_table ( compiler );
       // then call function to print symbol table
+
+    if ( compiler->optimize )
+    {
+        stats_begin ( stats, &clock, STATS_INLINE );
+        inline_calls ( compiler );
+        stats_end ( stats, &clock );
+        stats_begin ( stats, &clock, STATS_OPTIMIZE );
+        optimize_tree ( compiler );
+        stats_end ( stats, &clock );
+    }
+
 // generate the program
-    generate_program();
-    
-    destroy_subtree ( root );
+    stats_begin ( stats, &clock, STATS_GENERATE );
+    if ( compiler->emit_ir )
+        ssa_print_program ( compiler, output );
+    else
+        generate_program ( compiler, output );
+    stats_end ( stats, &clock );
+
+    if ( stats != NULL )
+    {
+        stats->symbols = count_symbols ( compiler );
+        stats->strings = compiler->stringc;
+        stats->instructions =
+            stats_count_instructions ( output->text, output->size );
+        stats->bytes = output->size;
+    }
+
+    stats_begin ( stats, &clock, STATS_TEARDOWN );
+    intern_finalize ( &compiler->names );
+    destroy_syntax_tree ( compiler );
 	// call function to destroy symbol table
-    destroy_symbol_table();
-    
+    destroy_symbol_table ( compiler );
+    source_close ( &compiler->source );
+    stats_end ( stats, &clock );
+}
+
+
+/* Compile one source file, and write the assembly when it is complete.
+ * A NULL output path writes to standard output. Functions are generated
+ * on up to options->n_jobs threads, or taken from the cache directory if
+ * there is one, and statistics are collected if 'stats' is not NULL.
+ */
+static void
+compile_file (
+    const char *input_path, const char *output_path,
+    const options_t *options, stats_t *stats
+)
+{
+    compiler_t compiler;
+    compiler_init ( &compiler, options );
+    compiler.stats = stats;
+    if ( stats != NULL )
+        mem_profile_attach ( stats->allocations );
+    emitter_t output;
+    if ( emitter_init ( &output, EMITTER_CAPACITY ) != EMITTER_SUCCESS )
+    {
+        fprintf ( stderr, "Out of memory for generated assembly\n" );
+        exit ( EXIT_FAILURE );
+    }
+    compile ( &compiler, input_path, &output );
+
+    int fd = STDOUT_FILENO;
+    if ( output_path != NULL )
+        fd = open ( output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( fd < 0 || emitter_flush ( &output, fd ) != EMITTER_SUCCESS )
+    {
+        perror ( (output_path != NULL) ? output_path : "stdout" );
+        exit ( EXIT_FAILURE );
+    }
+    if ( output_path != NULL )
+        close ( fd );
+    emitter_finalize ( &output );
+    mem_profile_attach ( NULL );
+}
+
+
+/* Inputs compiled by a pool of threads, with their statistics if any */
+typedef struct {
+    char **inputs;
+    options_t options;          // Each input is compiled by one thread
+    stats_t *stats;
+} batch_t;
+
+
+static void
+compile_input ( void *context, size_t index )
+{
+    batch_t *batch = context;
+    char *input = batch->inputs[index];
+    char *path = output_name ( input );
+    compile_file (
+        input, path, &batch->options,
+        (batch->stats != NULL) ? &batch->stats[index] : NULL
+    );
+    free ( path );
+}
+
+
+/* Statistics go to a file if one was given, or else to standard error */
+static void
+write_stats (
+    const char *stats_path, char **inputs, stats_t *stats, int n_inputs
+)
+{
+    FILE *file = stderr;
+    if ( stats_path != NULL && (file = fopen ( stats_path, "w" )) == NULL )
+    {
+        perror ( stats_path );
+        exit ( EXIT_FAILURE );
+    }
+    for ( int i=0; i<n_inputs; i++ )
+        stats_write ( file, (inputs != NULL) ? inputs[i] : NULL, &stats[i] );
+    if ( file != stderr )
+        fclose ( file );
+}
+
+
+int
+main ( int argc, char **argv )
+{
+    static const struct option options[] = {
+        { "jobs", required_argument, NULL, 'j' },
+        { "stats", optional_argument, NULL, 's' },
+        { "alloc-stats", optional_argument, NULL, 'a' },
+        { "cache", required_argument, NULL, 'c' },
+        { "no-optimize", no_argument, NULL, 'O' },
+        { "inline-budget", required_argument, NULL, 'b' },
+        { "via-ir", no_argument, NULL, 'i' },
+        { "emit-ir", no_argument, NULL, 'e' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *output_path = NULL;     // Standard output if not given
+    // One job, no cache and no IR if not given
+    options_t compile_options = {
+        .n_jobs = 1, .cache_directory = NULL, .optimize = true,
+        .inline_budget = INLINE_BUDGET
+    };
+    bool collect_stats = false, track_allocations = false;
+    const char *stats_path = NULL;      // Standard error if not given
+    int option;
+    char *end;
+    while ( (option = getopt_long ( argc, argv, "o:j:", options, NULL )) != -1 )
+    {
+        switch ( option )
+        {
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'j':
+                compile_options.n_jobs = strtol ( optarg, &end, 10 );
+                if ( *optarg == '\0' || *end != '\0'
+                    || compile_options.n_jobs < 1 )
+                    usage ( argv[0] );
+                break;
+            case 'a':
+                track_allocations = true;
+                /* Fall through, allocations are part of the statistics */
+            case 's':
+                collect_stats = true;
+                stats_path = optarg;
+                break;
+            case 'c':
+                compile_options.cache_directory = optarg;
+                if ( mkdir ( optarg, 0755 ) != 0 && errno != EEXIST )
+                {
+                    perror ( optarg );
+                    exit ( EXIT_FAILURE );
+                }
+                break;
+            case 'O':
+                compile_options.optimize = false;
+                break;
+            case 'b':
+                compile_options.inline_budget = strtol ( optarg, &end, 10 );
+                if ( *optarg == '\0' || *end != '\0'
+                    || compile_options.inline_budget < 0 )
+                    usage ( argv[0] );
+                break;
+            case 'i':
+                compile_options.via_ir = true;
+                break;
+            case 'e':
+                compile_options.emit_ir = true;
+                break;
+            default:
+                usage ( argv[0] );
+        }
+    }
+
+    /* No inputs: standard input. One input: -o or standard output, and
+     * the jobs generate its functions. More inputs: each to a file of its
+     * own, and the jobs compile separate inputs.
+     */
+    int n_inputs = argc - optind;
+    char **inputs = (n_inputs > 0) ? argv + optind : NULL;
+    int n_stats = (n_inputs > 0) ? n_inputs : 1;
+    stats_t *stats = NULL;
+    mem_profile_t *allocations = NULL;
+    if ( collect_stats )
+        stats = calloc ( n_stats, sizeof(stats_t) );
+    if ( track_allocations )
+    {
+        allocations = calloc ( n_stats, sizeof(mem_profile_t) );
+        for ( int i=0; i<n_stats; i++ )
+            stats[i].allocations = &allocations[i];
+    }
+    if ( n_inputs <= 1 )
+        compile_file (
+            (inputs != NULL) ? inputs[0] : NULL, output_path,
+            &compile_options, stats
+        );
+    else if ( output_path != NULL )
+        usage ( argv[0] );
+    else
+    {
+        /* Compilations share no state, so the output is the same as when
+         * the inputs are compiled one by one
+         */
+        batch_t batch = {
+            .inputs = inputs, .options = compile_options, .stats = stats
+        };
+        batch.options.n_jobs = 1;
+        pool_run ( n_inputs, compile_options.n_jobs, compile_input, &batch );
+    }
+
+    if ( stats != NULL )
+    {
+        write_stats ( stats_path, inputs, stats, n_stats );
+        free ( allocations );
+        free ( stats );
+    }
+    return EXIT_SUCCESS;
 }
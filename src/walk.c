@@ -0,0 +1,91 @@
+#include <vslc.h>
+
+#define WALK_CAPACITY 64
+
+
+/* Start a traversal at the node in 'root', which may be NULL */
+void
+walk_init ( walk_t *walk, node_t **root )
+{
+    *walk = (walk_t) {
+        .frames = mem_alloc (
+            MEM_WORK, WALK_CAPACITY * sizeof(walk_frame_t)
+        ),
+        .depth = 0,
+        .capacity = WALK_CAPACITY
+    };
+    if ( root != NULL && *root != NULL )
+        walk_push ( walk, root );
+}
+
+
+void
+walk_finalize ( walk_t *walk )
+{
+    mem_free ( MEM_WORK, walk->frames, walk->capacity * sizeof(walk_frame_t) );
+    walk->frames = NULL;
+    walk->depth = walk->capacity = 0;
+}
+
+
+/* Visit the node in 'slot' next. Frames above the top may move, so
+ * pointers to them do not survive a push.
+ */
+void
+walk_push ( walk_t *walk, node_t **slot )
+{
+    if ( walk->depth == walk->capacity )
+    {
+        walk->frames = mem_realloc ( MEM_WORK, walk->frames,
+            walk->capacity * sizeof(walk_frame_t),
+            2 * walk->capacity * sizeof(walk_frame_t)
+        );
+        walk->capacity *= 2;
+    }
+    walk->frames[walk->depth++] = (walk_frame_t) {
+        .slot = slot, .stage = 0, .mark = 0
+    };
+}
+
+
+/* Step through the tree in order, children from first to last. Every
+ * node is found once before its children, where walk_skip can pass over
+ * them, and once after, when its frame is already popped. Empty children
+ * are not visited.
+ */
+walk_event_t
+walk_next ( walk_t *walk, node_t ***slot )
+{
+    while ( walk->depth > 0 )
+    {
+        walk_frame_t *frame = WALK_TOP ( walk );
+        node_t *node = *frame->slot;
+        if ( frame->stage == 0 )
+        {
+            frame->stage = 1;
+            *slot = frame->slot;
+            return WALK_ENTER;
+        }
+        if ( frame->stage <= node->n_children )
+        {
+            node_t **child = &node->children[frame->stage - 1];
+            frame->stage += 1;
+            if ( *child != NULL )
+                walk_push ( walk, child );
+            continue;
+        }
+        *slot = frame->slot;
+        walk->depth -= 1;
+        return WALK_LEAVE;
+    }
+    return WALK_DONE;
+}
+
+
+/* Leave the children of the node just entered unvisited */
+void
+walk_skip ( walk_t *walk )
+{
+    walk_frame_t *frame = WALK_TOP ( walk );
+    frame->stage = (*frame->slot)->n_children + 1;
+}